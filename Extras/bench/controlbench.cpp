@@ -0,0 +1,254 @@
+/*
+ * Benchmark and check for the native flight controllers
+ *
+ * Flies a quad with CascadedController from a tilted, yawed start to a
+ * point and checks that it gets there and stays; flies a swarm with a
+ * ControllerBatch next to one CascadedController per vehicle and checks
+ * that their motor values agree; then times a controller update per
+ * vehicle both ways.
+ *
+ * Copyright (C) 2019 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#include <control/ControllerBatch.hpp>
+#include <dynamics/QuadXAP.hpp>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <vector>
+
+static const double DELTA_T  = 0.001;
+static const double SECONDS  = 20;
+static const uint32_t SWARM  = 64;
+static const uint32_t BATCH  = 4096;
+static const uint32_t STEPS  = 1000;
+
+static MultirotorDynamics::Parameters params = MultirotorDynamics::Parameters(
+
+        5.30216718361085E-05,   // b
+        2.23656692806239E-06,   // d
+        16.47,                  // m
+        0.6,                    // l
+        2,                      // Ix
+        2,                      // Iy
+        3,                      // Iz
+        3.08013E-04,            // Jr
+        15000                   // maxrpm
+        );
+
+static double now(void)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static CascadedController::config_t makeConfig(void)
+{
+    CascadedController::config_t config = {};
+
+    //                 kp     ki     kd     windupMax  outputMax
+    config.position = { 0.8,   0,     0,     0,         4 };
+    config.velocity = { 1.5,   0.2,   0,     1,         5 };
+    config.altitude = { 1.2,   0,     0,     0,         3 };
+    config.climb    = { 3,     1,     0,     2,         5 };
+    config.angle    = { 5,     0,     0,     0,         4 };
+    config.rate     = { 0.06,  0.02,  0,     0.02,      0.2 };
+    config.heading  = { 2,     0,     0,     0,         1 };
+    config.yawRate  = { 0.3,   0.05,  0,     0.05,      0.2 };
+
+    config.hoverThrottle = CascadedController::hoverThrottle(params, 4);
+    config.maxTilt = 0.35;
+
+    return config;
+}
+
+static double distance(const double a[3], const double b[3])
+{
+    return sqrt((a[0]-b[0])*(a[0]-b[0]) + (a[1]-b[1])*(a[1]-b[1]) + (a[2]-b[2])*(a[2]-b[2]));
+}
+
+// Starts a quad in the air, tilted and yawed
+static void launch(QuadXAPDynamics & quad, uint32_t index)
+{
+    double rotation[3] = { 0.2 - 0.01 * (index % 7), -0.15 + 0.01 * (index % 5), 0.3 * (index % 11) };
+    quad.init(rotation, true);
+}
+
+static void step(QuadXAPDynamics & quad, double * motorvals)
+{
+    quad.setMotors(motorvals, DELTA_T);
+    quad.update(DELTA_T);
+
+    // Flat ground far below
+    quad.setAgl(100 - quad.getState().pose.location[2]);
+}
+
+int main(int argc, char ** argv)
+{
+    uint32_t failures = 0;
+
+    const CascadedController::config_t config = makeConfig();
+    const Mixer & mixer = Mixer::quadXAP();
+
+    CascadedController::setpoint_t setpoint = {};
+    setpoint.location[0] = 5;
+    setpoint.location[1] = -3;
+    setpoint.location[2] = -10;
+    setpoint.rotation[2] = 1;
+
+    // One vehicle to a point
+    {
+        QuadXAPDynamics quad(&params);
+        launch(quad, 3);
+
+        CascadedController controller(config, mixer);
+        controller.setSetpoint(setpoint);
+
+        double motorvals[4] = {};
+        double worst = 0;
+
+        for (uint32_t k=0; k<SECONDS/DELTA_T; ++k) {
+
+            step(quad, motorvals);
+
+            MultirotorDynamics::state_t state = quad.getState();
+
+            controller.update(state, DELTA_T, motorvals);
+
+            // Over the last five seconds
+            if (k > (SECONDS-5)/DELTA_T) {
+                const double error = distance(state.pose.location, setpoint.location);
+                worst = error > worst ? error : worst;
+            }
+        }
+
+        MultirotorDynamics::state_t state = quad.getState();
+
+        const bool held = worst < 0.05 && fabs(state.pose.rotation[2] - setpoint.rotation[2]) < 0.01;
+
+        printf("Position hold: (%+.3f, %+.3f, %+.3f) yaw %+.3f; at worst %.3f m off over the last 5 s: %s\n",
+                state.pose.location[0], state.pose.location[1], state.pose.location[2], state.pose.rotation[2],
+                worst, held ? "held" : "not held");
+
+        failures += !held;
+    }
+
+    // A swarm, batched and one by one
+    {
+        std::vector<QuadXAPDynamics *> quads;
+        std::vector<CascadedController *> controllers;
+
+        for (uint32_t i=0; i<SWARM; ++i) {
+            quads.push_back(new QuadXAPDynamics(&params));
+            launch(*quads[i], i);
+            controllers.push_back(new CascadedController(config, mixer));
+        }
+
+        ControllerBatch batch(config, mixer, SWARM);
+
+        double * motorvals = new double[4 * SWARM]();
+        double worstDifference = 0;
+        uint32_t arrived = 0;
+
+        for (uint32_t k=0; k<SECONDS/DELTA_T; ++k) {
+
+            for (uint32_t i=0; i<SWARM; ++i) {
+
+                step(*quads[i], &motorvals[4*i]);
+
+                // Each vehicle has its own setpoint, on a ring around the first
+                CascadedController::setpoint_t mine = setpoint;
+                mine.location[0] += 2 * cos(i * 0.1);
+                mine.location[1] += 2 * sin(i * 0.1);
+
+                batch.setState(i, quads[i]->getState());
+                batch.setSetpoint(i, mine);
+
+                controllers[i]->setSetpoint(mine);
+            }
+
+            batch.update(DELTA_T);
+
+            for (uint32_t i=0; i<SWARM; ++i) {
+
+                controllers[i]->update(quads[i]->getState(), DELTA_T, &motorvals[4*i]);
+
+                double batched[4] = {};
+                batch.getMotors(i, batched);
+
+                for (uint8_t j=0; j<4; ++j) {
+                    const double difference = fabs(batched[j] - motorvals[4*i+j]);
+                    worstDifference = difference > worstDifference ? difference : worstDifference;
+                }
+            }
+        }
+
+        for (uint32_t i=0; i<SWARM; ++i) {
+            CascadedController::setpoint_t mine = setpoint;
+            mine.location[0] += 2 * cos(i * 0.1);
+            mine.location[1] += 2 * sin(i * 0.1);
+            arrived += distance(quads[i]->getState().pose.location, mine.location) < 0.05;
+            delete quads[i];
+            delete controllers[i];
+        }
+
+        delete[] motorvals;
+
+        const bool agree = worstDifference < 1e-9 && arrived == SWARM;
+
+        printf("Swarm of %u: %u arrived; batched and scalar motor values differ by at most %.1e: %s\n",
+                SWARM, arrived, worstDifference, agree ? "agree" : "disagree");
+
+        failures += !agree;
+    }
+
+    // Time per vehicle, on states that stay put
+    {
+        std::vector<CascadedController *> controllers;
+        std::vector<MultirotorDynamics::state_t> states(BATCH);
+
+        ControllerBatch batch(config, mixer, BATCH);
+
+        for (uint32_t i=0; i<BATCH; ++i) {
+            states[i] = {};
+            states[i].pose.location[0] = 0.001 * i;
+            states[i].pose.location[2] = -9;
+            states[i].pose.rotation[0] = 0.01;
+            states[i].pose.rotation[2] = 0.5;
+            controllers.push_back(new CascadedController(config, mixer));
+            controllers[i]->setSetpoint(setpoint);
+            batch.setState(i, states[i]);
+            batch.setSetpoint(i, setpoint);
+        }
+
+        double motorvals[4] = {};
+        double sum = 0;
+
+        double t0 = now();
+        for (uint32_t k=0; k<STEPS; ++k) {
+            for (uint32_t i=0; i<BATCH; ++i) {
+                controllers[i]->update(states[i], DELTA_T, motorvals);
+                sum += motorvals[0];
+            }
+        }
+        const double scalar = (now() - t0) / STEPS / BATCH;
+
+        t0 = now();
+        for (uint32_t k=0; k<STEPS; ++k) {
+            batch.update(DELTA_T);
+            sum += batch.getMotor(0)[k % BATCH];
+        }
+        const double batched = (now() - t0) / STEPS / BATCH;
+
+        printf("Update per vehicle: %.1f ns scalar, %.1f ns batched (%u vehicles)%s\n",
+                1e9 * scalar, 1e9 * batched, BATCH, sum < 0 ? " " : "");
+
+        for (uint32_t i=0; i<BATCH; ++i) {
+            delete controllers[i];
+        }
+    }
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,109 @@
+/*
+ * Benchmark for the flight dynamics
+ *
+ * Times a dynamics step on flat ground and over a heightfield, then repeats
+ * each run with hardware counters around setMotors() and update(), where
+ * the platform provides them, to tell cache misses from arithmetic when a
+ * step gets slower.
+ *
+ * Copyright (C) 2019 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#include <dynamics/QuadXAP.hpp>
+#include <PerfCounters.hpp>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <vector>
+
+static const uint32_t STEPS = 1000000;
+static const double DELTA_T = 0.001;
+
+static MultirotorDynamics::Parameters params = MultirotorDynamics::Parameters(
+
+        5.30216718361085E-05,   // b
+        2.23656692806239E-06,   // d
+        16.47,                  // m
+        0.6,                    // l
+        2,                      // Ix
+        2,                      // Iy
+        3,                      // Iz
+        3.08013E-04,            // Jr
+        15000                   // maxrpm
+        );
+
+static double now(void)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Returns seconds per step; counts phases if given counters
+static double run(const Heightfield * terrain, PerfCounters * counters)
+{
+    QuadXAPDynamics quad(&params);
+
+    double rotation[3] = {};
+    quad.init(rotation);
+    quad.setTerrain(terrain);
+
+    uint8_t motorsPhase = 0, updatePhase = 0;
+    if (counters) {
+        motorsPhase = counters->addPhase("setMotors");
+        updatePhase = counters->addPhase("update");
+    }
+
+    // A little over hover, so the vehicle climbs and drifts over the terrain
+    double motorvals[4] = { 0.58, 0.58, 0.58, 0.581 };
+
+    double t0 = now();
+
+    for (uint32_t k=0; k<STEPS; ++k) {
+
+        if (counters) counters->begin();
+
+        quad.setMotors(motorvals, DELTA_T);
+
+        if (counters) counters->end(motorsPhase);
+
+        quad.update(DELTA_T);
+
+        if (counters) counters->end(updatePhase);
+
+        if (!terrain) {
+            quad.setAgl(-quad.getState().pose.location[2]);
+        }
+    }
+
+    return (now() - t0) / STEPS;
+}
+
+int main(int argc, char ** argv)
+{
+    // Rough terrain, larger than the caches
+    const uint32_t n = 2001;
+    std::vector<float> samples((size_t)n * n);
+    for (float & sample : samples) {
+        sample = (float)(rand() / (double)RAND_MAX);
+    }
+
+    Heightfield terrain;
+    terrain.build(samples.data(), n, n, -500, -500, 0.5);
+
+    const char * names[2] = { "Flat ground", "Heightfield" };
+    const Heightfield * terrains[2] = { NULL, &terrain };
+
+    for (uint8_t k=0; k<2; ++k) {
+
+        printf("%s: %.1f ns per step\n", names[k], 1e9 * run(terrains[k], NULL));
+
+        PerfCounters counters;
+        counters.open();
+        run(terrains[k], &counters);
+        counters.summarize(stdout);
+    }
+
+    return 0;
+}
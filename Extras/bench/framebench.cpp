@@ -0,0 +1,418 @@
+/*
+ * Benchmark and check for frame encoding
+ *
+ * Round-trips random and adversarial buffers -- all the same, incompressible,
+ * short, and patterns built to be the worst case for RLE or LZ4 -- through
+ * every encoding, checking that nothing encodes larger than maxEncodedSize()
+ * and that corrupt streams decode without writing past the buffer.  Records
+ * two cameras into a dataset from two threads, closes it, and checks that
+ * the reopened dataset gives back every frame in time order and that
+ * findByTime() agrees with a search of every entry; fills the index and the
+ * data space to check what is kept.  Then times each encoding on a
+ * camera-like frame.
+ *
+ * Usage: framebench [file]
+ *
+ * Copyright (C) 2019 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#include <FrameCodec.hpp>
+#include <FrameDataset.hpp>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <chrono>
+#include <vector>
+#include <thread>
+
+static const uint32_t COLS = 640;
+static const uint32_t ROWS = 480;
+static const int REPS = 20;
+
+static const uint32_t RECORDED = 300;   // frames per camera
+static const uint16_t SMALL_COLS = 32;
+static const uint16_t SMALL_ROWS = 24;
+static const uint8_t SMALL_CHANNELS = 3;
+static const double FRAME_TIME = 0.01;
+
+static const size_t GUARD = 64;
+static const uint8_t GUARD_BYTE = 0xa5;
+
+static const FrameCodec::Encoding_t ENCODINGS[] = { FrameCodec::ENCODING_RAW, FrameCodec::ENCODING_RLE, FrameCodec::ENCODING_LZ4 };
+static const char * NAMES[] = { "RAW", "RLE", "LZ4" };
+
+static double now(void)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static uint32_t failures = 0;
+
+static void report(const char * what, bool ok)
+{
+    printf("%-58s %s\n", what, ok ? "ok" : "FAILED");
+    failures += !ok;
+}
+
+typedef struct {
+
+    const char * name;
+    std::vector<uint8_t> bytes;
+
+} buffer_t;
+
+// A smooth image with a little noise, as a camera over terrain gives
+static std::vector<uint8_t> cameraLike(uint32_t cols, uint32_t rows, uint8_t channels)
+{
+    std::vector<uint8_t> image(cols * rows * channels);
+
+    for (uint32_t y=0; y<rows; ++y) {
+        for (uint32_t x=0; x<cols; ++x) {
+            for (uint8_t c=0; c<channels; ++c) {
+                image[(y * cols + x) * channels + c] = (uint8_t)(x / 8 + y / 4 + 40 * c + (rand() % 4 == 0));
+            }
+        }
+    }
+
+    return image;
+}
+
+// A recorded frame that can be told from every other one
+static std::vector<uint8_t> recordedFrame(uint32_t frameId, uint8_t cameraId)
+{
+    std::vector<uint8_t> image(SMALL_COLS * SMALL_ROWS * SMALL_CHANNELS);
+
+    for (size_t k=0; k<image.size(); ++k) {
+        image[k] = (uint8_t)(k / 16 + 7 * frameId + 100 * cameraId);
+    }
+
+    return image;
+}
+
+static FrameDataset::info_t recordedInfo(uint32_t frameId, uint8_t cameraId)
+{
+    FrameDataset::info_t info = {};
+
+    info.frameId = frameId;
+    info.cameraId = cameraId;
+    info.time = frameId * FRAME_TIME + cameraId * FRAME_TIME / 2;
+    info.location[0] = frameId;
+    info.rotation[2] = cameraId;
+
+    return info;
+}
+
+// One camera's recording thread, appending its frames with a little reordering
+static void record(FrameDatasetWriter & writer, uint8_t cameraId)
+{
+    FrameCodec codec;
+    const size_t size = SMALL_COLS * SMALL_ROWS * SMALL_CHANNELS;
+    std::vector<uint8_t> scratch(FrameCodec::maxEncodedSize(size, SMALL_CHANNELS));
+
+    for (uint32_t k=0; k<RECORDED; ++k) {
+
+        const uint32_t frameId = k ^ 1;
+        std::vector<uint8_t> image = recordedFrame(frameId, cameraId);
+
+        writer.append(recordedInfo(frameId, cameraId), image.data(), SMALL_CHANNELS, SMALL_ROWS, SMALL_COLS,
+                ENCODINGS[frameId % 3], codec, scratch.data(), scratch.size());
+    }
+}
+
+// Appends raw frames to a dataset with room for the given frames and bytes, and returns how many come back
+static uint32_t fill(const char * path, uint32_t maxFrames, uint64_t dataBytes, uint32_t frames,
+        uint32_t & rejected, uint64_t & dataUsed)
+{
+    FrameDatasetWriter writer;
+    if (!writer.open(path, maxFrames, dataBytes)) return 0;
+
+    FrameCodec codec;
+
+    for (uint32_t frameId=0; frameId<frames; ++frameId) {
+        std::vector<uint8_t> image = recordedFrame(frameId, 0);
+        writer.append(recordedInfo(frameId, 0), image.data(), SMALL_CHANNELS, SMALL_ROWS, SMALL_COLS,
+                FrameCodec::ENCODING_RAW, codec, NULL, 0);
+    }
+
+    rejected = writer.getRejected();
+    dataUsed = writer.getDataUsed();
+
+    writer.close();
+
+    FrameDatasetReader reader;
+    if (!reader.open(path)) return 0;
+
+    return reader.count();
+}
+
+static std::vector<buffer_t> buffers(uint8_t pixelSize)
+{
+    std::vector<buffer_t> all;
+
+    // Short, down to nothing
+    for (size_t pixels=0; pixels<20; ++pixels) {
+        std::vector<uint8_t> bytes(pixels * pixelSize);
+        for (uint8_t & b : bytes) b = (uint8_t)rand();
+        all.push_back({ "short random", bytes });
+        all.push_back({ "short same", std::vector<uint8_t>(pixels * pixelSize, 7) });
+    }
+
+    const size_t size = 100003 * pixelSize;
+
+    all.push_back({ "all zero", std::vector<uint8_t>(size, 0) });
+    all.push_back({ "all 0xff", std::vector<uint8_t>(size, 0xff) });
+
+    std::vector<uint8_t> bytes(size);
+
+    for (uint8_t & b : bytes) b = (uint8_t)rand();
+    all.push_back({ "incompressible", bytes });
+
+    // RLE's worst case: a lone literal between runs of two
+    for (size_t k=0; k<size; ++k) {
+        size_t pixel = k / pixelSize;
+        bytes[k] = (uint8_t)(pixel % 3 == 0 ? pixel : pixel - (pixel % 3 == 2));
+    }
+    all.push_back({ "lone pixels between pairs", bytes });
+
+    // Runs just longer than one RLE control byte holds
+    for (size_t k=0; k<size; ++k) {
+        bytes[k] = (uint8_t)(k / pixelSize / 129);
+    }
+    all.push_back({ "runs of 129", bytes });
+
+    // Four-byte matches between short literals, the most LZ4 sequences per byte
+    for (size_t k=0; k<size; ++k) {
+        bytes[k] = k % 9 < 5 ? (uint8_t)(k % 9) : (uint8_t)rand();
+    }
+    all.push_back({ "short matches", bytes });
+
+    // Literal runs just past each length byte, then a match
+    for (size_t k=0; k<size; ++k) {
+        bytes[k] = k % 300 < 270 ? (uint8_t)rand() : (uint8_t)(k % 300);
+    }
+    all.push_back({ "long literals", bytes });
+
+    // Repeats at the largest offset LZ4 allows, and just past it
+    for (size_t period : { (size_t)65535, (size_t)65536 }) {
+        std::vector<uint8_t> random(period);
+        for (uint8_t & b : random) b = (uint8_t)rand();
+        for (size_t k=0; k<size; ++k) {
+            bytes[k] = random[k % period];
+        }
+        all.push_back({ period == 65535 ? "repeat at offset 65535" : "repeat at offset 65536", bytes });
+    }
+
+    all.push_back({ "camera-like", cameraLike(COLS / 4, ROWS / 4, pixelSize) });
+
+    return all;
+}
+
+int main(int argc, char ** argv)
+{
+    const char * path = argc > 1 ? argv[1] : "framebench.dataset";
+
+    srand(1);
+
+    FrameCodec codec;
+
+    for (uint8_t pixelSize : { 1, 3, 4 }) {
+
+        uint32_t roundTrips = 0, bad = 0, oversize = 0, overruns = 0, corruptions = 0;
+        double worstRatio = 0;
+
+        for (const buffer_t & buffer : buffers(pixelSize)) {
+
+            const size_t size = buffer.bytes.size();
+            const size_t bound = FrameCodec::maxEncodedSize(size, pixelSize);
+
+            for (uint8_t e=0; e<3; ++e) {
+
+                std::vector<uint8_t> encoded(bound + GUARD, GUARD_BYTE);
+                const size_t encodedSize = codec.encode(ENCODINGS[e], buffer.bytes.data(), size, pixelSize, encoded.data());
+
+                if (encodedSize > bound) {
+                    printf("%s %u-byte pixels: %s encodes %zu bytes to %zu, over the bound of %zu\n",
+                            buffer.name, pixelSize, NAMES[e], size, encodedSize, bound);
+                    oversize++;
+                }
+
+                for (size_t k=bound; k<encoded.size(); ++k) {
+                    overruns += encoded[k] != GUARD_BYTE;
+                }
+
+                if (size > 0) {
+                    worstRatio = fmax(worstRatio, (encodedSize + 1.) / (bound + 1.));
+                }
+
+                std::vector<uint8_t> decoded(size + GUARD, GUARD_BYTE);
+                const size_t decodedSize = FrameCodec::decode(ENCODINGS[e], encoded.data(), encodedSize, pixelSize,
+                        decoded.data(), size);
+
+                if (decodedSize != size || (size > 0 && memcmp(decoded.data(), buffer.bytes.data(), size))) {
+                    printf("%s %u-byte pixels: %s does not round-trip\n", buffer.name, pixelSize, NAMES[e]);
+                    bad++;
+                }
+
+                for (size_t k=size; k<decoded.size(); ++k) {
+                    overruns += decoded[k] != GUARD_BYTE;
+                }
+
+                roundTrips++;
+
+                // Corrupt and truncated streams must fail or decode within the buffer
+                if (encodedSize > 0) {
+
+                    for (uint32_t trial=0; trial<20; ++trial) {
+
+                        std::vector<uint8_t> corrupt(encoded.begin(), encoded.begin() + encodedSize);
+                        for (uint32_t flip=0; flip<=trial%4; ++flip) {
+                            corrupt[rand() % encodedSize] ^= (uint8_t)(1 + rand() % 255);
+                        }
+                        const size_t length = trial % 5 == 4 ? rand() % encodedSize : encodedSize;
+
+                        std::fill(decoded.begin(), decoded.end(), GUARD_BYTE);
+                        const size_t got = FrameCodec::decode(ENCODINGS[e], corrupt.data(), length, pixelSize,
+                                decoded.data(), size);
+
+                        bool ok = got <= size;
+                        for (size_t k=size; k<decoded.size(); ++k) {
+                            ok &= decoded[k] == GUARD_BYTE;
+                        }
+                        corruptions += !ok;
+                    }
+                }
+            }
+        }
+
+        printf("%u-byte pixels: %u round trips, %u wrong, %u over the bound (largest %.0f%% of it), %u overruns, %u bad corrupt decodes\n",
+                pixelSize, roundTrips, bad, oversize, 100 * worstRatio, overruns, corruptions);
+
+        report("Every buffer round-trips within maxEncodedSize()", bad == 0 && oversize == 0 && overruns == 0 && corruptions == 0);
+    }
+
+    // Two cameras recording at once, then played back
+    {
+        FrameDatasetWriter writer;
+
+        // Room for every frame even if none of them compress
+        const size_t size = SMALL_COLS * SMALL_ROWS * SMALL_CHANNELS;
+        if (!writer.open(path, 2 * RECORDED, 2 * RECORDED * FrameCodec::maxEncodedSize(size, SMALL_CHANNELS))) {
+            fprintf(stderr, "Unable to create %s\n", path);
+            return 1;
+        }
+
+        std::thread camera0(record, std::ref(writer), 0);
+        std::thread camera1(record, std::ref(writer), 1);
+        camera0.join();
+        camera1.join();
+
+        const uint32_t rejected = writer.getRejected();
+
+        writer.close();
+
+        FrameDatasetReader reader;
+        bool ok = reader.open(path) && rejected == 0 && reader.count() == 2 * RECORDED;
+
+        std::vector<uint8_t> decoded(size);
+
+        uint32_t wrong = 0;
+        double previous = -INFINITY;
+
+        for (uint32_t k=0; ok && k<reader.count(); ++k) {
+
+            const FrameDataset::entry_t & entry = reader.entry(k);
+            const FrameDataset::info_t info = recordedInfo(entry.frameId, entry.cameraId);
+
+            bool same = entry.time >= previous && entry.time == info.time && entry.location[0] == info.location[0] &&
+                entry.rotation[2] == info.rotation[2] && entry.encoding == ENCODINGS[entry.frameId % 3] &&
+                entry.channels == SMALL_CHANNELS && entry.rows == SMALL_ROWS && entry.cols == SMALL_COLS;
+
+            same &= reader.decode(k, decoded.data(), size) == size &&
+                decoded == recordedFrame(entry.frameId, entry.cameraId);
+
+            wrong += !same;
+            previous = entry.time;
+        }
+
+        printf("%u frames from two cameras read back, %u rejected, %u wrong\n", ok ? reader.count() : 0, rejected, wrong);
+        report("Reopened dataset gives back every frame in time order", ok && wrong == 0);
+
+        // Last frame at or before each time, of any camera and of each, by looking at every entry
+        uint32_t misses = 0, queries = 0;
+
+        for (double time=-FRAME_TIME; ok && time<(RECORDED+1)*FRAME_TIME; time+=FRAME_TIME/7) {
+
+            for (int16_t cameraId=-1; cameraId<2; ++cameraId) {
+
+                int32_t expected = -1;
+                for (uint32_t k=0; k<reader.count(); ++k) {
+                    if (reader.entry(k).time <= time && (cameraId < 0 || reader.entry(k).cameraId == cameraId)) {
+                        expected = k;
+                    }
+                }
+
+                misses += reader.findByTime(time, cameraId) != expected;
+                queries++;
+            }
+        }
+
+        // Exactly at a frame's time finds that frame
+        const int32_t exact = ok ? reader.findByTime(recordedInfo(17, 1).time) : -1;
+        misses += exact < 0 || reader.entry(exact).frameId != 17 || reader.entry(exact).cameraId != 1;
+
+        printf("%u of %u time lookups differ from a full search\n", misses, queries);
+        report("findByTime() finds the last frame at or before a time", ok && misses == 0);
+
+        reader.close();
+    }
+
+    // A full index rejects frames without using data space, and a full data region keeps what fit
+    {
+        const uint32_t frameSize = SMALL_COLS * SMALL_ROWS * SMALL_CHANNELS;
+
+        uint32_t rejected = 0;
+        uint64_t dataUsed = 0;
+
+        uint32_t kept = fill(path, 4, 100 * frameSize, 10, rejected, dataUsed);
+        report("Full index keeps the frames it indexed", kept == 4 && rejected == 6 && dataUsed == 4 * frameSize);
+
+        kept = fill(path, 100, 3 * frameSize + frameSize / 2, 10, rejected, dataUsed);
+        report("Full data region keeps the frames that fit", kept == 3 && rejected == 7);
+    }
+
+    remove(path);
+
+    // Speed on a full frame
+    for (uint8_t channels : { 1, 4 }) {
+
+        std::vector<uint8_t> frame = cameraLike(COLS, ROWS, channels);
+        const size_t size = frame.size();
+
+        std::vector<uint8_t> encoded(FrameCodec::maxEncodedSize(size, channels));
+        std::vector<uint8_t> decoded(size);
+
+        for (uint8_t e=0; e<3; ++e) {
+
+            size_t encodedSize = 0;
+
+            double t0 = now();
+            for (int rep=0; rep<REPS; ++rep) {
+                encodedSize = codec.encode(ENCODINGS[e], frame.data(), size, channels, encoded.data());
+            }
+            double t1 = now();
+            for (int rep=0; rep<REPS; ++rep) {
+                FrameCodec::decode(ENCODINGS[e], encoded.data(), encodedSize, channels, decoded.data(), size);
+            }
+            double t2 = now();
+
+            printf("%ux%ux%u %s: %5.1f%% of the frame, encode %6.0f MB/s, decode %6.0f MB/s\n",
+                    COLS, ROWS, channels, NAMES[e], 100. * encodedSize / size,
+                    REPS * size / (t1 - t0) / 1e6, REPS * size / (t2 - t1) / 1e6);
+        }
+    }
+
+    return failures ? 1 : 0;
+}
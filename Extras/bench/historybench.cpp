@@ -0,0 +1,257 @@
+/*
+ * Benchmark and check for the state history
+ *
+ * Checks that poses between samples follow a cubic path exactly and turn the
+ * short way across +/-pi; that poses past the newest sample are extrapolated
+ * no further than asked; that the ring holds its newest CAPACITY - 1 samples
+ * as it wraps; then has a thread publish while others read, checking that
+ * no reader sees a torn sample, and times poseAt().
+ *
+ * Copyright (C) 2019 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#include <StateHistory.hpp>
+
+#include <stdio.h>
+#include <math.h>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <chrono>
+
+static const double DT = 0.001;
+
+static const uint32_t READERS = 3;
+static const uint32_t PUBLISHES = 2000000;
+static const uint32_t TIMING_CALLS = 1000000;
+
+static uint32_t failures = 0;
+
+static double now(void)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// A cubic in time for each axis, which Hermite interpolation between exact velocities reproduces
+static void cubic(double t, double location[3], double velocity[3])
+{
+    for (uint8_t k=0; k<3; ++k) {
+        const double a = k + 1, b = 0.5 * k - 1, c = 0.25, d = -0.1 * (k + 1);
+        location[k] = a + (b + (c + d * t) * t) * t;
+        velocity[k] = b + (2 * c + 3 * d * t) * t;
+    }
+}
+
+// A straight line through the origin, the same in every sample, so that a mix of two samples shows
+static void line(double t, MultirotorDynamics::state_t & state)
+{
+    for (uint8_t k=0; k<3; ++k) {
+        state.pose.location[k] = (k + 1) * t;
+        state.inertialVel[k] = k + 1;
+        state.pose.rotation[k] = 0;
+        state.angularVel[k] = 0;
+    }
+}
+
+static MultirotorDynamics::state_t cubicState(double t)
+{
+    MultirotorDynamics::state_t state = {};
+    cubic(t, state.pose.location, state.inertialVel);
+    return state;
+}
+
+static void report(const char * what, bool ok)
+{
+    printf("%-58s %s\n", what, ok ? "ok" : "FAILED");
+    failures += !ok;
+}
+
+int main(int argc, char ** argv)
+{
+    // Nothing published
+    {
+        StateHistory history;
+        MultirotorDynamics::pose_t pose = {};
+        report("Empty history has no pose", history.poseAt(0, pose) == StateHistory::RESULT_NONE);
+    }
+
+    // Between samples
+    {
+        StateHistory history;
+
+        for (uint32_t k=0; k<10; ++k) {
+            history.publish(k * DT, cubicState(k * DT));
+        }
+
+        double worst = 0;
+        bool interpolated = true;
+
+        for (double t=0; t<9*DT; t+=DT/7) {
+
+            MultirotorDynamics::pose_t pose = {};
+            interpolated &= history.poseAt(t, pose) == StateHistory::RESULT_INTERPOLATED;
+
+            double location[3], velocity[3];
+            cubic(t, location, velocity);
+
+            for (uint8_t k=0; k<3; ++k) {
+                worst = fmax(worst, fabs(pose.location[k] - location[k]));
+            }
+        }
+
+        printf("Interpolated cubic off by at most %.1e\n", worst);
+        report("Interpolation follows a cubic path", interpolated && worst < 1e-12);
+
+        // Angles on either side of pi meet at pi, not at zero
+        StateHistory turning;
+        MultirotorDynamics::state_t state = {};
+        state.pose.rotation[2] = 3.0;
+        turning.publish(0, state);
+        state.pose.rotation[2] = -3.0;
+        turning.publish(DT, state);
+
+        MultirotorDynamics::pose_t pose = {};
+        turning.poseAt(DT/2, pose);
+        report("Angles interpolate the short way across pi", fabs(fabs(pose.rotation[2]) - 3.14159265358979) < 1e-9);
+    }
+
+    // Past the newest sample
+    {
+        StateHistory history;
+
+        MultirotorDynamics::state_t state = {};
+        line(1, state);
+        state.angularVel[0] = 0.5;
+        history.publish(1, state);
+
+        MultirotorDynamics::pose_t pose = {};
+
+        bool ok = history.poseAt(1.05, pose, 0.1) == StateHistory::RESULT_EXTRAPOLATED;
+        ok &= fabs(pose.location[2] - 3 * 1.05) < 1e-12 && fabs(pose.rotation[0] - 0.5 * 0.05) < 1e-12;
+        report("Extrapolation within the limit", ok);
+
+        ok = history.poseAt(5, pose, 0.1) == StateHistory::RESULT_EXTRAPOLATED;
+        ok &= fabs(pose.location[2] - 3 * 1.1) < 1e-12 && fabs(pose.rotation[0] - 0.5 * 0.1) < 1e-12;
+        report("Extrapolation stops at the limit", ok);
+
+        // Before the first sample the pose is held there
+        ok = history.poseAt(0.5, pose) == StateHistory::RESULT_HELD && fabs(pose.location[0] - 1) < 1e-12;
+        report("Before the oldest sample the pose is held", ok);
+    }
+
+    // Wrapping the ring
+    {
+        StateHistory history;
+
+        const uint32_t count = 3 * StateHistory::CAPACITY + 5;
+
+        for (uint32_t k=0; k<count; ++k) {
+            MultirotorDynamics::state_t state = {};
+            line(k * DT, state);
+            history.publish(k * DT, state);
+        }
+
+        StateHistory::sample_t newest = {};
+        bool ok = history.latest(newest) && fabs(newest.time - (count - 1) * DT) < 1e-12;
+        report("Newest sample after wrapping", ok);
+
+        // The oldest readable sample is the one after the slot the writer fills next
+        const uint32_t oldest = count - StateHistory::CAPACITY + 1;
+
+        MultirotorDynamics::pose_t pose = {};
+        ok = history.poseAt((oldest + 0.5) * DT, pose) == StateHistory::RESULT_INTERPOLATED &&
+            fabs(pose.location[0] - (oldest + 0.5) * DT) < 1e-12;
+        report("Interpolation in the oldest samples held", ok);
+
+        ok = history.poseAt((oldest - 1.5) * DT, pose) == StateHistory::RESULT_HELD &&
+            fabs(pose.location[0] - oldest * DT) < 1e-12;
+        report("Samples overwritten by the wrap are gone", ok);
+    }
+
+    // One publisher, several readers
+    {
+        StateHistory history;
+
+        std::atomic<bool> done(false);
+        std::atomic<uint32_t> torn(0);
+        std::atomic<uint64_t> reads(0);
+
+        std::vector<std::thread> readers;
+
+        for (uint32_t r=0; r<READERS; ++r) {
+
+            readers.push_back(std::thread([r, &history, &done, &torn, &reads]() {
+
+                uint64_t count = 0;
+
+                while (!done) {
+
+                    StateHistory::sample_t newest = {};
+                    if (!history.latest(newest)) continue;
+
+                    // Somewhere in the last dozen samples
+                    const double t = newest.time - DT * ((count * 7 + r) % 40) / 3.0;
+
+                    MultirotorDynamics::pose_t pose = {};
+                    const StateHistory::Result_t result = history.poseAt(t, pose, 0.002);
+
+                    // Every axis comes from the same line, and between samples lands on it at t
+                    bool ok = fabs(pose.location[1] - 2 * pose.location[0]) < 1e-9 &&
+                        fabs(pose.location[2] - 3 * pose.location[0]) < 1e-9;
+                    if (result == StateHistory::RESULT_INTERPOLATED) {
+                        ok &= fabs(pose.location[0] - t) < 1e-9;
+                    }
+
+                    torn += !ok;
+                    count++;
+                }
+
+                reads += count;
+            }));
+        }
+
+        for (uint32_t k=0; k<PUBLISHES; ++k) {
+            MultirotorDynamics::state_t state = {};
+            line(k * DT, state);
+            history.publish(k * DT, state);
+        }
+
+        done = true;
+
+        for (std::thread & reader : readers) {
+            reader.join();
+        }
+
+        printf("%u readers made %llu reads during %u publishes, %u inconsistent\n",
+                READERS, (unsigned long long)reads.load(), PUBLISHES, torn.load());
+
+        report("Readers never see a torn sample", torn == 0);
+    }
+
+    // Cost of a lookup a few samples back, as a renderer at a fixed latency makes it
+    {
+        StateHistory history;
+
+        for (uint32_t k=0; k<StateHistory::CAPACITY; ++k) {
+            history.publish(k * DT, cubicState(k * DT));
+        }
+
+        const double latest = (StateHistory::CAPACITY - 1) * DT;
+
+        double sum = 0;
+
+        const double t0 = now();
+
+        for (uint32_t k=0; k<TIMING_CALLS; ++k) {
+            MultirotorDynamics::pose_t pose = {};
+            history.poseAt(latest - 0.0025 - 1e-9 * (k & 255), pose);
+            sum += pose.location[0];
+        }
+
+        printf("poseAt() 2.5 samples back: %.1f ns (%g)\n", 1e9 * (now() - t0) / TIMING_CALLS, sum > 0 ? 1. : 0.);
+    }
+
+    return failures ? 1 : 0;
+}
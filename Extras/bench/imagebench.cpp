@@ -0,0 +1,121 @@
+/*
+ * Benchmark for the fused camera pixel-conversion kernels
+ *
+ * Compares the original copy-then-convert path with PixelConversion at
+ * each Camera resolution, and checks every instruction set against the
+ * scalar reference.  Build with "make OPENCV=1" to time cv::cvtColor
+ * for the baseline instead of an equivalent scalar loop.
+ *
+ * Copyright (C) 2019 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#include <PixelConversion.hpp>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+
+#ifdef HAVE_OPENCV
+#include <opencv2/imgproc/imgproc.hpp>
+#endif
+
+static const uint16_t ROWS[3] = {480, 720, 1080};
+static const uint16_t COLS[3] = {640, 1280, 1920};
+
+static const char * FORMAT_NAMES[PixelConversion::FORMAT_COUNT] = {"bgr", "rgb", "gray", "bgr/2"};
+
+static const char * ISA_NAMES[] = {"auto", "scalar", "ssse3", "avx2", "neon"};
+
+static const int REPS = 50;
+
+static double now(void)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// The path OpenCVCamera used before: copy into a private RGBA image, then drop alpha
+static void baseline(const uint8_t * src, uint8_t * staging, uint8_t * dst, uint16_t rows, uint16_t cols)
+{
+    memcpy(staging, src, (size_t)rows*cols*4);
+
+#ifdef HAVE_OPENCV
+    cv::Mat rgba(rows, cols, CV_8UC4, staging);
+    cv::Mat rgb(rows, cols, CV_8UC3, dst);
+    cv::cvtColor(rgba, rgb, CV_RGBA2RGB);
+#else
+    size_t npix = (size_t)rows*cols;
+    for (size_t i=0; i<npix; ++i) {
+        dst[3*i]   = staging[4*i];
+        dst[3*i+1] = staging[4*i+1];
+        dst[3*i+2] = staging[4*i+2];
+    }
+#endif
+}
+
+int main(int argc, char ** argv)
+{
+    bool ok = true;
+
+    for (uint8_t r=0; r<3; ++r) {
+
+        uint16_t rows = ROWS[r];
+        uint16_t cols = COLS[r];
+        size_t npix = (size_t)rows*cols;
+
+        std::vector<uint8_t> src(npix*4);
+        for (size_t i=0; i<src.size(); ++i) {
+            src[i] = (uint8_t)rand();
+        }
+
+        std::vector<uint8_t> staging(npix*4);
+        std::vector<uint8_t> expected(npix*3);
+        std::vector<uint8_t> actual(npix*3);
+
+        double start = now();
+        for (int k=0; k<REPS; ++k) {
+            baseline(src.data(), staging.data(), actual.data(), rows, cols);
+        }
+        double baselineMsec = (now() - start) / REPS * 1000;
+
+        printf("%4dx%-4d  baseline %-6s        %7.3f ms\n", cols, rows, "copy+cvt", baselineMsec);
+
+        for (uint8_t f=0; f<PixelConversion::FORMAT_COUNT; ++f) {
+
+            PixelConversion::Format_t format = (PixelConversion::Format_t)f;
+
+            PixelConversion::convert(src.data(), expected.data(), rows, cols, format, PixelConversion::ISA_SCALAR);
+
+            size_t outsize = (size_t)PixelConversion::outputRows(format, rows) *
+                PixelConversion::outputCols(format, cols) * PixelConversion::channels(format);
+
+            for (uint8_t i=PixelConversion::ISA_SCALAR; i<=PixelConversion::ISA_NEON; ++i) {
+
+                PixelConversion::Isa_t isa = (PixelConversion::Isa_t)i;
+
+                if (!PixelConversion::supported(isa)) continue;
+
+                memset(actual.data(), 0, actual.size());
+
+                start = now();
+                for (int k=0; k<REPS; ++k) {
+                    PixelConversion::convert(src.data(), actual.data(), rows, cols, format, isa);
+                }
+                double msec = (now() - start) / REPS * 1000;
+
+                bool match = memcmp(expected.data(), actual.data(), outsize) == 0;
+                ok = ok && match;
+
+                printf("%4dx%-4d  %-6s   %-6s        %7.3f ms  %5.2fx  %s\n", cols, rows, FORMAT_NAMES[f], ISA_NAMES[i],
+                        msec, baselineMsec/msec, match ? "" : "MISMATCH");
+            }
+        }
+
+        printf("\n");
+    }
+
+    return ok ? 0 : 1;
+}
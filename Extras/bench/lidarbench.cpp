@@ -0,0 +1,223 @@
+/*
+ * Benchmark and check for the BVH lidar
+ *
+ * Builds a scene from OBJ files (by default the hoop and battery from
+ * Extras/thingiverse, in millimeters) on a ground plane scattered with
+ * boxes, checks single-ray and packet tracing against brute force, and
+ * times full scans on one thread and on a LidarScanner.
+ *
+ * Usage: lidarbench [file.obj ...]
+ *
+ * Copyright (C) 2019 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#include <sensors/Lidar.hpp>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+
+static const uint16_t BOXES = 2000;
+static const int REPS = 20;
+
+static double now(void)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static float uniform(float lo, float hi)
+{
+    return lo + (hi - lo) * rand() / (float)RAND_MAX;
+}
+
+static void addBox(SceneMesh & mesh, float x, float y, float z, float sx, float sy, float sz)
+{
+    uint32_t v = mesh.vertexCount();
+
+    for (uint8_t k=0; k<8; ++k) {
+        mesh.addVertex(x + (k&1 ? sx : 0), y + (k&2 ? sy : 0), z + (k&4 ? sz : 0));
+    }
+
+    static const uint8_t faces[12][3] = {
+        {0,1,3}, {0,3,2}, {4,6,7}, {4,7,5}, {0,4,5}, {0,5,1},
+        {2,3,7}, {2,7,6}, {0,2,6}, {0,6,4}, {1,5,7}, {1,7,3} };
+
+    for (uint8_t f=0; f<12; ++f) {
+        mesh.addTriangle(v + faces[f][0], v + faces[f][1], v + faces[f][2]);
+    }
+}
+
+// Nearest hit by testing every triangle
+static float bruteForce(const SceneMesh & mesh, const float o[3], const float d[3], float tmin, float tmax)
+{
+    float best = INFINITY;
+
+    for (uint32_t t=0; t<mesh.triangleCount(); ++t) {
+
+        const float * a = &mesh.vertices[3*mesh.indices[3*t]];
+        const float * b = &mesh.vertices[3*mesh.indices[3*t+1]];
+        const float * c = &mesh.vertices[3*mesh.indices[3*t+2]];
+
+        double e1[3], e2[3], s[3];
+        for (uint8_t k=0; k<3; ++k) {
+            e1[k] = b[k] - a[k];
+            e2[k] = c[k] - a[k];
+            s[k] = o[k] - a[k];
+        }
+
+        double p[3] = { d[1]*e2[2] - d[2]*e2[1], d[2]*e2[0] - d[0]*e2[2], d[0]*e2[1] - d[1]*e2[0] };
+        double det = e1[0]*p[0] + e1[1]*p[1] + e1[2]*p[2];
+        if (fabs(det) < 1e-12) continue;
+
+        double u = (s[0]*p[0] + s[1]*p[1] + s[2]*p[2]) / det;
+        double q[3] = { s[1]*e1[2] - s[2]*e1[1], s[2]*e1[0] - s[0]*e1[2], s[0]*e1[1] - s[1]*e1[0] };
+        double v = (d[0]*q[0] + d[1]*q[1] + d[2]*q[2]) / det;
+        double h = (e2[0]*q[0] + e2[1]*q[1] + e2[2]*q[2]) / det;
+
+        if (u >= 0 && v >= 0 && u + v <= 1 && h > tmin && h < tmax && h < best) {
+            best = (float)h;
+        }
+    }
+
+    return best;
+}
+
+int main(int argc, char ** argv)
+{
+    SceneMesh mesh;
+
+    // Ground plane 1 m below the vehicle
+    uint32_t g = mesh.vertexCount();
+    mesh.addVertex(-100, -100, 1);
+    mesh.addVertex(100, -100, 1);
+    mesh.addVertex(100, 100, 1);
+    mesh.addVertex(-100, 100, 1);
+    mesh.addTriangle(g, g+1, g+2);
+    mesh.addTriangle(g, g+2, g+3);
+
+    srand(1);
+    for (uint16_t k=0; k<BOXES; ++k) {
+        float x = uniform(-60, 60);
+        float y = uniform(-60, 60);
+        if (fabsf(x) < 3 && fabsf(y) < 3) continue;
+        float h = uniform(0.5, 8);
+        addBox(mesh, x, y, 1 - h, uniform(0.2, 2), uniform(0.2, 2), h);
+    }
+
+    const char * defaults[] = { "../thingiverse/Hoop.obj", "../thingiverse/Battery.obj" };
+    int nfiles = argc > 1 ? argc - 1 : 2;
+
+    for (int k=0; k<nfiles; ++k) {
+        const char * path = argc > 1 ? argv[k+1] : defaults[k];
+        float offset[3] = { 5.f + 3*k, 0, 0 };
+
+        // The thingiverse parts are in millimeters; blow them up to obstacle size
+        float scale = argc > 1 ? 1 : 0.02f;
+
+        if (!mesh.loadObj(path, scale, offset)) {
+            fprintf(stderr, "Unable to load %s\n", path);
+            return 1;
+        }
+    }
+
+    printf("%u triangles\n", mesh.triangleCount());
+
+    Bvh bvh;
+    double t0 = now();
+    bvh.build(mesh);
+    printf("Built BVH with %u nodes in %.1f ms\n", bvh.nodeCount(), 1000 * (now() - t0));
+
+    // 32 rings x 1024 beams, like a mid-range 3D lidar
+    Lidar lidar = Lidar::scanner(1024, 6.2831853f, 32, -0.4f, 0.26f, 0.1f, 100);
+    std::vector<float> ranges(4 * lidar.packetCount());
+    std::vector<float> reference(ranges.size());
+
+    MultirotorDynamics::pose_t pose = {};
+    pose.location[2] = -0.5;
+    pose.rotation[0] = 0.05;
+    pose.rotation[1] = -0.1;
+    pose.rotation[2] = 0.7;
+
+    // Check packets against single rays, and a sample against brute force
+    lidar.scan(bvh, pose, ranges.data());
+
+    uint32_t mismatches = 0;
+    uint32_t hits = 0;
+
+    // Reconstruct the world rays the same way Lidar does
+    double cph = cos(pose.rotation[0]), sph = sin(pose.rotation[0]);
+    double cth = cos(pose.rotation[1]), sth = sin(pose.rotation[1]);
+    double cps = cos(pose.rotation[2]), sps = sin(pose.rotation[2]);
+    float o[3] = { (float)pose.location[0], (float)pose.location[1], (float)pose.location[2] };
+    std::vector<float> directions(3 * lidar.beamCount());
+
+    for (uint32_t b=0; b<lidar.beamCount(); ++b) {
+        uint16_t ring = b / 1024;
+        float azimuth = -3.14159265f + (b % 1024) * 6.2831853f / 1024;
+        float elevation = -0.4f + ring * 0.66f / 31;
+        float bx = cosf(elevation) * cosf(azimuth), by = cosf(elevation) * sinf(azimuth), bz = -sinf(elevation);
+        float * d = &directions[3*b];
+        d[0] = (float)(cth*cps)*bx + (float)(sph*sth*cps - cph*sps)*by + (float)(cph*sth*cps + sph*sps)*bz;
+        d[1] = (float)(cth*sps)*bx + (float)(sph*sth*sps + cph*cps)*by + (float)(cph*sth*sps - sph*cps)*bz;
+        d[2] = (float)(-sth)*bx + (float)(sph*cth)*by + (float)(cph*cth)*bz;
+    }
+
+    for (uint32_t b=0; b<lidar.beamCount(); ++b) {
+
+        const float * d = &directions[3*b];
+
+        float r = bvh.intersect(o, d, 0.1f, 100);
+
+        if (fabsf(r - ranges[b]) > 1e-4f * (r < INFINITY ? r : 1) && !(isinf(r) && isinf(ranges[b]))) {
+            mismatches++;
+        }
+
+        if (b % 97 == 0) {
+            float f = bruteForce(mesh, o, d, 0.1f, 100);
+            if (fabsf(f - r) > 1e-3f * (f < INFINITY ? f : 1) && !(isinf(f) && isinf(r))) {
+                mismatches++;
+            }
+        }
+
+        hits += r < INFINITY;
+    }
+
+    printf("%u beams, %u hits, %u mismatches\n", lidar.beamCount(), hits, mismatches);
+
+    t0 = now();
+    float sink = 0;
+    for (int k=0; k<REPS; ++k) {
+        for (uint32_t b=0; b<lidar.beamCount(); ++b) {
+            sink += bvh.intersect(o, &directions[3*b], 0.1f, 100) < INFINITY;
+        }
+    }
+    double rays = (now() - t0) / REPS;
+    printf("Single rays: %6.2f ms per scan, %5.1f Mrays/s (%g)\n", 1000 * rays, lidar.beamCount() / rays / 1e6, sink / REPS);
+
+    t0 = now();
+    for (int k=0; k<REPS; ++k) {
+        lidar.scan(bvh, pose, ranges.data());
+    }
+    double packets = (now() - t0) / REPS;
+    printf("Packets:     %6.2f ms per scan, %5.1f Mrays/s\n", 1000 * packets, lidar.beamCount() / packets / 1e6);
+
+    unsigned threads = std::thread::hardware_concurrency();
+    LidarScanner scanner(threads > 1 ? threads - 1 : 0);
+
+    t0 = now();
+    for (int k=0; k<REPS; ++k) {
+        scanner.scan(bvh, lidar, pose, reference.data());
+    }
+    double multi = (now() - t0) / REPS;
+    printf("%2u threads:  %6.2f ms per scan, %5.1f Mrays/s\n", threads, 1000 * multi, lidar.beamCount() / multi / 1e6);
+
+    for (size_t k=0; k<ranges.size(); ++k) {
+        if (ranges[k] != reference[k] && !(isinf(ranges[k]) && isinf(reference[k]))) {
+            mismatches++;
+        }
+    }
+
+    return mismatches ? 1 : 0;
+}
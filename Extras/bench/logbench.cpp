@@ -0,0 +1,289 @@
+/*
+ * Benchmark and check for the log channel
+ *
+ * Checks that queued messages come out as printf would have formatted them;
+ * has several threads post while another drains, and checks that every
+ * message is shown, counted as held back by its call site's rate limit, or
+ * counted as dropped; then times a post against formatting with snprintf.
+ *
+ * Copyright (C) 2019 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#include <LogChannel.hpp>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+
+static const uint32_t PRODUCERS = 4;
+static const uint32_t MESSAGES  = 200000;
+static const uint32_t POSTS     = 1000000;
+
+static double now(void)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static uint32_t failures = 0;
+
+// Posts a message, pops it, and compares it with what snprintf makes of the same arguments
+static void check(const char * format, ...)
+{
+    char expected[200];
+    va_list ap;
+    va_start(ap, format);
+    vsnprintf(expected, sizeof(expected), format, ap);
+    va_end(ap);
+
+    va_start(ap, format);
+    LogChannel::get().vpost(LogChannel::LEVEL_DEBUG, __FILE__, __LINE__, format, ap);
+    va_end(ap);
+
+    char actual[200] = {};
+    LogChannel::Level_t level = LogChannel::LEVEL_ERROR;
+    LogChannel::get().pop(level, actual, sizeof(actual));
+
+    if (strcmp(expected, actual) || level != LogChannel::LEVEL_DEBUG) {
+        printf("Mismatch: \"%s\" vs \"%s\"\n", expected, actual);
+        failures++;
+    }
+}
+
+// Reads the number at the end of a message, and the count of held-back messages after it
+static void parseMessage(const char * text, uint32_t & producer, uint32_t & suppressed)
+{
+    sscanf(text, "producer %u", &producer);
+    const char * more = strstr(text, " (");
+    suppressed = more ? atoi(more+2) : 0;
+}
+
+// One call site per producer, the same one whether it posts in the loop or to flush its held-back count
+static void postAsProducer(uint32_t k, uint32_t j)
+{
+    switch (k) {
+        case 0: LOG_POST(LogChannel::LEVEL_DEBUG, "producer %u: %u", k, j); break;
+        case 1: LOG_POST(LogChannel::LEVEL_DEBUG, "producer %u, message %u", k, j); break;
+        case 2: LOG_POST(LogChannel::LEVEL_LINE, "producer %u [%u]", k, j); break;
+        default: LOG_POST(LogChannel::LEVEL_ERROR, "producer %u #%u", k, j);
+    }
+}
+
+int main(int argc, char ** argv)
+{
+    LogChannel & channel = LogChannel::get();
+
+    // Formatting, with no rate limit so every check goes through
+    {
+        channel.setInterval(0);
+
+        char transient[20];
+        strcpy(transient, "copied");
+
+        check("plain text, 100%% literal");
+        check("Airborne: %d   AGL: %3.2f   velz: %+3.2f   netz: %+3.2f", 1, 12.3456, -0.5, 9.81);
+        check("%u %x %X %o %#x %08x", 4000000000u, 0xdeadbeefu, 255u, 8u, 16u, 0xabcu);
+        check("%hhd %hd %hhu %hu", 300, 70000, 300, 70000);
+        check("%ld %lld %llu %zu %jd", -5L, -1234567890123LL, 18446744073709551615ULL, (size_t)42, (intmax_t)-7);
+        check("%*d|%-*d|%*.*e", 6, 42, 5, 7, 12, 2, 6.02e23);
+        check("%.*f|%-+8.1f", 3, 3.14159, 2.25);
+        check("%c%c %s and %.3s", 'o', 'k', transient, "abcdef");
+        check("%s", (const char *)NULL);
+        check("%Lf %g %a", (long double)1.5, 1e-10, 1.0);
+        check("%p", (void *)0x1234);
+        check("%d %d %d %d %d %d %d %d", 1, 2, 3, 4, 5, 6, 7, 8);
+
+        // Copying string arguments happens at the post, so changing them later doesn't matter
+        LOG_POST(LogChannel::LEVEL_ERROR, "%s", transient);
+        strcpy(transient, "changed");
+        char text[200] = {};
+        LogChannel::Level_t level = LogChannel::LEVEL_DEBUG;
+        channel.pop(level, text, sizeof(text));
+        if (strcmp(text, "copied") || level != LogChannel::LEVEL_ERROR) {
+            printf("String argument not copied: \"%s\"\n", text);
+            failures++;
+        }
+
+        // More arguments than we keep print as ?
+        LOG_POST(LogChannel::LEVEL_DEBUG, "%d %d %d %d %d %d %d %d %d", 1, 2, 3, 4, 5, 6, 7, 8, 9);
+        channel.pop(level, text, sizeof(text));
+        if (strcmp(text, "1 2 3 4 5 6 7 8 ?")) {
+            printf("Extra argument: \"%s\"\n", text);
+            failures++;
+        }
+
+        printf("Formatting: %s\n", failures ? "mismatched" : "matches printf");
+    }
+
+    // A full ring drops rather than waits
+    {
+        for (uint32_t k=0; k<LogChannel::CAPACITY+10; ++k) {
+            LOG_POST(LogChannel::LEVEL_DEBUG, "filling %u", k);
+        }
+
+        const uint64_t dropped = channel.takeDropped();
+
+        char text[200];
+        LogChannel::Level_t level = LogChannel::LEVEL_DEBUG;
+        uint32_t count = 0;
+        while (channel.pop(level, text, sizeof(text))) {
+            count++;
+        }
+
+        const bool ok = dropped == 10 && count == LogChannel::CAPACITY && !strcmp(text, "filling 1023");
+
+        printf("Full ring: %u kept, %llu dropped\n", count, (unsigned long long)dropped);
+
+        failures += !ok;
+    }
+
+    // Call sites are limited separately even when they share a format
+    {
+        channel.setInterval(10);
+
+        // The first site posts twice, and is held back the second time; the second site still gets through
+        for (uint8_t k=0; k<2; ++k) {
+            LOG_POST(LogChannel::LEVEL_DEBUG, "%s", "first site");
+        }
+        LOG_POST(LogChannel::LEVEL_DEBUG, "%s", "second site");
+
+        char text[200];
+        LogChannel::Level_t level = LogChannel::LEVEL_DEBUG;
+        uint32_t count = 0;
+        while (channel.pop(level, text, sizeof(text))) {
+            count++;
+        }
+
+        const bool ok = count == 2;
+
+        printf("Sites sharing a format: %u of 3 shown: %s\n", count, ok ? "limited separately" : "not limited per site");
+
+        failures += !ok;
+    }
+
+    // Several producers and a consumer; every message accounted for
+    {
+        channel.setInterval(0.0001);
+
+        std::atomic<uint32_t> finished(0);
+        std::vector<std::thread> threads;
+
+        for (uint32_t k=0; k<PRODUCERS; ++k) {
+            threads.push_back(std::thread([k, &finished]() {
+                for (uint32_t j=0; j<MESSAGES; ++j) {
+                    postAsProducer(k, j);
+                }
+                finished++;
+            }));
+        }
+
+        uint64_t shown[PRODUCERS] = {};
+        uint64_t heldBack[PRODUCERS] = {};
+
+        char text[200];
+        LogChannel::Level_t level = LogChannel::LEVEL_DEBUG;
+
+        while (true) {
+
+            const bool done = finished == PRODUCERS;
+
+            while (channel.pop(level, text, sizeof(text))) {
+                uint32_t producer = PRODUCERS, suppressed = 0;
+                parseMessage(text, producer, suppressed);
+                if (producer < PRODUCERS) {
+                    shown[producer]++;
+                    heldBack[producer] += suppressed;
+                }
+            }
+
+            if (done) {
+                break;
+            }
+
+            std::this_thread::yield();
+        }
+
+        for (std::thread & thread : threads) {
+            thread.join();
+        }
+
+        // Flush what each site still holds back by letting one more message through
+        channel.setInterval(0.001);
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        const uint64_t dropped = channel.takeDropped();
+        uint64_t flushed = 0;
+        for (uint32_t k=0; k<PRODUCERS; ++k) {
+            postAsProducer(k, 0);
+            flushed++;
+        }
+        while (channel.pop(level, text, sizeof(text))) {
+            uint32_t producer = PRODUCERS, suppressed = 0;
+            parseMessage(text, producer, suppressed);
+            if (producer < PRODUCERS) {
+                shown[producer]++;
+                heldBack[producer] += suppressed;
+            }
+        }
+
+        uint64_t totalShown = 0, totalHeldBack = 0;
+        for (uint32_t k=0; k<PRODUCERS; ++k) {
+            totalShown += shown[k];
+            totalHeldBack += heldBack[k];
+        }
+
+        const uint64_t posted = PRODUCERS * (uint64_t)MESSAGES + flushed;
+        const bool accounted = totalShown + totalHeldBack + dropped == posted;
+
+        printf("%u producers: %llu shown, %llu held back, %llu dropped of %llu: %s\n", PRODUCERS,
+                (unsigned long long)totalShown, (unsigned long long)totalHeldBack, (unsigned long long)dropped,
+                (unsigned long long)posted, accounted ? "all accounted for" : "messages lost");
+
+        failures += !accounted;
+    }
+
+    // Cost of a post, rate-limited as in a fast loop, against formatting on the spot
+    {
+        channel.setInterval(0.1);
+
+        const double x = 1.23456, y = -7.5, z = 98.6;
+
+        double t0 = now();
+        for (uint32_t k=0; k<POSTS; ++k) {
+            LOG_POST(LogChannel::LEVEL_LINE, "x: %+3.2f  y: %+3.2f  z: %+3.2f  step %u", x, y, z, k);
+        }
+        double limited = (now() - t0) / POSTS;
+
+        char text[200];
+        LogChannel::Level_t level = LogChannel::LEVEL_DEBUG;
+        while (channel.pop(level, text, sizeof(text)))
+            ;
+
+        channel.setInterval(0);
+
+        // Time posts into an empty ring, draining between batches
+        double queued = 0;
+        for (uint32_t k=0; k<POSTS; k+=LogChannel::CAPACITY) {
+            t0 = now();
+            for (uint32_t j=0; j<LogChannel::CAPACITY; ++j) {
+                LOG_POST(LogChannel::LEVEL_LINE, "x: %+3.2f  y: %+3.2f  z: %+3.2f  step %u", x, y, z, k+j);
+            }
+            queued += now() - t0;
+            while (channel.pop(level, text, sizeof(text)))
+                ;
+        }
+        queued /= POSTS;
+
+        t0 = now();
+        for (uint32_t k=0; k<POSTS; ++k) {
+            snprintf(text, sizeof(text), "x: %+3.2f  y: %+3.2f  z: %+3.2f  step %u", x, y, z, k);
+        }
+        double formatted = (now() - t0) / POSTS;
+
+        printf("Post: %.1f ns rate-limited, %.1f ns queued; snprintf: %.1f ns\n",
+                1e9 * limited, 1e9 * queued, 1e9 * formatted);
+    }
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,343 @@
+/*
+ * Benchmark and check for the accuracy tiers of FastMath
+ *
+ * Checks the sines, cosines and square roots of each tier against the math
+ * library over a wide range of values, and that values the polynomials
+ * don't take still come out right; flies a swarm at each tier, dynamics and
+ * batched controller alike, next to the same swarm at full accuracy, and
+ * checks that the trajectories stay within the tier's bound; then times the
+ * kernels, a dynamics step and a batched controller update at each tier.
+ *
+ * Copyright (C) 2019 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#include <control/ControllerBatch.hpp>
+#include <dynamics/QuadXAP.hpp>
+#include <dynamics/FastMath.hpp>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <chrono>
+#include <vector>
+
+static const double DELTA_T  = 0.001;
+static const double SECONDS  = 20;
+static const uint32_t SWARM  = 16;
+static const uint32_t VALUES = 1000000;
+static const uint32_t ARRAY  = 4096;
+static const uint32_t REPEATS = 2000;
+static const uint32_t STEPS  = 1000000;
+static const uint32_t BATCH_STEPS = 1000;
+
+static const uint8_t TIERS = 3;
+
+static const FastMath::Accuracy_t ACCURACY[TIERS] = {
+    FastMath::ACCURACY_FULL, FastMath::ACCURACY_1E9, FastMath::ACCURACY_1E6 };
+
+static const char * NAMES[TIERS] = { "full", "1e-9", "1e-6" };
+
+// Largest error each tier may make in a sine, cosine or relative square root
+static const double KERNEL_BOUND[TIERS] = { 0, 1e-9, 1e-6 };
+
+// Largest distance in meters, and angle in radians, each tier may put between trajectories over the flight
+static const double TRAJECTORY_BOUND[TIERS] = { 0, 1e-8, 1e-5 };
+
+static MultirotorDynamics::Parameters params = MultirotorDynamics::Parameters(
+
+        5.30216718361085E-05,   // b
+        2.23656692806239E-06,   // d
+        16.47,                  // m
+        0.6,                    // l
+        2,                      // Ix
+        2,                      // Iy
+        3,                      // Iz
+        3.08013E-04,            // Jr
+        15000                   // maxrpm
+        );
+
+static double now(void)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static CascadedController::config_t makeConfig(void)
+{
+    CascadedController::config_t config = {};
+
+    //                 kp     ki     kd     windupMax  outputMax
+    config.position = { 0.8,   0,     0,     0,         4 };
+    config.velocity = { 1.5,   0.2,   0,     1,         5 };
+    config.altitude = { 1.2,   0,     0,     0,         3 };
+    config.climb    = { 3,     1,     0,     2,         5 };
+    config.angle    = { 5,     0,     0,     0,         4 };
+    config.rate     = { 0.06,  0.02,  0,     0.02,      0.2 };
+    config.heading  = { 2,     0,     0,     0,         1 };
+    config.yawRate  = { 0.3,   0.05,  0,     0.05,      0.2 };
+
+    config.hoverThrottle = CascadedController::hoverThrottle(params, 4);
+    config.maxTilt = 0.35;
+
+    return config;
+}
+
+// Largest error of a tier's sines and cosines, or -1 if a value it hands to the math library comes out wrong
+static double sincosError(FastMath::Accuracy_t accuracy)
+{
+    std::vector<double> x(VALUES), s(VALUES), c(VALUES);
+
+    // Far more turns than a vehicle will make, and a few values the polynomials don't take
+    for (uint32_t i=0; i<VALUES; ++i) {
+        x[i] = -1000 + 2000.0 * i / VALUES;
+    }
+
+    const double special[4] = { NAN, INFINITY, 3e6, -1e9 };
+    for (uint8_t k=0; k<4; ++k) {
+        x[1000 * k + 17] = special[k];
+    }
+
+    FastMath::sincos(&x[0], &s[0], &c[0], VALUES, accuracy);
+
+    double worst = 0;
+
+    for (uint32_t i=0; i<VALUES; ++i) {
+
+        if (isnan(sin(x[i]))) {
+            if (!isnan(s[i]) || !isnan(c[i])) {
+                return -1;
+            }
+            continue;
+        }
+
+        worst = fmax(worst, fabs(s[i] - sin(x[i])));
+        worst = fmax(worst, fabs(c[i] - cos(x[i])));
+    }
+
+    return worst;
+}
+
+// Largest relative error of a tier's square roots, or -1 if the root of zero isn't zero
+static double sqrtError(FastMath::Accuracy_t accuracy)
+{
+    std::vector<double> x(VALUES), y(VALUES);
+
+    // Twelve orders of magnitude either side of one
+    for (uint32_t i=0; i<VALUES; ++i) {
+        x[i] = pow(10, -12 + 24.0 * i / VALUES);
+    }
+    x[0] = 0;
+
+    FastMath::sqrt(&x[0], &y[0], VALUES, accuracy);
+
+    if (y[0] != 0) {
+        return -1;
+    }
+
+    double worst = 0;
+
+    for (uint32_t i=1; i<VALUES; ++i) {
+        worst = fmax(worst, fabs(y[i] - sqrt(x[i])) / sqrt(x[i]));
+    }
+
+    return worst;
+}
+
+// Flies a swarm to a ring of points, dynamics and controller at the same accuracy, recording every state
+static void fly(FastMath::Accuracy_t accuracy, std::vector<MultirotorDynamics::pose_t> & poses)
+{
+    const CascadedController::config_t config = makeConfig();
+    const Mixer & mixer = Mixer::quadXAP();
+
+    std::vector<QuadXAPDynamics *> quads;
+
+    ControllerBatch batch(config, mixer, SWARM);
+    batch.setMathAccuracy(accuracy);
+
+    for (uint32_t i=0; i<SWARM; ++i) {
+
+        quads.push_back(new QuadXAPDynamics(&params));
+        quads[i]->setMathAccuracy(accuracy);
+
+        // In the air, tilted, and yawed through more than a turn across the swarm
+        double rotation[3] = { 0.2 - 0.01 * (i % 7), -0.15 + 0.01 * (i % 5), 0.5 * i };
+        quads[i]->init(rotation, true);
+
+        CascadedController::setpoint_t setpoint = {};
+        setpoint.location[0] = 5 + 2 * cos(i * 0.4);
+        setpoint.location[1] = -3 + 2 * sin(i * 0.4);
+        setpoint.location[2] = -10;
+        setpoint.rotation[2] = 1 - 0.3 * i;
+        batch.setSetpoint(i, setpoint);
+    }
+
+    double motorvals[4] = {};
+
+    for (uint32_t k=0; k<SECONDS/DELTA_T; ++k) {
+
+        for (uint32_t i=0; i<SWARM; ++i) {
+            batch.setState(i, quads[i]->getState());
+        }
+
+        batch.update(DELTA_T);
+
+        for (uint32_t i=0; i<SWARM; ++i) {
+
+            batch.getMotors(i, motorvals);
+
+            quads[i]->setMotors(motorvals, DELTA_T);
+            quads[i]->update(DELTA_T);
+
+            // Flat ground far below
+            quads[i]->setAgl(100 - quads[i]->getState().pose.location[2]);
+
+            poses.push_back(quads[i]->getPose());
+        }
+    }
+
+    for (uint32_t i=0; i<SWARM; ++i) {
+        delete quads[i];
+    }
+}
+
+// Seconds per value of a tier's sines and cosines, or square roots
+static double timeKernel(FastMath::Accuracy_t accuracy, bool roots)
+{
+    std::vector<double> x(ARRAY), s(ARRAY), c(ARRAY);
+
+    // Angles a vehicle flies at, and values around one
+    for (uint32_t i=0; i<ARRAY; ++i) {
+        x[i] = -3 + 6.0 * i / ARRAY;
+    }
+
+    double sum = 0;
+
+    const double t0 = now();
+
+    for (uint32_t k=0; k<REPEATS; ++k) {
+
+        if (roots) {
+            FastMath::sqrt(&x[0] + ARRAY/2, &s[0], ARRAY/2, accuracy);
+        }
+        else {
+            FastMath::sincos(&x[0], &s[0], &c[0], ARRAY, accuracy);
+        }
+
+        sum += s[k % ARRAY];
+    }
+
+    const double elapsed = now() - t0;
+
+    return sum == 12345 ? 0 : elapsed / REPEATS / (roots ? ARRAY/2 : ARRAY);
+}
+
+// Seconds per dynamics step, setMotors() and update(), at a tier
+static double timeStep(FastMath::Accuracy_t accuracy)
+{
+    QuadXAPDynamics quad(&params);
+    quad.setMathAccuracy(accuracy);
+
+    double rotation[3] = { 0.1, -0.1, 0.5 };
+    quad.init(rotation, true);
+
+    // A little over hover, rolling, so the angles keep changing
+    double motorvals[4] = { 0.58, 0.58, 0.58, 0.581 };
+
+    const double t0 = now();
+
+    for (uint32_t k=0; k<STEPS; ++k) {
+        quad.setMotors(motorvals, DELTA_T);
+        quad.update(DELTA_T);
+    }
+
+    return (now() - t0) / STEPS;
+}
+
+// Seconds per vehicle of a batched controller update at a tier
+static double timeBatch(FastMath::Accuracy_t accuracy)
+{
+    ControllerBatch batch(makeConfig(), Mixer::quadXAP(), ARRAY);
+    batch.setMathAccuracy(accuracy);
+
+    for (uint32_t i=0; i<ARRAY; ++i) {
+
+        MultirotorDynamics::state_t state = {};
+        state.pose.location[0] = 0.001 * i;
+        state.pose.location[2] = -9;
+        state.pose.rotation[0] = 0.01;
+        state.pose.rotation[2] = 0.5;
+
+        CascadedController::setpoint_t setpoint = {};
+        setpoint.location[2] = -10;
+
+        batch.setState(i, state);
+        batch.setSetpoint(i, setpoint);
+    }
+
+    double sum = 0;
+
+    const double t0 = now();
+
+    for (uint32_t k=0; k<BATCH_STEPS; ++k) {
+        batch.update(DELTA_T);
+        sum += batch.getMotor(0)[k % ARRAY];
+    }
+
+    const double elapsed = now() - t0;
+
+    return sum == 12345 ? 0 : elapsed / BATCH_STEPS / ARRAY;
+}
+
+int main(int argc, char ** argv)
+{
+    uint32_t failures = 0;
+
+    for (uint8_t t=1; t<TIERS; ++t) {
+
+        const double sincos = sincosError(ACCURACY[t]);
+        const double roots = sqrtError(ACCURACY[t]);
+
+        const bool within = sincos >= 0 && sincos < KERNEL_BOUND[t] && roots >= 0 && roots < KERNEL_BOUND[t];
+
+        printf("%s: sines and cosines off by at most %.1e, square roots by %.1e: %s\n",
+                NAMES[t], sincos, roots, within ? "within bound" : "out of bound");
+
+        failures += !within;
+    }
+
+    std::vector<MultirotorDynamics::pose_t> reference;
+    fly(FastMath::ACCURACY_FULL, reference);
+
+    for (uint8_t t=1; t<TIERS; ++t) {
+
+        std::vector<MultirotorDynamics::pose_t> poses;
+        fly(ACCURACY[t], poses);
+
+        double location = 0;
+        double rotation = 0;
+
+        for (uint32_t k=0; k<poses.size(); ++k) {
+            for (uint8_t i=0; i<3; ++i) {
+                location = fmax(location, fabs(poses[k].location[i] - reference[k].location[i]));
+                rotation = fmax(rotation, fabs(poses[k].rotation[i] - reference[k].rotation[i]));
+            }
+        }
+
+        const bool within = location < TRAJECTORY_BOUND[t] && rotation < TRAJECTORY_BOUND[t];
+
+        printf("%s: swarm of %u over %.0f s strays from full accuracy by at most %.1e m and %.1e rad: %s\n",
+                NAMES[t], SWARM, SECONDS, location, rotation, within ? "within bound" : "out of bound");
+
+        failures += !within;
+    }
+
+    for (uint8_t t=0; t<TIERS; ++t) {
+        printf("%s: %.2f ns per sine and cosine, %.2f ns per square root, %.1f ns per dynamics step, "
+                "%.1f ns per vehicle in a batched controller update\n",
+                NAMES[t], 1e9 * timeKernel(ACCURACY[t], false), 1e9 * timeKernel(ACCURACY[t], true),
+                1e9 * timeStep(ACCURACY[t]), 1e9 * timeBatch(ACCURACY[t]));
+    }
+
+    return failures ? 1 : 0;
+}
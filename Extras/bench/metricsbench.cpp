@@ -0,0 +1,179 @@
+/*
+ * Benchmark and check for the metrics registry and its scrape endpoint
+ *
+ * Has more threads than there are shards count into the same metrics and
+ * checks that no update is lost; times an update against a single shared
+ * atomic counter; then scrapes the local endpoint and checks the
+ * Prometheus text that comes back.
+ *
+ * Copyright (C) 2019 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#include <MetricsServer.hpp>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+static const uint32_t THREADS    = 80;
+static const uint32_t INCREMENTS = 100000;
+static const uint32_t UPDATES    = 10000000;
+
+// Above 32767, which the socket classes once turned into a negative port
+static const uint16_t PORT = 49464;
+
+static double now(void)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Value of the sample starting with prefix, or -1 if there is none
+static double sample(const std::string & text, const char * prefix)
+{
+    size_t start = text.find(std::string("\n") + prefix);
+    return start == std::string::npos ? -1 : atof(text.c_str() + start + 1 + strlen(prefix));
+}
+
+static std::string scrape(const char * request)
+{
+    std::string reply;
+
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+
+    struct sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(PORT);
+    inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+
+    if (connect(sock, (struct sockaddr *)&address, sizeof(address)) == 0) {
+
+        send(sock, request, strlen(request), 0);
+
+        char buf[4096];
+        ssize_t count = 0;
+        while ((count = recv(sock, buf, sizeof(buf), 0)) > 0) {
+            reply.append(buf, count);
+        }
+    }
+
+    close(sock);
+
+    return reply;
+}
+
+int main(int argc, char ** argv)
+{
+    uint32_t failures = 0;
+
+    Metrics & metrics = Metrics::get();
+
+    static const double BOUNDS[] = { 0.25, 0.5, 0.75 };
+
+    // No update lost, including by threads sharing the last shard
+    {
+        std::vector<std::thread> threads;
+        std::atomic<uint32_t> started(0);
+
+        for (uint32_t k=0; k<THREADS; ++k) {
+            threads.push_back(std::thread([k, &started]() {
+                char labels[40];
+                snprintf(labels, sizeof(labels), "parity=\"%s\"", k & 1 ? "odd" : "even");
+                Metrics::Counter counter = Metrics::get().counter("bench_increments_total", "Increments", labels);
+                Metrics::Histogram histogram = Metrics::get().histogram("bench_values", "Values", BOUNDS, 3);
+                // Every thread holds a shard before any counts, so some have to share
+                counter.increment(0);
+                started++;
+                while (started < THREADS) {
+                    std::this_thread::yield();
+                }
+                for (uint32_t j=0; j<INCREMENTS; ++j) {
+                    counter.increment();
+                    histogram.observe((j % 4) * 0.25 + 0.125);
+                }
+            }));
+        }
+
+        for (std::thread & thread : threads) {
+            thread.join();
+        }
+
+        std::string text;
+        metrics.render(text);
+
+        const double half = THREADS / 2 * (double)INCREMENTS;
+        const double all = THREADS * (double)INCREMENTS;
+
+        bool exact =
+            sample(text, "bench_increments_total{parity=\"even\"} ") == half &&
+            sample(text, "bench_increments_total{parity=\"odd\"} ") == half &&
+            sample(text, "bench_values_bucket{le=\"0.25\"} ") == all / 4 &&
+            sample(text, "bench_values_bucket{le=\"0.75\"} ") == all * 3 / 4 &&
+            sample(text, "bench_values_bucket{le=\"+Inf\"} ") == all &&
+            sample(text, "bench_values_count ") == all &&
+            fabs(sample(text, "bench_values_sum ") - all / 2) < 1e-6 * all;
+
+        printf("%u threads: %s\n", THREADS, exact ? "every update counted" : "updates lost");
+
+        failures += !exact;
+    }
+
+    // An update against one atomic that every thread shares
+    {
+        Metrics::Counter counter = metrics.counter("bench_updates_total", "Updates");
+        std::atomic<uint64_t> shared(0);
+
+        double t0 = now();
+        for (uint32_t k=0; k<UPDATES; ++k) {
+            counter.increment();
+        }
+        double sharded = (now() - t0) / UPDATES;
+
+        t0 = now();
+        for (uint32_t k=0; k<UPDATES; ++k) {
+            shared.fetch_add(1);
+        }
+        double atomic = (now() - t0) / UPDATES;
+
+        printf("Counter update: %.1f ns sharded, %.1f ns shared atomic\n", 1e9 * sharded, 1e9 * atomic);
+    }
+
+    // Scrape
+    {
+        metrics.gauge("bench_queue_depth", "Depth", "camera=\"0\"").set(3);
+        metrics.gauge("bench_queue_depth", "Depth", "camera=\"1\"").set(0.5);
+
+        MetricsServer server("127.0.0.1", PORT);
+
+        if (!server.isServing()) {
+            printf("Scrape: %s\n", server.getMessage());
+            return 1;
+        }
+
+        double t0 = now();
+        std::string reply = scrape("GET /metrics HTTP/1.1\r\nHost: localhost\r\n\r\n");
+        double elapsed = now() - t0;
+
+        size_t body = reply.find("\r\n\r\n");
+        size_t length = atoi(reply.c_str() + reply.find("Content-Length: ") + 16);
+
+        bool ok = !reply.compare(0, 15, "HTTP/1.0 200 OK") &&
+            body != std::string::npos && reply.size() - body - 4 == length &&
+            reply.find("# TYPE bench_values histogram\n") != std::string::npos &&
+            reply.find("# HELP bench_queue_depth ") == reply.rfind("# HELP bench_queue_depth ") &&
+            sample(reply, "bench_queue_depth{camera=\"0\"} ") == 3 &&
+            sample(reply, "bench_queue_depth{camera=\"1\"} ") == 0.5;
+
+        bool missing = !scrape("GET /nothing HTTP/1.1\r\n\r\n").compare(0, 22, "HTTP/1.0 404 Not Found");
+
+        printf("Scrape: %u bytes in %.2f ms, %s; unknown path %s\n", (unsigned)reply.size(), 1e3 * elapsed,
+                ok ? "well formed" : "malformed", missing ? "not found" : "answered");
+
+        failures += !ok || !missing;
+    }
+
+    return failures ? 1 : 0;
+}
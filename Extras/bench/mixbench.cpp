@@ -0,0 +1,239 @@
+/*
+ * Benchmark and check for mixing motor speeds into thrust and torques
+ *
+ * Flies the quad-X and octo-X frames built from MotorLayout tables next to
+ * the hand-coded frames they replace, with the same motor values, and
+ * checks that their states agree; checks that a hexa-X built only from its
+ * table climbs straight up on equal motors; then times setMotors() both
+ * ways for four, eight and sixteen motors.
+ *
+ * Copyright (C) 2019 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#include <dynamics/QuadXAP.hpp>
+#include <dynamics/OctoXAP.hpp>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <chrono>
+
+static const double DELTA_T = 0.001;
+static const uint32_t STEPS = 5000;
+static const uint32_t TIMING_STEPS = 2000000;
+
+static MultirotorDynamics::Parameters params = MultirotorDynamics::Parameters(
+
+        5.30216718361085E-05,   // b
+        2.23656692806239E-06,   // d
+        16.47,                  // m
+        0.6,                    // l
+        2,                      // Ix
+        2,                      // Iy
+        3,                      // Iz
+        3.08013E-04,            // Jr
+        15000                   // maxrpm
+        );
+
+static double now(void)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Quad-X as it was hand-coded before MotorLayout
+class HandQuad : public MultirotorDynamics {
+
+    public:
+
+        HandQuad(Parameters * params) : MultirotorDynamics(params, 4) { }
+
+    protected:
+
+        virtual double u2(double * o) override { return (o[1] + o[2]) - (o[0] + o[3]); }
+        virtual double u3(double * o) override { return (o[1] + o[3]) - (o[0] + o[2]); }
+        virtual double u4(double * o) override { return (o[0] + o[1]) - (o[2] + o[3]); }
+};
+
+// Octo-X as it was hand-coded before MotorLayout
+class HandOcto : public MultirotorDynamics {
+
+    public:
+
+        HandOcto(Parameters * params) : MultirotorDynamics(params, 8) { }
+
+    protected:
+
+        virtual double u2(double * o) override
+        {
+            return (C1*o[1] + C1*o[4] + C2*o[5] + C2*o[6]) - (C1*o[0] + C2*o[2] + C1*o[3] + C2*o[7]);
+        }
+
+        virtual double u3(double * o) override
+        {
+            return (C2*o[1] + C2*o[3] + C1*o[5] + C1*o[7]) - (C2*o[0] + C1*o[2] + C2*o[4] + C1*o[6]);
+        }
+
+        virtual double u4(double * o) override
+        {
+            return (o[2] + o[3] + o[4] + o[5]) - (o[0] + o[1] + o[6] + o[7]);
+        }
+
+    private:
+
+        static constexpr double C1 = 0.382680;
+        static constexpr double C2 = 0.923879;
+};
+
+// Sixteen motors on a ring, one scalar sum per torque as a hand-coded frame would do it
+class HandSixteen : public MultirotorDynamics {
+
+    public:
+
+        HandSixteen(Parameters * params) : MultirotorDynamics(params, 16)
+        {
+            for (uint8_t j=0; j<16; ++j) {
+                _x[j] = cos(j * 3.14159265358979323846 / 8);
+                _y[j] = sin(j * 3.14159265358979323846 / 8);
+                _yaw[j] = j % 2 ? +1 : -1;
+            }
+        }
+
+    protected:
+
+        double _x[16], _y[16], _yaw[16];
+
+        virtual double u2(double * o) override { double s = 0; for (uint8_t j=0; j<16; ++j) s -= _y[j] * o[j]; return s; }
+        virtual double u3(double * o) override { double s = 0; for (uint8_t j=0; j<16; ++j) s -= _x[j] * o[j]; return s; }
+        virtual double u4(double * o) override { double s = 0; for (uint8_t j=0; j<16; ++j) s += _yaw[j] * o[j]; return s; }
+};
+
+static MotorLayout sixteen(void)
+{
+    MotorLayout layout;
+
+    for (uint8_t j=0; j<16; ++j) {
+        layout.add(cos(j * 3.14159265358979323846 / 8), sin(j * 3.14159265358979323846 / 8), j % 2 ? -1 : +1);
+    }
+
+    return layout;
+}
+
+// Wobbling motor values, different for each motor, around hover
+static void wobble(uint32_t step, uint8_t count, double * motorvals)
+{
+    for (uint8_t j=0; j<count; ++j) {
+        motorvals[j] = 0.6 + 0.05 * sin(0.01 * step * (j + 1) + j);
+    }
+}
+
+// Flies two frames on the same motor values, returning the largest difference in location and rotation
+static double compare(MultirotorDynamics & a, MultirotorDynamics & b)
+{
+    double rotation[3] = {};
+    a.init(rotation, true);
+    b.init(rotation, true);
+
+    double motorvals[16] = {};
+    double worst = 0;
+
+    for (uint32_t k=0; k<STEPS; ++k) {
+
+        wobble(k, a.motorCount(), motorvals);
+
+        a.setMotors(motorvals, DELTA_T);
+        a.update(DELTA_T);
+        b.setMotors(motorvals, DELTA_T);
+        b.update(DELTA_T);
+
+        MultirotorDynamics::pose_t pa = a.getPose(), pb = b.getPose();
+
+        for (uint8_t i=0; i<3; ++i) {
+            worst = fmax(worst, fabs(pa.location[i] - pb.location[i]));
+            worst = fmax(worst, fabs(pa.rotation[i] - pb.rotation[i]));
+        }
+    }
+
+    return worst;
+}
+
+// Seconds per setMotors()
+static double timeMotors(MultirotorDynamics & dynamics)
+{
+    double motorvals[16] = {};
+    wobble(0, dynamics.motorCount(), motorvals);
+
+    const double t0 = now();
+
+    for (uint32_t k=0; k<TIMING_STEPS; ++k) {
+        motorvals[k % dynamics.motorCount()] += 1e-9;
+        dynamics.setMotors(motorvals, DELTA_T);
+    }
+
+    return (now() - t0) / TIMING_STEPS;
+}
+
+int main(int argc, char ** argv)
+{
+    uint32_t failures = 0;
+
+    QuadXAPDynamics quad(&params);
+    HandQuad handQuad(&params);
+    OctoXAPDynamics octo(&params);
+    HandOcto handOcto(&params);
+    FrameDynamics frame16(&params, sixteen());
+    HandSixteen hand16(&params);
+
+    const char * names[3] = { "Quad-X", "Octo-X", "Sixteen" };
+    MultirotorDynamics * frames[3] = { &quad, &octo, &frame16 };
+    MultirotorDynamics * hands[3] = { &handQuad, &handOcto, &hand16 };
+
+    for (uint8_t k=0; k<3; ++k) {
+
+        const double difference = compare(*frames[k], *hands[k]);
+        const bool agree = difference < 1e-9;
+
+        printf("%-8s table and hand-coded frames differ by at most %.1e after %u steps: %s\n",
+                names[k], difference, STEPS, agree ? "agree" : "disagree");
+
+        failures += !agree;
+    }
+
+    // A frame that exists only as data
+    {
+        FrameDynamics hexa(&params, MotorLayout::hexaXAP());
+
+        double rotation[3] = {};
+        hexa.init(rotation, true);
+
+        double motorvals[6] = { 0.5, 0.5, 0.5, 0.5, 0.5, 0.5 };
+
+        for (uint32_t k=0; k<STEPS; ++k) {
+            hexa.setMotors(motorvals, DELTA_T);
+            hexa.update(DELTA_T);
+        }
+
+        MultirotorDynamics::pose_t pose = hexa.getPose();
+
+        double drift = 0;
+        for (uint8_t i=0; i<3; ++i) {
+            drift = fmax(drift, fabs(pose.rotation[i]));
+        }
+        drift = fmax(drift, fmax(fabs(pose.location[0]), fabs(pose.location[1])));
+
+        const bool straight = drift < 1e-9 && pose.location[2] < -1;
+
+        printf("Hexa-X   climbs %.2f m on equal motors, drifting %.1e: %s\n",
+                -pose.location[2], drift, straight ? "straight" : "not straight");
+
+        failures += !straight;
+    }
+
+    for (uint8_t k=0; k<3; ++k) {
+        printf("%-8s setMotors(): %.1f ns from the table, %.1f ns hand-coded\n",
+                names[k], 1e9 * timeMotors(*frames[k]), 1e9 * timeMotors(*hands[k]));
+    }
+
+    return failures ? 1 : 0;
+}
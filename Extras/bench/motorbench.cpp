@@ -0,0 +1,338 @@
+/*
+ * Benchmark and check for measured motor curves
+ *
+ * Checks that a frame whose motors follow curves made from its own
+ * parameters flies as the quadratic model does; that a curve read from a
+ * sample file passes through its samples, and that bad files are turned
+ * away; that a motor with a time constant takes a step in speed as a
+ * first-order lag does; then times setMotors(), and a whole step of the
+ * physics, with and without curves.
+ *
+ * The sample file written here is made up, shaped like a small motor on a
+ * thrust stand, to exercise the reader; it isn't a measurement.
+ *
+ * Copyright (C) 2019 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#include <dynamics/QuadXAP.hpp>
+#include <dynamics/OctoXAP.hpp>
+#include <dynamics/MotorCurve.hpp>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <chrono>
+
+static const double DELTA_T = 0.001;
+static const uint32_t STEPS = 5000;
+static const uint32_t TIMING_STEPS = 2000000;
+
+static const char * SAMPLE_FILE = "motorbench.samples";
+
+static MultirotorDynamics::Parameters params = MultirotorDynamics::Parameters(
+
+        5.30216718361085E-05,   // b
+        2.23656692806239E-06,   // d
+        16.47,                  // m
+        0.6,                    // l
+        2,                      // Ix
+        2,                      // Iy
+        3,                      // Iz
+        3.08013E-04,            // Jr
+        15000                   // maxrpm
+        );
+
+// Motor value, rpm, thrust and torque: speed flattening toward the top, thrust a little under b*w^2
+static const double SAMPLES[][4] = {
+
+    { 0.00,     0,  0.000, 0.0000 },
+    { 0.10,  1900,  0.210, 0.0050 },
+    { 0.25,  4600,  1.230, 0.0290 },
+    { 0.40,  7100,  2.900, 0.0690 },
+    { 0.55,  9300,  4.950, 0.1190 },
+    { 0.70, 11300,  7.250, 0.1760 },
+    { 0.85, 13000,  9.530, 0.2330 },
+    { 1.00, 14400, 11.620, 0.2860 }
+};
+
+static const uint8_t SAMPLE_COUNT = sizeof(SAMPLES) / sizeof(SAMPLES[0]);
+
+static double now(void)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Wobbling motor values, different for each motor, around hover
+static void wobble(uint32_t step, uint8_t count, double * motorvals)
+{
+    for (uint8_t j=0; j<count; ++j) {
+        motorvals[j] = 0.6 + 0.05 * sin(0.01 * step * (j + 1) + j);
+    }
+}
+
+// Flies two frames on the same motor values, returning the largest difference in location and rotation
+static double compare(MultirotorDynamics & a, MultirotorDynamics & b)
+{
+    double rotation[3] = {};
+    a.init(rotation, true);
+    b.init(rotation, true);
+
+    double motorvals[16] = {};
+    double worst = 0;
+
+    for (uint32_t k=0; k<STEPS; ++k) {
+
+        wobble(k, a.motorCount(), motorvals);
+
+        a.setMotors(motorvals, DELTA_T);
+        a.update(DELTA_T);
+        b.setMotors(motorvals, DELTA_T);
+        b.update(DELTA_T);
+
+        MultirotorDynamics::pose_t pa = a.getPose(), pb = b.getPose();
+
+        for (uint8_t i=0; i<3; ++i) {
+            worst = fmax(worst, fabs(pa.location[i] - pb.location[i]));
+            worst = fmax(worst, fabs(pa.rotation[i] - pb.rotation[i]));
+        }
+    }
+
+    return worst;
+}
+
+// Seconds per setMotors(), with a step that changes every time as on the wall clock if jittered
+static double timeMotors(MultirotorDynamics & dynamics, bool jittered=false)
+{
+    double motorvals[16] = {};
+    wobble(0, dynamics.motorCount(), motorvals);
+
+    const double t0 = now();
+
+    for (uint32_t k=0; k<TIMING_STEPS; ++k) {
+        motorvals[k % dynamics.motorCount()] += 1e-9;
+        dynamics.setMotors(motorvals, jittered ? DELTA_T * (1 + 1e-3 * (k & 7)) : DELTA_T);
+    }
+
+    return (now() - t0) / TIMING_STEPS;
+}
+
+// Seconds per setMotors() and update(), as the physics thread steps the vehicle
+static double timeStep(MultirotorDynamics & dynamics)
+{
+    double rotation[3] = {};
+    dynamics.init(rotation, true);
+
+    double motorvals[16] = {};
+
+    const double t0 = now();
+
+    for (uint32_t k=0; k<TIMING_STEPS; ++k) {
+        wobble(k, dynamics.motorCount(), motorvals);
+        dynamics.setMotors(motorvals, DELTA_T);
+        dynamics.update(DELTA_T);
+    }
+
+    return (now() - t0) / TIMING_STEPS;
+}
+
+static bool writeFile(const char * text)
+{
+    FILE * fp = fopen(SAMPLE_FILE, "w");
+
+    if (!fp) {
+        return false;
+    }
+
+    fputs(text, fp);
+    fclose(fp);
+
+    return true;
+}
+
+static bool writeSamples(double timeConstant)
+{
+    FILE * fp = fopen(SAMPLE_FILE, "w");
+
+    if (!fp) {
+        return false;
+    }
+
+    fprintf(fp, "# motor value, rpm, thrust [N], torque [N m]\n");
+    fprintf(fp, "timeConstant %g\n\n", timeConstant);
+
+    for (uint8_t k=0; k<SAMPLE_COUNT; ++k) {
+        fprintf(fp, "%.2f, %.0f, %.3f, %.4f\n", SAMPLES[k][0], SAMPLES[k][1], SAMPLES[k][2], SAMPLES[k][3]);
+    }
+
+    fclose(fp);
+
+    return true;
+}
+
+int main(int argc, char ** argv)
+{
+    uint32_t failures = 0;
+
+    // Curves from the parameters, without lag, against the quadratic model
+    {
+        QuadXAPDynamics quad(&params), curved(&params);
+        curved.setMotorCurves(MotorCurve::quadratic(params));
+
+        const double difference = compare(curved, quad);
+        const bool agree = difference < 1e-9;
+
+        printf("Quadratic curves and the quadratic model differ by at most %.1e after %u steps: %s\n",
+                difference, STEPS, agree ? "agree" : "disagree");
+
+        failures += !agree;
+    }
+
+    // A curve from a sample file
+    {
+        MotorCurve curve;
+
+        const bool loaded = writeSamples(0.02) && curve.load(SAMPLE_FILE);
+
+        double worst = 0;
+
+        for (uint8_t k=0; loaded && k<SAMPLE_COUNT; ++k) {
+
+            const double u = SAMPLES[k][0];
+            const double last = SAMPLE_COUNT - 1;
+
+            worst = fmax(worst, fabs(curve.speed(u) * 30 / 3.14159 - SAMPLES[k][1]) / SAMPLES[(int)last][1]);
+            worst = fmax(worst, fabs(curve.thrust(u) - SAMPLES[k][2]) / SAMPLES[(int)last][2]);
+            worst = fmax(worst, fabs(curve.torque(u) - SAMPLES[k][3]) / SAMPLES[(int)last][3]);
+        }
+
+        const bool close = loaded && worst < 0.01 && curve.getTimeConstant() == 0.02;
+
+        printf("Sample file: %s; curve within %.2f%% of full scale at the samples: %s\n",
+                curve.getMessage(), 100 * worst, close ? "pass" : "fail");
+
+        failures += !close;
+
+        static const char * BAD[] = {
+            "0 0 0 0\n0.5 7000 3\n",
+            "0 0 0 0\n0.5 7000 3 0.07\n0.4 8000 4 0.08\n",
+            "0 0 0 0\n0.5 7000 -3 0.07\n",
+            "0 0 0 0\n0.5 7000 3 0.07 9\n",
+            "0 0 0 0\n",
+            "timeConstant -1\n0 0 0 0\n1 9000 5 0.1\n"
+        };
+
+        for (uint8_t k=0; k<sizeof(BAD)/sizeof(BAD[0]); ++k) {
+
+            MotorCurve bad;
+            const bool rejected = writeFile(BAD[k]) && !bad.load(SAMPLE_FILE);
+
+            printf("Bad sample file %u: %s: %s\n", k+1, bad.getMessage(), rejected ? "rejected" : "accepted");
+
+            failures += !rejected;
+        }
+
+        remove(SAMPLE_FILE);
+
+        // A lighter vehicle, for the smaller motor of the samples
+        MultirotorDynamics::Parameters light = params;
+        light.m = 5;
+
+        FrameDynamics octo(&light, MotorLayout::octoXAP());
+        if (loaded) {
+            octo.setMotorCurves(curve);
+        }
+
+        double rotation[3] = {};
+        octo.init(rotation, true);
+
+        double motorvals[8] = { 0.8, 0.8, 0.8, 0.8, 0.8, 0.8, 0.8, 0.8 };
+
+        for (uint32_t k=0; k<STEPS; ++k) {
+            octo.setMotors(motorvals, DELTA_T);
+            octo.update(DELTA_T);
+        }
+
+        MultirotorDynamics::pose_t pose = octo.getPose();
+
+        double drift = 0;
+        for (uint8_t i=0; i<3; ++i) {
+            drift = fmax(drift, fabs(pose.rotation[i]));
+        }
+
+        const bool straight = drift < 1e-9 && pose.location[2] < -1;
+
+        printf("Octo-X on the sample curve climbs %.2f m on equal motors, turning %.1e: %s\n",
+                -pose.location[2], drift, straight ? "straight" : "not straight");
+
+        failures += !straight;
+    }
+
+    // A step in motor value through the lag, in steps short against the time constant, which
+    // take the series, and long ones, which take the exact step
+    {
+        const double taus[2] = { 0.05, 0.005 };
+
+        for (uint8_t k=0; k<2; ++k) {
+
+            const double tau = taus[k];
+
+            // Each step of the series falls short of the exact one by under x^4/24, x = dt/tau,
+            // and each step passes on less than all of what the ones before it missed
+            const double x = DELTA_T / tau;
+            const double tolerance = k == 0 ? (tau / DELTA_T) * pow(x, 4) / 24 : 1e-9;
+
+            QuadXAPDynamics quad(&params);
+            quad.setMotorCurves(MotorCurve::quadratic(params, tau));
+
+            double rotation[3] = {};
+            quad.init(rotation, true);
+
+            double motorvals[4] = { 0.6, 0.6, 0.6, 0.6 };
+
+            const uint32_t steps = (uint32_t)round(tau / DELTA_T);
+
+            for (uint32_t i=0; i<steps; ++i) {
+                quad.setMotors(motorvals, DELTA_T);
+            }
+
+            // After one time constant a first-order lag has covered 1 - 1/e of the step
+            const double target = 0.6 * params.maxrpm * 3.14159 / 30;
+            const double fraction = quad.motorSpeed(0) / target;
+            const double error = fabs(fraction - (1 - exp(-1)));
+            const bool lagged = error < tolerance;
+
+            printf("Motor with %.0f ms lag reaches %.6f of a step after %.0f ms, off by %.1e: %s\n",
+                    1000 * tau, fraction, 1000 * tau, error, lagged ? "pass" : "fail");
+
+            failures += !lagged;
+        }
+    }
+
+    // Cost of the tables against the polynomial
+    {
+        QuadXAPDynamics quad(&params), quadCurved(&params);
+        OctoXAPDynamics octo(&params), octoCurved(&params);
+
+        quadCurved.setMotorCurves(MotorCurve::quadratic(params, 0.02));
+        octoCurved.setMotorCurves(MotorCurve::quadratic(params, 0.02));
+
+        const char * names[2] = { "Quad-X", "Octo-X" };
+        MultirotorDynamics * plain[2] = { &quad, &octo };
+        MultirotorDynamics * curved[2] = { &quadCurved, &octoCurved };
+
+        for (uint8_t k=0; k<2; ++k) {
+            printf("%-8s setMotors(): %.1f ns with curves and lag (%.1f ns as dt changes), %.1f ns with the quadratic model\n",
+                    names[k], 1e9 * timeMotors(*curved[k]), 1e9 * timeMotors(*curved[k], true),
+                    1e9 * timeMotors(*plain[k]));
+        }
+
+        for (uint8_t k=0; k<2; ++k) {
+            printf("%-8s whole step:  %.1f ns with curves and lag, %.1f ns with the quadratic model\n",
+                    names[k], 1e9 * timeStep(*curved[k]), 1e9 * timeStep(*plain[k]));
+        }
+    }
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,289 @@
+/*
+ * Benchmark and check for the spatial hash behind proximity checking
+ *
+ * Moves a few hundred vehicles and targets around a box for many steps,
+ * feeding the hash the way the proximity manager does, and checks every
+ * collision and near miss, the closest approach, the totals and neighbor
+ * queries against a brute-force pass over all pairs.  Agents are removed
+ * and added back as it runs, and a small table forces cells to share
+ * buckets.  Then times both.
+ *
+ * Copyright (C) 2019 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#include <SpatialHash.hpp>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <vector>
+#include <map>
+
+static const uint32_t AGENTS = 300;
+static const uint32_t STEPS = 3000;
+static const double DT = 0.01;
+
+static const double BOX = 12;           // half width, meters
+static const double CELL_SIZE = 2;
+static const double NEAR_MISS = 1;
+
+static const uint32_t NEIGHBOR_EVERY = 50;
+static const uint32_t CHURN_EVERY = 100;
+static const uint32_t CAPACITY = 64;
+
+static double now(void)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static double uniform(double lo, double hi)
+{
+    return lo + (hi - lo) * rand() / (double)RAND_MAX;
+}
+
+typedef struct {
+
+    double location[3];
+    double velocity[3];
+    double radius;
+    SpatialHash::Kind_t kind;
+    bool active;
+
+} mover_t;
+
+typedef struct {
+
+    double minSeparation;
+    bool touched;
+
+} encounter_t;
+
+static double separation(const mover_t & a, const mover_t & b)
+{
+    double dx = a.location[0] - b.location[0];
+    double dy = a.location[1] - b.location[1];
+    double dz = a.location[2] - b.location[2];
+    return sqrt(dx*dx + dy*dy + dz*dz) - a.radius - b.radius;
+}
+
+static bool sameEvent(const SpatialHash::event_t & x, const SpatialHash::event_t & y)
+{
+    return x.type == y.type && x.a == y.a && x.b == y.b && x.time == y.time && fabs(x.separation - y.separation) < 1e-12;
+}
+
+static bool byPair(const SpatialHash::event_t & x, const SpatialHash::event_t & y)
+{
+    return x.a != y.a ? x.a < y.a : x.b != y.b ? x.b < y.b : x.type < y.type;
+}
+
+// Every pair, every step: the events and the closest approach among pairs in range
+static void bruteForce(const std::vector<mover_t> & movers, std::map<uint64_t, encounter_t> & encounters,
+        double time, std::vector<SpatialHash::event_t> & events, double & minSeparation)
+{
+    std::map<uint64_t, encounter_t> current;
+
+    minSeparation = INFINITY;
+
+    for (uint32_t a=0; a<AGENTS; ++a) {
+        for (uint32_t b=a+1; b<AGENTS; ++b) {
+
+            if (!movers[a].active || !movers[b].active) continue;
+            if (movers[a].kind == SpatialHash::KIND_TARGET && movers[b].kind == SpatialHash::KIND_TARGET) continue;
+
+            double s = separation(movers[a], movers[b]);
+
+            if (s < NEAR_MISS) {
+                minSeparation = fmin(minSeparation, s);
+                encounter_t encounter = { s, s <= 0 };
+                current[((uint64_t)a << 32) | b] = encounter;
+            }
+        }
+    }
+
+    events.clear();
+
+    for (auto & entry : current) {
+
+        bool wasTouching = false;
+
+        auto before = encounters.find(entry.first);
+        if (before != encounters.end()) {
+            wasTouching = before->second.touched;
+            entry.second.minSeparation = fmin(entry.second.minSeparation, before->second.minSeparation);
+            entry.second.touched = entry.second.touched || before->second.touched;
+        }
+
+        if (entry.second.touched && !wasTouching) {
+            SpatialHash::event_t event = { SpatialHash::EVENT_COLLISION, (uint32_t)(entry.first >> 32), (uint32_t)entry.first,
+                time, entry.second.minSeparation };
+            events.push_back(event);
+        }
+    }
+
+    for (auto & entry : encounters) {
+        if (!entry.second.touched && current.find(entry.first) == current.end()) {
+            SpatialHash::event_t event = { SpatialHash::EVENT_NEAR_MISS, (uint32_t)(entry.first >> 32), (uint32_t)entry.first,
+                time, entry.second.minSeparation };
+            events.push_back(event);
+        }
+    }
+
+    encounters.swap(current);
+}
+
+static void move(mover_t & mover)
+{
+    for (uint8_t k=0; k<3; ++k) {
+
+        mover.velocity[k] = fmax(-5, fmin(+5, mover.velocity[k] + uniform(-1, +1)));
+        mover.location[k] += mover.velocity[k] * DT;
+
+        if (fabs(mover.location[k]) > BOX) {
+            mover.location[k] = copysign(BOX, mover.location[k]);
+            mover.velocity[k] = -mover.velocity[k];
+        }
+    }
+}
+
+static bool run(uint32_t buckets)
+{
+    srand(1);
+
+    std::vector<mover_t> movers(AGENTS);
+
+    SpatialHash hash(AGENTS, CELL_SIZE, NEAR_MISS, buckets);
+
+    for (uint32_t id=0; id<AGENTS; ++id) {
+
+        mover_t & mover = movers[id];
+
+        // Every tenth agent is a target, which only drifts
+        mover.kind = id % 10 ? SpatialHash::KIND_VEHICLE : SpatialHash::KIND_TARGET;
+        mover.radius = uniform(0.2, 0.6);
+        mover.active = true;
+
+        for (uint8_t k=0; k<3; ++k) {
+            mover.location[k] = uniform(-BOX, +BOX);
+            mover.velocity[k] = mover.kind == SpatialHash::KIND_TARGET ? 0 : uniform(-5, +5);
+        }
+
+        hash.setAgent(id, mover.radius, mover.kind);
+    }
+
+    std::map<uint64_t, encounter_t> encounters;
+    std::vector<SpatialHash::event_t> expected;
+
+    uint32_t collisions = 0, nearMisses = 0;
+    uint32_t eventMismatches = 0, separationMismatches = 0, neighborMismatches = 0, queries = 0;
+
+    double hashTime = 0, bruteTime = 0;
+
+    for (uint32_t step=0; step<STEPS; ++step) {
+
+        const double time = step * DT;
+
+        // Take one agent out and put the one taken out before back
+        if (step % CHURN_EVERY == 0 && step > 0) {
+            uint32_t out = (step / CHURN_EVERY * 37) % AGENTS;
+            uint32_t back = ((step / CHURN_EVERY - 1) * 37) % AGENTS;
+            movers[back].active = true;
+            movers[out].active = false;
+            hash.remove(out);
+        }
+
+        for (uint32_t id=0; id<AGENTS; ++id) {
+            if (movers[id].kind == SpatialHash::KIND_VEHICLE) {
+                move(movers[id]);
+            }
+        }
+
+        double t0 = now();
+
+        for (uint32_t id=0; id<AGENTS; ++id) {
+            if (movers[id].active) {
+                hash.update(id, movers[id].location);
+            }
+        }
+
+        std::vector<SpatialHash::event_t> events = hash.detect(time);
+
+        double t1 = now();
+
+        double minSeparation = 0;
+        bruteForce(movers, encounters, time, expected, minSeparation);
+
+        bruteTime += now() - t1;
+        hashTime += t1 - t0;
+
+        for (const SpatialHash::event_t & event : expected) {
+            collisions += event.type == SpatialHash::EVENT_COLLISION;
+            nearMisses += event.type == SpatialHash::EVENT_NEAR_MISS;
+        }
+
+        std::sort(events.begin(), events.end(), byPair);
+        std::sort(expected.begin(), expected.end(), byPair);
+
+        bool same = events.size() == expected.size();
+        for (size_t k=0; same && k<events.size(); ++k) {
+            same = sameEvent(events[k], expected[k]);
+        }
+        eventMismatches += !same;
+
+        // The hash only sees pairs in range, so its closest approach is only comparable when one is
+        if (minSeparation < NEAR_MISS) {
+            separationMismatches += hash.getStepMinSeparation() != minSeparation;
+        }
+
+        if (step % NEIGHBOR_EVERY == 0) {
+
+            for (uint32_t id=0; id<AGENTS; ++id) {
+
+                for (double distance : { 0.5, 3.0 }) {
+
+                    std::vector<uint32_t> want;
+                    for (uint32_t other=0; other<AGENTS; ++other) {
+                        if (movers[id].active && movers[other].active && other != id &&
+                                separation(movers[id], movers[other]) < distance) {
+                            want.push_back(other);
+                        }
+                    }
+
+                    uint32_t found[CAPACITY] = {};
+                    uint32_t count = hash.neighbors(id, distance, found, CAPACITY);
+
+                    std::vector<uint32_t> got(found, found + std::min(count, CAPACITY));
+                    std::sort(got.begin(), got.end());
+
+                    neighborMismatches += count != want.size() || (count <= CAPACITY && got != want);
+                    queries++;
+                }
+            }
+        }
+    }
+
+    printf("%u buckets: %u collisions, %u near misses over %u steps of %u agents\n",
+            buckets, collisions, nearMisses, STEPS, AGENTS);
+    printf("  %u steps with different events, %u with a different closest approach, %u of %u neighbor queries differ\n",
+            eventMismatches, separationMismatches, neighborMismatches, queries);
+    printf("  hash %.1f us per step testing %.0f pairs, brute force %.1f us\n",
+            1e6 * hashTime / STEPS, hash.getPairsTested() / (double)STEPS, 1e6 * bruteTime / STEPS);
+
+    return collisions > 0 && nearMisses > 0 &&
+        hash.getCollisions() == collisions && hash.getNearMisses() == nearMisses &&
+        eventMismatches == 0 && separationMismatches == 0 && neighborMismatches == 0;
+}
+
+int main(int argc, char ** argv)
+{
+    uint32_t failures = 0;
+
+    for (uint32_t buckets : { 64, 4096 }) {
+        bool ok = run(buckets);
+        printf("%-58s %s\n", "Hash agrees with brute force", ok ? "ok" : "FAILED");
+        failures += !ok;
+    }
+
+    return failures ? 1 : 0;
+}
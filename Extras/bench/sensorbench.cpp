@@ -0,0 +1,141 @@
+/*
+ * Benchmark and check for the IMU/baro/GPS sensor models
+ *
+ * Checks Philox against the published known answers, checks that noise
+ * doesn't depend on how vehicles are batched, checks the IMU noise level,
+ * and times updating a fleet at 8 kHz.
+ *
+ * Usage: sensorbench [vehicles]
+ *
+ * Copyright (C) 2019 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#include <sensors/SensorSuite.hpp>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+
+static const double RATE = 8000;
+
+static double now(void)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void truth(uint32_t vehicle, double time, MultirotorDynamics::state_t & state)
+{
+    state = {};
+    state.angularVel[0] = 0.1 * sin(time + vehicle);
+    state.bodyAccel[2] = -9.8;
+    state.pose.location[0] = vehicle + time;
+    state.pose.location[2] = -10 * time;
+    state.inertialVel[0] = 1;
+    state.inertialVel[2] = -10;
+}
+
+static bool same(const SensorSuite::reading_t & a, const SensorSuite::reading_t & b)
+{
+    return memcmp(&a, &b, sizeof(a)) == 0;
+}
+
+int main(int argc, char ** argv)
+{
+    uint32_t vehicles = argc > 1 ? atoi(argv[1]) : 256;
+    uint32_t failures = 0;
+
+    // Known answers from the Random123 distribution
+    static const uint32_t kat[3][10] = {
+        { 0, 0, 0, 0,  0, 0,  0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8 },
+        { 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff,  0xffffffff, 0xffffffff,
+            0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd },
+        { 0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344,  0xa4093822, 0x299f31d0,
+            0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1 } };
+
+    for (uint8_t k=0; k<3; ++k) {
+        uint32_t out[4];
+        Philox::generate(&kat[k][0], &kat[k][4], out);
+        if (memcmp(out, &kat[k][6], sizeof(out))) {
+            printf("Philox known answer %d failed\n", k);
+            failures++;
+        }
+    }
+
+    SensorSuite::params_t params = SensorSuite::defaultParams();
+
+    // Whole fleet at once versus one vehicle at a time, backwards
+    SensorSuite batched(vehicles, params, 42);
+    SensorSuite single(vehicles, params, 42);
+
+    std::vector<MultirotorDynamics::state_t> states(vehicles);
+    std::vector<SensorSuite::reading_t> a(vehicles), b(vehicles);
+
+    uint32_t mismatches = 0;
+    uint32_t steps = (uint32_t)RATE / 4;
+
+    // Gyro noise about the truth, vehicle 0
+    double sum = 0, sum2 = 0;
+
+    for (uint32_t s=0; s<steps; ++s) {
+
+        double time = s / RATE;
+
+        for (uint32_t v=0; v<vehicles; ++v) {
+            truth(v, time, states[v]);
+        }
+
+        batched.update(0, vehicles, time, states.data(), a.data());
+
+        for (uint32_t v=vehicles; v-->0;) {
+            single.update(v, 1, time, &states[v], &b[v]);
+        }
+
+        for (uint32_t v=0; v<vehicles; ++v) {
+            mismatches += !same(a[v], b[v]);
+        }
+
+        if (s > 0) {
+            double e = a[0].gyro[1];
+            sum += e;
+            sum2 += e * e;
+        }
+    }
+
+    printf("%u vehicles, %u steps, %u batching mismatches\n", vehicles, steps, mismatches);
+    failures += mismatches > 0;
+
+    double mean = sum / (steps - 1);
+    double sigma = sqrt(sum2 / (steps - 1) - mean * mean);
+    double expected = params.gyroNoise * sqrt(RATE);
+    printf("Gyro noise %.5f rad/s, expected %.5f\n", sigma, expected);
+    if (fabs(sigma / expected - 1) > 0.1) {
+        failures++;
+    }
+
+    printf("Baro %.2f m taken at %.4f s, GPS north %.2f m taken at %.4f s, at %.4f s\n",
+            a[0].baroAltitude, a[0].baroTime, a[0].gpsLocation[0], a[0].gpsTime, (steps - 1) / RATE);
+
+    // A different seed gives different noise
+    SensorSuite other(1, params, 43);
+    SensorSuite::reading_t c = {};
+    for (uint32_t s=0; s<2; ++s) {
+        truth(0, s / RATE, states[0]);
+        other.update(0, 1, s / RATE, &states[0], &c);
+    }
+    failures += c.gyro[1] == a[0].gyro[1];
+
+    // One simulated second for the whole fleet
+    batched.reset();
+    double t0 = now();
+    for (uint32_t s=0; s<(uint32_t)RATE; ++s) {
+        batched.update(0, vehicles, s / RATE, states.data(), a.data());
+    }
+    double elapsed = now() - t0;
+
+    printf("%u vehicles at %.0f Hz: %.1f ms per simulated second, %.0f ns per vehicle update\n",
+            vehicles, RATE, 1000 * elapsed, 1e9 * elapsed / (RATE * vehicles));
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,160 @@
+/*
+ * Benchmark and check for precomputed target trajectories
+ *
+ * Checks that trajectories pass through their waypoints, join smoothly,
+ * loop without a jump, and match the textbook minimum-jerk profile; then
+ * times evaluation for short and long waypoint lists, which should differ
+ * only by cache misses on the longer one.
+ *
+ * Copyright (C) 2019 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#include <Trajectory.hpp>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <vector>
+
+static const uint32_t EVALUATIONS = 1000000;
+
+static double now(void)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static double uniform(double lo, double hi)
+{
+    return lo + (hi - lo) * rand() / (double)RAND_MAX;
+}
+
+static std::vector<Trajectory::waypoint_t> randomWaypoints(uint32_t count, bool loop)
+{
+    std::vector<Trajectory::waypoint_t> waypoints(count);
+
+    double time = 0;
+    for (uint32_t k=0; k<count; ++k) {
+        waypoints[k].time = time;
+        for (uint8_t j=0; j<3; ++j) {
+            waypoints[k].position[j] = uniform(-100, 100);
+        }
+        time += uniform(0.5, 5);
+    }
+
+    if (loop) {
+        memcpy(waypoints[count-1].position, waypoints[0].position, sizeof(waypoints[0].position));
+    }
+
+    return waypoints;
+}
+
+// Largest jump in position or velocity across time t
+static double jump(const Trajectory & trajectory, double t)
+{
+    const double eps = 1e-7;
+    double p0[3], v0[3], p1[3], v1[3];
+    trajectory.evaluate(t - eps, p0, v0);
+    trajectory.evaluate(t + eps, p1, v1);
+
+    double worst = 0;
+    for (uint8_t j=0; j<3; ++j) {
+        worst = fmax(worst, fmax(fabs(p1[j] - p0[j]), fabs(v1[j] - v0[j]) * 1e-3));
+    }
+    return worst;
+}
+
+int main(int argc, char ** argv)
+{
+    uint32_t failures = 0;
+
+    srand(1);
+
+    const char * names[2] = { "jerk", "snap" };
+
+    for (uint8_t order=0; order<2; ++order) {
+
+        Trajectory::Smoothness_t smoothness = order ? Trajectory::MINIMUM_SNAP : Trajectory::MINIMUM_JERK;
+
+        // Through the waypoints, smoothly
+        std::vector<Trajectory::waypoint_t> waypoints = randomWaypoints(50, false);
+        Trajectory trajectory;
+        failures += !trajectory.compile(waypoints.data(), (uint32_t)waypoints.size(), smoothness);
+
+        double worstWaypoint = 0, worstJump = 0, worstVelocity = 0;
+
+        for (const Trajectory::waypoint_t & waypoint : waypoints) {
+            double p[3];
+            trajectory.evaluate(waypoint.time, p);
+            for (uint8_t j=0; j<3; ++j) {
+                worstWaypoint = fmax(worstWaypoint, fabs(p[j] - waypoint.position[j]));
+            }
+            worstJump = fmax(worstJump, jump(trajectory, waypoint.time));
+        }
+
+        // Velocity against the slope of the position
+        for (uint32_t k=0; k<1000; ++k) {
+            double t = uniform(0, trajectory.getDuration());
+            double p[3], p0[3], p1[3], v[3];
+            trajectory.evaluate(t, p, v);
+            trajectory.evaluate(t - 1e-5, p0);
+            trajectory.evaluate(t + 1e-5, p1);
+            for (uint8_t j=0; j<3; ++j) {
+                worstVelocity = fmax(worstVelocity, fabs((p1[j] - p0[j]) / 2e-5 - v[j]));
+            }
+        }
+
+        // Looping, no jump where the end meets the start
+        std::vector<Trajectory::waypoint_t> loop = randomWaypoints(10, true);
+        Trajectory looped;
+        looped.compile(loop.data(), (uint32_t)loop.size(), smoothness, true);
+        double loopJump = fmax(jump(looped, looped.getDuration()), jump(looped, 3 * looped.getDuration()));
+
+        printf("Minimum %s: waypoints within %.1e, joins within %.1e, velocity within %.1e, loop join within %.1e\n",
+                names[order], worstWaypoint, worstJump, worstVelocity, loopJump);
+
+        failures += worstWaypoint > 1e-9 || worstJump > 1e-4 || worstVelocity > 1e-4 || loopJump > 1e-4;
+    }
+
+    // Rest to rest, minimum jerk is 10s^3 - 15s^4 + 6s^5
+    {
+        Trajectory::waypoint_t waypoints[2] = { { 0, { 0, 0, 0 } }, { 2, { 1, 0, 0 } } };
+        Trajectory trajectory;
+        trajectory.compile(waypoints, 2);
+        double worst = 0;
+        for (uint32_t k=0; k<=100; ++k) {
+            double s = k / 100., p[3];
+            trajectory.evaluate(2 * s, p);
+            worst = fmax(worst, fabs(p[0] - (10*s*s*s - 15*s*s*s*s + 6*s*s*s*s*s)));
+        }
+        printf("Rest to rest: within %.1e of the minimum-jerk profile\n", worst);
+        failures += worst > 1e-12;
+    }
+
+    // Cost of evaluation shouldn't depend on the number of waypoints
+    for (uint32_t count : { 10, 100000 }) {
+
+        std::vector<Trajectory::waypoint_t> waypoints = randomWaypoints(count, true);
+        Trajectory trajectory;
+        trajectory.compile(waypoints.data(), count, Trajectory::MINIMUM_SNAP, true);
+
+        std::vector<double> times(1024);
+        for (double & t : times) {
+            t = uniform(0, 2 * trajectory.getDuration());
+        }
+
+        double sink = 0;
+        double t0 = now();
+        for (uint32_t k=0; k<EVALUATIONS; ++k) {
+            double p[3], v[3];
+            trajectory.evaluate(times[k & 1023], p, v);
+            sink += p[0] + v[1];
+        }
+        double elapsed = (now() - t0) / EVALUATIONS;
+
+        printf("%6u waypoints: %.1f ns per evaluation (%g)\n", count, 1e9 * elapsed, sink != 0 ? 1. : 0.);
+    }
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,236 @@
+/*
+ * Benchmark and check for the memory-mapped wind field
+ *
+ * Checks that a field varying linearly in space and time is reproduced
+ * exactly, including its gradient, across brick borders and at the edges;
+ * times single and batched sampling over a field larger than the caches;
+ * and checks that a hovering vehicle drifts downwind.
+ *
+ * Usage: windbench [file]
+ *
+ * Copyright (C) 2019 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#include <dynamics/WindField.hpp>
+#include <dynamics/QuadXAP.hpp>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <vector>
+
+static const uint32_t POINTS = 1024;
+static const int REPS = 200;
+
+static double now(void)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static double uniform(double lo, double hi)
+{
+    return lo + (hi - lo) * rand() / (double)RAND_MAX;
+}
+
+// Wind at a node, linear in position and frame
+static void linear(double x, double y, double z, double t, float w[3])
+{
+    w[0] = (float)(1 + 0.5*x - 0.25*y + 0.125*z + 2*t);
+    w[1] = (float)(-2 + 0.1*x + 0.3*y - t);
+    w[2] = (float)(0.5 - 0.2*x + 0.05*y + 0.4*z + 0.5*t);
+}
+
+int main(int argc, char ** argv)
+{
+    const char * path = argc > 1 ? argv[1] : "windbench.wind";
+    uint32_t failures = 0;
+
+    // Small linear field, with sizes that don't fill the last bricks
+    {
+        const uint32_t n[3] = { 21, 13, 10 };
+        const double origin[3] = { -10, -5, -8 };
+        const double spacing = 2;
+        const uint32_t frames = 3;
+        const double timeStep = 0.5;
+
+        WindField field;
+        if (!field.create(path, n, frames, origin, spacing, timeStep, false)) {
+            fprintf(stderr, "Unable to create %s\n", path);
+            return 1;
+        }
+
+        std::vector<float> samples(3 * n[0] * n[1] * n[2]);
+        for (uint32_t f=0; f<frames; ++f) {
+            for (uint32_t z=0; z<n[2]; ++z) {
+                for (uint32_t y=0; y<n[1]; ++y) {
+                    for (uint32_t x=0; x<n[0]; ++x) {
+                        linear(origin[0] + x*spacing, origin[1] + y*spacing, origin[2] + z*spacing, f*timeStep,
+                                &samples[3 * ((z*n[1] + y)*n[0] + x)]);
+                    }
+                }
+            }
+            field.setFrame(f, samples.data());
+        }
+        field.close();
+
+        if (!field.load(path)) {
+            fprintf(stderr, "Unable to load %s\n", path);
+            return 1;
+        }
+
+        double worst = 0, worstGradient = 0;
+
+        srand(1);
+        for (uint32_t k=0; k<10000; ++k) {
+
+            // Inside the grid in space and time, plus a few exact edges
+            double p[3] = { uniform(-10, 30), uniform(-5, 19), uniform(-8, 10) };
+            double t = uniform(0, 1);
+            if (k < 8) {
+                p[0] = k&1 ? -10 : 30;
+                p[1] = k&2 ? -5 : 19;
+                p[2] = k&4 ? -8 : 10;
+                t = k&1 ? 0 : 1;
+            }
+
+            float w[3], dx[3], dy[3], expected[3];
+            field.sample(p, t, w, dx, dy);
+            linear(p[0], p[1], p[2], t, expected);
+
+            const float gradX[3] = { 0.5f, 0.1f, -0.2f };
+            const float gradY[3] = { -0.25f, 0.3f, 0.05f };
+
+            for (uint8_t c=0; c<3; ++c) {
+                worst = fmax(worst, fabs(w[c] - expected[c]));
+                worstGradient = fmax(worstGradient, fmax(fabs(dx[c] - gradX[c]), fabs(dy[c] - gradY[c])));
+            }
+        }
+
+        // Outside, the nearest boundary value
+        float w[3], expected[3];
+        double far[3] = { 100, -100, 50 };
+        field.sample(far, 5, w);
+        linear(30, -5, 10, 1, expected);
+        for (uint8_t c=0; c<3; ++c) {
+            worst = fmax(worst, fabs(w[c] - expected[c]));
+        }
+
+        printf("Linear field: worst error %.2e m/s, gradient %.2e 1/s\n", worst, worstGradient);
+        failures += worst > 1e-4 || worstGradient > 1e-4;
+
+        // Batches match single samples
+        std::vector<double> positions(3 * POINTS);
+        std::vector<float> winds(3 * POINTS);
+        for (uint32_t k=0; k<3*POINTS; ++k) {
+            positions[k] = uniform(-12, 32);
+        }
+        field.sample(POINTS, positions.data(), 0.7, winds.data());
+        for (uint32_t k=0; k<POINTS; ++k) {
+            float single[3];
+            field.sample(&positions[3*k], 0.7, single);
+            failures += memcmp(single, &winds[3*k], sizeof(single)) != 0;
+        }
+    }
+
+    // A field larger than the caches, vehicles scattered through it
+    {
+        const uint32_t n[3] = { 256, 256, 32 };
+        const double origin[3] = { -512, -512, -124 };
+        const uint32_t frames = 4;
+
+        WindField field;
+        field.create(path, n, frames, origin, 4, 1, true);
+        std::vector<float> samples(3 * n[0] * n[1] * n[2]);
+        for (size_t k=0; k<samples.size(); ++k) {
+            samples[k] = (float)(k % 7);
+        }
+        for (uint32_t f=0; f<frames; ++f) {
+            field.setFrame(f, samples.data());
+        }
+        field.close();
+        field.load(path);
+
+        std::vector<double> positions(3 * POINTS);
+        std::vector<float> winds(3 * POINTS);
+        for (uint32_t k=0; k<POINTS; ++k) {
+            positions[3*k] = uniform(-512, 508);
+            positions[3*k+1] = uniform(-512, 508);
+            positions[3*k+2] = uniform(-124, 0);
+        }
+
+        // Warm the page cache
+        field.sample(POINTS, positions.data(), 0, winds.data());
+
+        float sink = 0;
+        double t0 = now();
+        for (int r=0; r<REPS; ++r) {
+            for (uint32_t k=0; k<POINTS; ++k) {
+                float w[3];
+                field.sample(&positions[3*k], r * 0.01, w);
+                sink += w[0];
+            }
+        }
+        double single = (now() - t0) / REPS / POINTS;
+
+        t0 = now();
+        for (int r=0; r<REPS; ++r) {
+            field.sample(POINTS, positions.data(), r * 0.01, winds.data());
+            sink += winds[0];
+        }
+        double batched = (now() - t0) / REPS / POINTS;
+
+        printf("%u points in %.0f MB: %.1f ns per single sample, %.1f ns batched (%g)\n", POINTS,
+                field.getHeader().frames * (double)n[0] * n[1] * n[2] * 12 / 1e6, 1e9 * single, 1e9 * batched, sink > 0 ? 1. : 0.);
+    }
+
+    // Hover in a steady 5 m/s wind from the west
+    {
+        const uint32_t n[3] = { 2, 2, 2 };
+        const double origin[3] = { -1000, -1000, -1000 };
+
+        WindField field;
+        field.create(path, n, 1, origin, 2000, 1, false);
+        float samples[24];
+        for (uint8_t k=0; k<8; ++k) {
+            samples[3*k] = 5;
+            samples[3*k+1] = 0;
+            samples[3*k+2] = 0;
+        }
+        field.setFrame(0, samples);
+        field.close();
+        field.load(path);
+
+        MultirotorDynamics::Parameters params(5.30216718361085E-05, 2.23656692806239E-06, 16.47, 0.6, 2, 2, 3, 3.08013E-04, 15000);
+        QuadXAPDynamics quad(&params);
+
+        double rotation[3] = {};
+        quad.init(rotation, true);
+        double start[3] = {};
+        quad.setWind(&field, start);
+        quad.setAgl(100);
+
+        // Just enough thrust to hover
+        double hover = sqrt(params.m * 9.80665 / (4 * params.b)) * 30 / (3.14159 * params.maxrpm);
+        double motors[4] = { hover, hover, hover, hover };
+
+        double t0 = now();
+        for (uint32_t k=0; k<10000; ++k) {
+            quad.setMotors(motors, 0.001);
+            quad.update(0.001);
+        }
+        double step = (now() - t0) / 10000;
+
+        MultirotorDynamics::state_t state = quad.getState();
+        printf("After 10 s: north %.1f m at %.2f m/s, down %.2f m; %.0f ns per step\n",
+                state.pose.location[0], state.inertialVel[0], state.pose.location[2], 1e9 * step);
+
+        // Drag pulls the vehicle up to the wind speed
+        failures += !(state.inertialVel[0] > 4.5 && state.inertialVel[0] <= 5.01);
+    }
+
+    remove(path);
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,164 @@
+/*
+ * Runs the flight loop without the engine, as fast as it will go
+ *
+ * Steps a quad's dynamics and an altitude-holding CascadedController in the same
+ * order as FFlightManager::performTask(), optionally over terrain saved by
+ * the simulator and through wind made by windgen, then reports the steps per
+ * second, the real-time factor, and hardware counters for setMotors(),
+ * update() and the controller where the platform provides them.
+ *
+ * The vehicle's parameters come from the same kind of file the simulator
+ * reads (see ParameterFile), Parameters/Test.txt unless another is given.
+ * The wind field is in world coordinates, so the vehicle meets the same wind
+ * as in the simulator only when given the same start location, as X,Y,Z in
+ * the editor's centimeters; it starts at the world origin otherwise.
+ *
+ * Usage: headless [seconds [terrain [wind [parameters [start]]]]], with - for no terrain or wind
+ * or for the default parameters
+ *
+ * Copyright (C) 2019 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#include <dynamics/QuadXAP.hpp>
+#include <dynamics/ParameterFile.hpp>
+#include <control/CascadedController.hpp>
+#include <dynamics/WindField.hpp>
+#include <PerfCounters.hpp>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+
+static const double DELTA_T  = 0.001;
+static const double ALTITUDE = 10;
+
+static const char * PARAMETERS = "../../Parameters/Test.txt";
+
+static double now(void)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Climbs to ALTITUDE and holds it, level, with no yaw
+static CascadedController makeController(const MultirotorDynamics::Parameters & params)
+{
+    CascadedController::config_t config = {};
+
+    //                 kp     ki     kd     windupMax  outputMax
+    config.altitude = { 1.2,   0,     0,     0,         3 };
+    config.climb    = { 3,     1,     0,     2,         5 };
+    config.angle    = { 5,     0,     0,     0,         4 };
+    config.rate     = { 0.06,  0.02,  0,     0.02,      0.2 };
+    config.heading  = { 2,     0,     0,     0,         1 };
+    config.yawRate  = { 0.3,   0.05,  0,     0.05,      0.2 };
+
+    config.hoverThrottle = CascadedController::hoverThrottle(params, 4);
+
+    CascadedController controller(config, Mixer::quadXAP());
+
+    CascadedController::setpoint_t setpoint = {};
+    setpoint.location[2] = -ALTITUDE;
+
+    controller.setMode(CascadedController::MODE_ALTITUDE);
+    controller.setSetpoint(setpoint);
+
+    return controller;
+}
+
+int main(int argc, char ** argv)
+{
+    const double seconds = argc > 1 ? atof(argv[1]) : 60;
+
+    ParameterFile parameters;
+    if (!parameters.load(argc > 4 && strcmp(argv[4], "-") != 0 ? argv[4] : PARAMETERS)) {
+        fprintf(stderr, "Unable to load parameters: %s\n", parameters.getMessage());
+        return 1;
+    }
+
+    MultirotorDynamics::Parameters params = parameters.get();
+
+    QuadXAPDynamics quad(&params);
+
+    double rotation[3] = {};
+    quad.init(rotation);
+
+    // Optional terrain baked by the simulator, which is relative to the start location like the dynamics
+    Heightfield terrain;
+    if (argc > 2 && strcmp(argv[2], "-") != 0) {
+        if (!terrain.load(argv[2])) {
+            fprintf(stderr, "Unable to load terrain %s\n", argv[2]);
+            return 1;
+        }
+        quad.setTerrain(&terrain);
+    }
+
+    // Optional wind from windgen, placed as Vehicle::loadWind() places it
+    WindField wind;
+    if (argc > 3 && strcmp(argv[3], "-") != 0) {
+        if (!wind.load(argv[3])) {
+            fprintf(stderr, "Unable to load wind %s\n", argv[3]);
+            return 1;
+        }
+
+        double start[3] = {};
+        if (argc > 5 && sscanf(argv[5], "%lf,%lf,%lf", &start[0], &start[1], &start[2]) != 3) {
+            fprintf(stderr, "Start location %s is not X,Y,Z\n", argv[5]);
+            return 1;
+        }
+
+        double origin[3] = { start[0] / 100, start[1] / 100, -start[2] / 100 };  // UE cm forward, right, up => NED m
+        quad.setWind(&wind, origin, 0.3);
+    }
+
+    CascadedController controller = makeController(params);
+
+    PerfCounters counters;
+    counters.open();
+    const uint8_t motorsPhase = counters.addPhase("setMotors");
+    const uint8_t updatePhase = counters.addPhase("update");
+    const uint8_t controllerPhase = counters.addPhase("getMotors");
+
+    double motorvals[4] = {};
+
+    const uint32_t steps = (uint32_t)(seconds / DELTA_T);
+
+    const double start = now();
+
+    for (uint32_t k=0; k<steps; ++k) {
+
+        counters.begin();
+
+        quad.setMotors(motorvals, DELTA_T);
+
+        counters.end(motorsPhase);
+
+        quad.update(DELTA_T);
+
+        counters.end(updatePhase);
+
+        MultirotorDynamics::state_t state = quad.getState();
+
+        // Flat ground at zero when there is no terrain
+        if (!quad.hasTerrainAt(state.pose.location[0], state.pose.location[1])) {
+            quad.setAgl(-state.pose.location[2]);
+        }
+
+        counters.begin();
+
+        controller.update(state, DELTA_T, motorvals);
+
+        counters.end(controllerPhase);
+    }
+
+    const double elapsed = now() - start;
+
+    printf("Simulated %.1f s in %.3f s: %.0f steps per second, %.1f times real time; altitude %.2f m\n",
+            steps * DELTA_T, elapsed, steps / elapsed, steps * DELTA_T / elapsed, -quad.getState().pose.location[2]);
+
+    counters.summarize(stdout);
+
+    return 0;
+}
@@ -1,28 +1,101 @@
-/*
- * Test code for joystick on Linux
- *
- * Copyright (C) 2019 Simon D. Levy
- *
- * MIT License
- */
-
-#include <Joystick.h>
-#include <stdio.h>
-
-int main(int argc, char ** argv)
-{
-    Joystick js;
-    float axes[8] = {0};
-
-    while (true) {
-
-        if (!js.poll(axes)) {
-
-            printf("thr:%+f rol:%+f pit:%+f yaw:%+f aux:%+f\n", axes[0], axes[1], axes[2], axes[3], axes[4]);
-        }
-    }
-
-    return 0;
-}
-
-
+/*
+ * Test code for joystick on Linux
+ *
+ * Prints the axes whenever they change, with the time from the joystick
+ * event to its being read.
+ *
+ * Usage: joytest [-r FILE]      record to FILE
+ *        joytest -p FILE [-f]   play FILE back, in real time or (-f) as fast as possible
+ *
+ * Copyright (C) 2019 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#include <Joystick.h>
+#include <JoystickPlayback.h>
+#include <stdio.h>
+#include <string.h>
+
+int main(int argc, char ** argv)
+{
+    const char * recordPath = NULL;
+    const char * playbackPath = NULL;
+    bool fast = false;
+
+    for (int k=1; k<argc; ++k) {
+        if (!strcmp(argv[k], "-r") && k+1 < argc) {
+            recordPath = argv[++k];
+        }
+        else if (!strcmp(argv[k], "-p") && k+1 < argc) {
+            playbackPath = argv[++k];
+        }
+        else if (!strcmp(argv[k], "-f")) {
+            fast = true;
+        }
+        else {
+            fprintf(stderr, "Usage: %s [-r FILE] | -p FILE [-f]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    JoystickPlayback * playback = playbackPath ? new JoystickPlayback(playbackPath, !fast) : NULL;
+    Joystick * js = playback ? playback : new Joystick();
+
+    float axes[6] = {0};
+    float last[6] = {0};
+
+    if (playback && playback->poll(axes) == Joystick::ERROR_MISSING) {
+        fprintf(stderr, "Unable to play back %s\n", playbackPath);
+        return 1;
+    }
+
+    if (recordPath && !js->startRecording(recordPath)) {
+        fprintf(stderr, "Unable to write %s\n", recordPath);
+        return 1;
+    }
+
+    double latencySum = 0, latencyMax = 0;
+    uint32_t count = 0;
+
+    while (true) {
+
+        if (!js->waitForInput(1.0)) {
+            if (playback && playback->isFinished()) {
+                break;
+            }
+            continue;
+        }
+
+        double eventTime = 0;
+
+        Joystick::error_t status = js->poll(axes, eventTime);
+
+        if (status) {
+            fprintf(stderr, "Joystick error %d\n", status);
+            return 1;
+        }
+
+        if (eventTime < 0 || !memcmp(axes, last, sizeof(axes))) {
+            continue;
+        }
+
+        memcpy(last, axes, sizeof(axes));
+
+        // Playing back as fast as possible, the time is the recorded one
+        double latency = playback && fast ? 0 : Joystick::now() - eventTime;
+        latencySum += latency;
+        latencyMax = latency > latencyMax ? latency : latencyMax;
+        count++;
+
+        printf("thr:%+f rol:%+f pit:%+f yaw:%+f aux1:%+f aux2:%+f  latency:%.3f ms (mean %.3f max %.3f)\n",
+                axes[0], axes[1], axes[2], axes[3], axes[4], axes[5],
+                1e3 * latency, 1e3 * latencySum / count, 1e3 * latencyMax);
+    }
+
+    printf("Played %u inputs over %.1f s\n", count, playback->getDuration());
+
+    delete js;
+
+    return 0;
+}
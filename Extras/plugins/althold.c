@@ -0,0 +1,106 @@
+/*
+ * Example controller plugin: holds altitude with a PID on height
+ *
+ * Build variants with -DKP=... etc. to try new gains while the simulator
+ * runs; they keep the state layout, so a reload carries on with the same
+ * integral.  -DSTATE_VERSION=2 builds a variant with a different layout,
+ * which the host starts with fresh state.
+ *
+ * Copyright (C) 2019 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#include "../../Source/MainModule/control/ControllerPlugin.h"
+
+#ifndef TARGET
+#define TARGET 10   // meters above the start
+#endif
+
+#ifndef KP
+#define KP 0.05
+#endif
+
+#ifndef KI
+#define KI 0.05
+#endif
+
+#ifndef KD
+#define KD 0.1
+#endif
+
+#ifndef STATE_VERSION
+#define STATE_VERSION 1
+#endif
+
+typedef struct {
+
+    double integral;
+    double start;       // NED z where we were first updated
+    uint8_t started;
+
+#if STATE_VERSION > 1
+    double climbRate;   // low-passed, in place of the raw velocity
+#endif
+
+} state_t;
+
+static double clip(double value, double lo, double hi)
+{
+    return value < lo ? lo : value > hi ? hi : value;
+}
+
+static void init(void * state, uint8_t motorCount)
+{
+    (void)state;
+    (void)motorCount;
+}
+
+static void update(void * state, double time, double dt, const controller_plugin_state_t * vehicle,
+        double * motorvals, uint8_t motorCount)
+{
+    state_t * s = (state_t *)state;
+
+    (void)time;
+
+    if (!s->started) {
+        s->start = vehicle->location[2];
+        s->started = 1;
+    }
+
+    // NED: up is negative z
+    const double error = TARGET - (s->start - vehicle->location[2]);
+
+    double climbRate = -vehicle->inertialVel[2];
+
+#if STATE_VERSION > 1
+    s->climbRate += clip(dt / 0.02, 0, 1) * (climbRate - s->climbRate);
+    climbRate = s->climbRate;
+#endif
+
+    s->integral = clip(s->integral + error * dt, -1 / KI, 1 / KI);
+
+    const double throttle = clip(KP * error + KI * s->integral - KD * climbRate, 0, 1);
+
+    for (uint8_t k=0; k<motorCount; ++k) {
+        motorvals[k] = throttle;
+    }
+}
+
+CONTROLLER_PLUGIN_EXPORT const controller_plugin_t * controllerPlugin(void)
+{
+    static const controller_plugin_t plugin = {
+
+#ifdef ABI_VERSION
+        ABI_VERSION,
+#else
+        CONTROLLER_PLUGIN_ABI_VERSION,
+#endif
+        sizeof(state_t),
+        STATE_VERSION,
+        init,
+        update
+    };
+
+    return &plugin;
+}
@@ -0,0 +1,172 @@
+/*
+ * Flies a quad with the example plugin while swapping builds under it
+ *
+ * Loads althold.so from a watched file, then writes other builds over that
+ * file the way a compiler would, checking that
+ *
+ *   - a build with new gains and the same state layout is picked up and
+ *     carries on with the old state (the quad stays at its altitude)
+ *   - a broken file, or a build for another interface version, leaves the
+ *     loaded build flying
+ *   - a build with a new state layout starts with fresh state (it takes the
+ *     current altitude as its start, so the quad climbs again)
+ *
+ * Copyright (C) 2019 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#include <control/PluginController.hpp>
+#include <dynamics/QuadXAP.hpp>
+
+#include <stdio.h>
+#include <string.h>
+
+static const double DELTA_T = 0.001;
+static const char * WATCHED = "watched.so";
+
+static MultirotorDynamics::Parameters params = MultirotorDynamics::Parameters(
+
+        5.30216718361085E-05,   // b
+        2.23656692806239E-06,   // d
+        16.47,                  // m
+        0.6,                    // l
+        2,                      // Ix
+        2,                      // Iy
+        3,                      // Iz
+        3.08013E-04,            // Jr
+        15000                   // maxrpm
+        );
+
+static uint32_t failures = 0;
+
+static void check(bool ok, const char * what, const PluginController & plugin)
+{
+    printf("%-60s %s (%s)\n", what, ok ? "ok" : "FAILED", plugin.getMessage());
+    failures += !ok;
+}
+
+// Writes a file over the watched one in place, as a linker would
+static bool install(const char * from)
+{
+    FILE * in = fopen(from, "rb");
+    FILE * out = fopen(WATCHED, "wb");
+
+    if (!in || !out) {
+        fprintf(stderr, "can't copy %s to %s\n", from, WATCHED);
+        return false;
+    }
+
+    char buf[4096];
+    size_t count = 0;
+
+    while ((count = fread(buf, 1, sizeof(buf), in)) > 0) {
+        fwrite(buf, 1, count, out);
+    }
+
+    fclose(in);
+    fclose(out);
+
+    return true;
+}
+
+static bool garble(void)
+{
+    FILE * out = fopen(WATCHED, "wb");
+
+    if (!out) {
+        return false;
+    }
+
+    fputs("not a shared library\n", out);
+    fclose(out);
+
+    return true;
+}
+
+// Flies for a while, polling as the flight manager does; returns height above the start
+static double fly(QuadXAPDynamics & quad, PluginController & plugin, double seconds, double & time)
+{
+    double motorvals[4] = {};
+
+    for (uint32_t k=0; k<seconds/DELTA_T; ++k) {
+
+        if (k % 500 == 0) {
+            plugin.poll();
+        }
+
+        quad.setMotors(motorvals, DELTA_T);
+        quad.update(DELTA_T);
+        quad.setAgl(100 - quad.getState().pose.location[2]);
+
+        time += DELTA_T;
+
+        if (!plugin.update(time, DELTA_T, quad.getState(), motorvals)) {
+            for (uint8_t j=0; j<4; ++j) {
+                motorvals[j] = 0;
+            }
+        }
+    }
+
+    return -quad.getState().pose.location[2];
+}
+
+// Polls until the new build settles and loads, or gives up
+static bool reload(PluginController & plugin)
+{
+    for (uint8_t k=0; k<3; ++k) {
+        if (plugin.poll()) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+int main(int argc, char ** argv)
+{
+    if (!install("althold.so")) {
+        return 1;
+    }
+
+    QuadXAPDynamics quad(&params);
+    double rotation[3] = {};
+    quad.init(rotation, true);
+
+    PluginController plugin(4);
+    double time = 0;
+
+    check(plugin.load(WATCHED), "Load", plugin);
+
+    double height = fly(quad, plugin, 30, time);
+    check(fabs(height - 10) < 0.1, "Climb to 10 m", plugin);
+
+    install("althold-stiff.so");
+    const bool reloaded = reload(plugin);
+    height = fly(quad, plugin, 10, time);
+    check(reloaded && strstr(plugin.getMessage(), "keeping") && fabs(height - 10) < 0.1,
+            "Reload new gains, keep state, stay at 10 m", plugin);
+
+    garble();
+    const bool garbled = reload(plugin);
+    height = fly(quad, plugin, 5, time);
+    check(!garbled && plugin.isLoaded() && fabs(height - 10) < 0.1, "Broken file leaves old build flying", plugin);
+
+    install("althold-abi.so");
+    const bool mismatched = reload(plugin);
+    height = fly(quad, plugin, 5, time);
+    check(!mismatched && plugin.isLoaded() && fabs(height - 10) < 0.1,
+            "Wrong interface version leaves old build flying", plugin);
+
+    install("althold-v2.so");
+    const bool fresh = reload(plugin);
+    height = fly(quad, plugin, 30, time);
+    check(fresh && strstr(plugin.getMessage(), "fresh") && fabs(height - 20) < 0.1,
+            "New state layout starts fresh, climbs another 10 m", plugin);
+
+    check(plugin.getReloads() == 2, "Two reloads", plugin);
+
+    remove(WATCHED);
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,91 @@
+#!/usr/bin/env python3
+'''
+Receive frames streamed by a MulticopterSim StreamingCamera over TCP
+
+Decoding LZ4 frames needs the lz4 package; JPEG frames and display need OpenCV.
+
+Copyright (C) 2019 Simon D. Levy
+
+MIT License
+'''
+
+import socket
+import struct
+import argparse
+import numpy as np
+
+HEADER = struct.Struct('<IIdHHBBBBI')
+MAGIC = 0x4d49534d
+
+ENCODING_RAW, ENCODING_RLE, ENCODING_LZ4, ENCODING_JPEG = range(4)
+
+
+def recvall(sock, size):
+    data = bytearray()
+    while len(data) < size:
+        chunk = sock.recv(size - len(data))
+        if not chunk:
+            raise ConnectionError('stream closed')
+        data += chunk
+    return bytes(data)
+
+
+def rle_decode(payload, pixelsize, size):
+    out = bytearray()
+    k = 0
+    while k < len(payload):
+        c = payload[k]
+        k += 1
+        count = (c & 0x7f) + 1
+        if c & 0x80:
+            out += payload[k:k+pixelsize] * count
+            k += pixelsize
+        else:
+            out += payload[k:k+count*pixelsize]
+            k += count*pixelsize
+    return bytes(out[:size])
+
+
+def decode(encoding, payload, rows, cols, channels):
+    size = rows * cols * channels
+    if encoding == ENCODING_RAW:
+        pixels = payload
+    elif encoding == ENCODING_RLE:
+        pixels = rle_decode(payload, channels, size)
+    elif encoding == ENCODING_LZ4:
+        import lz4.block
+        pixels = lz4.block.decompress(payload, uncompressed_size=size)
+    else:
+        import cv2
+        return cv2.imdecode(np.frombuffer(payload, np.uint8), cv2.IMREAD_COLOR)
+    return np.frombuffer(pixels, np.uint8).reshape((rows, cols, channels))
+
+
+if __name__ == '__main__':
+
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--host', default='127.0.0.1')
+    parser.add_argument('--port', type=int, default=5002)
+    parser.add_argument('--show', action='store_true', help='display frames with OpenCV')
+    args = parser.parse_args()
+
+    sock = socket.create_connection((args.host, args.port))
+
+    while True:
+
+        magic, frameid, timestamp, cols, rows, channels, encoding, camera, _, size = \
+            HEADER.unpack(recvall(sock, HEADER.size))
+
+        if magic != MAGIC:
+            raise ValueError('bad frame header')
+
+        image = decode(encoding, recvall(sock, size), rows, cols, channels)
+
+        print('camera %d frame %6d  t=%10.4f  %dx%dx%d  %7d bytes' %
+              (camera, frameid, timestamp, cols, rows, channels, size))
+
+        if args.show:
+            import cv2
+            cv2.imshow('MulticopterSim', image)
+            if cv2.waitKey(1) == 27:
+                break
@@ -1,47 +1,67 @@
 /*
    UDP proxy for testing MulticopterSim socket comms
 
+   Usage: simproxy [terrain [parameters]], with - for no terrain.  The
+   parameter file (Parameters/Test.txt unless another is given) is read
+   again whenever it changes, and takes effect at the next step.
+
    Copyright(C) 2019 Simon D.Levy
 
    MIT License
  */
 
 #include <stdio.h>
+#include <string.h>
 #include "../sockets/TwoWayUdp.hpp"
 #include <dynamics/QuadXAP.hpp>
+#include <dynamics/ParameterFile.hpp>
 
 static const char * HOST           = "127.0.0.1";
 static const short  MOTOR_PORT     = 5000;
 static const short  TELEM_PORT     = 5001;
 static const double DELTA_T        = 0.001;
+static const char * PARAMETERS     = "../../Parameters/Test.txt";
 
-static MultirotorDynamics::Parameters params = MultirotorDynamics::Parameters(
-
-        5.30216718361085E-05,   // b
-        2.23656692806239E-06,   // d
-        16.47,                  // m
-        0.6,                    // l
-        2,                      // Ix
-        2,                      // Iy
-        3,                      // Iz
-        3.08013E-04,            // Jr
-        15000                   // maxrpm
-        );
+// Simulated seconds between looks at the parameter file
+static const double POLL_PERIOD    = 1.0;
 
 
 int main(int argc, char ** argv)
 {
+    // Optional terrain baked by the simulator, for the same ground contact as in the engine
+    Heightfield terrain;
+    if (argc > 1 && strcmp(argv[1], "-") != 0) {
+        if (!terrain.load(argv[1])) {
+            fprintf(stderr, "Unable to load terrain %s\n", argv[1]);
+            return 1;
+        }
+    }
+
+    ParameterFile parameters;
+    if (!parameters.load(argc > 2 ? argv[2] : PARAMETERS)) {
+        fprintf(stderr, "Unable to load parameters: %s\n", parameters.getMessage());
+        return 1;
+    }
+
     while (true) {
 
         TwoWayUdp twoWayUdp = TwoWayUdp(HOST, TELEM_PORT, MOTOR_PORT);
 
-        QuadXAPDynamics quad = QuadXAPDynamics(&params);
+        MultirotorDynamics::Parameters params = parameters.get();
+
+        QuadXAPDynamics quad(&params);
+
+        double pollTime = 0;
 
         double time = 0;
 
-        MultirotorDynamics::pose_t pose = {};
+        double rotation[3] = {};
 
-        quad.init(pose);
+        quad.init(rotation);
+
+        if (terrain.isValid()) {
+            quad.setTerrain(&terrain);
+        }
 
         while (true) {
 
@@ -65,11 +85,21 @@ int main(int argc, char ** argv)
             printf("t=%05f   m=%f %f %f %f  z=%+3.3f\n", 
                     time, motorvals[0], motorvals[1], motorvals[2], motorvals[3], state.pose.location[2]);
 
-            quad.setMotors(motorvals);
+            quad.setMotors(motorvals, DELTA_T);
 
             quad.update(DELTA_T);
 
             time += DELTA_T;
+
+            if (time - pollTime >= POLL_PERIOD) {
+                pollTime = time;
+                if (parameters.poll()) {
+                    if (parameters.isValid()) {
+                        quad.setParameters(parameters.get());
+                    }
+                    fprintf(stderr, "%s\n", parameters.getMessage());
+                }
+            }
         }
 
     } while (true)
@@ -16,11 +16,22 @@ static void closesocket(int socket) { close(socket); }
 
 class TcpServerSocket : public TcpSocket {
 
+    private:
+
+        bool _listening = false;
+
     public:
 
         TcpServerSocket(const char * host, short port)
             : TcpSocket(host, port)        
         {
+            // The address didn't resolve or there's no socket; the message says why
+            if (_sock == INVALID_SOCKET) return;
+
+            // Allow rebinding right after a previous session closed
+            int reuse = 1;
+            setsockopt(_sock, SOL_SOCKET, SO_REUSEADDR, (const char *)&reuse, sizeof(reuse));
+
             // Bind socket to address
             if (bind(_sock, _addressInfo->ai_addr, (int)_addressInfo->ai_addrlen) == SOCKET_ERROR) {
                 closesocket(_sock);
@@ -49,4 +60,58 @@ class TcpServerSocket : public TcpSocket {
             printf("connected\n");
             fflush(stdout);
         }
+
+        // Queues clients that connect before the first acceptConnection(timeoutMsec)
+        bool startListening(void)
+        {
+            if (_sock == INVALID_SOCKET) return false;
+
+            if (!_listening) {
+                if (listen(_sock, 1) == -1) {
+                    sprintf_s(_message, "listen() failed");
+                    return false;
+                }
+                _listening = true;
+            }
+
+            return true;
+        }
+
+        // Waits up to timeoutMsec for a client, returning true if one connected.
+        // Lets a worker thread poll for clients without blocking shutdown.
+        bool acceptConnection(uint32_t timeoutMsec)
+        {
+            if (!startListening()) return false;
+
+            fd_set readfds;
+            FD_ZERO(&readfds);
+            FD_SET(_sock, &readfds);
+
+            struct timeval timeout;
+            timeout.tv_sec = timeoutMsec / 1000;
+            timeout.tv_usec = (timeoutMsec % 1000) * 1000;
+
+            if (select((int)_sock+1, &readfds, NULL, NULL, &timeout) <= 0) {
+                return false;
+            }
+
+            _conn = accept(_sock, (struct sockaddr *)NULL, NULL);
+            if (_conn == INVALID_SOCKET) {
+                sprintf_s(_message, "accept() failed");
+                return false;
+            }
+
+            _connected = true;
+
+            return true;
+        }
+
+        // Drops the current client so another one can connect
+        void closeClient(void)
+        {
+            if (_connected) {
+                closesocket(_conn);
+                _connected = false;
+            }
+        }
 };
@@ -26,7 +26,7 @@ class TcpSocket : public Socket {
         TcpSocket(const char * host, const short port)
         {
             sprintf_s(_host, "%s", host);
-            sprintf_s(_port, "%d", port);
+            sprintf_s(_port, "%u", (unsigned short)port);    // ports above 32767 arrive negative
 
             // No connection yet
             _sock = INVALID_SOCKET;
@@ -63,7 +63,13 @@ class TcpSocket : public Socket {
 
         bool sendData(void *buf, size_t len)
         {
-            return (size_t)send(_conn, (const char *)buf, len, 0) == len;
+            // Report a vanished peer as a failed send rather than a SIGPIPE
+#ifdef MSG_NOSIGNAL
+            int flags = MSG_NOSIGNAL;
+#else
+            int flags = 0;
+#endif
+            return (size_t)send(_conn, (const char *)buf, len, flags) == len;
         }
 
 
@@ -71,6 +77,27 @@ class TcpSocket : public Socket {
         {
             return (size_t)recv(_conn, (char *)buf, len, 0) == len;
         }
+
+        // Receives whatever has arrived, up to len bytes, waiting up to timeoutMsec for something;
+        // returns the number of bytes, zero on timeout or a closed connection, or -1 on error
+        int receiveAvailable(void *buf, size_t len, uint32_t timeoutMsec)
+        {
+            fd_set readfds;
+            FD_ZERO(&readfds);
+            FD_SET(_conn, &readfds);
+
+            struct timeval timeout;
+            timeout.tv_sec = timeoutMsec / 1000;
+            timeout.tv_usec = (timeoutMsec % 1000) * 1000;
+
+            int ready = select((int)_conn+1, &readfds, NULL, NULL, &timeout);
+
+            if (ready <= 0) {
+                return ready;
+            }
+
+            return (int)recv(_conn, (char *)buf, (int)len, 0);
+        }
         bool isConnected()
         {
             return _connected;
@@ -26,10 +26,9 @@ class UdpSocket : public Socket {
 
     public:
 
-        void sendData(void * buf, size_t len)
+        bool sendData(void * buf, size_t len)
         {
-            sendto(_sock, (const char *)buf, (int)len, 0, (struct sockaddr *) &_si_other, (int)_slen);
-
+            return sendto(_sock, (const char *)buf, (int)len, 0, (struct sockaddr *) &_si_other, (int)_slen) == (RECVSIZE)len;
         }
 
         bool receiveData(void * buf, size_t len)
@@ -0,0 +1,135 @@
+/*
+ * Generates a turbulent wind field for WindField
+ *
+ * Turbulence is white noise filtered along x, y, and z by a first-order
+ * (Dryden-like) filter, giving a correlation that falls off exponentially
+ * with distance, and carried from frame to frame by the same filter in time,
+ * with the time constant given by the mean wind crossing one length scale.
+ * The field is written one frame at a time, so only two frames are ever in
+ * memory.
+ *
+ * Copyright (C) 2019 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#include <dynamics/WindField.hpp>
+#include <sensors/Philox.hpp>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+// First-order filter along one axis of a volume of vectors, leaving unit variance
+static void filter(float * field, const uint32_t n[3], uint8_t axis, float a)
+{
+    const size_t stride[3] = { 3, 3 * (size_t)n[0], 3 * (size_t)n[0] * n[1] };
+    const float b = sqrtf(1 - a*a);
+
+    // Every line along the axis
+    const uint8_t u = axis == 0 ? 1 : 0;
+    const uint8_t v = axis == 2 ? 1 : 2;
+
+    for (uint32_t j=0; j<n[v]; ++j) {
+        for (uint32_t i=0; i<n[u]; ++i) {
+
+            float * p = field + i*stride[u] + j*stride[v];
+
+            for (uint32_t k=1; k<n[axis]; ++k) {
+                float * q = p + k*stride[axis];
+                for (uint8_t c=0; c<3; ++c) {
+                    q[c] = a * (q - stride[axis])[c] + b * q[c];
+                }
+            }
+        }
+    }
+}
+
+int main(int argc, char ** argv)
+{
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s FILE [nx ny nz frames spacing timestep speed fromdegrees sigmaxy sigmaz length seed]\n", argv[0]);
+        return 1;
+    }
+
+    double arg[12] = { 64, 64, 16, 60, 4, 0.5, 5, 270, 1.5, 0.7, 30, 0 };
+    for (int k=2; k<argc && k<14; ++k) {
+        arg[k-2] = atof(argv[k]);
+    }
+
+    const uint32_t n[3] = { (uint32_t)arg[0], (uint32_t)arg[1], (uint32_t)arg[2] };
+    const uint32_t frames = (uint32_t)arg[3];
+    const double spacing = arg[4];
+    const double timeStep = arg[5];
+    const double speed = arg[6];
+    const double from = arg[7] * M_PI / 180;
+    const float sigma[3] = { (float)arg[8], (float)arg[8], (float)arg[9] };
+    const double length = arg[10];
+    const uint64_t seed = (uint64_t)arg[11];
+
+    // Centered on the world origin, from the ground up
+    const double origin[3] = { -(n[0] - 1) * spacing / 2, -(n[1] - 1) * spacing / 2, -(double)(n[2] - 1) * spacing };
+
+    WindField wind;
+    if (!wind.create(argv[1], n, frames, origin, spacing, timeStep, false)) {
+        fprintf(stderr, "Unable to create %s\n", argv[1]);
+        return 1;
+    }
+
+    const size_t count = 3 * (size_t)n[0] * n[1] * n[2];
+
+    std::vector<float> turbulence(count), fresh(count), samples(count);
+
+    const uint32_t key[2] = { (uint32_t)seed, (uint32_t)(seed >> 32) };
+
+    const float spatial = (float)exp(-spacing / length);
+    const float temporal = (float)exp(-timeStep * (speed > 1 ? speed : 1) / length);
+
+    // Blowing from the given direction
+    const float mean[3] = { (float)(-speed * cos(from)), (float)(-speed * sin(from)), 0 };
+
+    for (uint32_t f=0; f<frames; ++f) {
+
+        // White noise, row by row
+        const uint32_t row = 3 * n[0];
+        std::vector<uint32_t> counters((row + 7) / 8 * 8), words(counters.size());
+        std::vector<float> normals(counters.size());
+
+        for (uint32_t z=0; z<n[2]; ++z) {
+            for (uint32_t y=0; y<n[1]; ++y) {
+
+                for (uint32_t b=0; b<counters.size()/4; ++b) {
+                    counters[4*b] = f;
+                    counters[4*b+1] = z;
+                    counters[4*b+2] = y;
+                    counters[4*b+3] = b;
+                }
+
+                Philox::generate(counters.data(), key, words.data(), (uint32_t)counters.size() / 4);
+                Philox::normals(words.data(), normals.data(), (uint32_t)counters.size());
+
+                memcpy(&fresh[((size_t)z*n[1] + y) * row], normals.data(), row * sizeof(float));
+            }
+        }
+
+        for (uint8_t axis=0; axis<3; ++axis) {
+            filter(fresh.data(), n, axis, spatial);
+        }
+
+        // Carry the turbulence on from the last frame
+        const float a = f ? temporal : 0;
+        const float b = sqrtf(1 - a*a);
+        for (size_t k=0; k<count; ++k) {
+            turbulence[k] = a * turbulence[k] + b * fresh[k];
+            samples[k] = mean[k%3] + sigma[k%3] * turbulence[k];
+        }
+
+        wind.setFrame(f, samples.data());
+    }
+
+    wind.close();
+
+    printf("Wrote %ux%ux%u nodes x %u frames to %s\n", n[0], n[1], n[2], frames, argv[1]);
+
+    return 0;
+}
@@ -9,6 +9,8 @@
 #pragma once
 
 #include "Utils.hpp"
+#include "dynamics/MultirotorDynamics.hpp"
+#include "Trace.hpp"
 
 class Camera {
 
@@ -38,8 +40,12 @@ class Camera {
 
         Resolution_t _res;
 
-        // Byte array for RGBA image
-        uint8_t * _imageBytes = NULL;
+        // Pixels read from the render target; kept across frames to avoid reallocating
+        TArray<FColor> _renderTargetPixels;
+
+        // Time at which the current pixels were read, and vehicle pose at that time
+        double _timestamp = 0;
+        MultirotorDynamics::pose_t _pose = {};
 
     protected:
 
@@ -50,6 +56,9 @@ class Camera {
         // Initial FOV can be overridden by setFov()
         float    _fov  = 0;
 
+        // Index of this camera on its vehicle, set in addToVehicle()
+        uint8_t  _id = 0;
+
         // UE4 resources, set in Vehicle::addCamera()
         USceneCaptureComponent2D * _captureComponent = NULL;
         UCameraComponent         * _cameraComponent = NULL;
@@ -65,9 +74,6 @@ class Camera {
             _res  = resolution;
             _fov = fov;
 
-            // Create a byte array sufficient to hold the RGBA image
-            _imageBytes = new uint8_t [_rows*_cols*4]();
-
             // These will be set in Vehicle::addCamera()
             _captureComponent = NULL;
             _cameraComponent = NULL;
@@ -123,6 +129,8 @@ class Camera {
 
             UTextureRenderTarget2D * textureRenderTarget2D = cameraTextureObjects[_res][id].Object;
 
+            _id = id;
+
             _cameraComponent = pawn->CreateDefaultSubobject<UCameraComponent >(makeName("Camera", id));
             _cameraComponent->SetWorldScale3D(FVector(0.1,0.1,0.1));
             _cameraComponent->SetupAttachment(springArm, USpringArmComponent::SocketName);
@@ -143,7 +151,12 @@ class Camera {
             setFov(_fov);
         }
 
-        // Override this method for your video application
+        // Override this method for your video application.  Bytes are the
+        // render-target pixels in FColor (BGRA) order and are only valid for
+        // the duration of the call.  When the vehicle processes cameras in
+        // parallel this runs on a task-graph worker, so it must not touch
+        // UObjects; getTimestamp() and getPose() give the time the pixels
+        // were read and the vehicle pose at that time.
         virtual void processImageBytes(uint8_t * bytes) { (void)bytes; }
 
         // Sets current FOV
@@ -155,22 +168,45 @@ class Camera {
     public:
 
         // Called on main thread
-        void grabImage(void)
+        void grabImage(double timestamp, const MultirotorDynamics::pose_t & pose)
+        {
+            readPixels(timestamp, pose);
+
+            processPixels();
+        }
+
+        // Called on main thread: reads the pixels from the RenderTarget and stamps them
+        void readPixels(double timestamp, const MultirotorDynamics::pose_t & pose)
+        {
+            Trace::Scope scope("Camera::readPixels");
+
+            _renderTarget->ReadPixels(_renderTargetPixels);
+
+            _timestamp = timestamp;
+            _pose = pose;
+        }
+
+        // Can be called on any thread once readPixels() has returned
+        void processPixels(void)
         {
-            // Read the pixels from the RenderTarget
-            TArray<FColor> renderTargetPixels;
-            _renderTarget->ReadPixels(renderTargetPixels);
+            Trace::Scope scope("Camera::processPixels");
 
-            // Copy the RBGA pixels to the private image
-            FMemory::Memcpy(_imageBytes, renderTargetPixels.GetData(), _rows*_cols*4);
+            // Virtual method implemented in subclass, reading the pixels in place
+            processImageBytes((uint8_t *)_renderTargetPixels.GetData());
+        }
 
-            // Virtual method implemented in subclass
-            processImageBytes(_imageBytes);
+        double getTimestamp(void)
+        {
+            return _timestamp;
+        }
+
+        const MultirotorDynamics::pose_t & getPose(void)
+        {
+            return _pose;
         }
 
         virtual ~Camera()
         {
-            delete _imageBytes;
         }
 
 }; // Class Camera
@@ -0,0 +1,106 @@
+/*
+ * Tells when a watched file has changed and then stopped changing
+ *
+ * poll() reports a change only once the file's size and modification time
+ * are the same on two calls in a row, so a file that an editor or a linker
+ * is still writing is left alone until it is done.  Has no engine
+ * dependencies, so headless tools can use it too.
+ *
+ * Copyright (C) 2019 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+class FileWatcher {
+
+    private:
+
+        // Size and modification time, to tell when the file has changed
+        typedef struct {
+
+            int64_t size;
+            int64_t time;
+
+        } stamp_t;
+
+        // The file as we last handled it, and as we last saw it
+        stamp_t _handledStamp = {};
+        stamp_t _seenStamp = {};
+
+        static bool getStamp(const char * path, stamp_t & stamp)
+        {
+            struct stat info;
+
+            if (stat(path, &info) != 0) {
+                return false;
+            }
+
+            stamp.size = (int64_t)info.st_size;
+#ifdef __linux__
+            stamp.time = (int64_t)info.st_mtim.tv_sec * 1000000000 + info.st_mtim.tv_nsec;
+#else
+            stamp.time = (int64_t)info.st_mtime;
+#endif
+            return true;
+        }
+
+        static bool sameStamp(const stamp_t & a, const stamp_t & b)
+        {
+            return a.size == b.size && a.time == b.time;
+        }
+
+    public:
+
+        /**
+         * Starts watching a file, counting it as handled as it is now.
+         *
+         * @param path file
+         * @return false if the file can't be found; poll() reports it once it appears
+         */
+        bool watch(const char * path)
+        {
+            stamp_t none = {};
+            _seenStamp = none;
+
+            const bool found = getStamp(path, _seenStamp);
+
+            _handledStamp = _seenStamp;
+
+            return found;
+        }
+
+        /**
+         * Checks whether the file has changed since it was last handled and then stayed the same
+         * since the last call.  If so, it counts as handled from now on, whatever the caller makes of it.
+         *
+         * @param path the file given to watch()
+         * @return true if the caller should read the file again
+         */
+        bool poll(const char * path)
+        {
+            stamp_t stamp = {};
+
+            if (!getStamp(path, stamp)) {
+                return false;
+            }
+
+            const bool settled = sameStamp(stamp, _seenStamp);
+
+            _seenStamp = stamp;
+
+            if (!settled || sameStamp(stamp, _handledStamp)) {
+                return false;
+            }
+
+            _handledStamp = stamp;
+
+            return true;
+        }
+
+}; // class FileWatcher
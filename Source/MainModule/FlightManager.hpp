@@ -10,6 +10,13 @@
 
 #include "dynamics/MultirotorDynamics.hpp"
 #include "ThreadedManager.hpp"
+#include "StateHistory.hpp"
+#include "sensors/SensorSuite.hpp"
+#include "Metrics.hpp"
+#include "Trace.hpp"
+#include "PerfCounters.hpp"
+
+#include <atomic>
 
 class FFlightManager : public FThreadedManager {
 
@@ -23,6 +30,58 @@ class FFlightManager : public FThreadedManager {
 
         bool _running = false;
 
+        // States published for rendering; decimated so the ring covers a useful span of time
+        static constexpr double HISTORY_PERIOD = 0.0005;
+        StateHistory _history;
+        double _historyTime = -1;
+
+        // Optional sensor models between the dynamics and the controller; the flight thread is already running
+        // when they are set, so the index is written first and the models published after it
+        std::atomic<SensorSuite *> _sensors;
+        std::atomic<uint32_t> _sensorIndex;
+        SensorSuite::reading_t _reading = {};
+        MultirotorDynamics::state_t _measured = {};
+
+        // Health metrics, summed over all vehicles
+        Metrics::Counter _stepsMetric;
+        Metrics::Histogram _dtMetric;
+
+        // Optional hardware counters around the phases of performTask(), counting the thread that opened them
+        std::atomic<bool> _countersRequested;
+        PerfCounters * _counters = NULL;
+        uint32 _countersThread = 0;
+        uint8_t _motorsPhase = 0;
+        uint8_t _updatePhase = 0;
+        uint8_t _controllerPhase = 0;
+
+        // True if this step should be counted
+        bool startCounters(void)
+        {
+            if (!_countersRequested.load(std::memory_order_acquire)) {
+                return false;
+            }
+
+            if (!_counters) {
+                _counters = new PerfCounters();
+                _motorsPhase = _counters->addPhase("setMotors");
+                _updatePhase = _counters->addPhase("update");
+                _controllerPhase = _counters->addPhase("getMotors");
+                _countersThread = FPlatformTLS::GetCurrentThreadId();
+                if (!_counters->open()) {
+                    MCS_DEBUG("%s", _counters->getMessage());
+                }
+            }
+
+            // In the pool another worker can run us; its steps aren't on our counters
+            if (!_counters->isOpen() || FPlatformTLS::GetCurrentThreadId() != _countersThread) {
+                return false;
+            }
+
+            _counters->begin();
+
+            return true;
+        }
+
         /**
          * Flight-control method running repeatedly on its own thread.  
          * Override this method to implement your own flight controller.
@@ -42,9 +101,9 @@ class FFlightManager : public FThreadedManager {
 
         MultirotorDynamics::state_t _state = {};
 
-        // Constructor, called main thread
-        FFlightManager(MultirotorDynamics * dynamics) 
-            : FThreadedManager()
+        // Constructor, called main thread; rate applies when managers share the pool
+        FFlightManager(MultirotorDynamics * dynamics, double rate=1000) 
+            : FThreadedManager(rate), _sensors(NULL), _sensorIndex(0), _countersRequested(false)
         {
             // Allocate array for motor values
             _motorvals = new double[dynamics->motorCount()]();
@@ -59,6 +118,16 @@ class FFlightManager : public FThreadedManager {
             _previousTime = 0;
 
             _running = true;
+
+            static const double DT_BOUNDS[] = { 0.0005, 0.001, 0.002, 0.005, 0.01, 0.02, 0.05, 0.1, 0.5 };
+
+            Metrics & metrics = Metrics::get();
+            _stepsMetric = metrics.counter("multicopter_physics_steps_total", "Dynamics updates by flight managers");
+            _dtMetric = metrics.histogram("multicopter_physics_dt_seconds", "Simulated time between dynamics updates",
+                    DT_BOUNDS, sizeof(DT_BOUNDS) / sizeof(double));
+
+            // The first vehicle's physics steps a stepped simulation clock
+            driveClock();
         }
 
         // Called repeatedly on worker thread to compute dynamics and run flight controller (PID)
@@ -66,24 +135,59 @@ class FFlightManager : public FThreadedManager {
         {
             if (!_running) return;
 
+            Trace::Scope scope("FFlightManager::performTask");
+
             // Compute time deltay in seconds
 			double dt = currentTime - _previousTime;
 
+            const bool counting = startCounters();
+
             // Send current motor values and time delay to dynamics
             _dynamics->setMotors(_motorvals, dt);
 
+            if (counting) _counters->end(_motorsPhase);
+
             // Update dynamics
             _dynamics->update(dt);
 
+            if (counting) _counters->end(_updatePhase);
+
             // Get new vehicle state
             _state = _dynamics->getState();
 
+            // Publish it for the game thread
+            if (currentTime - _historyTime >= HISTORY_PERIOD) {
+                _history.publish(currentTime, _state);
+                _historyTime = currentTime;
+            }
+
+            // Pass the state through the sensors if we have them
+            SensorSuite * sensors = _sensors.load(std::memory_order_acquire);
+            if (sensors) {
+                sensors->update(_sensorIndex.load(std::memory_order_relaxed), 1, currentTime, &_state, &_reading);
+                SensorSuite::toState(_state, _reading, _measured);
+            }
+
             // PID controller: update the flight manager (e.g., HackflightManager) with
             // the dynamics state, getting back the motor values
-            this->getMotors(currentTime, _state, _motorvals);
+            {
+                Trace::Scope controllerScope("FFlightManager::getMotors");
+                if (counting) _counters->begin();
+                this->getMotors(currentTime, sensors ? _measured : _state, _motorvals);
+                if (counting) _counters->end(_controllerPhase);
+            }
 
             // Track previous time for deltaT
             _previousTime = currentTime;
+
+            _stepsMetric.increment();
+            _dtMetric.observe(dt);
+        }
+
+        // Latest raw sensor readings, for controllers that want reading times or GPS altitude
+        const SensorSuite::reading_t & getSensorReading(void)
+        {
+            return _reading;
         }
 
         // Supports subclasses that might need direct access to dynamics state vector
@@ -98,6 +202,7 @@ class FFlightManager : public FThreadedManager {
 
         ~FFlightManager(void)
         {
+            delete _counters;
         }
 
         // Called by VehiclePawn::Tick() method to propeller animation/sound (motorvals)
@@ -109,6 +214,40 @@ class FFlightManager : public FThreadedManager {
             }
         }
 
+        // Timestamped states, on the clock returned by getCurrentTime()
+        const StateHistory & getHistory(void)
+        {
+            return _history;
+        }
+
+        /**
+         * Feeds the controller through sensor models instead of ground truth, from the next step on.
+         * Call it once per vehicle; vehicles can share a SensorSuite as long as each has its own index.
+         *
+         * @param sensors models, or NULL for ground truth
+         * @param index this vehicle's index in the models
+         */
+        void setSensors(SensorSuite * sensors, uint32_t index)
+        {
+            _sensorIndex.store(index, std::memory_order_relaxed);
+            _sensors.store(sensors, std::memory_order_release);
+        }
+
+        /**
+         * Counts cycles, instructions, cache misses and branch misses in setMotors(), update() and
+         * getMotors(), where the platform allows, from the next step on.
+         */
+        void setPerfCounters(bool enabled)
+        {
+            _countersRequested.store(enabled, std::memory_order_release);
+        }
+
+        // Counters so far, or NULL if not requested or not yet opened; read them after stop()
+        const PerfCounters * getPerfCounters(void)
+        {
+            return _counters;
+        }
+
         void stop(void)
         {
             _running = false;
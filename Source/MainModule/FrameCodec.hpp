@@ -0,0 +1,355 @@
+/*
+ * Lightweight frame encodings for streaming and recording camera images
+ *
+ * RAW sends the pixels as they are, RLE collapses runs of identical pixels,
+ * and LZ4 produces a standard LZ4 block that any LZ4 library can decode.
+ * Encoders keep their working state in the object, so a codec allocates
+ * nothing per frame.
+ *
+ * Copyright (C) 2019 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+class FrameCodec {
+
+    public:
+
+        typedef enum {
+
+            ENCODING_RAW,
+            ENCODING_RLE,
+            ENCODING_LZ4,
+            ENCODING_JPEG    // produced by the engine's image wrapper, not by this class
+
+        } Encoding_t;
+
+        // Header preceding every encoded frame on the wire and on disk
+#pragma pack(push, 1)
+        typedef struct {
+
+            uint32_t magic;
+            uint32_t frameId;
+            double   timestamp;
+            uint16_t cols;
+            uint16_t rows;
+            uint8_t  channels;
+            uint8_t  encoding;
+            uint8_t  cameraId;
+            uint8_t  reserved;
+            uint32_t size;      // encoded payload bytes following the header
+
+        } header_t;
+#pragma pack(pop)
+
+        static const uint32_t MAGIC = 0x4d49534d; // "MSIM"
+
+        /**
+         * Worst-case encoded size for a frame of the given size, whatever the encoding.
+         *
+         * @param size bytes of pixels
+         * @param pixelSize bytes per pixel; RLE's worst case grows as pixels get smaller
+         */
+        static size_t maxEncodedSize(size_t size, uint8_t pixelSize=1)
+        {
+            // RLE can need a control byte for every pixel: a lone literal between runs of two
+            // takes four bytes for three one-byte pixels, and never more than one per pixel
+            const size_t rle = size + (size + pixelSize - 1) / pixelSize;
+
+            // LZ4 adds a length byte per 255 literals, plus a token and the end of the block
+            const size_t lz4 = size + size/255 + 16;
+
+            return (rle > lz4 ? rle : lz4) + 64;
+        }
+
+        /**
+         * Encodes a frame.
+         *
+         * @param encoding RAW, RLE or LZ4
+         * @param src pixels
+         * @param size bytes of pixels
+         * @param pixelSize bytes per pixel, used by RLE
+         * @param dst output buffer of at least maxEncodedSize(size, pixelSize) bytes
+         * @return encoded size, or 0 for an unsupported encoding
+         */
+        size_t encode(Encoding_t encoding, const uint8_t * src, size_t size, uint8_t pixelSize, uint8_t * dst)
+        {
+            switch (encoding) {
+
+                case ENCODING_RAW:
+                    // memcpy() may not be passed the null pointer of an empty frame, even to copy nothing
+                    if (size > 0) memcpy(dst, src, size);
+                    return size;
+
+                case ENCODING_RLE:
+                    return rleEncode(src, size, pixelSize, dst);
+
+                case ENCODING_LZ4:
+                    return lz4Encode(src, size, dst);
+
+                default:
+                    return 0;
+            }
+        }
+
+        /**
+         * Decodes a frame produced by encode().
+         *
+         * @return decoded size, or 0 if the input is malformed or does not fit
+         */
+        static size_t decode(Encoding_t encoding, const uint8_t * src, size_t size, uint8_t pixelSize, uint8_t * dst, size_t capacity)
+        {
+            switch (encoding) {
+
+                case ENCODING_RAW:
+                    if (size > capacity) return 0;
+                    memcpy(dst, src, size);
+                    return size;
+
+                case ENCODING_RLE:
+                    return rleDecode(src, size, pixelSize, dst, capacity);
+
+                case ENCODING_LZ4:
+                    return lz4Decode(src, size, dst, capacity);
+
+                default:
+                    return 0;
+            }
+        }
+
+    private:
+
+        static const uint8_t  HASH_LOG  = 14;
+        static const uint32_t MAX_OFFSET = 65535;
+
+        // LZ4 match finder: position+1 of the last occurrence of each hashed 4-byte sequence
+        uint32_t _hashTable[1<<HASH_LOG] = {};
+
+        static uint32_t read32(const uint8_t * p)
+        {
+            uint32_t v;
+            memcpy(&v, p, 4);
+            return v;
+        }
+
+        static uint8_t * writeLength(uint8_t * op, size_t len)
+        {
+            while (len >= 255) {
+                *op++ = 255;
+                len -= 255;
+            }
+            *op++ = (uint8_t)len;
+            return op;
+        }
+
+        // RLE: a control byte with the high bit set repeats the next pixel (c & 0x7f) + 1
+        // times; otherwise c + 1 literal pixels follow
+        static size_t rleEncode(const uint8_t * src, size_t size, uint8_t pixelSize, uint8_t * dst)
+        {
+            size_t npix = size / pixelSize;
+            uint8_t * op = dst;
+            size_t i = 0;
+
+            while (i < npix) {
+
+                // Measure the run starting here
+                size_t run = 1;
+                while (i+run < npix && run < 128 &&
+                        !memcmp(src + i*pixelSize, src + (i+run)*pixelSize, pixelSize)) {
+                    run++;
+                }
+
+                if (run > 1) {
+                    *op++ = (uint8_t)(0x80 | (run-1));
+                    memcpy(op, src + i*pixelSize, pixelSize);
+                    op += pixelSize;
+                    i += run;
+                    continue;
+                }
+
+                // Gather literals until the next run of at least two pixels
+                size_t lit = 1;
+                while (i+lit < npix && lit < 128 &&
+                        (i+lit+1 >= npix || memcmp(src + (i+lit)*pixelSize, src + (i+lit+1)*pixelSize, pixelSize))) {
+                    lit++;
+                }
+
+                *op++ = (uint8_t)(lit-1);
+                memcpy(op, src + i*pixelSize, lit*pixelSize);
+                op += lit*pixelSize;
+                i += lit;
+            }
+
+            return op - dst;
+        }
+
+        static size_t rleDecode(const uint8_t * src, size_t size, uint8_t pixelSize, uint8_t * dst, size_t capacity)
+        {
+            const uint8_t * ip = src;
+            const uint8_t * iend = src + size;
+            uint8_t * op = dst;
+            uint8_t * oend = dst + capacity;
+
+            while (ip < iend) {
+
+                uint8_t c = *ip++;
+                size_t count = (c & 0x7f) + 1;
+
+                if (c & 0x80) {
+                    if (ip + pixelSize > iend || op + count*pixelSize > oend) return 0;
+                    for (size_t k=0; k<count; ++k) {
+                        memcpy(op, ip, pixelSize);
+                        op += pixelSize;
+                    }
+                    ip += pixelSize;
+                }
+                else {
+                    if (ip + count*pixelSize > iend || op + count*pixelSize > oend) return 0;
+                    memcpy(op, ip, count*pixelSize);
+                    ip += count*pixelSize;
+                    op += count*pixelSize;
+                }
+            }
+
+            return op - dst;
+        }
+
+        // Greedy LZ4 block compressor
+        size_t lz4Encode(const uint8_t * src, size_t size, uint8_t * dst)
+        {
+            // The format requires the last match to start 12 bytes before the end and
+            // the last 5 bytes to be literals
+            const size_t MFLIMIT = 12;
+            const size_t LASTLITERALS = 5;
+
+            uint8_t * op = dst;
+            size_t anchor = 0;
+
+            if (size > MFLIMIT) {
+
+                memset(_hashTable, 0, sizeof(_hashTable));
+
+                size_t ip = 0;
+                size_t limit = size - MFLIMIT;
+                size_t matchLimit = size - LASTLITERALS;
+
+                while (ip < limit) {
+
+                    uint32_t seq = read32(src + ip);
+                    uint32_t h = (seq * 2654435761U) >> (32 - HASH_LOG);
+                    size_t ref = _hashTable[h];
+                    _hashTable[h] = (uint32_t)(ip + 1);
+
+                    if (ref == 0 || ip - (ref-1) > MAX_OFFSET || read32(src + ref - 1) != seq) {
+                        // Skip faster through incompressible data
+                        ip += 1 + ((ip - anchor) >> 6);
+                        continue;
+                    }
+
+                    ref--;
+
+                    size_t mlen = 4;
+                    while (ip + mlen < matchLimit && src[ref+mlen] == src[ip+mlen]) {
+                        mlen++;
+                    }
+
+                    size_t lit = ip - anchor;
+                    uint8_t * token = op++;
+                    *token = (uint8_t)(((lit >= 15 ? 15 : lit) << 4) | (mlen-4 >= 15 ? 15 : mlen-4));
+
+                    if (lit >= 15) {
+                        op = writeLength(op, lit - 15);
+                    }
+                    memcpy(op, src + anchor, lit);
+                    op += lit;
+
+                    uint16_t offset = (uint16_t)(ip - ref);
+                    *op++ = (uint8_t)(offset & 0xff);
+                    *op++ = (uint8_t)(offset >> 8);
+
+                    if (mlen-4 >= 15) {
+                        op = writeLength(op, mlen - 4 - 15);
+                    }
+
+                    ip += mlen;
+                    anchor = ip;
+                }
+            }
+
+            // Final literal-only sequence
+            size_t lit = size - anchor;
+            *op++ = (uint8_t)((lit >= 15 ? 15 : lit) << 4);
+            if (lit >= 15) {
+                op = writeLength(op, lit - 15);
+            }
+            if (lit > 0) memcpy(op, src + anchor, lit);
+            op += lit;
+
+            return op - dst;
+        }
+
+        static size_t lz4Decode(const uint8_t * src, size_t size, uint8_t * dst, size_t capacity)
+        {
+            const uint8_t * ip = src;
+            const uint8_t * iend = src + size;
+            uint8_t * op = dst;
+            uint8_t * oend = dst + capacity;
+
+            while (ip < iend) {
+
+                uint8_t token = *ip++;
+
+                size_t lit = token >> 4;
+                if (lit == 15) {
+                    uint8_t b;
+                    do {
+                        if (ip >= iend) return 0;
+                        b = *ip++;
+                        lit += b;
+                    } while (b == 255);
+                }
+
+                if (ip + lit > iend || op + lit > oend) return 0;
+                memcpy(op, ip, lit);
+                ip += lit;
+                op += lit;
+
+                // Last sequence has no match
+                if (ip >= iend) break;
+
+                if (ip + 2 > iend) return 0;
+                size_t offset = ip[0] | (ip[1] << 8);
+                ip += 2;
+                if (offset == 0 || offset > (size_t)(op - dst)) return 0;
+
+                size_t mlen = token & 15;
+                if (mlen == 15) {
+                    uint8_t b;
+                    do {
+                        if (ip >= iend) return 0;
+                        b = *ip++;
+                        mlen += b;
+                    } while (b == 255);
+                }
+                mlen += 4;
+
+                if (op + mlen > oend) return 0;
+
+                // Byte-wise copy handles overlapping matches
+                const uint8_t * match = op - offset;
+                for (size_t k=0; k<mlen; ++k) {
+                    op[k] = match[k];
+                }
+                op += mlen;
+            }
+
+            return op - dst;
+        }
+
+}; // class FrameCodec
@@ -0,0 +1,389 @@
+/*
+ * Memory-mapped frame dataset container for MulticopterSim
+ *
+ * Layout: a fixed header, an index of entry_t records, then the frame data.
+ * The whole file is allocated up front, so appending a frame is a reservation
+ * plus a copy into mapped memory.  Several threads (one per camera) can append
+ * at the same time.  Each index entry records the frame id, sim time, vehicle
+ * pose and camera id, and the reader finds frames by time with a binary search.
+ *
+ * Copyright (C) 2019 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include "MappedFile.hpp"
+#include "FrameCodec.hpp"
+
+#include <atomic>
+#include <vector>
+#include <algorithm>
+
+class FrameDataset {
+
+    public:
+
+        static const uint32_t MAGIC   = 0x5344534d; // "MSDS"
+        static const uint32_t VERSION = 1;
+
+#pragma pack(push, 1)
+        typedef struct {
+
+            uint32_t magic;
+            uint32_t version;
+            uint32_t indexCapacity;
+            uint32_t frameCount;    // entries reserved; valid once closed is set
+            uint64_t dataOffset;
+            uint64_t dataUsed;
+            uint32_t closed;
+            uint32_t reserved[7];
+
+        } header_t;
+
+        typedef struct {
+
+            uint32_t frameId;
+            uint8_t  cameraId;
+            uint8_t  encoding;
+            uint8_t  channels;
+            uint8_t  valid;         // set last, so a crash leaves only complete entries valid
+            uint16_t rows;
+            uint16_t cols;
+            uint32_t size;
+            uint64_t offset;        // from start of data region
+            double   time;
+            double   location[3];
+            double   rotation[3];
+
+        } entry_t;
+#pragma pack(pop)
+
+        // Per-frame metadata supplied by the recorder
+        typedef struct {
+
+            uint32_t frameId;
+            uint8_t  cameraId;
+            double   time;
+            double   location[3];
+            double   rotation[3];
+
+        } info_t;
+
+}; // class FrameDataset
+
+class FrameDatasetWriter {
+
+    private:
+
+        MappedFile _file;
+
+        FrameDataset::header_t * _header = NULL;
+        FrameDataset::entry_t * _index = NULL;
+        uint8_t * _dataRegion = NULL;
+        uint64_t _dataCapacity = 0;
+
+        std::atomic<uint32_t> _nextEntry;
+        std::atomic<uint64_t> _nextOffset;
+        std::atomic<uint32_t> _rejected;
+
+    public:
+
+        FrameDatasetWriter(void)
+            : _nextEntry(0), _nextOffset(0), _rejected(0)
+        {
+        }
+
+        /**
+         * Creates a dataset file with room for the given frames and bytes of frame data.
+         */
+        bool open(const char * path, uint32_t maxFrames, uint64_t dataBytes)
+        {
+            uint64_t dataOffset = sizeof(FrameDataset::header_t) + (uint64_t)maxFrames * sizeof(FrameDataset::entry_t);
+
+            // Start frame data on a page boundary
+            dataOffset = (dataOffset + 4095) & ~(uint64_t)4095;
+
+            if (!_file.create(path, (size_t)(dataOffset + dataBytes))) {
+                return false;
+            }
+
+            _header = (FrameDataset::header_t *)_file.data();
+            _index = (FrameDataset::entry_t *)(_file.data() + sizeof(FrameDataset::header_t));
+            _dataRegion = _file.data() + dataOffset;
+            _dataCapacity = dataBytes;
+
+            memset(_header, 0, sizeof(FrameDataset::header_t));
+            _header->magic = FrameDataset::MAGIC;
+            _header->version = FrameDataset::VERSION;
+            _header->indexCapacity = maxFrames;
+            _header->dataOffset = dataOffset;
+
+            _nextEntry = 0;
+            _nextOffset = 0;
+            _rejected = 0;
+
+            return true;
+        }
+
+        /**
+         * Reserves an index entry and space for a frame.  Thread-safe.
+         *
+         * @param size bytes of frame data
+         * @param entry index of the reserved entry (output)
+         * @return where to write the frame, or NULL if the dataset is full
+         */
+        uint8_t * reserve(uint32_t size, uint32_t & entry)
+        {
+            if (!_header) return NULL;
+
+            // The index first, so frames turned away by a full index take no data space; an entry
+            // whose data doesn't fit is never committed, and readers skip it
+            entry = _nextEntry.fetch_add(1);
+            if (entry >= _header->indexCapacity) {
+                _rejected++;
+                return NULL;
+            }
+
+            uint64_t offset = _nextOffset.fetch_add(size);
+            if (offset + size > _dataCapacity) {
+                _rejected++;
+                return NULL;
+            }
+
+            _index[entry].offset = offset;
+            _index[entry].size = size;
+
+            return _dataRegion + offset;
+        }
+
+        // Fills in and publishes a reserved entry once its frame has been written
+        void commit(uint32_t entry, const FrameDataset::info_t & info, FrameCodec::Encoding_t encoding,
+                uint8_t channels, uint16_t rows, uint16_t cols)
+        {
+            FrameDataset::entry_t & e = _index[entry];
+
+            e.frameId = info.frameId;
+            e.cameraId = info.cameraId;
+            e.encoding = (uint8_t)encoding;
+            e.channels = channels;
+            e.rows = rows;
+            e.cols = cols;
+            e.time = info.time;
+            for (uint8_t k=0; k<3; ++k) {
+                e.location[k] = info.location[k];
+                e.rotation[k] = info.rotation[k];
+            }
+
+            std::atomic_thread_fence(std::memory_order_release);
+            e.valid = 1;
+        }
+
+        /**
+         * Encodes and appends a frame.  Thread-safe, as long as each thread passes its own
+         * codec and scratch buffer.  A scratch buffer smaller than FrameCodec::maxEncodedSize()
+         * for the frame gets the frame stored raw rather than encoded past its end.
+         *
+         * @return true on success, false if the dataset is full
+         */
+        bool append(const FrameDataset::info_t & info, const uint8_t * pixels, uint8_t channels, uint16_t rows, uint16_t cols,
+                FrameCodec::Encoding_t encoding, FrameCodec & codec, uint8_t * scratch, size_t scratchCapacity)
+        {
+            size_t size = (size_t)rows * cols * channels;
+            const uint8_t * payload = pixels;
+
+            if (encoding != FrameCodec::ENCODING_RAW && scratchCapacity < FrameCodec::maxEncodedSize(size, channels)) {
+                encoding = FrameCodec::ENCODING_RAW;
+            }
+
+            if (encoding != FrameCodec::ENCODING_RAW) {
+                size = codec.encode(encoding, pixels, size, channels, scratch);
+                payload = scratch;
+            }
+
+            uint32_t entry = 0;
+            uint8_t * dst = reserve((uint32_t)size, entry);
+            if (!dst) return false;
+
+            memcpy(dst, payload, size);
+
+            commit(entry, info, encoding, channels, rows, cols);
+
+            return true;
+        }
+
+        uint32_t getRejected(void)
+        {
+            return _rejected;
+        }
+
+        uint64_t getDataUsed(void)
+        {
+            uint64_t used = _nextOffset;
+            return used < _dataCapacity ? used : _dataCapacity;
+        }
+
+        // Finalizes the header and trims unused data space from the file
+        void close(void)
+        {
+            if (!_header) return;
+
+            uint32_t count = _nextEntry;
+            uint64_t used = getDataUsed();
+
+            _header->frameCount = count < _header->indexCapacity ? count : _header->indexCapacity;
+            _header->dataUsed = used;
+            _header->closed = 1;
+
+            uint64_t total = _header->dataOffset + used;
+
+            _file.flush();
+            _file.close((size_t)total);
+
+            _header = NULL;
+            _index = NULL;
+            _dataRegion = NULL;
+        }
+
+        ~FrameDatasetWriter(void)
+        {
+            close();
+        }
+
+}; // class FrameDatasetWriter
+
+class FrameDatasetReader {
+
+    private:
+
+        MappedFile _file;
+
+        const FrameDataset::header_t * _header = NULL;
+        const FrameDataset::entry_t * _index = NULL;
+        const uint8_t * _dataRegion = NULL;
+
+        // Valid entries in time order
+        std::vector<uint32_t> _order;
+
+    public:
+
+        bool open(const char * path)
+        {
+            if (!_file.open(path) || _file.size() < sizeof(FrameDataset::header_t)) {
+                return false;
+            }
+
+            _header = (const FrameDataset::header_t *)_file.data();
+
+            if (_header->magic != FrameDataset::MAGIC || _header->version != FrameDataset::VERSION) {
+                _file.close();
+                _header = NULL;
+                return false;
+            }
+
+            // A truncated or corrupt file can claim more index and data than it holds
+            const uint64_t fileSize = _file.size();
+            const uint64_t indexEnd = sizeof(FrameDataset::header_t) +
+                (uint64_t)_header->indexCapacity * sizeof(FrameDataset::entry_t);
+
+            if (indexEnd > fileSize || _header->dataOffset < indexEnd || _header->dataOffset > fileSize) {
+                _file.close();
+                _header = NULL;
+                return false;
+            }
+
+            _index = (const FrameDataset::entry_t *)(_file.data() + sizeof(FrameDataset::header_t));
+            _dataRegion = _file.data() + _header->dataOffset;
+
+            const uint64_t dataSize = fileSize - _header->dataOffset;
+
+            // A recording that was not closed cleanly may have gaps, so check every entry
+            uint32_t count = _header->closed && _header->frameCount < _header->indexCapacity ?
+                _header->frameCount : _header->indexCapacity;
+
+            _order.clear();
+            for (uint32_t k=0; k<count; ++k) {
+                const FrameDataset::entry_t & e = _index[k];
+                if (e.valid && e.offset <= dataSize && e.size <= dataSize - e.offset) {
+                    _order.push_back(k);
+                }
+            }
+
+            // Concurrent writers can commit slightly out of order
+            std::stable_sort(_order.begin(), _order.end(), [this](uint32_t a, uint32_t b) {
+                return _index[a].time < _index[b].time;
+            });
+
+            _file.adviseSequential(false);
+
+            return true;
+        }
+
+        // Number of frames, ordered by time
+        uint32_t count(void) const
+        {
+            return (uint32_t)_order.size();
+        }
+
+        const FrameDataset::entry_t & entry(uint32_t k) const
+        {
+            return _index[_order[k]];
+        }
+
+        // Encoded frame bytes, valid while the reader is open
+        const uint8_t * payload(uint32_t k) const
+        {
+            return _dataRegion + entry(k).offset;
+        }
+
+        /**
+         * Finds the last frame at or before a given time.
+         *
+         * @param time sim time in seconds
+         * @param cameraId camera to look for, or -1 for any camera
+         * @return position in time order, or -1 if there is none
+         */
+        int32_t findByTime(double time, int16_t cameraId=-1) const
+        {
+            // First frame strictly after the time
+            uint32_t lo = 0;
+            uint32_t hi = count();
+            while (lo < hi) {
+                uint32_t mid = (lo + hi) / 2;
+                if (entry(mid).time <= time) {
+                    lo = mid + 1;
+                }
+                else {
+                    hi = mid;
+                }
+            }
+
+            for (int32_t k=(int32_t)lo-1; k>=0; --k) {
+                if (cameraId < 0 || entry(k).cameraId == cameraId) {
+                    return k;
+                }
+            }
+
+            return -1;
+        }
+
+        /**
+         * Decodes a frame into a caller-supplied buffer.
+         *
+         * @return decoded size in bytes, or 0 on failure
+         */
+        size_t decode(uint32_t k, uint8_t * dst, size_t capacity) const
+        {
+            const FrameDataset::entry_t & e = entry(k);
+            return FrameCodec::decode((FrameCodec::Encoding_t)e.encoding, payload(k), e.size, e.channels, dst, capacity);
+        }
+
+        void close(void)
+        {
+            _file.close();
+            _order.clear();
+            _header = NULL;
+        }
+
+}; // class FrameDatasetReader
@@ -0,0 +1,216 @@
+/*
+ * Small fixed queue of frame buffers for handing camera images to a worker thread
+ *
+ * A producer (camera task) acquires a slot, fills it, and commits it; the
+ * worker takes the oldest committed slot and releases it when done.  Buffers
+ * are allocated once, so nothing is allocated per frame.
+ *
+ * Copyright (C) 2019 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include "Utils.hpp"
+#include "dynamics/MultirotorDynamics.hpp"
+#include "Metrics.hpp"
+
+class FrameQueue {
+
+    public:
+
+        typedef enum {
+
+            DROP_OLDEST,    // a new frame replaces the oldest one still waiting
+            DROP_NEWEST     // a new frame is discarded while the queue is full
+
+        } DropPolicy_t;
+
+        // Metadata travelling with each frame
+        typedef struct {
+
+            uint32_t frameId;
+            double timestamp;
+            MultirotorDynamics::pose_t pose;
+
+        } info_t;
+
+        static const uint8_t MAX_LENGTH = 16;
+
+    private:
+
+        typedef enum {
+
+            SLOT_FREE,
+            SLOT_FILLING,
+            SLOT_READY,
+            SLOT_TAKEN
+
+        } SlotState_t;
+
+        uint8_t _length = 0;
+        size_t _slotSize = 0;
+        DropPolicy_t _dropPolicy;
+
+        uint8_t * _bytes[MAX_LENGTH] = {};
+        SlotState_t _state[MAX_LENGTH] = {};
+        info_t _info[MAX_LENGTH] = {};
+
+        uint32_t _frameCount = 0;
+
+        FCriticalSection _lock;
+
+        FThreadSafeCounter _dropped;
+
+        Metrics::Counter _droppedMetric;
+        Metrics::Gauge _depthMetric;
+
+        // Call with the lock held
+        void updateDepth(void)
+        {
+            uint8_t depth = 0;
+            for (uint8_t k=0; k<_length; ++k) {
+                depth += _state[k] == SLOT_READY;
+            }
+            _depthMetric.set(depth);
+        }
+
+        int32 oldestReady(void)
+        {
+            int32 oldest = -1;
+
+            for (uint8_t k=0; k<_length; ++k) {
+                if (_state[k] == SLOT_READY && (oldest < 0 || _info[k].frameId < _info[oldest].frameId)) {
+                    oldest = k;
+                }
+            }
+
+            return oldest;
+        }
+
+    public:
+
+        FrameQueue(size_t slotSize, DropPolicy_t dropPolicy, uint8_t length=3)
+        {
+            _length = FMath::Min(length, MAX_LENGTH);
+            _slotSize = slotSize;
+            _dropPolicy = dropPolicy;
+
+            for (uint8_t k=0; k<_length; ++k) {
+                _bytes[k] = new uint8_t [slotSize];
+                _state[k] = SLOT_FREE;
+            }
+        }
+
+        ~FrameQueue(void)
+        {
+            for (uint8_t k=0; k<_length; ++k) {
+                delete[] _bytes[k];
+            }
+        }
+
+        // Reserves a slot for an incoming frame, or returns -1 if the frame must be dropped
+        int32 acquire(void)
+        {
+            FScopeLock lock(&_lock);
+
+            uint32_t frameId = _frameCount++;
+
+            for (uint8_t k=0; k<_length; ++k) {
+                if (_state[k] == SLOT_FREE) {
+                    _state[k] = SLOT_FILLING;
+                    _info[k].frameId = frameId;
+                    return k;
+                }
+            }
+
+            _dropped.Increment();
+            _droppedMetric.increment();
+
+            int32 oldest = oldestReady();
+
+            if (_dropPolicy == DROP_OLDEST && oldest >= 0) {
+                _state[oldest] = SLOT_FILLING;
+                _info[oldest].frameId = frameId;
+                updateDepth();
+                return oldest;
+            }
+
+            return -1;
+        }
+
+        // Makes a filled slot available to the worker
+        void commit(int32 slot)
+        {
+            FScopeLock lock(&_lock);
+            _state[slot] = SLOT_READY;
+            updateDepth();
+        }
+
+        // Takes the oldest committed slot, or returns -1 if there is none
+        int32 take(void)
+        {
+            FScopeLock lock(&_lock);
+
+            int32 oldest = oldestReady();
+
+            if (oldest >= 0) {
+                _state[oldest] = SLOT_TAKEN;
+                updateDepth();
+            }
+
+            return oldest;
+        }
+
+        // Returns a taken slot to the pool
+        void release(int32 slot)
+        {
+            FScopeLock lock(&_lock);
+            _state[slot] = SLOT_FREE;
+        }
+
+        // Releases a taken slot whose frame was thrown away
+        void discard(int32 slot)
+        {
+            _dropped.Increment();
+            _droppedMetric.increment();
+            release(slot);
+        }
+
+        uint8_t * bytes(int32 slot)
+        {
+            return _bytes[slot];
+        }
+
+        info_t & info(int32 slot)
+        {
+            return _info[slot];
+        }
+
+        size_t slotSize(void)
+        {
+            return _slotSize;
+        }
+
+        uint32_t getDropped(void)
+        {
+            return _dropped.GetValue();
+        }
+
+        /**
+         * Reports drops and the number of frames waiting in the metrics registry.
+         *
+         * @param labels labels telling this queue apart from others, e.g. camera="0",sink="stream"
+         */
+        void setMetrics(const char * labels)
+        {
+            Metrics & metrics = Metrics::get();
+
+            _droppedMetric = metrics.counter("multicopter_camera_frames_dropped_total",
+                    "Camera frames dropped because the consumer fell behind", labels);
+            _depthMetric = metrics.gauge("multicopter_camera_queue_depth", "Camera frames waiting for the consumer",
+                    labels);
+        }
+
+}; // class FrameQueue
@@ -0,0 +1,653 @@
+/*
+ * Lock-free channel carrying log messages from worker threads to one that can show them
+ *
+ * post() copies the format pointer and the raw arguments into a slot of a
+ * bounded multi-producer, multi-consumer ring (Vyukov's per-slot sequence
+ * numbers), with no formatting, locking or allocation; it is cheap enough for
+ * the 1 kHz flight loop.  Whoever drains the channel -- the game thread, or a
+ * logger thread -- calls pop(), which does the formatting.  When the ring is
+ * full a message is dropped and counted rather than waiting.
+ *
+ * LOG_POST() passes its file and line, which identify the call site, so
+ * sites that share a format -- "%s", say -- are limited separately.  Each
+ * call site posts at most once per interval; messages in between are counted,
+ * and the count rides along with the next one that goes through.  The format
+ * has to outlive the channel, which string literals do.  %s arguments are
+ * copied, so they needn't outlive the call; %n is not supported.
+ *
+ * Copyright (C) 2019 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+
+class LogChannel {
+
+    public:
+
+        typedef enum {
+
+            LEVEL_DEBUG,
+            LEVEL_LINE,     // replaces the previous LEVEL_LINE message on screen
+            LEVEL_ERROR
+
+        } Level_t;
+
+        // Messages the ring holds before they are dropped; a power of two
+        static const uint32_t CAPACITY = 1024;
+
+        // Arguments kept per message, counting * widths and precisions; conversions past these print as ?
+        static const uint8_t MAX_ARGS = 8;
+
+        // Room for the characters of all %s arguments of a message
+        static const uint8_t TEXT_SIZE = 64;
+
+        // Call sites tracked for rate limiting; sites past these go unlimited
+        static const uint32_t MAX_SITES = 256;
+
+    private:
+
+        typedef union {
+
+            int64_t i;
+            uint64_t u;
+            double d;
+            const void * p;
+
+        } arg_t;
+
+        typedef struct {
+
+            const char * format;
+            uint32_t suppressed;
+            uint8_t level;
+            uint8_t argCount;
+            uint8_t textLength;
+            arg_t args[MAX_ARGS];
+            char text[TEXT_SIZE];
+
+        } record_t;
+
+        typedef struct {
+
+            std::atomic<uint64_t> sequence;
+            record_t record;
+
+        } slot_t;
+
+        typedef enum {
+
+            SITE_EMPTY,
+            SITE_CLAIMED,   // its key is being written
+            SITE_READY
+
+        } SiteState_t;
+
+        typedef struct {
+
+            std::atomic<uint32_t> state;
+            const char * file;
+            uint32_t line;
+            std::atomic<int64_t> next;
+            std::atomic<uint32_t> suppressed;
+
+        } site_t;
+
+        // A conversion specification, e.g. %-08.3lf
+        typedef struct {
+
+            const char * start;     // the %
+            const char * end;       // just past the conversion character
+            char flags[8];
+            bool widthStar;
+            bool precisionStar;
+            char length;            // H for hh, L for ll, D for long double, else the modifier or 0
+            char conversion;
+
+        } spec_t;
+
+        slot_t _slots[CAPACITY];
+
+        // Producers claim slots at the tail and consumers take them from the head, on separate cache lines
+        alignas(64) std::atomic<uint64_t> _tail;
+        alignas(64) std::atomic<uint64_t> _head;
+
+        alignas(64) std::atomic<uint64_t> _dropped;
+
+        site_t _sites[MAX_SITES];
+
+        std::atomic<int64_t> _interval;
+
+        LogChannel(void)
+            : _tail(0), _head(0), _dropped(0), _interval(100000000)
+        {
+            for (uint32_t k=0; k<CAPACITY; ++k) {
+                _slots[k].sequence = k;
+            }
+
+            for (uint32_t k=0; k<MAX_SITES; ++k) {
+                _sites[k].state = SITE_EMPTY;
+                _sites[k].file = NULL;
+                _sites[k].line = 0;
+                _sites[k].next = 0;
+                _sites[k].suppressed = 0;
+            }
+        }
+
+        static int64_t now(void)
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        // The rate-limiting state of a call site, found by its file and line; NULL if the table is full
+        site_t * site(const char * file, uint32_t line)
+        {
+            const uint64_t hash = ((((uintptr_t)file >> 2) + line * 0x9E3779B1ull) * 0x9E3779B97F4A7C15ull) >> 32;
+
+            for (uint32_t k=0; k<MAX_SITES; ++k) {
+
+                site_t & s = _sites[(hash + k) & (MAX_SITES-1)];
+
+                uint32_t state = s.state.load(std::memory_order_acquire);
+
+                if (state == SITE_EMPTY &&
+                        s.state.compare_exchange_strong(state, SITE_CLAIMED, std::memory_order_acquire)) {
+                    s.file = file;
+                    s.line = line;
+                    s.state.store(SITE_READY, std::memory_order_release);
+                    return &s;
+                }
+
+                // Another producer is writing the key, which takes it two stores
+                while (state == SITE_CLAIMED) {
+                    state = s.state.load(std::memory_order_acquire);
+                }
+
+                if (s.file == file && s.line == line) {
+                    return &s;
+                }
+            }
+
+            return NULL;
+        }
+
+        // Whether the site may post now; if so, how many of its messages were held back since the last one
+        bool admit(site_t * s, uint32_t & suppressed)
+        {
+            suppressed = 0;
+
+            const int64_t interval = _interval.load(std::memory_order_relaxed);
+
+            if (!s || interval <= 0) {
+                return true;
+            }
+
+            const int64_t t = now();
+            int64_t next = s->next.load(std::memory_order_relaxed);
+
+            if (t < next || !s->next.compare_exchange_strong(next, t + interval, std::memory_order_relaxed)) {
+                s->suppressed.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+
+            suppressed = s->suppressed.exchange(0, std::memory_order_relaxed);
+
+            return true;
+        }
+
+        // Parses the conversion at p, which follows a %; returns false at the end of the string
+        static bool parse(const char * p, spec_t & spec)
+        {
+            spec.start = p - 1;
+
+            uint8_t f = 0;
+            while (*p && strchr("-+ #0", *p)) {
+                if (f < sizeof(spec.flags)-1) {
+                    spec.flags[f++] = *p;
+                }
+                ++p;
+            }
+            spec.flags[f] = 0;
+
+            // Width and precision are copied from the format when they are literal, so just skip them here
+            spec.widthStar = *p == '*';
+            if (spec.widthStar) {
+                ++p;
+            }
+            while (*p >= '0' && *p <= '9') {
+                ++p;
+            }
+
+            spec.precisionStar = false;
+            if (*p == '.') {
+                ++p;
+                spec.precisionStar = *p == '*';
+                if (spec.precisionStar) {
+                    ++p;
+                }
+                while (*p >= '0' && *p <= '9') {
+                    ++p;
+                }
+            }
+
+            spec.length = 0;
+            if (*p == 'h' || *p == 'l') {
+                spec.length = *p++;
+                if (*p == spec.length) {
+                    spec.length = spec.length == 'h' ? 'H' : 'L';
+                    ++p;
+                }
+            }
+            else if (*p == 'j' || *p == 'z' || *p == 't') {
+                spec.length = *p++;
+            }
+            else if (*p == 'L') {
+                spec.length = 'D';
+                ++p;
+            }
+
+            if (!*p) {
+                return false;
+            }
+
+            spec.conversion = *p++;
+            spec.end = p;
+
+            return true;
+        }
+
+        // Pulls the arguments the format calls for off the list and into the record
+        static void capture(record_t & record, const char * format, va_list ap)
+        {
+            record.argCount = 0;
+            record.textLength = 0;
+
+            for (const char * p=strchr(format, '%'); p; p=strchr(p, '%')) {
+
+                spec_t spec;
+
+                if (!parse(p+1, spec)) {
+                    return;
+                }
+
+                p = spec.end;
+
+                if (spec.conversion == '%') {
+                    continue;
+                }
+
+                arg_t stars[2];
+                uint8_t starCount = 0;
+
+                if (spec.widthStar) {
+                    stars[starCount++].i = va_arg(ap, int);
+                }
+                if (spec.precisionStar) {
+                    stars[starCount++].i = va_arg(ap, int);
+                }
+
+                arg_t arg;
+
+                switch (spec.conversion) {
+
+                    case 'd':
+                    case 'i':
+                        switch (spec.length) {
+                            case 'H': arg.i = (signed char)va_arg(ap, int); break;
+                            case 'h': arg.i = (short)va_arg(ap, int); break;
+                            case 'l': arg.i = va_arg(ap, long); break;
+                            case 'L': arg.i = va_arg(ap, long long); break;
+                            case 'j': arg.i = va_arg(ap, intmax_t); break;
+                            case 'z': arg.i = (int64_t)va_arg(ap, size_t); break;
+                            case 't': arg.i = va_arg(ap, ptrdiff_t); break;
+                            default:  arg.i = va_arg(ap, int);
+                        }
+                        break;
+
+                    case 'u':
+                    case 'o':
+                    case 'x':
+                    case 'X':
+                        switch (spec.length) {
+                            case 'H': arg.u = (unsigned char)va_arg(ap, unsigned); break;
+                            case 'h': arg.u = (unsigned short)va_arg(ap, unsigned); break;
+                            case 'l': arg.u = va_arg(ap, unsigned long); break;
+                            case 'L': arg.u = va_arg(ap, unsigned long long); break;
+                            case 'j': arg.u = va_arg(ap, uintmax_t); break;
+                            case 'z': arg.u = va_arg(ap, size_t); break;
+                            case 't': arg.u = (uint64_t)va_arg(ap, ptrdiff_t); break;
+                            default:  arg.u = va_arg(ap, unsigned);
+                        }
+                        break;
+
+                    case 'c':
+                        arg.i = va_arg(ap, int);
+                        break;
+
+                    case 'f':
+                    case 'F':
+                    case 'e':
+                    case 'E':
+                    case 'g':
+                    case 'G':
+                    case 'a':
+                    case 'A':
+                        arg.d = spec.length == 'D' ? (double)va_arg(ap, long double) : va_arg(ap, double);
+                        break;
+
+                    case 's':
+                        arg.u = copyText(record, va_arg(ap, const char *));
+                        break;
+
+                    case 'p':
+                        arg.p = va_arg(ap, void *);
+                        break;
+
+                    // Anything else (%n, or a typo) would leave us out of step with the arguments
+                    default:
+                        return;
+                }
+
+                if (record.argCount + starCount + 1 > MAX_ARGS) {
+                    return;
+                }
+
+                for (uint8_t k=0; k<starCount; ++k) {
+                    record.args[record.argCount++] = stars[k];
+                }
+
+                record.args[record.argCount++] = arg;
+            }
+        }
+
+        // Copies a string argument into the record, returning its offset
+        static uint64_t copyText(record_t & record, const char * s)
+        {
+            const uint64_t offset = record.textLength;
+
+            if (!s) {
+                s = "(null)";
+            }
+
+            while (*s && record.textLength < TEXT_SIZE-1) {
+                record.text[record.textLength++] = *s++;
+            }
+
+            record.text[record.textLength] = 0;
+
+            if (record.textLength < TEXT_SIZE-1) {
+                record.textLength++;
+            }
+
+            return offset;
+        }
+
+        // Formats a record as printf would have when it was posted
+        static void render(const record_t & record, char * out, size_t size)
+        {
+            size_t length = 0;
+            uint8_t next = 0;
+
+            const char * p = record.format;
+
+            while (*p && length < size-1) {
+
+                if (*p != '%') {
+                    out[length++] = *p++;
+                    continue;
+                }
+
+                spec_t spec;
+
+                if (!parse(p+1, spec)) {
+                    break;
+                }
+
+                p = spec.end;
+
+                if (spec.conversion == '%') {
+                    out[length++] = '%';
+                    continue;
+                }
+
+                const uint8_t needed = 1 + spec.widthStar + spec.precisionStar;
+
+                if (next + needed > record.argCount) {
+                    out[length++] = '?';
+                    continue;
+                }
+
+                // Rebuild the specification with stars filled in and a length that fits what we stored
+                char conversion[40];
+                size_t c = 0;
+
+                c += snprintf(conversion+c, sizeof(conversion)-c, "%%%s", spec.flags);
+
+                const char * q = spec.start + 1;
+                while (*q && strchr("-+ #0", *q)) {
+                    ++q;
+                }
+
+                if (spec.widthStar) {
+                    c += snprintf(conversion+c, sizeof(conversion)-c, "%d", (int)record.args[next++].i);
+                    ++q;
+                }
+                while (*q >= '0' && *q <= '9' && c < sizeof(conversion)-8) {
+                    conversion[c++] = *q++;
+                }
+
+                if (*q == '.') {
+                    conversion[c++] = *q++;
+                    if (spec.precisionStar) {
+                        c += snprintf(conversion+c, sizeof(conversion)-c, "%d", (int)record.args[next++].i);
+                        ++q;
+                    }
+                    while (*q >= '0' && *q <= '9' && c < sizeof(conversion)-8) {
+                        conversion[c++] = *q++;
+                    }
+                }
+
+                const arg_t & arg = record.args[next++];
+
+                const bool integer = strchr("diuoxX", spec.conversion) != NULL;
+
+                snprintf(conversion+c, sizeof(conversion)-c, "%s%c", integer ? "ll" : "", spec.conversion);
+
+                const size_t room = size - length;
+
+                int count = 0;
+
+                switch (spec.conversion) {
+
+                    case 'd':
+                    case 'i':
+                        count = snprintf(out+length, room, conversion, (long long)arg.i);
+                        break;
+
+                    case 'u':
+                    case 'o':
+                    case 'x':
+                    case 'X':
+                        count = snprintf(out+length, room, conversion, (unsigned long long)arg.u);
+                        break;
+
+                    case 'c':
+                        count = snprintf(out+length, room, conversion, (int)arg.i);
+                        break;
+
+                    case 's':
+                        count = snprintf(out+length, room, conversion, record.text + arg.u);
+                        break;
+
+                    case 'p':
+                        count = snprintf(out+length, room, conversion, arg.p);
+                        break;
+
+                    default:
+                        count = snprintf(out+length, room, conversion, arg.d);
+                }
+
+                if (count > 0) {
+                    length += (size_t)count < room ? count : room-1;
+                }
+            }
+
+            out[length] = 0;
+
+            if (record.suppressed && length < size-1) {
+                snprintf(out+length, size-length, " (%u more)", record.suppressed);
+            }
+        }
+
+    public:
+
+        static LogChannel & get(void)
+        {
+            static LogChannel channel;
+            return channel;
+        }
+
+        /**
+         * Queues a message without blocking, from any thread; LOG_POST() fills in the call site.
+         *
+         * @param level how to show it
+         * @param file call site's file, for rate limiting; has to outlive the channel, as __FILE__ does
+         * @param line call site's line
+         * @param format printf format; a string literal
+         * @return false if the message was held back by the rate limit or dropped because the ring was full
+         */
+        bool post(Level_t level, const char * file, uint32_t line, const char * format, ...)
+        {
+            va_list ap;
+            va_start(ap, format);
+            bool posted = vpost(level, file, line, format, ap);
+            va_end(ap);
+            return posted;
+        }
+
+        bool vpost(Level_t level, const char * file, uint32_t line, const char * format, va_list ap)
+        {
+            site_t * s = site(file, line);
+
+            uint32_t suppressed = 0;
+
+            if (!admit(s, suppressed)) {
+                return false;
+            }
+
+            uint64_t position = _tail.load(std::memory_order_relaxed);
+
+            slot_t * slot = NULL;
+
+            while (true) {
+
+                slot = &_slots[position & (CAPACITY-1)];
+
+                const uint64_t sequence = slot->sequence.load(std::memory_order_acquire);
+                const int64_t difference = (int64_t)(sequence - position);
+
+                if (difference == 0) {
+                    if (_tail.compare_exchange_weak(position, position+1, std::memory_order_relaxed)) {
+                        break;
+                    }
+                }
+
+                // Full: keep the held-back count for the site's next message
+                else if (difference < 0) {
+                    if (s) {
+                        s->suppressed.fetch_add(suppressed, std::memory_order_relaxed);
+                    }
+                    _dropped.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+
+                else {
+                    position = _tail.load(std::memory_order_relaxed);
+                }
+            }
+
+            record_t & record = slot->record;
+            record.format = format;
+            record.level = (uint8_t)level;
+            record.suppressed = suppressed;
+            capture(record, format, ap);
+
+            slot->sequence.store(position+1, std::memory_order_release);
+
+            return true;
+        }
+
+        /**
+         * Takes the oldest message and formats it.
+         *
+         * @param level set to how the message should be shown
+         * @param text where to write the message
+         * @param size size of text
+         * @return false if there was no message
+         */
+        bool pop(Level_t & level, char * text, size_t size)
+        {
+            uint64_t position = _head.load(std::memory_order_relaxed);
+
+            slot_t * slot = NULL;
+
+            while (true) {
+
+                slot = &_slots[position & (CAPACITY-1)];
+
+                const uint64_t sequence = slot->sequence.load(std::memory_order_acquire);
+                const int64_t difference = (int64_t)(sequence - (position+1));
+
+                if (difference == 0) {
+                    if (_head.compare_exchange_weak(position, position+1, std::memory_order_relaxed)) {
+                        break;
+                    }
+                }
+
+                else if (difference < 0) {
+                    return false;
+                }
+
+                else {
+                    position = _head.load(std::memory_order_relaxed);
+                }
+            }
+
+            level = (Level_t)slot->record.level;
+            render(slot->record, text, size);
+
+            slot->sequence.store(position+CAPACITY, std::memory_order_release);
+
+            return true;
+        }
+
+        /**
+         * Sets how often each call site may post; 0 turns rate limiting off.
+         *
+         * @param seconds minimum time between messages from the same site
+         */
+        void setInterval(double seconds)
+        {
+            _interval = (int64_t)(seconds * 1e9);
+        }
+
+        // Messages lost to a full ring since the last call
+        uint64_t takeDropped(void)
+        {
+            return _dropped.exchange(0, std::memory_order_relaxed);
+        }
+
+}; // class LogChannel
+
+// Posts from the line it is written on, which rate limiting treats as one call site
+#define LOG_POST(level, ...) LogChannel::get().post(level, __FILE__, __LINE__, __VA_ARGS__)
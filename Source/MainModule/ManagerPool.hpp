@@ -0,0 +1,380 @@
+/*
+ * Shared pool of worker threads for running many managers at fixed rates
+ *
+ * Instead of one OS thread per manager, each manager is a task with a rate.
+ * Tasks are spread over a fixed number of workers, each with its own queue.
+ * A worker wakes up when its earliest task is due and runs every task that is
+ * due, or nearly due, in one batch.  A worker with nothing to do steals due
+ * tasks from a worker that is busy, so one slow manager does not hold up the
+ * others in its queue.
+ *
+ * The pool is off by default.  Call FManagerPool::get().enable() before the
+ * managers are created, e.g. in a swarm pawn's constructor.
+ *
+ * Copyright (C) 2019 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include "Runnable.h"
+#include "RunnableThread.h"
+#include "SimClock.hpp"
+#include "Metrics.hpp"
+#include "Trace.hpp"
+
+// Anything the pool can run
+class FPoolable {
+
+    public:
+
+        // Returns false if there was nothing to do yet, e.g. waiting for a stepped clock
+        virtual bool poolStep(void) = 0;
+
+}; // class FPoolable
+
+class FManagerPool {
+
+    public:
+
+        typedef struct {
+
+            FPoolable * client;
+            double period;
+            double deadline;
+            bool running;
+
+        } task_t;
+
+    private:
+
+        // Tasks due within this long of now are run in the same batch
+        static constexpr double BATCH_WINDOW = 0.0002;
+
+        // Shortest wait worth handing to the OS; shorter waits yield instead
+        static constexpr double MIN_WAIT = 0.002;
+
+        class FWorker : public FRunnable {
+
+            private:
+
+                FManagerPool * _pool = NULL;
+                uint8_t _index = 0;
+
+                FRunnableThread * _thread = NULL;
+
+                // Tasks run in the current batch, kept to avoid allocating per batch
+                TArray<task_t *> _batch;
+
+            public:
+
+                TArray<task_t *> tasks;
+                FCriticalSection lock;
+                FEvent * wakeup = NULL;
+                FThreadSafeBool busy = false;
+                FThreadSafeBool running = false;
+
+                FWorker(FManagerPool * pool, uint8_t index)
+                {
+                    _pool = pool;
+                    _index = index;
+                    wakeup = FPlatformProcess::GetSynchEventFromPool(false);
+                }
+
+                void start(void)
+                {
+                    running = true;
+                    _thread = FRunnableThread::Create(this, TEXT("FManagerPool"), 0, TPri_BelowNormal);
+                }
+
+                void stop(void)
+                {
+                    running = false;
+                    wakeup->Trigger();
+                }
+
+                void join(void)
+                {
+                    _thread->WaitForCompletion();
+                }
+
+                ~FWorker(void)
+                {
+                    delete _thread;
+                    FPlatformProcess::ReturnSynchEventToPool(wakeup);
+                }
+
+                virtual uint32 Run() override
+                {
+                    Trace::get().setThreadName("FManagerPool");
+
+                    while (running) {
+
+                        double now = FPlatformTime::Seconds();
+
+                        // Collect everything due, marking it so no one steals it while we run it
+                        _batch.Reset();
+                        double earliest = now + 1;
+                        {
+                            FScopeLock scopeLock(&lock);
+                            for (task_t * task : tasks) {
+                                if (task->deadline <= now + BATCH_WINDOW) {
+                                    task->running = true;
+                                    _batch.Add(task);
+                                }
+                                else if (task->deadline < earliest) {
+                                    earliest = task->deadline;
+                                }
+                            }
+                        }
+
+                        if (_batch.Num() == 0 && _pool->steal(_index, now)) {
+                            continue;
+                        }
+
+                        if (_batch.Num() > 0) {
+
+                            busy = true;
+                            bool stepped = false;
+                            for (task_t * task : _batch) {
+                                stepped |= task->client->poolStep();
+                            }
+                            busy = false;
+
+                            now = FPlatformTime::Seconds();
+
+                            // Periods are in simulated time; stepped, tasks are always due
+                            const double scale = SimClock::get().toWall(1);
+
+                            FScopeLock scopeLock(&lock);
+                            for (task_t * task : _batch) {
+                                task->deadline += task->period * scale;
+                                if (task->deadline <= now && scale > 0) {
+                                    // Fell behind: skip the missed steps rather than bursting to catch up
+                                    _pool->_overruns.Increment();
+                                    _pool->_overrunsMetric.increment();
+                                    task->deadline = now + task->period * scale;
+                                }
+                                task->running = false;
+                            }
+
+                            // Let the tasks we are waiting for run
+                            if (!stepped) {
+                                FPlatformProcess::Sleep(0);
+                            }
+
+                            continue;
+                        }
+
+                        double wait = earliest - now;
+
+                        if (wait > MIN_WAIT) {
+                            wakeup->Wait((uint32)((wait - MIN_WAIT/2) * 1000));
+                        }
+                        else {
+                            FPlatformProcess::Sleep(0);
+                        }
+                    }
+
+                    return 0;
+                }
+
+        }; // class FWorker
+
+        FCriticalSection _workersLock;
+        TArray<FWorker *> _workers;
+        uint32 _taskCount = 0;
+        uint32 _nextWorker = 0;
+
+        bool _enabled = false;
+        uint8_t _workerCount = 0;
+
+        FThreadSafeCounter _overruns;
+        FThreadSafeCounter _steals;
+
+        Metrics::Counter _overrunsMetric = Metrics::get().counter("multicopter_manager_overruns_total",
+                "Manager steps that started more than a period late", "runner=\"pool\"");
+
+        // Moves a due task from a busy worker to an idle one; true if a task was moved
+        bool steal(uint8_t thief, double now)
+        {
+            for (uint8_t k=1; k<_workers.Num(); ++k) {
+
+                uint8_t victim = (thief + k) % _workers.Num();
+
+                if (!_workers[victim]->busy) continue;
+
+                // Lock in index order so two thieves can't deadlock
+                FWorker * first = _workers[FMath::Min(thief, victim)];
+                FWorker * second = _workers[FMath::Max(thief, victim)];
+                FScopeLock lock1(&first->lock);
+                FScopeLock lock2(&second->lock);
+
+                TArray<task_t *> & from = _workers[victim]->tasks;
+
+                for (int32 j=0; j<from.Num(); ++j) {
+                    task_t * task = from[j];
+                    if (!task->running && task->deadline <= now) {
+                        from.RemoveAtSwap(j);
+                        _workers[thief]->tasks.Add(task);
+                        _steals.Increment();
+                        return true;
+                    }
+                }
+            }
+
+            return false;
+        }
+
+        void startWorkers(void)
+        {
+            uint8_t count = _workerCount;
+
+            // Leave room for the game and render threads
+            if (count == 0) {
+                count = (uint8_t)FMath::Max(1, FPlatformMisc::NumberOfCores() - 2);
+            }
+
+            // Workers look at each other's queues, so all must exist before any starts
+            for (uint8_t k=0; k<count; ++k) {
+                _workers.Add(new FWorker(this, k));
+            }
+            for (FWorker * worker : _workers) {
+                worker->start();
+            }
+        }
+
+        void stopWorkers(void)
+        {
+            // Likewise, none can go away until all have stopped
+            for (FWorker * worker : _workers) {
+                worker->stop();
+            }
+            for (FWorker * worker : _workers) {
+                worker->join();
+            }
+            for (FWorker * worker : _workers) {
+                delete worker;
+            }
+            _workers.Reset();
+        }
+
+        ~FManagerPool(void)
+        {
+            stopWorkers();
+        }
+
+    public:
+
+        static FManagerPool & get(void)
+        {
+            static FManagerPool pool;
+            return pool;
+        }
+
+        /**
+         * Runs managers created from now on in the pool instead of on their own threads.
+         *
+         * @param workers number of worker threads; zero sizes the pool to the cores left over
+         * after the game and render threads
+         */
+        void enable(uint8_t workers=0)
+        {
+            FScopeLock lock(&_workersLock);
+            _enabled = true;
+            _workerCount = workers;
+        }
+
+        // Managers created from now on get their own threads again
+        void disable(void)
+        {
+            FScopeLock lock(&_workersLock);
+            _enabled = false;
+        }
+
+        bool isEnabled(void)
+        {
+            return _enabled;
+        }
+
+        /**
+         * Adds a task.  Workers are started with the first task.
+         *
+         * @param client object to run
+         * @param rate runs per second
+         * @param delay seconds before the first run
+         * @return handle for remove()
+         */
+        task_t * add(FPoolable * client, double rate, double delay=0)
+        {
+            FScopeLock lock(&_workersLock);
+
+            if (_workers.Num() == 0) {
+                startWorkers();
+            }
+
+            task_t * task = new task_t;
+            task->client = client;
+            task->period = 1 / rate;
+            task->deadline = FPlatformTime::Seconds() + delay;
+            task->running = false;
+
+            FWorker * worker = _workers[_nextWorker++ % _workers.Num()];
+            {
+                FScopeLock workerLock(&worker->lock);
+                worker->tasks.Add(task);
+            }
+            worker->wakeup->Trigger();
+
+            _taskCount++;
+
+            return task;
+        }
+
+        // Removes a task, waiting for it to finish if it is running.  Workers stop with the last task.
+        void remove(task_t * task)
+        {
+            FScopeLock lock(&_workersLock);
+
+            // The task may be moved between queues while we look for it, so look until we find it idle
+            bool removed = false;
+            while (!removed) {
+                for (FWorker * worker : _workers) {
+                    FScopeLock workerLock(&worker->lock);
+                    int32 index = worker->tasks.Find(task);
+                    if (index != INDEX_NONE && !task->running) {
+                        worker->tasks.RemoveAtSwap(index);
+                        removed = true;
+                        break;
+                    }
+                }
+                if (!removed) {
+                    FPlatformProcess::Sleep(0);
+                }
+            }
+
+            delete task;
+
+            if (--_taskCount == 0) {
+                stopWorkers();
+            }
+        }
+
+        // Steps that started more than a period late since the pool was created
+        uint32 getOverruns(void)
+        {
+            return _overruns.GetValue();
+        }
+
+        uint32 getSteals(void)
+        {
+            return _steals.GetValue();
+        }
+
+        uint8_t getWorkerCount(void)
+        {
+            return (uint8_t)_workers.Num();
+        }
+
+}; // class FManagerPool
@@ -0,0 +1,221 @@
+/*
+ * Memory-mapped files for MulticopterSim datasets and lookup tables
+ *
+ * Works on Windows and POSIX systems, with no engine dependencies, so the
+ * same files can be read by headless tools.
+ *
+ * Copyright (C) 2019 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef _WIN32
+// Inside the engine, windows.h has to come between its guards, unless an includer already opened them
+#if defined(WITH_ENGINE) && !defined(WINDOWS_PLATFORM_TYPES_GUARD)
+#define MAPPEDFILE_WINDOWS_TYPES
+#pragma push_macro("TEXT")
+#include "Windows/AllowWindowsPlatformTypes.h"
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#ifdef MAPPEDFILE_WINDOWS_TYPES
+#include "Windows/HideWindowsPlatformTypes.h"
+#pragma pop_macro("TEXT")
+#undef MAPPEDFILE_WINDOWS_TYPES
+#endif
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+class MappedFile {
+
+    private:
+
+        uint8_t * _data = NULL;
+        size_t _size = 0;
+        bool _writable = false;
+
+#ifdef _WIN32
+        HANDLE _file = INVALID_HANDLE_VALUE;
+        HANDLE _mapping = NULL;
+#else
+        int _fd = -1;
+#endif
+
+        bool map(void)
+        {
+#ifdef _WIN32
+            _mapping = CreateFileMappingA(_file, NULL, _writable ? PAGE_READWRITE : PAGE_READONLY,
+                    (DWORD)((uint64_t)_size >> 32), (DWORD)(_size & 0xffffffff), NULL);
+            if (!_mapping) return false;
+            _data = (uint8_t *)MapViewOfFile(_mapping, _writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, _size);
+#else
+            void * p = mmap(NULL, _size, _writable ? PROT_READ|PROT_WRITE : PROT_READ, MAP_SHARED, _fd, 0);
+            _data = p == MAP_FAILED ? NULL : (uint8_t *)p;
+#endif
+            return _data != NULL;
+        }
+
+    public:
+
+        /**
+         * Creates (or replaces) a file of the given size and maps it for writing.
+         * The space is reserved up front so appends never grow the file.
+         */
+        bool create(const char * path, size_t size)
+        {
+            close();
+
+            _size = size;
+            _writable = true;
+
+#ifdef _WIN32
+            _file = CreateFileA(path, GENERIC_READ|GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+            if (_file == INVALID_HANDLE_VALUE) return false;
+#else
+            _fd = ::open(path, O_RDWR|O_CREAT|O_TRUNC, 0644);
+            if (_fd < 0) return false;
+            if (ftruncate(_fd, (off_t)size) != 0) {
+                close();
+                return false;
+            }
+#endif
+            if (!map()) {
+                close();
+                return false;
+            }
+
+            return true;
+        }
+
+        // Maps an existing file read-only
+        bool open(const char * path)
+        {
+            close();
+
+            _writable = false;
+
+#ifdef _WIN32
+            _file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ|FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+            if (_file == INVALID_HANDLE_VALUE) return false;
+            LARGE_INTEGER size;
+            if (!GetFileSizeEx(_file, &size)) {
+                close();
+                return false;
+            }
+            _size = (size_t)size.QuadPart;
+#else
+            _fd = ::open(path, O_RDONLY);
+            if (_fd < 0) return false;
+            struct stat st;
+            if (fstat(_fd, &st) != 0) {
+                close();
+                return false;
+            }
+            _size = (size_t)st.st_size;
+#endif
+            if (_size == 0 || !map()) {
+                close();
+                return false;
+            }
+
+            return true;
+        }
+
+        // Hints that the whole mapping will be read in order or at random
+        void adviseSequential(bool sequential)
+        {
+#ifndef _WIN32
+            if (_data) {
+                madvise(_data, _size, sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+            }
+#else
+            (void)sequential;
+#endif
+        }
+
+        // Writes dirty pages back to disk
+        void flush(void)
+        {
+            if (!_data || !_writable) return;
+#ifdef _WIN32
+            FlushViewOfFile(_data, 0);
+#else
+            msync(_data, _size, MS_ASYNC);
+#endif
+        }
+
+        /**
+         * Unmaps and closes the file.
+         *
+         * @param truncateTo if nonzero, shrinks a writable file to this many bytes
+         */
+        void close(size_t truncateTo=0)
+        {
+#ifdef _WIN32
+            if (_data) UnmapViewOfFile(_data);
+            if (_mapping) CloseHandle(_mapping);
+            if (_file != INVALID_HANDLE_VALUE) {
+                if (_writable && truncateTo > 0) {
+                    LARGE_INTEGER pos;
+                    pos.QuadPart = (LONGLONG)truncateTo;
+                    SetFilePointerEx(_file, pos, NULL, FILE_BEGIN);
+                    SetEndOfFile(_file);
+                }
+                CloseHandle(_file);
+            }
+            _file = INVALID_HANDLE_VALUE;
+            _mapping = NULL;
+#else
+            if (_data) munmap(_data, _size);
+            if (_fd >= 0) {
+                if (_writable && truncateTo > 0) {
+                    if (ftruncate(_fd, (off_t)truncateTo) != 0) {
+                        // Leave the file at its preallocated size
+                    }
+                }
+                ::close(_fd);
+            }
+            _fd = -1;
+#endif
+            _data = NULL;
+            _size = 0;
+        }
+
+        uint8_t * data(void)
+        {
+            return _data;
+        }
+
+        const uint8_t * data(void) const
+        {
+            return _data;
+        }
+
+        size_t size(void) const
+        {
+            return _size;
+        }
+
+        bool isOpen(void) const
+        {
+            return _data != NULL;
+        }
+
+        ~MappedFile(void)
+        {
+            close();
+        }
+
+}; // class MappedFile
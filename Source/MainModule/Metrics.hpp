@@ -0,0 +1,552 @@
+/*
+ * Registry of counters, gauges and histograms for watching simulator health
+ *
+ * Metrics are registered once, by name and labels, and updated through small
+ * handles from any thread without locking.  Each thread counts into its own
+ * shard of slots, so threads never contend for a cache line; a scrape adds
+ * the shards up.  Gauges hold a single value, since only the latest one
+ * matters.  render() writes everything in the Prometheus text format.
+ *
+ * A handle that was never registered, or couldn't be because the registry
+ * was full, is harmless: its updates go to a slot no one reads.
+ *
+ * Copyright (C) 2019 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+
+class Metrics {
+
+    public:
+
+        typedef enum {
+
+            TYPE_COUNTER,
+            TYPE_GAUGE,
+            TYPE_HISTOGRAM
+
+        } Type_t;
+
+        static const uint8_t MAX_BOUNDS = 16;
+
+        class Counter {
+
+            friend class Metrics;
+
+            private:
+
+                uint32_t _slot = 0;
+
+            public:
+
+                void increment(uint64_t count=1)
+                {
+                    Metrics::get().add(_slot, count);
+                }
+
+        }; // class Counter
+
+        class Gauge {
+
+            friend class Metrics;
+
+            private:
+
+                uint32_t _index = 0;
+
+            public:
+
+                void set(double value)
+                {
+                    Metrics::get()._gauges[_index].store(toBits(value), std::memory_order_relaxed);
+                }
+
+        }; // class Gauge
+
+        class Histogram {
+
+            friend class Metrics;
+
+            private:
+
+                uint32_t _slot = 0;
+                uint8_t _boundCount = 0;
+                double _bounds[MAX_BOUNDS] = {};
+
+            public:
+
+                void observe(double value)
+                {
+                    uint8_t bucket = 0;
+                    while (bucket < _boundCount && value > _bounds[bucket]) {
+                        bucket++;
+                    }
+
+                    Metrics & metrics = Metrics::get();
+
+                    // Unregistered: everything goes to the sink
+                    if (_slot == 0) {
+                        metrics.add(0, 1);
+                        return;
+                    }
+
+                    metrics.add(_slot + bucket, 1);
+                    metrics.addDouble(_slot + _boundCount + 1, value);
+                }
+
+        }; // class Histogram
+
+    private:
+
+        static const uint32_t MAX_METRICS = 256;
+        static const uint32_t MAX_SLOTS   = 1024;
+
+        // Beyond MAX_SHARDS-1 threads at once, the rest share the last shard
+        static const uint32_t MAX_SHARDS  = 64;
+
+        typedef struct {
+
+            bool shared;
+
+            // Keeps the slots off the cache lines of whatever the allocator put before us
+            uint8_t pad[64];
+
+            std::atomic<uint64_t> slots[MAX_SLOTS];
+
+        } shard_t;
+
+        typedef struct {
+
+            char name[64];
+            char labels[96];
+            char help[128];
+            Type_t type;
+
+            // First slot for counters and histograms: the buckets, then +Inf, then the sum
+            uint32_t slot;
+
+            // Index of a gauge's value
+            uint32_t index;
+
+            uint8_t boundCount;
+            double bounds[MAX_BOUNDS];
+
+        } metric_t;
+
+        // Registration is rare and takes the lock; updates and scrapes don't
+        std::mutex _lock;
+
+        metric_t _metrics[MAX_METRICS];
+        std::atomic<uint32_t> _metricCount;
+
+        // Slot and gauge zero are the sink for unregistered handles
+        uint32_t _slotCount = 1;
+        uint32_t _gaugeCount = 1;
+
+        std::atomic<shard_t *> _shards[MAX_SHARDS];
+        uint32_t _shardCount = 0;
+
+        // Shards of threads that have exited
+        shard_t * _free[MAX_SHARDS];
+        uint32_t _freeCount = 0;
+
+        std::atomic<uint64_t> _gauges[MAX_METRICS];
+
+        Metrics(void)
+            : _metricCount(0)
+        {
+            for (uint32_t k=0; k<MAX_SHARDS; ++k) {
+                _shards[k] = NULL;
+            }
+
+            for (uint32_t k=0; k<MAX_METRICS; ++k) {
+                _gauges[k] = 0;
+            }
+        }
+
+        ~Metrics(void)
+        {
+            for (uint32_t k=0; k<MAX_SHARDS; ++k) {
+                delete _shards[k].load();
+            }
+        }
+
+        static uint64_t toBits(double value)
+        {
+            uint64_t bits = 0;
+            memcpy(&bits, &value, sizeof(bits));
+            return bits;
+        }
+
+        static double fromBits(uint64_t bits)
+        {
+            double value = 0;
+            memcpy(&value, &bits, sizeof(value));
+            return value;
+        }
+
+        // Gives a thread's shard to the next new thread when the thread exits
+        class Owner {
+
+            public:
+
+                shard_t * shard = NULL;
+
+                ~Owner(void)
+                {
+                    if (shard && !shard->shared) {
+                        Metrics & metrics = Metrics::get();
+                        std::lock_guard<std::mutex> lock(metrics._lock);
+                        metrics._free[metrics._freeCount++] = shard;
+                    }
+                }
+
+        }; // class Owner
+
+        // This thread's shard, found the first time the thread updates a metric
+        shard_t * shard(void)
+        {
+            static thread_local Owner owner;
+
+            if (!owner.shard) {
+
+                std::lock_guard<std::mutex> lock(_lock);
+
+                if (_freeCount > 0) {
+                    owner.shard = _free[--_freeCount];
+                }
+
+                else {
+
+                    // Past the last, everyone shares it
+                    const uint32_t index = _shardCount < MAX_SHARDS ? _shardCount++ : MAX_SHARDS-1;
+
+                    if (!_shards[index].load()) {
+                        shard_t * shard = new shard_t;
+                        shard->shared = index == MAX_SHARDS-1;
+                        for (uint32_t k=0; k<MAX_SLOTS; ++k) {
+                            shard->slots[k].store(0, std::memory_order_relaxed);
+                        }
+                        _shards[index].store(shard, std::memory_order_release);
+                    }
+
+                    owner.shard = _shards[index].load();
+                }
+            }
+
+            return owner.shard;
+        }
+
+        void add(uint32_t slot, uint64_t count)
+        {
+            shard_t * s = shard();
+
+            std::atomic<uint64_t> & value = s->slots[slot];
+
+            // We are the only writer, so a plain read-modify-write will do
+            if (!s->shared) {
+                value.store(value.load(std::memory_order_relaxed) + count, std::memory_order_relaxed);
+            }
+            else {
+                value.fetch_add(count, std::memory_order_relaxed);
+            }
+        }
+
+        void addDouble(uint32_t slot, double amount)
+        {
+            shard_t * s = shard();
+
+            std::atomic<uint64_t> & value = s->slots[slot];
+
+            uint64_t bits = value.load(std::memory_order_relaxed);
+
+            if (!s->shared) {
+                value.store(toBits(fromBits(bits) + amount), std::memory_order_relaxed);
+                return;
+            }
+
+            while (!value.compare_exchange_weak(bits, toBits(fromBits(bits) + amount), std::memory_order_relaxed)) {
+            }
+        }
+
+        uint64_t total(uint32_t slot)
+        {
+            uint64_t sum = 0;
+
+            for (uint32_t k=0; k<MAX_SHARDS; ++k) {
+                shard_t * s = _shards[k].load(std::memory_order_acquire);
+                if (s) {
+                    sum += s->slots[slot].load(std::memory_order_relaxed);
+                }
+            }
+
+            return sum;
+        }
+
+        double totalDouble(uint32_t slot)
+        {
+            double sum = 0;
+
+            for (uint32_t k=0; k<MAX_SHARDS; ++k) {
+                shard_t * s = _shards[k].load(std::memory_order_acquire);
+                if (s) {
+                    sum += fromBits(s->slots[slot].load(std::memory_order_relaxed));
+                }
+            }
+
+            return sum;
+        }
+
+        // Finds or adds a metric; returns NULL if it clashes with an existing one or there is no room
+        metric_t * find(Type_t type, const char * name, const char * labels, const char * help, uint32_t slots,
+                const double * bounds=NULL, uint8_t boundCount=0)
+        {
+            std::lock_guard<std::mutex> lock(_lock);
+
+            const uint32_t count = _metricCount.load(std::memory_order_relaxed);
+
+            for (uint32_t k=0; k<count; ++k) {
+                metric_t & metric = _metrics[k];
+                if (!strcmp(metric.name, name)) {
+                    if (metric.type != type) {
+                        return NULL;
+                    }
+                    if (!strcmp(metric.labels, labels)) {
+                        return &metric;
+                    }
+                }
+            }
+
+            if (count == MAX_METRICS || _slotCount + slots > MAX_SLOTS ||
+                    strlen(name) >= sizeof(metric_t::name) || strlen(labels) >= sizeof(metric_t::labels)) {
+                return NULL;
+            }
+
+            metric_t & metric = _metrics[count];
+            memset(&metric, 0, sizeof(metric));
+
+            snprintf(metric.name, sizeof(metric.name), "%s", name);
+            snprintf(metric.labels, sizeof(metric.labels), "%s", labels);
+            snprintf(metric.help, sizeof(metric.help), "%s", help);
+            metric.type = type;
+
+            metric.slot = _slotCount;
+            _slotCount += slots;
+
+            if (type == TYPE_GAUGE) {
+                metric.index = _gaugeCount++;
+            }
+
+            metric.boundCount = boundCount;
+            if (boundCount) {
+                memcpy(metric.bounds, bounds, boundCount * sizeof(double));
+            }
+
+            // Scrapes see the metric only once it is filled in
+            _metricCount.store(count + 1, std::memory_order_release);
+
+            return &metric;
+        }
+
+        static void appendValue(std::string & text, double value)
+        {
+            char buf[32];
+
+            if (isnan(value)) {
+                snprintf(buf, sizeof(buf), "NaN");
+            }
+            else if (isinf(value)) {
+                snprintf(buf, sizeof(buf), value > 0 ? "+Inf" : "-Inf");
+            }
+            else {
+                snprintf(buf, sizeof(buf), "%.10g", value);
+            }
+
+            text += buf;
+        }
+
+        // name{labels} or name{labels,extra}
+        static void appendSample(std::string & text, const metric_t & metric, const char * suffix, const char * extra=NULL)
+        {
+            text += metric.name;
+            text += suffix;
+
+            if (*metric.labels || extra) {
+                text += "{";
+                text += metric.labels;
+                if (*metric.labels && extra) {
+                    text += ",";
+                }
+                if (extra) {
+                    text += extra;
+                }
+                text += "}";
+            }
+
+            text += " ";
+        }
+
+        void renderMetric(std::string & text, const metric_t & metric)
+        {
+            char buf[64];
+
+            switch (metric.type) {
+
+                case TYPE_COUNTER:
+                    appendSample(text, metric, "");
+                    snprintf(buf, sizeof(buf), "%llu\n", (unsigned long long)total(metric.slot));
+                    text += buf;
+                    break;
+
+                case TYPE_GAUGE:
+                    appendSample(text, metric, "");
+                    appendValue(text, fromBits(_gauges[metric.index].load(std::memory_order_relaxed)));
+                    text += "\n";
+                    break;
+
+                case TYPE_HISTOGRAM: {
+
+                    // Buckets are cumulative
+                    uint64_t count = 0;
+                    for (uint8_t k=0; k<=metric.boundCount; ++k) {
+
+                        count += total(metric.slot + k);
+
+                        char le[48];
+                        if (k < metric.boundCount) {
+                            snprintf(le, sizeof(le), "le=\"%.10g\"", metric.bounds[k]);
+                        }
+                        else {
+                            snprintf(le, sizeof(le), "le=\"+Inf\"");
+                        }
+
+                        appendSample(text, metric, "_bucket", le);
+                        snprintf(buf, sizeof(buf), "%llu\n", (unsigned long long)count);
+                        text += buf;
+                    }
+
+                    appendSample(text, metric, "_sum");
+                    appendValue(text, totalDouble(metric.slot + metric.boundCount + 1));
+                    text += "\n";
+
+                    appendSample(text, metric, "_count");
+                    snprintf(buf, sizeof(buf), "%llu\n", (unsigned long long)count);
+                    text += buf;
+                }
+            }
+        }
+
+    public:
+
+        static Metrics & get(void)
+        {
+            static Metrics metrics;
+            return metrics;
+        }
+
+        /**
+         * Registers a counter, or finds the one already registered under the same name and labels.
+         *
+         * @param name Prometheus metric name, ending in _total by convention
+         * @param help one-line description, shown once per name
+         * @param labels comma-separated label pairs, e.g. camera="0", or an empty string
+         */
+        Counter counter(const char * name, const char * help, const char * labels="")
+        {
+            Counter counter;
+
+            metric_t * metric = find(TYPE_COUNTER, name, labels, help, 1);
+
+            if (metric) {
+                counter._slot = metric->slot;
+            }
+
+            return counter;
+        }
+
+        Gauge gauge(const char * name, const char * help, const char * labels="")
+        {
+            Gauge gauge;
+
+            metric_t * metric = find(TYPE_GAUGE, name, labels, help, 0);
+
+            if (metric) {
+                gauge._index = metric->index;
+            }
+
+            return gauge;
+        }
+
+        /**
+         * Registers a histogram.  Metrics with the same name should have the same bounds.
+         *
+         * @param bounds upper bounds of the buckets, increasing; values above the last go in +Inf
+         * @param boundCount number of bounds, at most MAX_BOUNDS
+         */
+        Histogram histogram(const char * name, const char * help, const double * bounds, uint8_t boundCount,
+                const char * labels="")
+        {
+            Histogram histogram;
+
+            if (boundCount > MAX_BOUNDS) {
+                return histogram;
+            }
+
+            metric_t * metric = find(TYPE_HISTOGRAM, name, labels, help, boundCount + 2, bounds, boundCount);
+
+            if (metric) {
+                histogram._slot = metric->slot;
+                histogram._boundCount = metric->boundCount;
+                memcpy(histogram._bounds, metric->bounds, metric->boundCount * sizeof(double));
+            }
+
+            return histogram;
+        }
+
+        // Everything registered so far, in the Prometheus text format; callable from any thread
+        void render(std::string & text)
+        {
+            static const char * TYPES[3] = { "counter", "gauge", "histogram" };
+
+            const uint32_t count = _metricCount.load(std::memory_order_acquire);
+
+            // All the samples with one name go together, under one HELP and TYPE
+            for (uint32_t k=0; k<count; ++k) {
+
+                const metric_t & metric = _metrics[k];
+
+                bool seen = false;
+                for (uint32_t j=0; j<k && !seen; ++j) {
+                    seen = !strcmp(_metrics[j].name, metric.name);
+                }
+                if (seen) continue;
+
+                text += "# HELP ";
+                text += metric.name;
+                text += " ";
+                text += metric.help;
+                text += "\n# TYPE ";
+                text += metric.name;
+                text += " ";
+                text += TYPES[metric.type];
+                text += "\n";
+
+                for (uint32_t j=k; j<count; ++j) {
+                    if (!strcmp(_metrics[j].name, metric.name)) {
+                        renderMetric(text, _metrics[j]);
+                    }
+                }
+            }
+        }
+
+}; // class Metrics
@@ -0,0 +1,174 @@
+/*
+ * Local HTTP endpoint serving the metrics registry to a Prometheus scraper
+ *
+ * One thread answers GET /metrics (or GET /) with Metrics::render(), one
+ * connection at a time, and closes each connection after replying.  It
+ * listens on the loopback interface by default; give another address to be
+ * scraped from other machines.
+ *
+ * Copyright (C) 2019 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include "Metrics.hpp"
+
+#include <thread>
+
+// The socket headers pull in winsock on Windows, which redefines TEXT
+#pragma push_macro("TEXT")
+#ifdef _WIN32
+#include "Windows/AllowWindowsPlatformTypes.h"
+#endif
+#include "../../Extras/sockets/TcpServerSocket.hpp"
+#ifdef _WIN32
+#include "Windows/HideWindowsPlatformTypes.h"
+#endif
+#pragma pop_macro("TEXT")
+
+class MetricsServer {
+
+    public:
+
+        static const uint16_t DEFAULT_PORT = 9464;
+
+    private:
+
+        // How often the thread looks up from waiting for a client to see if it should stop
+        static const uint32_t WAIT_MSEC = 100;
+
+        // How long a client has to finish sending its request
+        static const uint32_t REQUEST_MSEC = 1000;
+
+        static const uint32_t MAX_REQUEST = 2048;
+
+        TcpServerSocket * _socket = NULL;
+
+        std::thread _thread;
+        std::atomic<bool> _running;
+
+        char _message[200] = {};
+
+        std::string _body;
+        std::string _reply;
+
+        void run(void)
+        {
+            while (_running) {
+
+                if (!_socket->acceptConnection(WAIT_MSEC)) {
+                    continue;
+                }
+
+                serve();
+
+                _socket->closeClient();
+            }
+        }
+
+        void serve(void)
+        {
+            char request[MAX_REQUEST];
+            size_t length = 0;
+
+            // Read up to the end of the headers; we only need the request line
+            while (length < sizeof(request)-1) {
+
+                int count = _socket->receiveAvailable(request+length, sizeof(request)-1-length, REQUEST_MSEC);
+
+                if (count <= 0) {
+                    break;
+                }
+
+                length += count;
+                request[length] = 0;
+
+                if (strstr(request, "\r\n\r\n") || strstr(request, "\n\n")) {
+                    break;
+                }
+            }
+
+            request[length] = 0;
+
+            const bool get = !strncmp(request, "GET ", 4);
+            const char * path = request + 4;
+            const bool found = get && (!strncmp(path, "/metrics", 8) || !strncmp(path, "/ ", 2));
+
+            _body.clear();
+
+            if (found) {
+                Metrics::get().render(_body);
+            }
+            else {
+                _body = get ? "Not found\n" : "Bad request\n";
+            }
+
+            char header[200];
+            snprintf(header, sizeof(header),
+                    "HTTP/1.0 %s\r\n"
+                    "Content-Type: %s\r\n"
+                    "Content-Length: %u\r\n"
+                    "Connection: close\r\n"
+                    "\r\n",
+                    found ? "200 OK" : get ? "404 Not Found" : "400 Bad Request",
+                    found ? "text/plain; version=0.0.4; charset=utf-8" : "text/plain",
+                    (unsigned)_body.size());
+
+            _reply = header;
+            _reply += _body;
+
+            _socket->sendData((void *)_reply.data(), _reply.size());
+        }
+
+    public:
+
+        /**
+         * Starts serving right away.
+         *
+         * @param host address to listen on
+         * @param port port to listen on
+         */
+        MetricsServer(const char * host="127.0.0.1", uint16_t port=DEFAULT_PORT)
+            : _running(false)
+        {
+            // The registry has to outlive our thread
+            Metrics::get();
+
+            // The socket takes a short, but reads it back as unsigned
+            _socket = new TcpServerSocket(host, (short)port);
+
+            // No thread if we can't listen, e.g. because another instance has the port
+            if (!_socket->startListening()) {
+                snprintf(_message, sizeof(_message), "can't listen on %s:%d", host, port);
+                return;
+            }
+
+            _running = true;
+            _thread = std::thread(&MetricsServer::run, this);
+        }
+
+        ~MetricsServer(void)
+        {
+            if (_running) {
+                _running = false;
+                _thread.join();
+            }
+
+            _socket->closeConnection();
+            delete _socket;
+        }
+
+        bool isServing(void)
+        {
+            return _running;
+        }
+
+        // Why we aren't serving, if we aren't
+        const char * getMessage(void)
+        {
+            return _message;
+        }
+
+}; // class MetricsServer
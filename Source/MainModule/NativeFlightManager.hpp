@@ -0,0 +1,71 @@
+/*
+ * Flight manager running a CascadedController on the flight thread
+ *
+ * Keeps the control loop in-process at the physics rate, with no round trip
+ * to a controller in another process.  The game thread (or anyone else) can
+ * change the mode and setpoint at any time; the flight thread picks them up
+ * at its next step.
+ *
+ * Copyright (C) 2019 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include "FlightManager.hpp"
+#include "control/CascadedController.hpp"
+
+class FNativeFlightManager : public FFlightManager {
+
+    private:
+
+        CascadedController _controller;
+
+        // Setpoint and mode handed over from other threads
+        FCriticalSection _lock;
+        CascadedController::setpoint_t _setpoint = {};
+        CascadedController::Mode_t _mode = CascadedController::MODE_POSITION;
+
+        double _previousTime = 0;
+
+        virtual void getMotors(const double time, const MultirotorDynamics::state_t & state, double * motorvals) override
+        {
+            {
+                FScopeLock lock(&_lock);
+                _controller.setMode(_mode);
+                _controller.setSetpoint(_setpoint);
+            }
+
+            _controller.update(state, time - _previousTime, motorvals);
+
+            _previousTime = time;
+        }
+
+    public:
+
+        /**
+         * @param dynamics vehicle dynamics
+         * @param config controller gains and limits
+         * @param mixer motor layout matching the dynamics, e.g. Mixer::quadXAP()
+         * @param rate steps per second when managers share the pool
+         */
+        FNativeFlightManager(MultirotorDynamics * dynamics, const CascadedController::config_t & config,
+                const Mixer & mixer, double rate=1000)
+            : FFlightManager(dynamics, rate), _controller(config, mixer)
+        {
+        }
+
+        void setSetpoint(const CascadedController::setpoint_t & setpoint)
+        {
+            FScopeLock lock(&_lock);
+            _setpoint = setpoint;
+        }
+
+        void setMode(CascadedController::Mode_t mode)
+        {
+            FScopeLock lock(&_lock);
+            _mode = mode;
+        }
+
+}; // class FNativeFlightManager
@@ -9,6 +9,7 @@
 #pragma once
 
 #include "Camera.hpp"
+#include "PixelConversion.hpp"
 
 #include <opencv2/imgproc/imgproc.hpp>
 
@@ -16,32 +17,30 @@ class OpenCVCamera : public Camera {
 
     private:
 
-        // RBGA image created from render target on main thread
-        cv::Mat _rbga_image;
+        // Format of the image sent to subclass
+        PixelConversion::Format_t _format;
 
-        // RGB image sent to subclass for processing
+        // Image sent to subclass for processing
         cv::Mat _image;
 
     protected:
 
-        OpenCVCamera(float fov, Resolution_t res)
+        OpenCVCamera(float fov, Resolution_t res, PixelConversion::Format_t format=PixelConversion::FORMAT_BGR)
             : Camera(fov, res)
         {
-            // Create a private RBGA image for acquiring render target on main thread
-            _rbga_image = cv::Mat::zeros(_rows, _cols, CV_8UC4);
-
-            // Create a public OpenCV BGR image for uses by other classes
-            _image = cv::Mat::zeros(_rows, _cols, CV_8UC3);
+            _format = format;
 
+            // Create a public OpenCV image for uses by other classes
+            _image = cv::Mat::zeros(
+                    PixelConversion::outputRows(format, _rows),
+                    PixelConversion::outputCols(format, _cols),
+                    format == PixelConversion::FORMAT_GRAY ? CV_8UC1 : CV_8UC3);
         }
 
         virtual void processImageBytes(uint8_t * bytes) override
-        { 
-            // Copy the RBGA pixels to the private image
-            FMemory::Memcpy(_rbga_image.data, bytes, _rows*_cols*4);
-
-            // Convert RGBA => RGB for public image
-            cv::cvtColor(_rbga_image, _image, CV_RGBA2RGB);
+        {
+            // Convert render-target pixels straight into the public image in one pass
+            PixelConversion::convert(bytes, _image.data, _rows, _cols, _format);
 
             // Virtual method implemented in subclass
             processImage(_image);
@@ -0,0 +1,342 @@
+/*
+ * Hardware performance counters around phases of a loop
+ *
+ * Counts cycles, instructions, cache misses and branch misses for the
+ * calling thread with one perf_event_open group on Linux, so the four are
+ * always read together.  Mark the start of a loop iteration with begin() and
+ * the end of each phase with end(phase); each end() starts the next phase,
+ * so phases that follow one another take one read each.
+ *
+ * Where counters are unavailable (another OS, a VM without a PMU, a
+ * container that forbids perf_event_open, perf_event_paranoid above 2)
+ * open() returns false, getMessage() says why, and begin() and end() do
+ * nothing.  Counters the CPU lacks are left out and shown as unavailable.
+ *
+ * Copyright (C) 2019 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+class PerfCounters {
+
+    public:
+
+        typedef enum {
+
+            COUNTER_CYCLES,
+            COUNTER_INSTRUCTIONS,
+            COUNTER_CACHE_MISSES,
+            COUNTER_BRANCH_MISSES,
+            COUNTER_COUNT
+
+        } Counter_t;
+
+        static const uint8_t MAX_PHASES = 8;
+
+        typedef struct {
+
+            const char * name;
+            uint64_t calls;
+            uint64_t values[COUNTER_COUNT];
+
+        } phase_t;
+
+    private:
+
+        // File descriptor of each counter, or -1; the first one open leads the group
+        int _fds[COUNTER_COUNT];
+        int _leader = -1;
+
+        // Where each counter comes in a read of the group
+        uint8_t _position[COUNTER_COUNT] = {};
+        uint8_t _openCount = 0;
+
+        phase_t _phases[MAX_PHASES] = {};
+        uint8_t _phaseCount = 0;
+
+        uint64_t _start[COUNTER_COUNT] = {};
+
+        // Set if the kernel had to share the hardware with other groups, so counts are low
+        bool _multiplexed = false;
+
+        char _message[200] = {};
+
+        bool sample(uint64_t values[COUNTER_COUNT])
+        {
+#ifdef __linux__
+            // PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING
+            uint64_t buf[3 + COUNTER_COUNT];
+
+            if (::read(_leader, buf, sizeof(buf)) < (ssize_t)((3 + _openCount) * sizeof(uint64_t))) {
+                return false;
+            }
+
+            if (buf[2] < buf[1]) {
+                _multiplexed = true;
+            }
+
+            for (uint8_t k=0; k<COUNTER_COUNT; ++k) {
+                values[k] = _fds[k] >= 0 ? buf[3 + _position[k]] : 0;
+            }
+
+            return true;
+#else
+            (void)values;
+            return false;
+#endif
+        }
+
+#ifdef __linux__
+        static int openCounter(uint64_t config, int leader)
+        {
+            struct perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = config;
+            attr.disabled = leader < 0;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+            // This thread, on any CPU
+            return (int)syscall(__NR_perf_event_open, &attr, 0, -1, leader, 0);
+        }
+#endif
+
+    public:
+
+        PerfCounters(void)
+        {
+            for (uint8_t k=0; k<COUNTER_COUNT; ++k) {
+                _fds[k] = -1;
+            }
+        }
+
+        ~PerfCounters(void)
+        {
+            close();
+        }
+
+        /**
+         * Starts counting for the calling thread, which is the only one that should call begin() and end().
+         *
+         * @return false if no counter could be opened
+         */
+        bool open(void)
+        {
+            close();
+
+#ifdef __linux__
+            static const uint64_t CONFIGS[COUNTER_COUNT] = {
+                PERF_COUNT_HW_CPU_CYCLES,
+                PERF_COUNT_HW_INSTRUCTIONS,
+                PERF_COUNT_HW_CACHE_MISSES,
+                PERF_COUNT_HW_BRANCH_MISSES
+            };
+
+            int error = 0;
+
+            for (uint8_t k=0; k<COUNTER_COUNT; ++k) {
+
+                _fds[k] = openCounter(CONFIGS[k], _leader);
+
+                if (_fds[k] < 0) {
+                    error = errno;
+                    continue;
+                }
+
+                if (_leader < 0) {
+                    _leader = _fds[k];
+                }
+
+                _position[k] = _openCount++;
+            }
+
+            if (_leader < 0) {
+                snprintf(_message, sizeof(_message), "perf_event_open: %s", strerror(error));
+                return false;
+            }
+
+            ioctl(_leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+            ioctl(_leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+
+            return true;
+#else
+            snprintf(_message, sizeof(_message), "hardware counters are only supported on Linux");
+            return false;
+#endif
+        }
+
+        void close(void)
+        {
+#ifdef __linux__
+            for (uint8_t k=0; k<COUNTER_COUNT; ++k) {
+                if (_fds[k] >= 0) {
+                    ::close(_fds[k]);
+                }
+            }
+#endif
+            for (uint8_t k=0; k<COUNTER_COUNT; ++k) {
+                _fds[k] = -1;
+            }
+
+            _leader = -1;
+            _openCount = 0;
+        }
+
+        bool isOpen(void) const
+        {
+            return _leader >= 0;
+        }
+
+        bool isAvailable(Counter_t counter) const
+        {
+            return _fds[counter] >= 0;
+        }
+
+        // Why open() failed
+        const char * getMessage(void) const
+        {
+            return _message;
+        }
+
+        /**
+         * @param name string literal
+         * @return index for end(), or MAX_PHASES if there are too many
+         */
+        uint8_t addPhase(const char * name)
+        {
+            if (_phaseCount == MAX_PHASES) {
+                return MAX_PHASES;
+            }
+
+            _phases[_phaseCount].name = name;
+
+            return _phaseCount++;
+        }
+
+        // Marks the start of the first phase
+        void begin(void)
+        {
+            if (_leader >= 0) {
+                sample(_start);
+            }
+        }
+
+        // Marks the end of a phase, and the start of the next one
+        void end(uint8_t phase)
+        {
+            if (_leader < 0 || phase >= _phaseCount) {
+                return;
+            }
+
+            uint64_t now[COUNTER_COUNT];
+
+            if (!sample(now)) {
+                return;
+            }
+
+            phase_t & totals = _phases[phase];
+            totals.calls++;
+
+            for (uint8_t k=0; k<COUNTER_COUNT; ++k) {
+                totals.values[k] += now[k] - _start[k];
+                _start[k] = now[k];
+            }
+        }
+
+        uint8_t getPhaseCount(void) const
+        {
+            return _phaseCount;
+        }
+
+        const phase_t & getPhase(uint8_t phase) const
+        {
+            return _phases[phase];
+        }
+
+        bool wasMultiplexed(void) const
+        {
+            return _multiplexed;
+        }
+
+        // Clears the totals, keeping the phases
+        void reset(void)
+        {
+            for (uint8_t k=0; k<_phaseCount; ++k) {
+                _phases[k].calls = 0;
+                memset(_phases[k].values, 0, sizeof(_phases[k].values));
+            }
+
+            _multiplexed = false;
+        }
+
+        // Per-call averages for each phase, with instructions per cycle and misses per thousand instructions
+        void summarize(FILE * fp) const
+        {
+            if (_leader < 0) {
+                fprintf(fp, "Hardware counters unavailable: %s\n", _message);
+                return;
+            }
+
+            fprintf(fp, "%-12s %10s %10s %10s %6s %10s %8s %10s %8s\n", "phase", "calls", "cycles", "instr", "IPC",
+                    "cache-miss", "per-kI", "br-miss", "per-kI");
+
+            for (uint8_t k=0; k<_phaseCount; ++k) {
+
+                const phase_t & phase = _phases[k];
+
+                const double calls = phase.calls ? (double)phase.calls : 1;
+                const double cycles = phase.values[COUNTER_CYCLES] / calls;
+                const double instructions = phase.values[COUNTER_INSTRUCTIONS] / calls;
+                const double cacheMisses = phase.values[COUNTER_CACHE_MISSES] / calls;
+                const double branchMisses = phase.values[COUNTER_BRANCH_MISSES] / calls;
+
+                const bool perInstruction = isAvailable(COUNTER_INSTRUCTIONS) && instructions > 0;
+
+                fprintf(fp, "%-12s %10llu ", phase.name, (unsigned long long)phase.calls);
+                printValue(fp, isAvailable(COUNTER_CYCLES), cycles, 10, 1);
+                printValue(fp, isAvailable(COUNTER_INSTRUCTIONS), instructions, 10, 1);
+                printValue(fp, perInstruction && isAvailable(COUNTER_CYCLES) && cycles > 0, instructions / cycles, 6, 2);
+                printValue(fp, isAvailable(COUNTER_CACHE_MISSES), cacheMisses, 10, 1);
+                printValue(fp, perInstruction && isAvailable(COUNTER_CACHE_MISSES), 1000 * cacheMisses / instructions, 8, 3);
+                printValue(fp, isAvailable(COUNTER_BRANCH_MISSES), branchMisses, 10, 1);
+                printValue(fp, perInstruction && isAvailable(COUNTER_BRANCH_MISSES), 1000 * branchMisses / instructions, 8, 3);
+                fprintf(fp, "\n");
+            }
+
+            if (_multiplexed) {
+                fprintf(fp, "Counters were shared with other programs; counts are low\n");
+            }
+        }
+
+    private:
+
+        // A value, or a dash where its counter is missing
+        static void printValue(FILE * fp, bool available, double value, int width, int precision)
+        {
+            if (available) {
+                fprintf(fp, "%*.*f ", width, precision, value);
+            }
+            else {
+                fprintf(fp, "%*s ", width, "-");
+            }
+        }
+
+}; // class PerfCounters
@@ -0,0 +1,468 @@
+/*
+ * Fused single-pass pixel conversion kernels for MulticopterSim cameras
+ *
+ * The render target delivers UE4 FColor pixels, which are laid out in memory
+ * as B,G,R,A.  Each kernel reads those bytes exactly once and writes the
+ * requested format straight into the consumer's buffer, replacing the
+ * copy-then-cvtColor path.  SSSE3 / AVX2 paths are selected at run time on
+ * x86; NEON is used when compiled for ARM.  All paths produce bit-identical
+ * output to the scalar reference.
+ *
+ * Copyright (C) 2019 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define PIXCONV_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define PIXCONV_TARGET(isa)
+#else
+#define PIXCONV_TARGET(isa) __attribute__((target(isa)))
+#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define PIXCONV_NEON
+#include <arm_neon.h>
+#endif
+
+class PixelConversion {
+
+    public:
+
+        // Output formats supported by convert()
+        typedef enum {
+
+            FORMAT_BGR,      // drop alpha, keep byte order (OpenCV default)
+            FORMAT_RGB,      // drop alpha, swap red and blue
+            FORMAT_GRAY,     // single-channel luma
+            FORMAT_BGR_HALF, // drop alpha, downscale 2x in each direction
+            FORMAT_COUNT
+
+        } Format_t;
+
+        // Instruction sets that can be forced for benchmarking
+        typedef enum {
+
+            ISA_AUTO,
+            ISA_SCALAR,
+            ISA_SSSE3,
+            ISA_AVX2,
+            ISA_NEON
+
+        } Isa_t;
+
+        static uint8_t channels(Format_t format)
+        {
+            return format == FORMAT_GRAY ? 1 : 3;
+        }
+
+        static uint16_t outputRows(Format_t format, uint16_t rows)
+        {
+            return format == FORMAT_BGR_HALF ? rows/2 : rows;
+        }
+
+        static uint16_t outputCols(Format_t format, uint16_t cols)
+        {
+            return format == FORMAT_BGR_HALF ? cols/2 : cols;
+        }
+
+        /**
+         * Converts a BGRA image into the requested format.
+         *
+         * @param bgra source pixels, rows*cols*4 bytes
+         * @param dst destination, outputRows()*outputCols()*channels() bytes
+         * @param rows source rows
+         * @param cols source columns
+         * @param format destination format
+         * @param isa instruction set to use; ISA_AUTO picks the best available
+         */
+        static void convert(const uint8_t * bgra, uint8_t * dst, uint16_t rows, uint16_t cols, Format_t format, Isa_t isa=ISA_AUTO)
+        {
+            if (isa == ISA_AUTO) {
+                isa = bestIsa();
+            }
+
+            size_t npix = (size_t)rows * cols;
+
+            switch (format) {
+
+                case FORMAT_BGR:
+                    dropAlpha(bgra, dst, npix, false, isa);
+                    break;
+
+                case FORMAT_RGB:
+                    dropAlpha(bgra, dst, npix, true, isa);
+                    break;
+
+                case FORMAT_GRAY:
+                    gray(bgra, dst, npix, isa);
+                    break;
+
+                case FORMAT_BGR_HALF:
+                    for (uint16_t r=0; r<rows/2; ++r) {
+                        const uint8_t * row0 = bgra + (size_t)(2*r) * cols * 4;
+                        halfRow(row0, row0 + (size_t)cols*4, dst + (size_t)r * (cols/2) * 3, cols/2, isa);
+                    }
+                    break;
+
+                default:
+                    break;
+            }
+        }
+
+        // Best instruction set supported by this CPU
+        static Isa_t bestIsa(void)
+        {
+            static Isa_t isa = detectIsa();
+            return isa;
+        }
+
+        static bool supported(Isa_t isa)
+        {
+            switch (isa) {
+                case ISA_AUTO:
+                case ISA_SCALAR:
+                    return true;
+#if defined(PIXCONV_X86)
+                case ISA_SSSE3:
+                    return bestIsa() == ISA_SSSE3 || bestIsa() == ISA_AVX2;
+                case ISA_AVX2:
+                    return bestIsa() == ISA_AVX2;
+#elif defined(PIXCONV_NEON)
+                case ISA_NEON:
+                    return true;
+#endif
+                default:
+                    return false;
+            }
+        }
+
+    private:
+
+        // Luma weights scaled to 128 so that a pair sum fits a signed 16-bit lane
+        static const uint8_t WB = 15;
+        static const uint8_t WG = 75;
+        static const uint8_t WR = 38;
+
+        static Isa_t detectIsa(void)
+        {
+#if defined(PIXCONV_X86)
+#ifdef _MSC_VER
+            int info[4];
+            __cpuid(info, 1);
+            bool ssse3 = (info[2] & (1<<9)) != 0;
+            bool osxsave = (info[2] & (1<<27)) != 0;
+            __cpuidex(info, 7, 0);
+            bool avx2 = osxsave && (info[1] & (1<<5)) && ((_xgetbv(0) & 6) == 6);
+#else
+            __builtin_cpu_init();
+            bool ssse3 = __builtin_cpu_supports("ssse3");
+            bool avx2 = __builtin_cpu_supports("avx2");
+#endif
+            return avx2 ? ISA_AVX2 : (ssse3 ? ISA_SSSE3 : ISA_SCALAR);
+#elif defined(PIXCONV_NEON)
+            return ISA_NEON;
+#else
+            return ISA_SCALAR;
+#endif
+        }
+
+        // Scalar reference kernels -------------------------------------------------------
+
+        static void dropAlphaScalar(const uint8_t * src, uint8_t * dst, size_t npix, bool swap)
+        {
+            uint8_t c0 = swap ? 2 : 0;
+            uint8_t c2 = swap ? 0 : 2;
+
+            for (size_t i=0; i<npix; ++i) {
+                dst[0] = src[c0];
+                dst[1] = src[1];
+                dst[2] = src[c2];
+                src += 4;
+                dst += 3;
+            }
+        }
+
+        static void grayScalar(const uint8_t * src, uint8_t * dst, size_t npix)
+        {
+            for (size_t i=0; i<npix; ++i) {
+                dst[i] = (uint8_t)((WB*src[0] + WG*src[1] + WR*src[2] + 64) >> 7);
+                src += 4;
+            }
+        }
+
+        // Rounded pairwise mean, matching pavgb / vrhadd
+        static uint8_t avg(uint8_t a, uint8_t b)
+        {
+            return (uint8_t)((a + b + 1) >> 1);
+        }
+
+        static void halfRowScalar(const uint8_t * row0, const uint8_t * row1, uint8_t * dst, uint16_t ocols)
+        {
+            for (uint16_t c=0; c<ocols; ++c) {
+                for (uint8_t k=0; k<3; ++k) {
+                    dst[k] = avg(avg(row0[k], row1[k]), avg(row0[4+k], row1[4+k]));
+                }
+                row0 += 8;
+                row1 += 8;
+                dst += 3;
+            }
+        }
+
+        // Dispatchers ----------------------------------------------------------------
+
+        static void dropAlpha(const uint8_t * src, uint8_t * dst, size_t npix, bool swap, Isa_t isa)
+        {
+            size_t done = 0;
+
+#if defined(PIXCONV_X86)
+            if (isa == ISA_AVX2) {
+                done = dropAlphaAvx2(src, dst, npix, swap);
+            }
+            else if (isa == ISA_SSSE3) {
+                done = dropAlphaSsse3(src, dst, npix, swap);
+            }
+#elif defined(PIXCONV_NEON)
+            if (isa == ISA_NEON) {
+                done = dropAlphaNeon(src, dst, npix, swap);
+            }
+#else
+            (void)isa;
+#endif
+            dropAlphaScalar(src + 4*done, dst + 3*done, npix - done, swap);
+        }
+
+        static void gray(const uint8_t * src, uint8_t * dst, size_t npix, Isa_t isa)
+        {
+            size_t done = 0;
+
+#if defined(PIXCONV_X86)
+            if (isa == ISA_AVX2 || isa == ISA_SSSE3) {
+                done = graySsse3(src, dst, npix);
+            }
+#elif defined(PIXCONV_NEON)
+            if (isa == ISA_NEON) {
+                done = grayNeon(src, dst, npix);
+            }
+#else
+            (void)isa;
+#endif
+            grayScalar(src + 4*done, dst + done, npix - done);
+        }
+
+        static void halfRow(const uint8_t * row0, const uint8_t * row1, uint8_t * dst, uint16_t ocols, Isa_t isa)
+        {
+            uint16_t done = 0;
+
+#if defined(PIXCONV_X86)
+            if (isa == ISA_AVX2 || isa == ISA_SSSE3) {
+                done = halfRowSsse3(row0, row1, dst, ocols);
+            }
+#elif defined(PIXCONV_NEON)
+            if (isa == ISA_NEON) {
+                done = halfRowNeon(row0, row1, dst, ocols);
+            }
+#else
+            (void)isa;
+#endif
+            halfRowScalar(row0 + 8*done, row1 + 8*done, dst + 3*done, ocols - done);
+        }
+
+        // SIMD kernels: each returns the number of pixels it handled -----------------
+
+#if defined(PIXCONV_X86)
+
+        PIXCONV_TARGET("ssse3")
+        static size_t dropAlphaSsse3(const uint8_t * src, uint8_t * dst, size_t npix, bool swap)
+        {
+            // Packs four BGRA pixels into the low 12 bytes
+            const __m128i mask = swap ?
+                _mm_setr_epi8(2,1,0, 6,5,4, 10,9,8, 14,13,12, -1,-1,-1,-1) :
+                _mm_setr_epi8(0,1,2, 4,5,6, 8,9,10, 12,13,14, -1,-1,-1,-1);
+
+            size_t n = npix & ~(size_t)15;
+
+            for (size_t i=0; i<n; i+=16) {
+
+                __m128i a = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src)),    mask);
+                __m128i b = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src+16)), mask);
+                __m128i c = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src+32)), mask);
+                __m128i d = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src+48)), mask);
+
+                // Stitch 4 x 12 bytes into 3 x 16 bytes
+                _mm_storeu_si128((__m128i *)(dst),    _mm_or_si128(a, _mm_slli_si128(b, 12)));
+                _mm_storeu_si128((__m128i *)(dst+16), _mm_or_si128(_mm_srli_si128(b, 4), _mm_slli_si128(c, 8)));
+                _mm_storeu_si128((__m128i *)(dst+32), _mm_or_si128(_mm_srli_si128(c, 8), _mm_slli_si128(d, 4)));
+
+                src += 64;
+                dst += 48;
+            }
+
+            return n;
+        }
+
+        PIXCONV_TARGET("avx2")
+        static size_t dropAlphaAvx2(const uint8_t * src, uint8_t * dst, size_t npix, bool swap)
+        {
+            const __m256i mask = swap ?
+                _mm256_setr_epi8(2,1,0, 6,5,4, 10,9,8, 14,13,12, -1,-1,-1,-1,
+                                 2,1,0, 6,5,4, 10,9,8, 14,13,12, -1,-1,-1,-1) :
+                _mm256_setr_epi8(0,1,2, 4,5,6, 8,9,10, 12,13,14, -1,-1,-1,-1,
+                                 0,1,2, 4,5,6, 8,9,10, 12,13,14, -1,-1,-1,-1);
+
+            // Moves the two 12-byte lane results next to each other
+            const __m256i pack = _mm256_setr_epi32(0,1,2, 4,5,6, 3,7);
+
+            // Stop one block early so the 32-byte store never runs past the output
+            size_t n = npix >= 8 ? (npix - 8) & ~(size_t)7 : 0;
+
+            for (size_t i=0; i<n; i+=8) {
+
+                __m256i v = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)src), mask);
+                _mm256_storeu_si256((__m256i *)dst, _mm256_permutevar8x32_epi32(v, pack));
+
+                src += 32;
+                dst += 24;
+            }
+
+            return n;
+        }
+
+        PIXCONV_TARGET("ssse3")
+        static size_t graySsse3(const uint8_t * src, uint8_t * dst, size_t npix)
+        {
+            const __m128i weights = _mm_setr_epi8(WB,WG,WR,0, WB,WG,WR,0, WB,WG,WR,0, WB,WG,WR,0);
+            const __m128i round = _mm_set1_epi16(64);
+
+            size_t n = npix & ~(size_t)15;
+
+            for (size_t i=0; i<n; i+=16) {
+
+                // (B*wb + G*wg, R*wr) pairs, then horizontal add gives one sum per pixel
+                __m128i a = _mm_maddubs_epi16(_mm_loadu_si128((const __m128i *)(src)),    weights);
+                __m128i b = _mm_maddubs_epi16(_mm_loadu_si128((const __m128i *)(src+16)), weights);
+                __m128i c = _mm_maddubs_epi16(_mm_loadu_si128((const __m128i *)(src+32)), weights);
+                __m128i d = _mm_maddubs_epi16(_mm_loadu_si128((const __m128i *)(src+48)), weights);
+
+                __m128i lo = _mm_srli_epi16(_mm_add_epi16(_mm_hadd_epi16(a, b), round), 7);
+                __m128i hi = _mm_srli_epi16(_mm_add_epi16(_mm_hadd_epi16(c, d), round), 7);
+
+                _mm_storeu_si128((__m128i *)dst, _mm_packus_epi16(lo, hi));
+
+                src += 64;
+                dst += 16;
+            }
+
+            return n;
+        }
+
+        PIXCONV_TARGET("ssse3")
+        static uint16_t halfRowSsse3(const uint8_t * row0, const uint8_t * row1, uint8_t * dst, uint16_t ocols)
+        {
+            // Picks pixels 0 and 2 of each averaged quad, dropping alpha
+            const __m128i pick = _mm_setr_epi8(0,1,2, 8,9,10, -1,-1,-1,-1,-1,-1,-1,-1,-1,-1);
+
+            // Each iteration consumes 16 source pixels and writes 8 output pixels (24 bytes);
+            // stop early so the final 16-byte store stays inside the row
+            uint16_t n = ocols >= 8 ? (uint16_t)((ocols - 4) & ~7) : 0;
+
+            for (uint16_t i=0; i<n; i+=8) {
+
+                __m128i out[4];
+
+                for (uint8_t k=0; k<4; ++k) {
+                    __m128i v = _mm_avg_epu8(_mm_loadu_si128((const __m128i *)(row0 + 16*k)),
+                                             _mm_loadu_si128((const __m128i *)(row1 + 16*k)));
+                    v = _mm_avg_epu8(v, _mm_srli_si128(v, 4));
+                    out[k] = _mm_shuffle_epi8(v, pick);
+                }
+
+                _mm_storeu_si128((__m128i *)dst,
+                        _mm_or_si128(_mm_or_si128(out[0], _mm_slli_si128(out[1], 6)), _mm_slli_si128(out[2], 12)));
+                _mm_storeu_si128((__m128i *)(dst+16), _mm_or_si128(_mm_srli_si128(out[2], 4), _mm_slli_si128(out[3], 2)));
+
+                row0 += 64;
+                row1 += 64;
+                dst += 24;
+            }
+
+            return n;
+        }
+
+#elif defined(PIXCONV_NEON)
+
+        static size_t dropAlphaNeon(const uint8_t * src, uint8_t * dst, size_t npix, bool swap)
+        {
+            size_t n = npix & ~(size_t)15;
+
+            for (size_t i=0; i<n; i+=16) {
+
+                uint8x16x4_t v = vld4q_u8(src);
+                uint8x16x3_t o;
+                o.val[0] = swap ? v.val[2] : v.val[0];
+                o.val[1] = v.val[1];
+                o.val[2] = swap ? v.val[0] : v.val[2];
+                vst3q_u8(dst, o);
+
+                src += 64;
+                dst += 48;
+            }
+
+            return n;
+        }
+
+        static size_t grayNeon(const uint8_t * src, uint8_t * dst, size_t npix)
+        {
+            size_t n = npix & ~(size_t)7;
+
+            for (size_t i=0; i<n; i+=8) {
+
+                uint8x8x4_t v = vld4_u8(src);
+                uint16x8_t s = vmull_u8(v.val[0], vdup_n_u8(WB));
+                s = vmlal_u8(s, v.val[1], vdup_n_u8(WG));
+                s = vmlal_u8(s, v.val[2], vdup_n_u8(WR));
+                vst1_u8(dst, vrshrn_n_u16(s, 7));
+
+                src += 32;
+                dst += 8;
+            }
+
+            return n;
+        }
+
+        static uint16_t halfRowNeon(const uint8_t * row0, const uint8_t * row1, uint8_t * dst, uint16_t ocols)
+        {
+            uint16_t n = ocols & ~7;
+
+            for (uint16_t i=0; i<n; i+=8) {
+
+                uint8x16x4_t a = vld4q_u8(row0);
+                uint8x16x4_t b = vld4q_u8(row1);
+                uint8x8x3_t o;
+
+                for (uint8_t k=0; k<3; ++k) {
+                    uint8x16_t v = vrhaddq_u8(a.val[k], b.val[k]);
+                    uint8x16x2_t eo = vuzpq_u8(v, v);
+                    o.val[k] = vrhadd_u8(vget_low_u8(eo.val[0]), vget_low_u8(eo.val[1]));
+                }
+
+                vst3_u8(dst, o);
+
+                row0 += 64;
+                row1 += 64;
+                dst += 24;
+            }
+
+            return n;
+        }
+
+#endif
+
+}; // class PixelConversion
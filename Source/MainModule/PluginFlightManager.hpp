@@ -0,0 +1,93 @@
+/*
+ * Flight manager running a controller plugin, reloaded when it is rebuilt
+ *
+ * The plugin (see control/ControllerPlugin.h) is watched for changes between
+ * control steps and reloaded on the flight thread, so rebuilding it takes
+ * effect in flight without restarting the editor.  Until a plugin loads, or
+ * if it gives motor values that aren't numbers, a CascadedController flies
+ * the vehicle instead.
+ *
+ * Copyright (C) 2019 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include "FlightManager.hpp"
+#include "control/CascadedController.hpp"
+#include "control/PluginController.hpp"
+
+class FPluginFlightManager : public FFlightManager {
+
+    private:
+
+        // Simulated seconds between looks at the plugin file
+        static constexpr double POLL_PERIOD = 0.5;
+
+        PluginController _plugin;
+
+        CascadedController _fallback;
+
+        double _previousTime = 0;
+        double _pollTime = 0;
+
+        // Whether the last step was flown by the plugin, to report changes
+        bool _flying = false;
+
+        virtual void getMotors(const double time, const MultirotorDynamics::state_t & state, double * motorvals) override
+        {
+            if (time - _pollTime >= POLL_PERIOD) {
+                _pollTime = time;
+                if (_plugin.poll()) {
+                    MCS_DEBUG("Controller plugin: %s", _plugin.getMessage());
+                }
+            }
+
+            const double dt = time - _previousTime;
+            _previousTime = time;
+
+            const bool flying = _plugin.update(time, dt, state, motorvals);
+
+            // Keep the fallback's loops running, so it takes over smoothly
+            double fallbackvals[FFlightManager::MAX_MOTORS] = {};
+            _fallback.update(state, dt, fallbackvals);
+
+            if (!flying) {
+                for (uint8_t k=0; k<_motorCount; ++k) {
+                    motorvals[k] = fallbackvals[k];
+                }
+            }
+
+            if (flying != _flying && _plugin.isLoaded()) {
+                MCS_DEBUG(flying ? "Controller plugin flying" : "Controller plugin gave bad motor values; falling back");
+            }
+
+            _flying = flying;
+        }
+
+    public:
+
+        /**
+         * @param dynamics vehicle dynamics
+         * @param path controller plugin shared library
+         * @param fallback gains and limits for the controller that flies when the plugin can't
+         * @param mixer motor layout for the fallback controller
+         * @param rate steps per second when managers share the pool
+         */
+        FPluginFlightManager(MultirotorDynamics * dynamics, const char * path,
+                const CascadedController::config_t & fallback, const Mixer & mixer, double rate=1000)
+            : FFlightManager(dynamics, rate), _plugin(dynamics->motorCount()), _fallback(fallback, mixer)
+        {
+            if (!_plugin.load(path)) {
+                MCS_ERROR("Controller plugin: %s", _plugin.getMessage());
+            }
+        }
+
+        // Where to hold the vehicle while the fallback flies it
+        void setFallbackSetpoint(const CascadedController::setpoint_t & setpoint)
+        {
+            _fallback.setSetpoint(setpoint);
+        }
+
+}; // class FPluginFlightManager
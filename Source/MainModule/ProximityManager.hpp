@@ -0,0 +1,226 @@
+/*
+ * Threaded proximity checking for vehicles and targets
+ *
+ * Runs on the flight side at a fixed rate, reading each vehicle's newest
+ * published state and each target's location into a SpatialHash, so checks
+ * stay cheap with hundreds of agents and do not depend on UE4 overlap events.
+ * Override onEvent() to react to collisions and near misses; flight managers
+ * can ask for their neighbors at any time.
+ *
+ * Everything is in NED meters relative to the world origin.
+ *
+ * Copyright (C) 2019 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include "FlightManager.hpp"
+#include "TargetManager.hpp"
+#include "SpatialHash.hpp"
+
+class FProximityManager : public FThreadedManager {
+
+    public:
+
+        // Returned by addVehicle() and addTarget() when there is no room for another agent
+        static const uint32_t ID_NONE = UINT32_MAX;
+
+    private:
+
+        typedef struct {
+
+            FFlightManager * flightManager;
+            FTargetManager * targetManager;
+            double origin[3];
+            double radius;
+            SpatialHash::Kind_t kind;
+
+        } source_t;
+
+        // Added from any thread, under _lock
+        TArray<source_t> _sources;
+        FCriticalSection _lock;
+
+        typedef struct {
+
+            double location[3];
+            bool located;
+
+        } fix_t;
+
+        // The proximity thread's copy of the sources, and where each one is this check
+        TArray<source_t> _snapshot;
+        TArray<fix_t> _fixes;
+        uint32_t _registered = 0;
+
+        // Only the proximity thread changes the hash: locations under _hashLock, which queries take too, and
+        // encounters without it, since queries never read them
+        SpatialHash _hash;
+        FCriticalSection _hashLock;
+
+        // Statistics as of the latest check, under _hashLock
+        double _minSeparation = INFINITY;
+        uint32_t _collisions = 0;
+        uint32_t _nearMisses = 0;
+
+        uint32_t _maxAgents = 0;
+
+        uint32_t addSource(const source_t & source)
+        {
+            FScopeLock lock(&_lock);
+
+            uint32_t id = _sources.Num();
+
+            if (id >= _maxAgents) return ID_NONE;
+
+            _sources.Add(source);
+
+            return id;
+        }
+
+    protected:
+
+        virtual void performTask(double currentTime) override
+        {
+            // Sources are only ever added, so copy the new ones
+            {
+                FScopeLock lock(&_lock);
+                for (int32 k=_snapshot.Num(); k<_sources.Num(); ++k) {
+                    _snapshot.Add(_sources[k]);
+                }
+            }
+
+            const uint32_t count = _snapshot.Num();
+
+            _fixes.SetNum(count);
+
+            for (uint32_t id=0; id<count; ++id) {
+
+                const source_t & source = _snapshot[id];
+                fix_t & fix = _fixes[id];
+
+                fix.located = false;
+
+                if (source.flightManager) {
+
+                    StateHistory::sample_t sample;
+                    if (!source.flightManager->getHistory().latest(sample)) continue;
+
+                    for (uint8_t k=0; k<3; ++k) {
+                        fix.location[k] = source.origin[k] + sample.pose.location[k];
+                    }
+                }
+
+                else {
+
+                    // Targets report world locations in centimeters
+                    FVector target = source.targetManager->getLocation();
+                    fix.location[0] = target.X / 100;
+                    fix.location[1] = target.Y / 100;
+                    fix.location[2] = -target.Z / 100;
+                }
+
+                fix.located = true;
+            }
+
+            {
+                FScopeLock lock(&_hashLock);
+
+                for (; _registered<count; ++_registered) {
+                    _hash.setAgent(_registered, _snapshot[_registered].radius, _snapshot[_registered].kind);
+                }
+
+                for (uint32_t id=0; id<count; ++id) {
+                    if (_fixes[id].located) {
+                        _hash.update(id, _fixes[id].location);
+                    }
+                }
+            }
+
+            const std::vector<SpatialHash::event_t> & events = _hash.detect(currentTime);
+
+            {
+                FScopeLock lock(&_hashLock);
+                _minSeparation = _hash.getMinSeparation();
+                _collisions = _hash.getCollisions();
+                _nearMisses = _hash.getNearMisses();
+            }
+
+            for (const SpatialHash::event_t & event : events) {
+                onEvent(event);
+            }
+        }
+
+        // Called on the proximity thread for each collision or near miss
+        virtual void onEvent(const SpatialHash::event_t & event)
+        {
+            (void)event;
+        }
+
+    public:
+
+        /**
+         * @param maxAgents most vehicles and targets that can be added
+         * @param cellSize grid spacing in meters
+         * @param nearMissDistance surface distance in meters below which an encounter counts as a near miss
+         * @param rate checks per second, in the shared pool or on our own thread
+         */
+        FProximityManager(uint32_t maxAgents=1024, double cellSize=2, double nearMissDistance=1, double rate=1000)
+            : FThreadedManager(rate, true), _hash(maxAgents, cellSize, nearMissDistance)
+        {
+            _maxAgents = maxAgents;
+        }
+
+        /**
+         * Adds a vehicle, whose NED locations are relative to its start location.
+         *
+         * @return the vehicle's id for neighbor queries and events, or ID_NONE if maxAgents have been added
+         */
+        uint32_t addVehicle(FFlightManager * flightManager, const double origin[3], double radius)
+        {
+            source_t source = { flightManager, NULL, { origin[0], origin[1], origin[2] }, radius, SpatialHash::KIND_VEHICLE };
+            return addSource(source);
+        }
+
+        // @return the target's id, or ID_NONE if maxAgents have been added
+        uint32_t addTarget(FTargetManager * targetManager, double radius)
+        {
+            source_t source = { NULL, targetManager, {}, radius, SpatialHash::KIND_TARGET };
+            return addSource(source);
+        }
+
+        /**
+         * Finds agents whose surfaces are within a distance of an agent's surface, as of the latest check.
+         * Thread-safe.
+         *
+         * @return number found, which may exceed capacity; zero for ID_NONE or an agent not yet checked
+         */
+        uint32_t getNeighbors(uint32_t id, double distance, uint32_t * neighbors, uint32_t capacity)
+        {
+            if (id >= _maxAgents) return 0;
+
+            FScopeLock lock(&_hashLock);
+            return _hash.neighbors(id, distance, neighbors, capacity);
+        }
+
+        double getMinSeparation(void)
+        {
+            FScopeLock lock(&_hashLock);
+            return _minSeparation;
+        }
+
+        uint32_t getCollisions(void)
+        {
+            FScopeLock lock(&_hashLock);
+            return _collisions;
+        }
+
+        uint32_t getNearMisses(void)
+        {
+            FScopeLock lock(&_hashLock);
+            return _nearMisses;
+        }
+
+}; // class FProximityManager
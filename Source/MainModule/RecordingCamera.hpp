@@ -0,0 +1,225 @@
+/*
+ * Camera sink that records frames into a memory-mapped FrameDataset
+ *
+ * Frames are converted into a queue slot on the camera task and appended to
+ * the dataset by a worker thread, so recording never waits on the disk.  Every
+ * frame is indexed with its id, time, the vehicle pose at capture and the
+ * camera id.  Several cameras can share one FrameDatasetWriter.
+ *
+ * Open the writer before play begins and close it after the cameras have been
+ * destroyed; FrameDatasetReader reads the result, with or without the engine.
+ *
+ * Copyright (C) 2019 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include "Camera.hpp"
+#include "FrameQueue.hpp"
+#include "PixelConversion.hpp"
+
+#include "Runnable.h"
+#include "RunnableThread.h"
+
+#pragma push_macro("TEXT")
+#ifdef _WIN32
+#include "Windows/AllowWindowsPlatformTypes.h"
+#endif
+#include "FrameDataset.hpp"
+#ifdef _WIN32
+#include "Windows/HideWindowsPlatformTypes.h"
+#endif
+#pragma pop_macro("TEXT")
+
+class RecordingCamera : public Camera, public FRunnable {
+
+    private:
+
+        // Recording should ride out disk hiccups rather than drop frames
+        static const uint8_t  QUEUE_LENGTH = 8;
+        static const uint32_t WAIT_MSEC    = 100;
+
+        FrameDatasetWriter * _writer = NULL;
+
+        FrameCodec::Encoding_t _encoding;
+        PixelConversion::Format_t _format;
+
+        FrameQueue * _queue = NULL;
+
+        FRunnableThread * _thread = NULL;
+        FEvent * _frameReady = NULL;
+        FThreadSafeBool _running = false;
+
+        // Worker-owned encoding state
+        FrameCodec _codec;
+        uint8_t * _scratch = NULL;
+        size_t _scratchCapacity = 0;
+
+        FThreadSafeCounter _framesRecorded;
+        FThreadSafeCounter _framesRejected;
+
+        Metrics::Counter _framesRecordedMetric;
+        Metrics::Counter _framesRejectedMetric;
+
+        void recordSlot(int32 slot)
+        {
+            Trace::Scope scope("RecordingCamera::record");
+
+            const FrameQueue::info_t & queued = _queue->info(slot);
+
+            FrameDataset::info_t info = {};
+            info.frameId = queued.frameId;
+            info.cameraId = _id;
+            info.time = queued.timestamp;
+            for (uint8_t k=0; k<3; ++k) {
+                info.location[k] = queued.pose.location[k];
+                info.rotation[k] = queued.pose.rotation[k];
+            }
+
+            bool ok = _writer->append(info, _queue->bytes(slot), PixelConversion::channels(_format),
+                    PixelConversion::outputRows(_format, _rows), PixelConversion::outputCols(_format, _cols),
+                    _encoding, _codec, _scratch, _scratchCapacity);
+
+            if (ok) {
+                _framesRecorded.Increment();
+                _framesRecordedMetric.increment();
+            }
+            else {
+                _framesRejected.Increment();
+                _framesRejectedMetric.increment();
+            }
+        }
+
+    protected:
+
+        /**
+         * @param fov field of view
+         * @param resolution render-target resolution
+         * @param writer open dataset, possibly shared with other cameras
+         * @param encoding RAW, RLE or LZ4
+         * @param format pixel format to store
+         * @param dropPolicy what to do with frames if the disk falls behind
+         */
+        RecordingCamera(float fov, Resolution_t resolution, FrameDatasetWriter * writer,
+                FrameCodec::Encoding_t encoding=FrameCodec::ENCODING_RAW,
+                PixelConversion::Format_t format=PixelConversion::FORMAT_BGR,
+                FrameQueue::DropPolicy_t dropPolicy=FrameQueue::DROP_NEWEST)
+            : Camera(fov, resolution)
+        {
+            _writer = writer;
+            _encoding = encoding;
+            _format = format;
+
+            size_t slotSize = (size_t)PixelConversion::outputRows(format, _rows) *
+                PixelConversion::outputCols(format, _cols) * PixelConversion::channels(format);
+
+            _queue = new FrameQueue(slotSize, dropPolicy, QUEUE_LENGTH);
+
+            _scratchCapacity = FrameCodec::maxEncodedSize(slotSize, PixelConversion::channels(format));
+            _scratch = new uint8_t [_scratchCapacity];
+
+            _frameReady = FPlatformProcess::GetSynchEventFromPool(false);
+        }
+
+        virtual void addToVehicle(APawn * pawn, USpringArmComponent * springArm, uint8_t id) override
+        {
+            Camera::addToVehicle(pawn, springArm, id);
+
+            char labels[40];
+            SPRINTF(labels, "camera=\"%d\",sink=\"record\"", id);
+
+            Metrics & metrics = Metrics::get();
+            _framesRecordedMetric = metrics.counter("multicopter_camera_frames_recorded_total",
+                    "Camera frames written to a dataset", labels);
+            _framesRejectedMetric = metrics.counter("multicopter_camera_frames_rejected_total",
+                    "Camera frames the dataset had no room for", labels);
+            _queue->setMetrics(labels);
+        }
+
+        // Runs on the game thread or a camera task: convert and hand off, never wait on the disk
+        virtual void processImageBytes(uint8_t * bytes) override
+        {
+            if (!_writer) return;
+
+            if (!_thread) {
+                _running = true;
+                _thread = FRunnableThread::Create(this, TEXT("RecordingCamera"), 0, TPri_BelowNormal);
+            }
+
+            int32 slot = _queue->acquire();
+
+            if (slot < 0) return;
+
+            PixelConversion::convert(bytes, _queue->bytes(slot), _rows, _cols, _format);
+
+            _queue->info(slot).timestamp = getTimestamp();
+            _queue->info(slot).pose = getPose();
+
+            _queue->commit(slot);
+
+            _frameReady->Trigger();
+        }
+
+    public:
+
+        uint32_t getFramesRecorded(void)
+        {
+            return _framesRecorded.GetValue();
+        }
+
+        // Frames lost because the queue was full or the dataset ran out of space
+        uint32_t getFramesDropped(void)
+        {
+            return _queue->getDropped() + _framesRejected.GetValue();
+        }
+
+        // FRunnable interface, running on the worker thread
+
+        virtual uint32 Run() override
+        {
+            Trace::get().setThreadName("RecordingCamera");
+
+            while (true) {
+
+                int32 slot = _queue->take();
+
+                if (slot < 0) {
+
+                    // Drain everything queued before stopping
+                    if (!_running) break;
+
+                    _frameReady->Wait(WAIT_MSEC);
+                    continue;
+                }
+
+                recordSlot(slot);
+
+                _queue->release(slot);
+            }
+
+            return 0;
+        }
+
+        virtual void Stop() override
+        {
+            _running = false;
+            _frameReady->Trigger();
+        }
+
+        virtual ~RecordingCamera()
+        {
+            if (_thread) {
+                Stop();
+                _thread->WaitForCompletion();
+                delete _thread;
+            }
+
+            FPlatformProcess::ReturnSynchEventToPool(_frameReady);
+
+            delete _queue;
+            delete[] _scratch;
+        }
+
+}; // Class RecordingCamera
@@ -0,0 +1,308 @@
+/*
+ * Simulation clock shared by all managers
+ *
+ * By default simulated time is wall-clock time.  Scaled, it runs at a
+ * multiple of wall-clock speed, e.g. 0.25 for debugging or 5 for soak tests.
+ * Stepped, it moves one step at a time when the manager driving it, and
+ * every other manager due by then, have finished their steps, so the
+ * simulation runs as fast as the managers can step, in lockstep.  Switching
+ * modes never makes the time jump.
+ *
+ * Readers take the time without locking: the clock is a line through an
+ * anchor point, guarded by a sequence counter that is odd while it changes.
+ *
+ * Copyright (C) 2019 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#include <atomic>
+
+class SimClock {
+
+    public:
+
+        typedef enum {
+
+            MODE_WALL,
+            MODE_SCALED,
+            MODE_STEPPED
+
+        } Mode_t;
+
+    private:
+
+        // Achieved real-time factor is measured over at least this many wall-clock seconds
+        static constexpr double RTF_WINDOW = 1.0;
+
+        // Simulated time is simAnchor + (wall - wallAnchor) * speed
+        std::atomic<uint32_t> _sequence;
+        double _simAnchor = 0;
+        double _wallAnchor = 0;
+        double _speed = 1;
+
+        // Writers take the lock; readers use the sequence counter
+        FCriticalSection _lock;
+
+        std::atomic<Mode_t> _mode;
+        double _step = 0.001;
+        std::atomic<const void *> _driver;
+
+        // Managers the driver of a stepped clock waits for, with the simulated times they are next due
+        typedef struct {
+
+            const void * owner;
+            const std::atomic<double> * due;
+
+        } follower_t;
+
+        TArray<follower_t> _followers;
+
+        // For the achieved real-time factor
+        double _rtfWall = 0;
+        double _rtfSim = 0;
+        double _rtf = 1;
+
+        SimClock(void)
+            : _sequence(0), _mode(MODE_WALL), _driver(NULL)
+        {
+            _wallAnchor = FPlatformTime::Seconds();
+            _rtfWall = _wallAnchor;
+        }
+
+        // Call with the lock held
+        void reanchor(double speed)
+        {
+            double wall = FPlatformTime::Seconds();
+            double sim = at(wall);
+
+            const uint32_t sequence = _sequence.load(std::memory_order_relaxed);
+
+            _sequence.store(sequence + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+
+            _simAnchor = sim;
+            _wallAnchor = wall;
+            _speed = speed;
+
+            _sequence.store(sequence + 2, std::memory_order_release);
+        }
+
+        void read(double & simAnchor, double & wallAnchor, double & speed)
+        {
+            while (true) {
+
+                const uint32_t sequence = _sequence.load(std::memory_order_acquire);
+
+                if (sequence & 1) {
+                    continue;
+                }
+
+                simAnchor = _simAnchor;
+                wallAnchor = _wallAnchor;
+                speed = _speed;
+
+                std::atomic_thread_fence(std::memory_order_acquire);
+
+                if (_sequence.load(std::memory_order_relaxed) == sequence) {
+                    return;
+                }
+            }
+        }
+
+        // Simulated time at a wall-clock time
+        double at(double wall)
+        {
+            double simAnchor = 0, wallAnchor = 0, speed = 0;
+            read(simAnchor, wallAnchor, speed);
+
+            return simAnchor + (wall - wallAnchor) * speed;
+        }
+
+    public:
+
+        static SimClock & get(void)
+        {
+            static SimClock clock;
+            return clock;
+        }
+
+        // Simulated seconds since the clock was first used; callable from any thread
+        double now(void)
+        {
+            return at(FPlatformTime::Seconds());
+        }
+
+        /**
+         * Wall-clock seconds for a span of simulated time; zero when stepped, when simulated time
+         * doesn't depend on the wall clock.
+         */
+        double toWall(double simSeconds)
+        {
+            double simAnchor = 0, wallAnchor = 0, speed = 0;
+            read(simAnchor, wallAnchor, speed);
+
+            return speed > 0 ? simSeconds / speed : 0;
+        }
+
+        Mode_t getMode(void)
+        {
+            return _mode;
+        }
+
+        // Simulated time runs with the wall clock
+        void setWall(void)
+        {
+            FScopeLock lock(&_lock);
+            _mode = MODE_WALL;
+            reanchor(1);
+        }
+
+        /**
+         * Simulated time runs at a multiple of wall-clock speed.
+         *
+         * @param factor simulated seconds per wall-clock second
+         */
+        void setScaled(double factor)
+        {
+            FScopeLock lock(&_lock);
+            _mode = MODE_SCALED;
+            reanchor(factor > 0 ? factor : 1);
+        }
+
+        /**
+         * Simulated time moves only by advance(), by a fixed step each time.  With no driver, it
+         * stands still.
+         *
+         * @param step simulated seconds per step
+         */
+        void setStepped(double step)
+        {
+            FScopeLock lock(&_lock);
+            _mode = MODE_STEPPED;
+            _step = step;
+            reanchor(0);
+        }
+
+        double getStep(void)
+        {
+            return _step;
+        }
+
+        /**
+         * Makes a manager the one that steps the clock, if no other is.
+         *
+         * @return true if the manager now drives the clock
+         */
+        bool claim(const void * driver)
+        {
+            FScopeLock lock(&_lock);
+
+            if (!_driver.load()) {
+                _driver = driver;
+            }
+
+            return _driver.load() == driver;
+        }
+
+        void release(const void * driver)
+        {
+            FScopeLock lock(&_lock);
+
+            if (_driver.load() == driver) {
+                _driver = NULL;
+            }
+        }
+
+        bool isDriver(const void * driver)
+        {
+            return _driver.load(std::memory_order_relaxed) == driver;
+        }
+
+        /**
+         * Makes the driver of a stepped clock wait for a manager.
+         *
+         * @param owner the manager
+         * @param due simulated time at which it next needs to step, updated by the manager
+         */
+        void follow(const void * owner, const std::atomic<double> * due)
+        {
+            FScopeLock lock(&_lock);
+
+            follower_t follower = { owner, due };
+            _followers.Add(follower);
+        }
+
+        void unfollow(const void * owner)
+        {
+            FScopeLock lock(&_lock);
+
+            for (int32 k=_followers.Num()-1; k>=0; --k) {
+                if (_followers[k].owner == owner) {
+                    _followers.RemoveAtSwap(k);
+                }
+            }
+        }
+
+        // True once the clock has reached a simulated time; stepped, to within half a step
+        bool reached(double time)
+        {
+            return now() >= (_mode == MODE_STEPPED ? time - _step / 2 : time);
+        }
+
+        /**
+         * Moves stepped time on by one step; called by the driver after each of its steps.
+         *
+         * @return false, without moving, while another manager due by now has yet to step
+         */
+        bool advance(const void * driver)
+        {
+            FScopeLock lock(&_lock);
+
+            if (_mode != MODE_STEPPED) {
+                return true;
+            }
+
+            for (const follower_t & follower : _followers) {
+                if (follower.owner != driver && reached(follower.due->load())) {
+                    return false;
+                }
+            }
+
+            const uint32_t sequence = _sequence.load(std::memory_order_relaxed);
+
+            _sequence.store(sequence + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+
+            _simAnchor += _step;
+
+            _sequence.store(sequence + 2, std::memory_order_release);
+
+            return true;
+        }
+
+        /**
+         * Simulated seconds per wall-clock second achieved over the last second or so.  Call from one
+         * thread, e.g. the game thread each tick.
+         */
+        double getRealTimeFactor(void)
+        {
+            FScopeLock lock(&_lock);
+
+            double wall = FPlatformTime::Seconds();
+            double sim = at(wall);
+
+            if (wall - _rtfWall >= RTF_WINDOW) {
+                _rtf = (sim - _rtfSim) / (wall - _rtfWall);
+                _rtfWall = wall;
+                _rtfSim = sim;
+            }
+
+            return _rtf;
+        }
+
+}; // class SimClock
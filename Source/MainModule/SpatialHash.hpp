@@ -0,0 +1,401 @@
+/*
+ * Uniform-grid spatial hash for vehicle and target proximity
+ *
+ * Agents are hashed by the grid cell containing them, and each bucket is an
+ * intrusive linked list, so moving an agent within its cell costs nothing and
+ * moving it to another cell is an unlink and a link.  Proximity checks only
+ * visit the cells around each agent, so they scale with the number of agents
+ * rather than the number of pairs.
+ *
+ * detect() finds every pair whose surfaces are within the near-miss distance
+ * and tracks encounters from one call to the next: a collision is reported
+ * when it begins, and a near miss when an encounter that never touched ends.
+ *
+ * Positions are NED meters in a frame shared by all agents.
+ *
+ * Copyright (C) 2019 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <math.h>
+
+#include <vector>
+#include <algorithm>
+
+class SpatialHash {
+
+    public:
+
+        typedef enum {
+
+            KIND_VEHICLE,
+            KIND_TARGET
+
+        } Kind_t;
+
+        typedef enum {
+
+            EVENT_COLLISION,    // surfaces touched; separation is negative penetration
+            EVENT_NEAR_MISS     // came within the near-miss distance without touching
+
+        } EventType_t;
+
+        typedef struct {
+
+            EventType_t type;
+            uint32_t a;
+            uint32_t b;
+            double time;
+            double separation;  // closest surface distance during the encounter so far
+
+        } event_t;
+
+    private:
+
+        static const int32_t NONE = -1;
+
+        typedef struct {
+
+            bool active;
+            Kind_t kind;
+            double radius;
+            double location[3];
+            int32_t cell[3];
+            uint32_t bucket;
+            int32_t prev;
+            int32_t next;
+
+        } agent_t;
+
+        // Pairs within range, tracked across calls to detect()
+        typedef struct {
+
+            uint64_t key;
+            double minSeparation;
+            bool touched;
+
+        } encounter_t;
+
+        double _cellSize = 1;
+        double _nearMissDistance = 1;
+
+        std::vector<agent_t> _agents;
+        std::vector<int32_t> _buckets;
+        uint32_t _bucketMask = 0;
+
+        double _maxRadius = 0;
+
+        // Reused between calls, so detect() stops allocating once warmed up
+        std::vector<encounter_t> _encounters;
+        std::vector<encounter_t> _current;
+        std::vector<event_t> _events;
+
+        // Statistics
+        double _minSeparation = INFINITY;
+        double _stepMinSeparation = INFINITY;
+        uint32_t _collisions = 0;
+        uint32_t _nearMisses = 0;
+        uint32_t _pairsTested = 0;
+
+        int32_t cellOf(double x) const
+        {
+            return (int32_t)floor(x / _cellSize);
+        }
+
+        uint32_t hash(int32_t ix, int32_t iy, int32_t iz) const
+        {
+            return ((uint32_t)ix * 73856093u ^ (uint32_t)iy * 19349663u ^ (uint32_t)iz * 83492791u) & _bucketMask;
+        }
+
+        void link(uint32_t id)
+        {
+            agent_t & agent = _agents[id];
+
+            agent.bucket = hash(agent.cell[0], agent.cell[1], agent.cell[2]);
+            agent.prev = NONE;
+            agent.next = _buckets[agent.bucket];
+
+            if (agent.next != NONE) {
+                _agents[agent.next].prev = (int32_t)id;
+            }
+
+            _buckets[agent.bucket] = (int32_t)id;
+        }
+
+        void unlink(uint32_t id)
+        {
+            agent_t & agent = _agents[id];
+
+            if (agent.prev != NONE) {
+                _agents[agent.prev].next = agent.next;
+            }
+            else {
+                _buckets[agent.bucket] = agent.next;
+            }
+
+            if (agent.next != NONE) {
+                _agents[agent.next].prev = agent.prev;
+            }
+        }
+
+        static uint64_t pairKey(uint32_t a, uint32_t b)
+        {
+            return ((uint64_t)a << 32) | b;
+        }
+
+        /**
+         * Calls visit(id) for every active agent in the cells overlapping a cube around a point.
+         * Agents from other cells that share a bucket are skipped.
+         */
+        template <typename Visitor>
+        void visitCells(const double location[3], double range, Visitor visit) const
+        {
+            int32_t lo[3], hi[3];
+            for (uint8_t k=0; k<3; ++k) {
+                lo[k] = cellOf(location[k] - range);
+                hi[k] = cellOf(location[k] + range);
+            }
+
+            for (int32_t ix=lo[0]; ix<=hi[0]; ++ix) {
+                for (int32_t iy=lo[1]; iy<=hi[1]; ++iy) {
+                    for (int32_t iz=lo[2]; iz<=hi[2]; ++iz) {
+                        for (int32_t id=_buckets[hash(ix, iy, iz)]; id!=NONE; id=_agents[id].next) {
+                            const agent_t & agent = _agents[id];
+                            if (agent.cell[0] == ix && agent.cell[1] == iy && agent.cell[2] == iz) {
+                                visit((uint32_t)id);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        double separation(const agent_t & a, const agent_t & b) const
+        {
+            double dx = a.location[0] - b.location[0];
+            double dy = a.location[1] - b.location[1];
+            double dz = a.location[2] - b.location[2];
+            return sqrt(dx*dx + dy*dy + dz*dz) - a.radius - b.radius;
+        }
+
+    public:
+
+        /**
+         * @param maxAgents largest agent id plus one
+         * @param cellSize grid spacing in meters; about twice the typical agent radius plus the near-miss distance works well
+         * @param nearMissDistance surface distance below which an encounter counts as a near miss
+         * @param buckets hash table size, rounded up to a power of two
+         */
+        SpatialHash(uint32_t maxAgents, double cellSize, double nearMissDistance, uint32_t buckets=4096)
+        {
+            _cellSize = cellSize;
+            _nearMissDistance = nearMissDistance;
+
+            uint32_t size = 1;
+            while (size < buckets) size <<= 1;
+            _bucketMask = size - 1;
+            _buckets.assign(size, (int32_t)NONE);
+
+            _agents.resize(maxAgents);
+            for (agent_t & agent : _agents) {
+                agent.active = false;
+            }
+        }
+
+        /**
+         * Adds an agent, or changes its size and kind.  The agent is not checked until its first update().
+         */
+        void setAgent(uint32_t id, double radius, Kind_t kind=KIND_VEHICLE)
+        {
+            _agents[id].radius = radius;
+            _agents[id].kind = kind;
+
+            if (radius > _maxRadius) _maxRadius = radius;
+        }
+
+        void update(uint32_t id, const double location[3])
+        {
+            agent_t & agent = _agents[id];
+
+            int32_t cell[3] = { cellOf(location[0]), cellOf(location[1]), cellOf(location[2]) };
+
+            bool moved = !agent.active || cell[0] != agent.cell[0] || cell[1] != agent.cell[1] || cell[2] != agent.cell[2];
+
+            if (moved && agent.active) {
+                unlink(id);
+            }
+
+            for (uint8_t k=0; k<3; ++k) {
+                agent.location[k] = location[k];
+                agent.cell[k] = cell[k];
+            }
+
+            if (moved) {
+                link(id);
+            }
+
+            agent.active = true;
+        }
+
+        void remove(uint32_t id)
+        {
+            if (_agents[id].active) {
+                unlink(id);
+                _agents[id].active = false;
+            }
+        }
+
+        /**
+         * Finds the agents whose surfaces are within a distance of an agent's surface.
+         *
+         * @param id agent
+         * @param distance surface-to-surface distance in meters
+         * @param neighbors ids found (output)
+         * @param capacity size of neighbors
+         * @return number found, which may exceed capacity
+         */
+        uint32_t neighbors(uint32_t id, double distance, uint32_t * neighbors, uint32_t capacity) const
+        {
+            const agent_t & self = _agents[id];
+
+            if (!self.active) return 0;
+
+            uint32_t count = 0;
+
+            visitCells(self.location, self.radius + _maxRadius + distance, [&](uint32_t other) {
+                if (other != id && separation(self, _agents[other]) < distance) {
+                    if (count < capacity) neighbors[count] = other;
+                    count++;
+                }
+            });
+
+            return count;
+        }
+
+        /**
+         * Checks every pair within range, updating encounters and statistics.
+         *
+         * @param time time of the positions, stamped on events
+         * @return events that happened since the previous call, valid until the next call
+         */
+        const std::vector<event_t> & detect(double time)
+        {
+            _events.clear();
+            _current.clear();
+            _stepMinSeparation = INFINITY;
+
+            for (uint32_t a=0; a<(uint32_t)_agents.size(); ++a) {
+
+                const agent_t & self = _agents[a];
+
+                if (!self.active) continue;
+
+                visitCells(self.location, self.radius + _maxRadius + _nearMissDistance, [&](uint32_t b) {
+
+                    // Each pair once; targets don't interact with each other
+                    if (b <= a) return;
+                    const agent_t & other = _agents[b];
+                    if (self.kind == KIND_TARGET && other.kind == KIND_TARGET) return;
+
+                    _pairsTested++;
+
+                    double s = separation(self, other);
+
+                    if (s < _stepMinSeparation) _stepMinSeparation = s;
+
+                    if (s < _nearMissDistance) {
+                        encounter_t encounter = { pairKey(a, b), s, s <= 0 };
+                        _current.push_back(encounter);
+                    }
+                });
+            }
+
+            if (_stepMinSeparation < _minSeparation) _minSeparation = _stepMinSeparation;
+
+            std::sort(_current.begin(), _current.end(), [](const encounter_t & x, const encounter_t & y) {
+                return x.key < y.key;
+            });
+
+            // Merge with the encounters from the previous call
+            size_t j = 0;
+            for (size_t k=0; k<_current.size(); ++k) {
+
+                encounter_t & now = _current[k];
+
+                // Encounters that are over
+                while (j < _encounters.size() && _encounters[j].key < now.key) {
+                    const encounter_t & ended = _encounters[j++];
+                    if (!ended.touched) {
+                        event_t event = { EVENT_NEAR_MISS, (uint32_t)(ended.key >> 32), (uint32_t)ended.key, time, ended.minSeparation };
+                        _events.push_back(event);
+                        _nearMisses++;
+                    }
+                }
+
+                bool wasTouching = false;
+
+                if (j < _encounters.size() && _encounters[j].key == now.key) {
+                    const encounter_t & before = _encounters[j++];
+                    wasTouching = before.touched;
+                    now.minSeparation = fmin(now.minSeparation, before.minSeparation);
+                    now.touched = now.touched || before.touched;
+                }
+
+                if (now.touched && !wasTouching) {
+                    event_t event = { EVENT_COLLISION, (uint32_t)(now.key >> 32), (uint32_t)now.key, time, now.minSeparation };
+                    _events.push_back(event);
+                    _collisions++;
+                }
+            }
+
+            while (j < _encounters.size()) {
+                const encounter_t & ended = _encounters[j++];
+                if (!ended.touched) {
+                    event_t event = { EVENT_NEAR_MISS, (uint32_t)(ended.key >> 32), (uint32_t)ended.key, time, ended.minSeparation };
+                    _events.push_back(event);
+                    _nearMisses++;
+                }
+            }
+
+            _encounters.swap(_current);
+
+            return _events;
+        }
+
+        // Smallest surface distance between any two agents in range, over all calls to detect()
+        double getMinSeparation(void) const
+        {
+            return _minSeparation;
+        }
+
+        // Same, for the latest call only; infinite if no agents were in range of each other
+        double getStepMinSeparation(void) const
+        {
+            return _stepMinSeparation;
+        }
+
+        uint32_t getCollisions(void) const
+        {
+            return _collisions;
+        }
+
+        uint32_t getNearMisses(void) const
+        {
+            return _nearMisses;
+        }
+
+        uint32_t getPairsTested(void) const
+        {
+            return _pairsTested;
+        }
+
+        const double * getLocation(uint32_t id) const
+        {
+            return _agents[id].location;
+        }
+
+}; // class SpatialHash
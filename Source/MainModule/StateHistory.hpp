@@ -0,0 +1,220 @@
+/*
+ * Timestamped history of vehicle states, for rendering at a fixed latency
+ *
+ * The flight thread publishes states into a ring; any number of readers can
+ * ask for the pose at a given time without locking.  Each slot is guarded by
+ * a sequence counter (a seqlock): the writer makes it odd while writing, and
+ * a reader retries or gives up on a slot whose counter changed under it.
+ *
+ * Poses between samples are interpolated, using the sampled velocities for
+ * position and the shortest way around for angles.  Poses past the newest
+ * sample are extrapolated from its velocities for a limited time.
+ *
+ * Copyright (C) 2019 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include "dynamics/MultirotorDynamics.hpp"
+
+#include <atomic>
+
+class StateHistory {
+
+    public:
+
+        static const uint32_t CAPACITY = 128;
+
+        typedef struct {
+
+            double time;
+            MultirotorDynamics::pose_t pose;
+            double inertialVel[3];
+            double angularVel[3];  // Euler-angle rates
+
+        } sample_t;
+
+        typedef enum {
+
+            RESULT_NONE,            // nothing published yet
+            RESULT_INTERPOLATED,
+            RESULT_EXTRAPOLATED,    // time was past the newest sample
+            RESULT_HELD             // time was before the oldest sample still held
+
+        } Result_t;
+
+    private:
+
+        static constexpr double PI = 3.14159265358979323846;
+
+        static const uint8_t MAX_RETRIES = 4;
+
+        typedef struct {
+
+            std::atomic<uint32_t> sequence;
+            uint32_t index;
+            sample_t sample;
+
+        } slot_t;
+
+        slot_t _slots[CAPACITY];
+
+        // Number of samples ever published
+        std::atomic<uint32_t> _count;
+
+        // Copies sample k if it is still in the ring, returning false if it has been overwritten
+        bool read(uint32_t k, sample_t & sample) const
+        {
+            const slot_t & slot = _slots[k % CAPACITY];
+
+            for (uint8_t attempt=0; attempt<MAX_RETRIES; ++attempt) {
+
+                uint32_t before = slot.sequence.load(std::memory_order_acquire);
+
+                if (before & 1) continue;
+
+                uint32_t index = slot.index;
+                sample = slot.sample;
+
+                std::atomic_thread_fence(std::memory_order_acquire);
+
+                if (slot.sequence.load(std::memory_order_relaxed) == before) {
+                    return index == k;
+                }
+            }
+
+            return false;
+        }
+
+        static double wrap(double angle)
+        {
+            while (angle > PI) angle -= 2*PI;
+            while (angle < -PI) angle += 2*PI;
+            return angle;
+        }
+
+        static void interpolate(const sample_t & a, const sample_t & b, double time, MultirotorDynamics::pose_t & pose)
+        {
+            double h = b.time - a.time;
+            double s = h > 0 ? (time - a.time) / h : 1;
+
+            // Cubic Hermite basis, so position and velocity are continuous across samples
+            double s2 = s*s;
+            double s3 = s2*s;
+            double h00 = 2*s3 - 3*s2 + 1;
+            double h10 = s3 - 2*s2 + s;
+            double h01 = -2*s3 + 3*s2;
+            double h11 = s3 - s2;
+
+            for (uint8_t k=0; k<3; ++k) {
+                pose.location[k] = h00*a.pose.location[k] + h10*h*a.inertialVel[k] + h01*b.pose.location[k] + h11*h*b.inertialVel[k];
+                pose.rotation[k] = wrap(a.pose.rotation[k] + s * wrap(b.pose.rotation[k] - a.pose.rotation[k]));
+            }
+        }
+
+    public:
+
+        StateHistory(void)
+            : _count(0)
+        {
+            for (uint32_t k=0; k<CAPACITY; ++k) {
+                _slots[k].sequence = 0;
+                _slots[k].index = 0;
+            }
+        }
+
+        /**
+         * Adds a state.  Only one thread may publish; times must increase.
+         *
+         * @param time time of the state in seconds
+         * @param state vehicle state
+         */
+        void publish(double time, const MultirotorDynamics::state_t & state)
+        {
+            uint32_t k = _count.load(std::memory_order_relaxed);
+
+            slot_t & slot = _slots[k % CAPACITY];
+
+            uint32_t sequence = slot.sequence.load(std::memory_order_relaxed);
+
+            slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+
+            slot.index = k;
+            slot.sample.time = time;
+            slot.sample.pose = state.pose;
+            for (uint8_t j=0; j<3; ++j) {
+                slot.sample.inertialVel[j] = state.inertialVel[j];
+                slot.sample.angularVel[j] = state.angularVel[j];
+            }
+
+            slot.sequence.store(sequence + 2, std::memory_order_release);
+
+            _count.store(k + 1, std::memory_order_release);
+        }
+
+        // Newest sample, or false if nothing has been published
+        bool latest(sample_t & sample) const
+        {
+            uint32_t count = _count.load(std::memory_order_acquire);
+
+            for (uint32_t k=count; k-- > 0 && count-k < CAPACITY; ) {
+                if (read(k, sample)) return true;
+            }
+
+            return false;
+        }
+
+        /**
+         * Pose at a given time.  Safe to call from any thread.
+         *
+         * @param time time in seconds, on the publisher's clock
+         * @param pose the pose (output)
+         * @param maxExtrapolation longest time to extrapolate past the newest sample
+         * @return how the pose was obtained
+         */
+        Result_t poseAt(double time, MultirotorDynamics::pose_t & pose, double maxExtrapolation=0.1) const
+        {
+            uint32_t count = _count.load(std::memory_order_acquire);
+
+            sample_t newer = {};
+            bool haveNewer = false;
+
+            // Walk back from the newest sample, leaving the slot the writer may be filling
+            for (uint32_t k=count; k-- > 0 && count-k < CAPACITY; ) {
+
+                sample_t sample;
+                if (!read(k, sample)) break;
+
+                if (sample.time <= time) {
+
+                    if (haveNewer) {
+                        interpolate(sample, newer, time, pose);
+                        return RESULT_INTERPOLATED;
+                    }
+
+                    double dt = time - sample.time;
+                    if (dt > maxExtrapolation) dt = maxExtrapolation;
+
+                    for (uint8_t j=0; j<3; ++j) {
+                        pose.location[j] = sample.pose.location[j] + dt * sample.inertialVel[j];
+                        pose.rotation[j] = wrap(sample.pose.rotation[j] + dt * sample.angularVel[j]);
+                    }
+
+                    return RESULT_EXTRAPOLATED;
+                }
+
+                newer = sample;
+                haveNewer = true;
+            }
+
+            if (!haveNewer) return RESULT_NONE;
+
+            pose = newer.pose;
+
+            return RESULT_HELD;
+        }
+
+}; // class StateHistory
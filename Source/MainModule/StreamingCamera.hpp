@@ -0,0 +1,374 @@
+/*
+ * Camera sink that streams encoded frames to consumers on the local network
+ *
+ * Frames are copied into a small queue when they arrive, then encoded and sent
+ * on a worker thread, so neither the game thread nor the camera tasks wait on
+ * the network.  When the consumer lags, the queue either overwrites its oldest
+ * frame or drops the incoming one.
+ *
+ * Each frame goes out as a FrameCodec::header_t followed by the payload.  Over
+ * TCP that is the whole message; over UDP the message is split into datagrams,
+ * each prefixed by a chunk_t.
+ *
+ * Copyright (C) 2019 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include "Camera.hpp"
+#include "FrameCodec.hpp"
+#include "FrameQueue.hpp"
+#include "PixelConversion.hpp"
+
+#include "Runnable.h"
+#include "RunnableThread.h"
+#include "IImageWrapper.h"
+#include "IImageWrapperModule.h"
+
+// The socket headers pull in winsock on Windows, which redefines TEXT
+#pragma push_macro("TEXT")
+#ifdef _WIN32
+#include "Windows/AllowWindowsPlatformTypes.h"
+#endif
+#include "../../Extras/sockets/TcpServerSocket.hpp"
+#include "../../Extras/sockets/UdpClientSocket.hpp"
+#ifdef _WIN32
+#include "Windows/HideWindowsPlatformTypes.h"
+#endif
+#pragma pop_macro("TEXT")
+
+class StreamingCamera : public Camera, public FRunnable {
+
+    public:
+
+        typedef enum {
+
+            TRANSPORT_TCP,  // we listen, one consumer connects
+            TRANSPORT_UDP   // we send datagrams to host:port
+
+        } Transport_t;
+
+#pragma pack(push, 1)
+        typedef struct {
+
+            uint32_t frameId;
+            uint16_t index;
+            uint16_t count;
+
+        } chunk_t;
+#pragma pack(pop)
+
+    private:
+
+        static const uint16_t CHUNK_SIZE   = 1400;  // stays under a typical Ethernet MTU
+        static const uint32_t WAIT_MSEC    = 100;
+
+        // Settings from constructor
+        FrameCodec::Encoding_t _encoding;
+        PixelConversion::Format_t _format;
+        Transport_t _transport;
+        char _host[200];
+        short _port = 0;
+        int32 _jpegQuality = 85;
+
+        // Frames waiting to be sent
+        FrameQueue * _queue = NULL;
+
+        // Worker
+        FRunnableThread * _thread = NULL;
+        FEvent * _frameReady = NULL;
+        FThreadSafeBool _running = false;
+
+        // Worker-owned encoding state
+        FrameCodec _codec;
+        uint8_t * _payload = NULL;
+        size_t _payloadCapacity = 0;
+        uint8_t _datagram[sizeof(chunk_t) + CHUNK_SIZE];
+        TSharedPtr<IImageWrapper> _jpegWrapper;
+
+        // Transport, owned by worker
+        TcpServerSocket * _tcp = NULL;
+        UdpClientSocket * _udp = NULL;
+
+        // Statistics
+        FThreadSafeCounter _framesSent;
+        FThreadSafeCounter _sendFailures;
+
+        Metrics::Counter _framesSentMetric;
+        Metrics::Counter _sendFailuresMetric;
+
+        void startWorker(void)
+        {
+            _running = true;
+            _thread = FRunnableThread::Create(this, TEXT("StreamingCamera"), 0, TPri_BelowNormal);
+        }
+
+        // Encodes a queued frame into _payload after its header, returning the message size
+        size_t encodeSlot(int32 slot)
+        {
+            const uint8_t * pixels = _queue->bytes(slot);
+            size_t pixelsSize = _queue->slotSize();
+
+            FrameCodec::header_t * header = (FrameCodec::header_t *)_payload;
+            uint8_t * data = _payload + sizeof(FrameCodec::header_t);
+
+            uint16_t rows = _rows;
+            uint16_t cols = _cols;
+            uint8_t channels = 4;
+            size_t size = 0;
+
+            if (_encoding == FrameCodec::ENCODING_JPEG) {
+
+                _jpegWrapper->SetRaw(pixels, pixelsSize, cols, rows, ERGBFormat::BGRA, 8);
+                const auto & jpeg = _jpegWrapper->GetCompressed(_jpegQuality);
+                size = jpeg.Num();
+                if (size > _payloadCapacity) return 0;
+                FMemory::Memcpy(data, jpeg.GetData(), size);
+                channels = 3;
+            }
+
+            else {
+
+                rows = PixelConversion::outputRows(_format, _rows);
+                cols = PixelConversion::outputCols(_format, _cols);
+                channels = PixelConversion::channels(_format);
+                size = _codec.encode(_encoding, pixels, pixelsSize, channels, data);
+            }
+
+            header->magic = FrameCodec::MAGIC;
+            header->frameId = _queue->info(slot).frameId;
+            header->timestamp = _queue->info(slot).timestamp;
+            header->cols = cols;
+            header->rows = rows;
+            header->channels = channels;
+            header->encoding = (uint8_t)_encoding;
+            header->cameraId = _id;
+            header->reserved = 0;
+            header->size = (uint32_t)size;
+
+            return sizeof(FrameCodec::header_t) + size;
+        }
+
+        bool sendMessage(uint32_t frameId, size_t size)
+        {
+            if (_transport == TRANSPORT_TCP) {
+                if (_tcp->sendData(_payload, size)) {
+                    return true;
+                }
+                // Consumer went away; wait for another one
+                _tcp->closeClient();
+                return false;
+            }
+
+            chunk_t * chunk = (chunk_t *)_datagram;
+            chunk->frameId = frameId;
+            chunk->count = (uint16_t)((size + CHUNK_SIZE - 1) / CHUNK_SIZE);
+
+            // A frame missing any chunk is lost to the consumer
+            bool sent = true;
+
+            for (uint16_t k=0; k<chunk->count; ++k) {
+                size_t offset = (size_t)k * CHUNK_SIZE;
+                size_t len = FMath::Min((size_t)CHUNK_SIZE, size - offset);
+                chunk->index = k;
+                FMemory::Memcpy(_datagram + sizeof(chunk_t), _payload + offset, len);
+                sent &= _udp->sendData(_datagram, sizeof(chunk_t) + len);
+            }
+
+            return sent;
+        }
+
+    protected:
+
+        /**
+         * @param fov field of view
+         * @param resolution render-target resolution
+         * @param host address to send to (UDP) or listen on (TCP)
+         * @param port port to send to or listen on
+         * @param encoding RAW, RLE, LZ4 or JPEG
+         * @param transport TCP or UDP
+         * @param dropPolicy what to do with frames when the consumer lags
+         * @param format pixel format for RAW, RLE and LZ4; JPEG is always BGR
+         */
+        StreamingCamera(float fov, Resolution_t resolution, const char * host, short port,
+                FrameCodec::Encoding_t encoding=FrameCodec::ENCODING_LZ4,
+                Transport_t transport=TRANSPORT_TCP,
+                FrameQueue::DropPolicy_t dropPolicy=FrameQueue::DROP_OLDEST,
+                PixelConversion::Format_t format=PixelConversion::FORMAT_BGR)
+            : Camera(fov, resolution)
+        {
+            _encoding = encoding;
+            _transport = transport;
+            _format = format;
+            SPRINTF(_host, "%s", host);
+            _port = port;
+
+            // JPEG compresses the BGRA pixels directly; the others convert first
+            size_t slotSize = encoding == FrameCodec::ENCODING_JPEG ? (size_t)_rows*_cols*4 :
+                (size_t)PixelConversion::outputRows(format, _rows) * PixelConversion::outputCols(format, _cols) *
+                PixelConversion::channels(format);
+
+            _queue = new FrameQueue(slotSize, dropPolicy);
+
+            // JPEG output is held to the size of the BGRA pixels; RLE's worst case depends on the pixel size
+            const uint8_t pixelSize = encoding == FrameCodec::ENCODING_JPEG ? 4 : PixelConversion::channels(format);
+
+            _payloadCapacity = FrameCodec::maxEncodedSize(slotSize, pixelSize);
+            _payload = new uint8_t [sizeof(FrameCodec::header_t) + _payloadCapacity];
+
+            _frameReady = FPlatformProcess::GetSynchEventFromPool(false);
+        }
+
+        virtual void addToVehicle(APawn * pawn, USpringArmComponent * springArm, uint8_t id) override
+        {
+            Camera::addToVehicle(pawn, springArm, id);
+
+            char labels[40];
+            SPRINTF(labels, "camera=\"%d\",sink=\"stream\"", id);
+
+            Metrics & metrics = Metrics::get();
+            _framesSentMetric = metrics.counter("multicopter_camera_frames_sent_total", "Camera frames sent to consumers",
+                    labels);
+            _sendFailuresMetric = metrics.counter("multicopter_socket_send_failures_total",
+                    "Frames lost on the way out of a socket", labels);
+            _queue->setMetrics(labels);
+
+            // Modules have to be loaded on the game thread
+            if (_encoding == FrameCodec::ENCODING_JPEG) {
+                IImageWrapperModule & module = FModuleManager::LoadModuleChecked<IImageWrapperModule>(FName("ImageWrapper"));
+                _jpegWrapper = module.CreateImageWrapper(EImageFormat::JPEG);
+            }
+        }
+
+        // Runs on the game thread or a camera task: copy and hand off, never wait on the network
+        virtual void processImageBytes(uint8_t * bytes) override
+        {
+            if (!_thread) {
+                startWorker();
+            }
+
+            int32 slot = _queue->acquire();
+
+            if (slot < 0) return;
+
+            if (_encoding == FrameCodec::ENCODING_JPEG) {
+                FMemory::Memcpy(_queue->bytes(slot), bytes, _queue->slotSize());
+            }
+            else {
+                PixelConversion::convert(bytes, _queue->bytes(slot), _rows, _cols, _format);
+            }
+
+            _queue->info(slot).timestamp = getTimestamp();
+            _queue->info(slot).pose = getPose();
+
+            _queue->commit(slot);
+
+            _frameReady->Trigger();
+        }
+
+    public:
+
+        void setJpegQuality(int32 quality)
+        {
+            _jpegQuality = quality;
+        }
+
+        uint32_t getFramesSent(void)
+        {
+            return _framesSent.GetValue();
+        }
+
+        uint32_t getFramesDropped(void)
+        {
+            return _queue->getDropped();
+        }
+
+        uint32_t getSendFailures(void)
+        {
+            return _sendFailures.GetValue();
+        }
+
+        // FRunnable interface, running on the worker thread
+
+        virtual uint32 Run() override
+        {
+            Trace::get().setThreadName("StreamingCamera");
+
+            if (_transport == TRANSPORT_TCP) {
+                _tcp = new TcpServerSocket(_host, _port);
+            }
+            else {
+                _udp = new UdpClientSocket(_host, _port);
+            }
+
+            while (_running) {
+
+                int32 slot = _queue->take();
+
+                if (slot < 0) {
+                    _frameReady->Wait(WAIT_MSEC);
+                    continue;
+                }
+
+                // Nobody to send to yet: discard the frame and look for a consumer
+                if (_tcp && !_tcp->isConnected() && !_tcp->acceptConnection(0)) {
+                    _queue->discard(slot);
+                    _frameReady->Wait(WAIT_MSEC);
+                    continue;
+                }
+
+                Trace::Scope scope("StreamingCamera::send");
+
+                uint32_t frameId = _queue->info(slot).frameId;
+                size_t size = encodeSlot(slot);
+
+                // The slot can take new frames as soon as it has been encoded
+                _queue->release(slot);
+
+                if (size > 0 && sendMessage(frameId, size)) {
+                    _framesSent.Increment();
+                    _framesSentMetric.increment();
+                }
+                else {
+                    _sendFailures.Increment();
+                    _sendFailuresMetric.increment();
+                }
+            }
+
+            if (_tcp) {
+                _tcp->closeClient();
+                _tcp->closeConnection();
+                delete _tcp;
+                _tcp = NULL;
+            }
+
+            if (_udp) {
+                _udp = UdpClientSocket::free(_udp);
+            }
+
+            return 0;
+        }
+
+        virtual void Stop() override
+        {
+            _running = false;
+            _frameReady->Trigger();
+        }
+
+        virtual ~StreamingCamera()
+        {
+            if (_thread) {
+                Stop();
+                _thread->WaitForCompletion();
+                delete _thread;
+            }
+
+            FPlatformProcess::ReturnSynchEventToPool(_frameReady);
+
+            delete _queue;
+            delete[] _payload;
+        }
+
+}; // Class StreamingCamera
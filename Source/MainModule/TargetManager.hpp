@@ -1,36 +1,141 @@
+/*
+ * Moves a target for vehicles to track
+ *
+ * A target either follows a precomputed Trajectory, evaluated on demand with
+ * no thread at all, or is moved by a subclass's computePose() at a bounded
+ * rate.  Either way, getLocation() and getRotation() return a consistent
+ * pose from any thread.
+ *
+ * Copyright (C) 2019 Simon D. Levy
+ *
+ * MIT License
+ */
+
 #pragma once
 
 #include "../MainModule/ThreadedManager.hpp"
+#include "Trajectory.hpp"
+
+#include <atomic>
 
 class FTargetManager : public FThreadedManager {
 
+private:
+
+	// Latest pose from computePose(), guarded by a sequence counter that is odd while it is written
+	std::atomic<uint32_t> _sequence;
+	FVector _publishedLocation;
+	FRotator _publishedRotation;
+
+	Trajectory _trajectory;
+
+	void publish(void)
+	{
+		const uint32_t sequence = _sequence.load(std::memory_order_relaxed);
+
+		_sequence.store(sequence + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		_publishedLocation = _location;
+		_publishedRotation = _rotation;
+
+		_sequence.store(sequence + 2, std::memory_order_release);
+	}
+
+	void evaluate(double currentTime, FVector & location, FRotator & rotation) const
+	{
+		double position[3];
+		_trajectory.evaluate(currentTime, position);
+
+		location = FVector(position[0], position[1], position[2]);
+		rotation = FRotator(0, FMath::RadiansToDegrees(_trajectory.getHeading(currentTime)), 0);
+	}
+
 protected:
 
 	FVector _location;
 	FRotator _rotation;
-	
+
 	virtual void performTask(double currentTime) override
 	{
-		computePose(currentTime);
+		{
+			Trace::Scope scope("FTargetManager::computePose");
+			computePose(currentTime);
+		}
+
+		publish();
 	}
 
-	FTargetManager() : FThreadedManager()
+	/**
+	 * @param rate steps per second for computePose()
+	 */
+	FTargetManager(double rate=100) : FThreadedManager(rate, true), _sequence(0)
 	{
 		_location = FVector(0, 10, 0);
 		_rotation = FRotator(0, 0, 0);
+
+		publish();
 	}
 
-	virtual void computePose(double currentTime) = 0;
+	// Sets _location and _rotation for the given time
+	virtual void computePose(double currentTime)
+	{
+		evaluate(currentTime, _location, _rotation);
+	}
 
 public:
 
-	const FVector & getLocation(void)
+	/**
+	 * Follows a trajectory, with no thread; time zero on the trajectory is when the target is created.
+	 *
+	 * @param trajectory compiled trajectory, in world coordinates; heading follows the direction of travel
+	 */
+	FTargetManager(const Trajectory & trajectory) : FThreadedManager(0), _sequence(0), _trajectory(trajectory)
 	{
-		return _location;
+		computePose(0);
+
+		publish();
 	}
-	
-	const FRotator & getRotation(void)
+
+	void getPose(FVector & location, FRotator & rotation)
+	{
+		if (!_trajectory.isEmpty()) {
+			evaluate(getCurrentTime(), location, rotation);
+			return;
+		}
+
+		while (true) {
+
+			const uint32_t sequence = _sequence.load(std::memory_order_acquire);
+
+			if (sequence & 1) {
+				continue;
+			}
+
+			location = _publishedLocation;
+			rotation = _publishedRotation;
+
+			std::atomic_thread_fence(std::memory_order_acquire);
+
+			if (_sequence.load(std::memory_order_relaxed) == sequence) {
+				return;
+			}
+		}
+	}
+
+	FVector getLocation(void)
+	{
+		FVector location;
+		FRotator rotation;
+		getPose(location, rotation);
+		return location;
+	}
+
+	FRotator getRotation(void)
 	{
-		return _rotation;
+		FVector location;
+		FRotator rotation;
+		getPose(location, rotation);
+		return rotation;
 	}
 };
@@ -10,21 +10,48 @@
 
 #include "Runnable.h"
 #include "Utils.hpp"
+#include "ManagerPool.hpp"
+#include "SimClock.hpp"
+#include "Metrics.hpp"
+#include "Trace.hpp"
 
-class FThreadedManager : public FRunnable {
+class FThreadedManager : public FRunnable, public FPoolable {
 
     private:
 
+        // Wait before the first step
+        static constexpr double START_DELAY = 0.5;
+
+        // Either our own thread, or a task in the shared pool when it is enabled
         FRunnableThread * _thread = NULL;
+        FManagerPool::task_t * _task = NULL;
 
         bool _running = false;
 
-        // Start-time offset so timing begins at zero
+        // Start-time offset so timing begins at zero, on the simulation clock
         double _startTime = 0;
 
+        // Wall-clock start, for FPS reporting
+        double _wallStartTime = 0;
+
+        // Time between steps on our own thread, or zero to step as fast as possible
+        double _period = 0;
+
+        // Time between steps in the pool
+        double _ratePeriod = 0;
+
+        // When the clock is stepped: when we are next due, which its driver waits for
+        std::atomic<double> _due;
+
+        // Driving a stepped clock: our last step is done but others were still due then
+        bool _advancePending = false;
+
         // For FPS reporting
         uint32_t _count;
 
+        // Paced steps that started more than a period late
+        Metrics::Counter _overrunsMetric;
+
     protected:
 
         // Implemented differently by each subclass
@@ -32,23 +59,99 @@ class FThreadedManager : public FRunnable {
 
         uint32_t getFps(void)
         {
-            return (uint32_t)(_count/(FPlatformTime::Seconds()-_startTime));
+            return (uint32_t)(_count/(FPlatformTime::Seconds()-_wallStartTime));
+        }
+
+        // Makes us the manager that moves a stepped clock on, if no other does
+        bool driveClock(void)
+        {
+            return SimClock::get().claim(this);
+        }
+
+        /**
+         * Runs a step, unless the clock is stepped and we are waiting for it.  The driver moves the clock
+         * on after each of its steps once every other manager due by then has stepped; the others step
+         * when the clock reaches the time they are due.
+         *
+         * @return true if we stepped
+         */
+        bool step(void)
+        {
+            SimClock & clock = SimClock::get();
+
+            if (clock.isDriver(this)) {
+
+                if (_advancePending && !clock.advance(this)) {
+                    return false;
+                }
+
+                performTask(getCurrentTime());
+
+                _advancePending = !clock.advance(this);
+
+                return true;
+            }
+
+            if (clock.getMode() == SimClock::MODE_STEPPED && !clock.reached(_due)) {
+                return false;
+            }
+
+            const double now = clock.now();
+
+            performTask(now - _startTime);
+
+            // Paced or pooled, we are next due a period on; otherwise at every step of the clock
+            _due = now + FMath::Max(clock.getStep(), _period > 0 || _task ? _ratePeriod : 0);
+
+            return true;
         }
 
     public:
 
-        FThreadedManager(void)
+        /**
+         * @param rate steps per second when running in the shared pool; on its own thread,
+         * a manager steps as fast as it can unless paced.  Zero for no steps at all.
+         * @param paced true to keep to the rate on our own thread too
+         */
+        FThreadedManager(double rate=1000, bool paced=false)
+            : _due(0)
         {
-            _thread = FRunnableThread::Create(this, TEXT("FThreadedManage"), 0, TPri_BelowNormal); 
+            SimClock & clock = SimClock::get();
 
-            _startTime = FPlatformTime::Seconds();
+            _startTime = clock.now();
+            _wallStartTime = FPlatformTime::Seconds();
 
             _count = 0;
+
+            if (rate <= 0) {
+                return;
+            }
+
+            _ratePeriod = 1 / rate;
+            _period = paced ? _ratePeriod : 0;
+
+            _overrunsMetric = Metrics::get().counter("multicopter_manager_overruns_total",
+                    "Manager steps that started more than a period late", "runner=\"thread\"");
+
+            _due = _startTime;
+            clock.follow(this, &_due);
+
+            FManagerPool & pool = FManagerPool::get();
+
+            if (pool.isEnabled()) {
+                _task = pool.add(this, rate, START_DELAY);
+            }
+            else {
+                _thread = FRunnableThread::Create(this, TEXT("FThreadedManage"), 0, TPri_BelowNormal); 
+            }
         }
 
 
         ~FThreadedManager()
         {
+            SimClock::get().unfollow(this);
+            SimClock::get().release(this);
+
             delete _thread;
         }
 
@@ -57,6 +160,12 @@ class FThreadedManager : public FRunnable {
             return _count;
         }
 
+        // Time in seconds on the clock passed to performTask(); callable from any thread
+        double getCurrentTime(void)
+        {
+            return SimClock::get().now() - _startTime;
+        }
+
         static void stopThread(FThreadedManager ** worker)
         {
             if (*worker) {
@@ -78,28 +187,71 @@ class FThreadedManager : public FRunnable {
 
         virtual uint32_t Run() override
         {
+            Trace::get().setThreadName("FThreadedManager");
+
             // Initial wait before starting
-            FPlatformProcess::Sleep(0.5);
+            FPlatformProcess::Sleep(START_DELAY);
 
             _running = true;
 
-            while (_running) {
+            double deadline = getCurrentTime();
 
-                // Get a high-fidelity current time value from the OS
-                double currentTime = FPlatformTime::Seconds() - _startTime;
+            while (_running) {
 
                 // Pass current time to task implementation
-                performTask(currentTime);
+                if (!step()) {
+                    FPlatformProcess::Sleep(0);
+                    continue;
+                }
 
                 // Increment count for FPS reporting
                 _count++;
+
+                // A stepped clock paces us itself
+                if (_period > 0 && SimClock::get().getMode() != SimClock::MODE_STEPPED) {
+
+                    deadline += _period;
+
+                    // Fell behind: start again from now rather than bursting to catch up
+                    if (deadline <= getCurrentTime()) {
+                        _overrunsMetric.increment();
+                        deadline = getCurrentTime();
+                    }
+
+                    while (_running && getCurrentTime() < deadline) {
+                        FPlatformProcess::Sleep(SimClock::get().toWall(deadline - getCurrentTime()));
+                    }
+                }
             }
 
 			return 0;
         }
 
+        // FPoolable interface, called by a pool worker
+
+        virtual bool poolStep(void) override
+        {
+            if (!step()) {
+                return false;
+            }
+
+            _count++;
+
+            return true;
+        }
+
         virtual void Stop() override
         {
+            // A stepped clock no longer waits for us
+            SimClock::get().unfollow(this);
+
+            // In the pool, removing our task waits for any step in progress
+            if (_task) {
+                FManagerPool::get().remove(_task);
+                _task = NULL;
+                return;
+            }
+
             _running = false;
 
             // Final wait after stopping
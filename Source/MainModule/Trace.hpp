@@ -0,0 +1,338 @@
+/*
+ * Timeline of what each thread was doing, for the Chrome/Perfetto trace viewer
+ *
+ * A Trace::Scope marks a span of code: construct one at the top of a block
+ * and the span ends when it goes out of scope.  While tracing is on, each
+ * thread records its spans into its own ring buffer without locking, so the
+ * buffers hold the last few seconds of every thread.  dump() writes them in
+ * the Chrome trace-event JSON format, which chrome://tracing and
+ * ui.perfetto.dev load.  While tracing is off a Scope costs one relaxed load.
+ *
+ * Span names must be string literals, or otherwise outlive the trace; they
+ * are stored as pointers and written without escaping.
+ *
+ * Copyright (C) 2019 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include "LogChannel.hpp"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+
+class Trace {
+
+    private:
+
+        // Spans each thread keeps, oldest overwritten first; a power of two
+        static const uint32_t RING_SIZE = 32768;
+
+        // Threads beyond this many at once record nothing; a thread that exits leaves its ring to a later one
+        static const uint32_t MAX_THREADS = 64;
+
+        typedef struct {
+
+            const char * name;
+            int64_t start;
+            int64_t duration;
+
+        } span_t;
+
+        typedef struct {
+
+            // Spans written so far; span k is in slot k % RING_SIZE
+            std::atomic<uint64_t> head;
+
+            std::atomic<const char *> name;
+
+            span_t spans[RING_SIZE];
+
+        } ring_t;
+
+        std::atomic<bool> _enabled;
+
+        // Spans that started before this are from an earlier session
+        std::atomic<int64_t> _sessionStart;
+
+        std::mutex _lock;
+
+        std::atomic<ring_t *> _rings[MAX_THREADS];
+        std::atomic<uint32_t> _ringCount;
+
+        // Rings of threads that have exited, under _lock; their spans stay in dumps until a new thread takes one
+        ring_t * _free[MAX_THREADS];
+        uint32_t _freeCount = 0;
+
+        bool _warned = false;
+
+        Trace(void)
+            : _enabled(false), _sessionStart(0), _ringCount(0)
+        {
+            for (uint32_t k=0; k<MAX_THREADS; ++k) {
+                _rings[k] = NULL;
+            }
+        }
+
+        ~Trace(void)
+        {
+            for (uint32_t k=0; k<MAX_THREADS; ++k) {
+                delete _rings[k].load();
+            }
+        }
+
+        // Gives a thread's ring back when the thread exits
+        class Owner {
+
+            public:
+
+                ring_t * ring = NULL;
+                bool refused = false;
+                const char * name = NULL;
+
+                ~Owner(void)
+                {
+                    if (ring) {
+                        Trace & trace = Trace::get();
+                        std::lock_guard<std::mutex> lock(trace._lock);
+                        trace._free[trace._freeCount++] = ring;
+                    }
+                }
+
+        }; // class Owner
+
+        static Owner & local(void)
+        {
+            static thread_local Owner owner;
+            return owner;
+        }
+
+        // This thread's ring, found the first time the thread records a span; NULL if there are too many threads
+        ring_t * ring(void)
+        {
+            Owner & mine = local();
+
+            if (!mine.ring && !mine.refused) {
+
+                std::lock_guard<std::mutex> lock(_lock);
+
+                const uint32_t index = _ringCount.load(std::memory_order_relaxed);
+
+                // A new ring while there is room, so exited threads' spans last as long as they can
+                if (index < MAX_THREADS) {
+                    mine.ring = new ring_t;
+                    mine.ring->head = 0;
+                    mine.ring->name = mine.name;
+                    _rings[index].store(mine.ring, std::memory_order_release);
+                    _ringCount.store(index + 1, std::memory_order_release);
+                }
+
+                // Then an exited thread's, whose spans a dump can't be reading since we hold the lock
+                else if (_freeCount > 0) {
+                    mine.ring = _free[--_freeCount];
+                    mine.ring->head.store(0, std::memory_order_relaxed);
+                    mine.ring->name = mine.name;
+                }
+
+                else {
+                    mine.refused = true;
+                    if (!_warned) {
+                        _warned = true;
+                        LOG_POST(LogChannel::LEVEL_ERROR, "Trace: more than %u threads at once; the others record nothing",
+                                MAX_THREADS);
+                    }
+                    return NULL;
+                }
+            }
+
+            return mine.ring;
+        }
+
+        void record(const char * name, int64_t start, int64_t end)
+        {
+            ring_t * r = ring();
+
+            if (!r) {
+                return;
+            }
+
+            const uint64_t head = r->head.load(std::memory_order_relaxed);
+
+            span_t & span = r->spans[head & (RING_SIZE-1)];
+            span.name = name;
+            span.start = start;
+            span.duration = end - start;
+
+            r->head.store(head + 1, std::memory_order_release);
+        }
+
+        // Writes one ring's spans from this session, skipping any overwritten while we read them
+        uint32_t dumpRing(FILE * fp, const ring_t * r, uint32_t tid, int64_t sessionStart, bool & first)
+        {
+            const uint64_t head = r->head.load(std::memory_order_acquire);
+            const uint64_t oldest = head > RING_SIZE ? head - RING_SIZE : 0;
+
+            static span_t copy[RING_SIZE];
+
+            for (uint64_t k=oldest; k<head; ++k) {
+                copy[k - oldest] = r->spans[k & (RING_SIZE-1)];
+            }
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+
+            // Spans the thread may have overwritten since we looked at the head
+            const uint64_t now = r->head.load(std::memory_order_relaxed);
+            const uint64_t valid = now > RING_SIZE ? now - RING_SIZE : 0;
+
+            uint32_t count = 0;
+
+            for (uint64_t k=(valid > oldest ? valid : oldest); k<head; ++k) {
+
+                const span_t & span = copy[k - oldest];
+
+                if (span.start < sessionStart) {
+                    continue;
+                }
+
+                fprintf(fp, "%s\n{\"name\":\"%s\",\"cat\":\"sim\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u}",
+                        first ? "" : ",", span.name, (span.start - sessionStart) / 1e3, span.duration / 1e3, tid);
+
+                first = false;
+                count++;
+            }
+
+            return count;
+        }
+
+    public:
+
+        // Marks the span from its construction to its destruction
+        class Scope {
+
+            private:
+
+                const char * _name = NULL;
+                int64_t _start = 0;
+
+            public:
+
+                Scope(const char * name)
+                {
+                    if (Trace::get()._enabled.load(std::memory_order_relaxed)) {
+                        _name = name;
+                        _start = Trace::now();
+                    }
+                }
+
+                ~Scope(void)
+                {
+                    if (_name) {
+                        Trace::get().record(_name, _start, Trace::now());
+                    }
+                }
+
+        }; // class Scope
+
+        static Trace & get(void)
+        {
+            static Trace trace;
+            return trace;
+        }
+
+        // Nanoseconds on a monotonic clock
+        static int64_t now(void)
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        // Starts a new session, leaving out of the next dump anything recorded before
+        void start(void)
+        {
+            _sessionStart = now();
+            _enabled = true;
+        }
+
+        void stop(void)
+        {
+            _enabled = false;
+        }
+
+        bool isEnabled(void)
+        {
+            return _enabled;
+        }
+
+        /**
+         * Names the calling thread in the dump.  Cheap enough to call every time the thread starts work.
+         *
+         * @param name string literal
+         */
+        void setThreadName(const char * name)
+        {
+            Owner & mine = local();
+
+            mine.name = name;
+
+            if (mine.ring) {
+                mine.ring->name = name;
+            }
+        }
+
+        /**
+         * Writes the spans of the current or last session, on any thread, while tracing or not.
+         *
+         * @param path JSON file to write
+         * @return number of spans written, or -1 if the file couldn't be opened
+         */
+        int32_t dump(const char * path)
+        {
+            FILE * fp = fopen(path, "w");
+
+            if (!fp) {
+                return -1;
+            }
+
+            // One dump at a time, since we copy each ring aside while we read it
+            std::lock_guard<std::mutex> lock(_lock);
+
+            const int64_t sessionStart = _sessionStart;
+            const uint32_t ringCount = _ringCount.load(std::memory_order_acquire);
+
+            fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+            bool first = true;
+            int32_t count = 0;
+
+            for (uint32_t k=0; k<ringCount; ++k) {
+
+                const ring_t * r = _rings[k].load(std::memory_order_acquire);
+
+                fprintf(fp, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"",
+                        first ? "" : ",", k);
+                const char * name = r->name;
+                if (name) {
+                    fprintf(fp, "%s\"}}", name);
+                }
+                else {
+                    fprintf(fp, "Thread %u\"}}", k);
+                }
+
+                first = false;
+
+                count += dumpRing(fp, r, k, sessionStart, first);
+            }
+
+            fprintf(fp, "\n]}\n");
+
+            fclose(fp);
+
+            return count;
+        }
+
+}; // class Trace
@@ -0,0 +1,371 @@
+/*
+ * Precomputed piecewise-polynomial trajectory through timed waypoints
+ *
+ * compile() turns the waypoints into one polynomial per leg: quintic for
+ * minimum jerk, or septic for minimum snap.  Each is the polynomial with the
+ * least integrated squared jerk (snap) that meets the position, velocity and
+ * acceleration (and zero jerk) given at both ends.  The velocity and
+ * acceleration at a waypoint come from the parabola through it and its
+ * neighbours, so legs join smoothly; the ends are at rest unless the
+ * trajectory loops.
+ *
+ * A table of segments over equal time buckets, each no longer than the
+ * shortest leg, finds the leg for any time in constant time.  The trajectory
+ * is not changed by evaluation, so any number of threads can evaluate it.
+ *
+ * Copyright (C) 2019 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <math.h>
+#include <string.h>
+#include <vector>
+
+class Trajectory {
+
+    public:
+
+        typedef enum {
+
+            MINIMUM_JERK,
+            MINIMUM_SNAP
+
+        } Smoothness_t;
+
+        typedef struct {
+
+            double time;
+            double position[3];
+
+        } waypoint_t;
+
+    private:
+
+        static const uint8_t MAX_COEFFS = 8;
+
+        // Most buckets per segment, for legs much shorter than the others
+        static const uint32_t MAX_BUCKETS_PER_SEGMENT = 16;
+
+        typedef struct {
+
+            double start;
+            double duration;
+
+            // Coefficients of each axis in s = (t - start) / duration, lowest power first
+            double coeffs[3][MAX_COEFFS];
+
+        } segment_t;
+
+        std::vector<segment_t> _segments;
+
+        // First segment in each bucket
+        std::vector<uint32_t> _index;
+        double _bucket = 0;
+
+        uint8_t _coeffCount = 0;
+        bool _loop = false;
+
+        double _start = 0;
+        double _duration = 0;
+
+        // Time within the trajectory: clamped to the ends, or wrapped if looping
+        double localTime(double time) const
+        {
+            double t = time - _start;
+
+            if (_loop && _duration > 0) {
+                t = fmod(t, _duration);
+                if (t < 0) t += _duration;
+            }
+
+            if (t < 0) t = 0;
+            if (t > _duration) t = _duration;
+
+            return t;
+        }
+
+        const segment_t & find(double t) const
+        {
+            uint32_t b = (uint32_t)(t / _bucket);
+            if (b >= _index.size()) b = (uint32_t)_index.size() - 1;
+
+            uint32_t k = _index[b];
+
+            while (k+1 < _segments.size() && _segments[k+1].start <= t) {
+                k++;
+            }
+
+            return _segments[k];
+        }
+
+        // Derivatives at waypoint k from the parabola through it and its neighbours
+        static void estimate(const waypoint_t & prev, const waypoint_t & here, const waypoint_t & next, double h0, double h1,
+                double velocity[3], double acceleration[3])
+        {
+            for (uint8_t j=0; j<3; ++j) {
+                double slope0 = (here.position[j] - prev.position[j]) / h0;
+                double slope1 = (next.position[j] - here.position[j]) / h1;
+                velocity[j] = (slope0 * h1 + slope1 * h0) / (h0 + h1);
+                acceleration[j] = 2 * (slope1 - slope0) / (h0 + h1);
+            }
+        }
+
+        // Polynomial in s on [0,1] with the given derivatives (with respect to s) at each end
+        static void fit(const double * start, const double * end, uint8_t m, double * coeffs)
+        {
+            // Lower half straight from the start
+            double factorial = 1;
+            for (uint8_t k=0; k<m; ++k) {
+                if (k > 0) factorial *= k;
+                coeffs[k] = start[k] / factorial;
+            }
+
+            // Upper half from the end: sum over i of c[i] * i!/(i-k)! = end[k]
+            double a[4][5] = {};
+            for (uint8_t k=0; k<m; ++k) {
+
+                double rhs = end[k];
+                for (uint8_t i=k; i<m; ++i) {
+                    rhs -= coeffs[i] * falling(i, k);
+                }
+
+                for (uint8_t i=0; i<m; ++i) {
+                    a[k][i] = falling(m+i, k);
+                }
+                a[k][m] = rhs;
+            }
+
+            // Gaussian elimination with partial pivoting
+            for (uint8_t c=0; c<m; ++c) {
+
+                uint8_t pivot = c;
+                for (uint8_t r=c+1; r<m; ++r) {
+                    if (fabs(a[r][c]) > fabs(a[pivot][c])) pivot = r;
+                }
+                for (uint8_t j=0; j<=m; ++j) {
+                    double tmp = a[c][j];
+                    a[c][j] = a[pivot][j];
+                    a[pivot][j] = tmp;
+                }
+
+                for (uint8_t r=0; r<m; ++r) {
+                    if (r == c) continue;
+                    double f = a[r][c] / a[c][c];
+                    for (uint8_t j=c; j<=m; ++j) {
+                        a[r][j] -= f * a[c][j];
+                    }
+                }
+            }
+
+            for (uint8_t i=0; i<m; ++i) {
+                coeffs[m+i] = a[i][m] / a[i][i];
+            }
+        }
+
+        // i!/(i-k)!
+        static double falling(uint8_t i, uint8_t k)
+        {
+            double product = 1;
+            for (uint8_t j=0; j<k; ++j) {
+                product *= i - j;
+            }
+            return product;
+        }
+
+    public:
+
+        /**
+         * Builds the trajectory, replacing any earlier one.
+         *
+         * @param waypoints waypoints in order of strictly increasing time
+         * @param count number of waypoints, at least two
+         * @param smoothness MINIMUM_JERK or MINIMUM_SNAP
+         * @param loop true to repeat forever; the last waypoint should then be at the first one's position
+         * @return false if there are too few waypoints or their times don't increase
+         */
+        bool compile(const waypoint_t * waypoints, uint32_t count, Smoothness_t smoothness=MINIMUM_JERK, bool loop=false)
+        {
+            _segments.clear();
+            _index.clear();
+
+            if (count < 2) {
+                return false;
+            }
+
+            for (uint32_t k=1; k<count; ++k) {
+                if (!(waypoints[k].time > waypoints[k-1].time)) {
+                    return false;
+                }
+            }
+
+            // Boundary conditions: position, velocity, acceleration, jerk
+            const uint8_t m = smoothness == MINIMUM_SNAP ? 4 : 3;
+            _coeffCount = 2 * m;
+            _loop = loop;
+            _start = waypoints[0].time;
+            _duration = waypoints[count-1].time - _start;
+
+            std::vector<double> velocities(3 * count), accelerations(3 * count);
+
+            for (uint32_t k=0; k<count; ++k) {
+
+                double * v = &velocities[3*k];
+                double * a = &accelerations[3*k];
+
+                if (k > 0 && k < count-1) {
+                    estimate(waypoints[k-1], waypoints[k], waypoints[k+1],
+                            waypoints[k].time - waypoints[k-1].time, waypoints[k+1].time - waypoints[k].time, v, a);
+                }
+
+                // Looping, the ends meet at the first waypoint, between the last leg and the first
+                else if (loop && count > 2) {
+                    estimate(waypoints[count-2], waypoints[0], waypoints[1],
+                            waypoints[count-1].time - waypoints[count-2].time, waypoints[1].time - waypoints[0].time, v, a);
+                }
+
+                else {
+                    memset(v, 0, 3 * sizeof(double));
+                    memset(a, 0, 3 * sizeof(double));
+                }
+            }
+
+            double shortest = _duration;
+
+            for (uint32_t k=0; k<count-1; ++k) {
+
+                segment_t segment = {};
+                segment.start = waypoints[k].time - _start;
+                segment.duration = waypoints[k+1].time - waypoints[k].time;
+
+                const double h = segment.duration;
+
+                for (uint8_t j=0; j<3; ++j) {
+
+                    // Derivatives with respect to s, zero jerk at both ends
+                    double a[4] = { waypoints[k].position[j], velocities[3*k+j] * h, accelerations[3*k+j] * h*h, 0 };
+                    double b[4] = { waypoints[k+1].position[j], velocities[3*(k+1)+j] * h, accelerations[3*(k+1)+j] * h*h, 0 };
+
+                    fit(a, b, m, segment.coeffs[j]);
+                }
+
+                _segments.push_back(segment);
+
+                if (h < shortest) shortest = h;
+            }
+
+            // Buckets no longer than the shortest leg, so each holds at most two segments
+            uint32_t buckets = (uint32_t)ceil(_duration / shortest) + 1;
+            const uint32_t limit = MAX_BUCKETS_PER_SEGMENT * (uint32_t)_segments.size() + 1;
+            if (buckets > limit) buckets = limit;
+
+            _bucket = _duration / (buckets - 1);
+            _index.resize(buckets);
+
+            uint32_t k = 0;
+            for (uint32_t b=0; b<buckets; ++b) {
+                while (k+1 < _segments.size() && _segments[k+1].start <= b * _bucket) {
+                    k++;
+                }
+                _index[b] = k;
+            }
+
+            return true;
+        }
+
+        bool isEmpty(void) const
+        {
+            return _segments.empty();
+        }
+
+        double getStartTime(void) const
+        {
+            return _start;
+        }
+
+        double getDuration(void) const
+        {
+            return _duration;
+        }
+
+        /**
+         * Position, and optionally velocity, at a time.  Before the start and after the end (unless looping)
+         * this is the first or last waypoint, at rest.
+         *
+         * @param time time in seconds, on the waypoints' clock
+         * @param position position (output)
+         * @param velocity velocity per second (output), or NULL
+         */
+        void evaluate(double time, double position[3], double velocity[3]=NULL) const
+        {
+            if (_segments.empty()) {
+                memset(position, 0, 3 * sizeof(double));
+                if (velocity) memset(velocity, 0, 3 * sizeof(double));
+                return;
+            }
+
+            const double t = localTime(time);
+
+            const segment_t & segment = find(t);
+
+            double s = (t - segment.start) / segment.duration;
+            if (s > 1) s = 1;
+
+            for (uint8_t j=0; j<3; ++j) {
+
+                const double * c = segment.coeffs[j];
+
+                // Horner's rule for the value and the derivative together
+                double p = c[_coeffCount-1];
+                double dp = 0;
+                for (int8_t i=_coeffCount-2; i>=0; --i) {
+                    dp = dp * s + p;
+                    p = p * s + c[i];
+                }
+
+                position[j] = p;
+
+                if (velocity) {
+                    velocity[j] = dp / segment.duration;
+                }
+            }
+
+            // Resting beyond the ends
+            if (velocity && !_loop && (time < _start || time > _start + _duration)) {
+                memset(velocity, 0, 3 * sizeof(double));
+            }
+        }
+
+        /**
+         * Heading in radians, measured from the x axis toward the y axis: along the velocity, or along the
+         * current leg when stopped.
+         */
+        double getHeading(double time) const
+        {
+            double position[3], velocity[3];
+            evaluate(time, position, velocity);
+
+            if (fabs(velocity[0]) + fabs(velocity[1]) > 1e-9) {
+                return atan2(velocity[1], velocity[0]);
+            }
+
+            if (_segments.empty()) {
+                return 0;
+            }
+
+            const segment_t & segment = find(localTime(time));
+
+            // Net displacement over the leg is the sum of the non-constant coefficients
+            double dx = 0, dy = 0;
+            for (uint8_t i=1; i<_coeffCount; ++i) {
+                dx += segment.coeffs[0][i];
+                dy += segment.coeffs[1][i];
+            }
+
+            return dx || dy ? atan2(dy, dx) : 0;
+        }
+
+}; // class Trajectory
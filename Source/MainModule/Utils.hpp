@@ -13,7 +13,9 @@
 #include <stdio.h>
 #include <stdarg.h>
 
+#include "MainModule.h"
 #include "OSD.hpp"
+#include "LogChannel.hpp"
 
 // Windows/Linux compatibility 
 #ifdef _WIN32
@@ -30,32 +32,55 @@ static const FName makeName(const char * prefix, const uint8_t index, const char
     return FName(name);
 }
 
-static void debug(const char * fmt, ...)
+// Shows a message now on the game thread; queues it for showLog() on any other, where the OSD isn't safe to touch.
+// The file and line identify the call site, which the queue rate-limits.
+static void report(LogChannel::Level_t level, const char * file, uint32_t line, const char * fmt, ...)
 {
 	va_list ap;
 	va_start(ap, fmt);
-	char buf[200];
-	vsnprintf(buf, 200, fmt, ap);
-	osd(buf, false);
-	va_end(ap);
-}
 
-static void debugline(const char * fmt, ...)
-{
-	va_list ap;
-	va_start(ap, fmt);
-	char buf[200];
-	vsnprintf(buf, 200, fmt, ap);
-	osd(buf, false, true);
+	if (!IsInGameThread()) {
+		LogChannel::get().vpost(level, file, line, fmt, ap);
+	}
+
+	else {
+		char buf[200];
+		vsnprintf(buf, 200, fmt, ap);
+		osd(buf, level == LogChannel::LEVEL_ERROR, level == LogChannel::LEVEL_LINE);
+	}
+
 	va_end(ap);
 }
 
-static void error(const char * fmt, ...)
+// Macros rather than functions, so that each call is its own site; prefixed, so as not to
+// take over common names like debug and error in every file that includes this one
+#define MCS_DEBUG(...)     report(LogChannel::LEVEL_DEBUG, __FILE__, __LINE__, __VA_ARGS__)
+#define MCS_DEBUGLINE(...) report(LogChannel::LEVEL_LINE,  __FILE__, __LINE__, __VA_ARGS__)
+#define MCS_ERROR(...)     report(LogChannel::LEVEL_ERROR, __FILE__, __LINE__, __VA_ARGS__)
+
+// Shows and logs the messages other threads have queued; call from the game thread
+static void showLog(void)
 {
-	va_list ap;
-	va_start(ap, fmt);
+	LogChannel & channel = LogChannel::get();
+
+	LogChannel::Level_t level = LogChannel::LEVEL_DEBUG;
 	char buf[200];
-	vsnprintf(buf, 200, fmt, ap);
-	osd(buf, true);
-	va_end(ap);
+
+	while (channel.pop(level, buf, sizeof(buf))) {
+
+		osd(buf, level == LogChannel::LEVEL_ERROR, level == LogChannel::LEVEL_LINE);
+
+		if (level == LogChannel::LEVEL_ERROR) {
+			UE_LOG(LogFlying, Error, TEXT("%s"), ANSI_TO_TCHAR(buf));
+		}
+		else {
+			UE_LOG(LogFlying, Log, TEXT("%s"), ANSI_TO_TCHAR(buf));
+		}
+	}
+
+	uint64_t dropped = channel.takeDropped();
+
+	if (dropped) {
+		UE_LOG(LogFlying, Warning, TEXT("%llu log messages dropped"), (unsigned long long)dropped);
+	}
 }
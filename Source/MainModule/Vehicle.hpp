@@ -18,11 +18,18 @@
 
 #include "Utils.hpp"
 #include "dynamics/MultirotorDynamics.hpp"
+#include "dynamics/Heightfield.hpp"
+#include "dynamics/WindField.hpp"
+#include "dynamics/ParameterFile.hpp"
 #include "FlightManager.hpp"
+#include "ProximityManager.hpp"
 #include "Camera.hpp"
+#include "MetricsServer.hpp"
+#include "Trace.hpp"
 #include "Landscape.h"
 
 #include "Runtime/Engine/Classes/Kismet/KismetMathLibrary.h"
+#include "Async/TaskGraphInterfaces.h"
 
 #include <stdio.h>
 
@@ -73,7 +80,11 @@ class Vehicle {
 
         // Cameras
         Camera* _cameras[Camera::MAX_CAMERAS];
-        uint8_t  _cameraCount;
+        uint8_t  _cameraCount = 0;
+
+        // Process cameras concurrently on the task graph (off unless asked for), and stamp them all with the same time
+        bool _parallelCameras = false;
+        bool _sharedCameraTimestamp = true;
 
         // Set in constructor
         MultirotorDynamics* _dynamics = NULL;
@@ -94,17 +105,161 @@ class Vehicle {
         // For computing AGL
         float _aglOffset = 0;
 
+        // Terrain around the start location, baked at BeginPlay so the dynamics can compute AGL every update
+        Heightfield _terrain;
+        float _terrainHalfExtentMeters = 100;
+        float _terrainSpacingMeters = 0.5;
+        float _terrainCeilingMeters = 20;
+
+        // Optional wind field, mapped at BeginPlay
+        WindField _wind;
+        FString _windPath;
+        double _windDrag = 0.3;
+
+        // Optional parameter file, read at BeginPlay and read again whenever it changes
+        ParameterFile _parameterFile;
+        FString _parameterPath;
+        float _parameterPollCountdown = 0;
+
+        // Seconds between looks at the parameter file
+        static constexpr float PARAMETER_POLL_PERIOD = 1.0;
+
         // Countdown for zeroing-out velocity during final phase of landing
         float _settlingCountdown = 0;
 
         // Starting location, for kinematic offset
         FVector _startLocation = {};
 
+        // Pose most recently displayed, handed to cameras with their images
+        MultirotorDynamics::pose_t _displayedPose = {};
+
+        // We render the pose from this long ago, so there are usually states on either side of it
+        double _renderLatency = 0.010;
+        double _maxExtrapolation = 0.1;
+
+        // How old the displayed pose and the newest published state are at each tick
+        double _poseLag = 0;
+        double _maxPoseLag = 0;
+        double _stateAge = 0;
+        uint32_t _extrapolatedFrames = 0;
+
+        // Health metrics, labelled with the pawn's name
+        Metrics::Counter _ticksMetric;
+        Metrics::Gauge _realTimeFactorMetric;
+        Metrics::Gauge _simTimeMetric;
+        Metrics::Gauge _poseLagMetric;
+        Metrics::Gauge _stateAgeMetric;
+
+        // Registers our metrics and starts the process's endpoint, on the port given by -MetricsPort= (0 for none)
+        void startMetrics(void)
+        {
+            static MetricsServer * server = NULL;
+
+            int32 port = MetricsServer::DEFAULT_PORT;
+            FParse::Value(FCommandLine::Get(), TEXT("MetricsPort="), port);
+
+            if (port < 0 || port > 65535) {
+                MCS_ERROR("No metrics endpoint: -MetricsPort=%d is not a port from 1 to 65535", port);
+            }
+
+            else if (!server && port > 0) {
+                server = new MetricsServer("127.0.0.1", (uint16_t)port);
+                if (!server->isServing()) {
+                    MCS_DEBUG("No metrics endpoint: %s", server->getMessage());
+                }
+            }
+
+            char labels[100];
+            SPRINTF(labels, "vehicle=\"%s\"", TCHAR_TO_ANSI(*_pawn->GetName()));
+
+            Metrics & metrics = Metrics::get();
+            _ticksMetric = metrics.counter("multicopter_game_ticks_total", "Game-thread ticks", labels);
+            _realTimeFactorMetric = metrics.gauge("multicopter_real_time_factor",
+                    "Simulated seconds per wall-clock second over the last second");
+            _simTimeMetric = metrics.gauge("multicopter_sim_time_seconds", "Simulated time of the flight manager",
+                    labels);
+            _poseLagMetric = metrics.gauge("multicopter_pose_lag_seconds", "Age of the displayed pose", labels);
+            _stateAgeMetric = metrics.gauge("multicopter_state_age_seconds",
+                    "Age of the newest state from the flight manager", labels);
+        }
+
+        // T starts a trace, and T again writes it to the Saved directory
+        void toggleTrace(void)
+        {
+            Trace & trace = Trace::get();
+
+            // Every vehicle sees the key, but the trace is shared
+            static uint64 toggledFrame = 0;
+
+            if (!_playerController->WasInputKeyJustPressed(EKeys::T) || toggledFrame == GFrameCounter) {
+                return;
+            }
+
+            toggledFrame = GFrameCounter;
+
+            if (!trace.isEnabled()) {
+                trace.start();
+                MCS_DEBUG("Tracing");
+                return;
+            }
+
+            trace.stop();
+
+            FString path = FPaths::ProjectSavedDir() + TEXT("Trace-") + FDateTime::Now().ToString() + TEXT(".json");
+
+            int32 count = trace.dump(TCHAR_TO_ANSI(*FPaths::ConvertRelativePathToFull(path)));
+
+            if (count < 0) {
+                MCS_DEBUG("Couldn't write trace to %s", TCHAR_TO_ANSI(*path));
+            }
+            else {
+                MCS_DEBUG("Wrote %d spans to %s", count, TCHAR_TO_ANSI(*path));
+            }
+        }
+
+        void updateMetrics(void)
+        {
+            _ticksMetric.increment();
+            _realTimeFactorMetric.set(getRealTimeFactor());
+            _simTimeMetric.set(_flightManager->getCurrentTime());
+            _poseLagMetric.set(_poseLag);
+            _stateAgeMetric.set(_stateAge);
+        }
+
         // Retrieves kinematics from dynamics computed in another thread, returning true if vehicle is airborne, false otherwise.
         void updateKinematics(void)
         {
-            // Get vehicle pose from dynamics
-            MultirotorDynamics::pose_t pose = _dynamics->getPose();
+            MultirotorDynamics::pose_t pose = {};
+
+            const StateHistory & history = _flightManager->getHistory();
+            StateHistory::sample_t newest = {};
+            StateHistory::Result_t result = StateHistory::RESULT_NONE;
+
+            if (_renderLatency >= 0 && history.latest(newest)) {
+
+                double now = _flightManager->getCurrentTime();
+                double renderTime = now - _renderLatency;
+
+                result = history.poseAt(renderTime, pose, _maxExtrapolation);
+
+                // Extrapolation stops short of the render time when states are very late
+                _poseLag = now - FMath::Min(renderTime, newest.time + _maxExtrapolation);
+                _maxPoseLag = FMath::Max(_poseLag, _maxPoseLag);
+                _stateAge = now - newest.time;
+
+                if (result == StateHistory::RESULT_EXTRAPOLATED) {
+                    _extrapolatedFrames++;
+                }
+            }
+
+            // Nothing published yet, or history disabled: show the current pose
+            if (result == StateHistory::RESULT_NONE) {
+                pose = _dynamics->getPose();
+                _poseLag = 0;
+                _stateAge = 0;
+            }
+
+            _displayedPose = pose;
 
             // Set vehicle pose in animation
             _pawn->SetActorLocation(_startLocation +
@@ -146,8 +301,123 @@ class Vehicle {
 
         void grabImages(void)
         {
+            // On the simulation clock, like the poses
+            double timestamp = _flightManager->getCurrentTime();
+
+            // Same pose the pawn was just drawn at
+            const MultirotorDynamics::pose_t & pose = _displayedPose;
+
+            // Single camera or serial processing: no need for the task graph
+            if (!_parallelCameras || _cameraCount < 2) {
+                for (uint8_t i = 0; i < _cameraCount; ++i) {
+                    _cameras[i]->grabImage(_sharedCameraTimestamp ? timestamp : _flightManager->getCurrentTime(), pose);
+                }
+                return;
+            }
+
+            // Reading a render target has to happen on the game thread, so we read
+            // the cameras in turn and dispatch each one's processing as soon as its
+            // pixels are available, overlapping it with the remaining reads.
+            FGraphEventArray tasks;
+
             for (uint8_t i = 0; i < _cameraCount; ++i) {
-                _cameras[i]->grabImage();
+
+                Camera * camera = _cameras[i];
+
+                camera->readPixels(_sharedCameraTimestamp ? timestamp : _flightManager->getCurrentTime(), pose);
+
+                tasks.Add(FFunctionGraphTask::CreateAndDispatchWhenReady(
+                            [camera]() { camera->processPixels(); }, TStatId(), NULL, ENamedThreads::AnyThread));
+            }
+
+            // One sync point per tick: all cameras are done before we move on
+            FTaskGraphInterface::Get().WaitUntilTasksComplete(tasks, ENamedThreads::GameThread);
+        }
+
+        // Samples the ground on a grid around the start location by tracing down from above
+        void bakeTerrain(void)
+        {
+            _dynamics->setTerrain(NULL);
+
+            uint32_t n = _terrainSpacingMeters > 0 ? 2 * (uint32_t)(_terrainHalfExtentMeters / _terrainSpacingMeters) + 1 : 0;
+
+            if (n < 2) return;
+
+            // Heights are relative to the ground under the start location, where AGL is zero
+            FVector groundPoint;
+            if (!traceGround(_startLocation + FVector(0, 0, 100), groundPoint)) return;
+
+            float * samples = new float [n*n];
+
+            float origin = -(float)(n / 2) * _terrainSpacingMeters;
+
+            for (uint32_t j = 0; j < n; ++j) {
+                for (uint32_t i = 0; i < n; ++i) {
+
+                    // NED x,y map directly onto world X,Y
+                    FVector top = _startLocation + FVector(origin + i*_terrainSpacingMeters, origin + j*_terrainSpacingMeters,
+                            _terrainCeilingMeters) * 100;
+
+                    FVector impactPoint;
+                    samples[j*n + i] = traceGround(top, impactPoint) ? (impactPoint.Z - groundPoint.Z) / 100 : NAN;
+                }
+            }
+
+            _terrain.build(samples, n, n, origin, origin, _terrainSpacingMeters);
+
+            delete[] samples;
+
+            _dynamics->setTerrain(&_terrain);
+        }
+
+        void loadWind(void)
+        {
+            double none[3] = {};
+            _dynamics->setWind(NULL, none);
+
+            if (_windPath.IsEmpty()) return;
+
+            if (!_wind.load(TCHAR_TO_ANSI(*_windPath))) {
+                MCS_ERROR("Unable to load wind field %s", TCHAR_TO_ANSI(*_windPath));
+                return;
+            }
+
+            double origin[3] = { _startLocation.X / 100, _startLocation.Y / 100, -_startLocation.Z / 100 };  // UE cm forward, right, up => NED m
+
+            _dynamics->setWind(&_wind, origin, _windDrag);
+        }
+
+        void loadParameters(void)
+        {
+            if (_parameterPath.IsEmpty()) return;
+
+            if (!_parameterFile.load(TCHAR_TO_ANSI(*_parameterPath))) {
+                MCS_ERROR("%s; using built-in parameters", _parameterFile.getMessage());
+                return;
+            }
+
+            _dynamics->setParameters(_parameterFile.get());
+        }
+
+        // Hands the flight thread new parameters when the file changes; a bad edit keeps the ones we have
+        void pollParameters(float DeltaSeconds)
+        {
+            if (_parameterPath.IsEmpty()) return;
+
+            _parameterPollCountdown -= DeltaSeconds;
+
+            if (_parameterPollCountdown > 0) return;
+
+            _parameterPollCountdown = PARAMETER_POLL_PERIOD;
+
+            if (!_parameterFile.poll()) return;
+
+            if (_parameterFile.isValid()) {
+                _dynamics->setParameters(_parameterFile.get());
+                MCS_DEBUG("Reloaded parameters from %s", TCHAR_TO_ANSI(*_parameterPath));
+            }
+            else {
+                MCS_ERROR("%s; keeping the parameters we have", _parameterFile.getMessage());
             }
         }
 
@@ -322,6 +592,115 @@ class Vehicle {
             _propellerMeshComponents[index]->SetRelativeRotation(FRotator(0, angle, 0));
         }
 
+        /**
+         * Sets the area baked into the terrain heightfield at BeginPlay.  Beyond it, and where
+         * nothing was hit, AGL comes from a line trace on the game thread as before.
+         *
+         * @param halfExtentMeters distance from the start location to the edge of the area; zero disables baking
+         * @param spacingMeters distance between samples
+         * @param ceilingMeters height above the start location to trace down from
+         */
+        void setTerrainArea(float halfExtentMeters, float spacingMeters=0.5, float ceilingMeters=20)
+        {
+            _terrainHalfExtentMeters = halfExtentMeters;
+            _terrainSpacingMeters = spacingMeters;
+            _terrainCeilingMeters = ceilingMeters;
+        }
+
+        /**
+         * Sets a wind field file (see WindField) to fly through, mapped at BeginPlay.
+         *
+         * @param path field file, or empty for still air
+         * @param drag linear drag per unit mass on the velocity relative to the air, 1/s
+         */
+        void setWindField(const FString & path, double drag=0.3)
+        {
+            _windPath = path;
+            _windDrag = drag;
+        }
+
+        /**
+         * Sets a parameter file (see ParameterFile) for the dynamics, read at BeginPlay and read again
+         * whenever it changes, so the vehicle can be retuned while it flies.
+         *
+         * @param path parameter file, or empty for the built-in parameters
+         */
+        void setParameterFile(const FString & path)
+        {
+            _parameterPath = path;
+        }
+
+        // Saves the baked terrain for use by programs running the dynamics without the engine
+        bool saveTerrain(const char * path)
+        {
+            return _terrain.save(path);
+        }
+
+        /**
+         * Sets how far behind the flight thread the vehicle is rendered.  Poses are interpolated
+         * between published states, or extrapolated when the newest state is older than the
+         * latency.  A negative latency shows the current pose at every tick, without smoothing.
+         *
+         * @param seconds render latency
+         * @param maxExtrapolationSeconds longest time to extrapolate past the newest state
+         */
+        void setRenderLatency(double seconds, double maxExtrapolationSeconds=0.1)
+        {
+            _renderLatency = seconds;
+            _maxExtrapolation = maxExtrapolationSeconds;
+        }
+
+        // Seconds between the time of the displayed pose (also given to cameras) and the tick that showed it
+        double getPoseLag(void)
+        {
+            return _poseLag;
+        }
+
+        double getMaxPoseLag(void)
+        {
+            return _maxPoseLag;
+        }
+
+        // Seconds since the flight thread published its newest state, as of the last tick
+        double getStateAge(void)
+        {
+            return _stateAge;
+        }
+
+        uint32_t getExtrapolatedFrames(void)
+        {
+            return _extrapolatedFrames;
+        }
+
+        // Simulated seconds per wall-clock second, as achieved; see SimClock for running faster or slower
+        double getRealTimeFactor(void)
+        {
+            return SimClock::get().getRealTimeFactor();
+        }
+
+        /**
+         * Adds the vehicle to proximity checking; call after BeginPlay().
+         *
+         * @param proximity shared proximity manager
+         * @param radiusMeters radius of a sphere enclosing the vehicle
+         * @return the vehicle's id in the proximity manager, or FProximityManager::ID_NONE if it is full
+         */
+        uint32_t addToProximity(FProximityManager * proximity, double radiusMeters)
+        {
+            double origin[3] = { _startLocation.X / 100, _startLocation.Y / 100, -_startLocation.Z / 100 };  // UE cm forward, right, up => NED m
+
+            return proximity->addVehicle(_flightManager, origin, radiusMeters);
+        }
+
+        // Serial processing, the default, runs each camera's processImageBytes() on the game thread.
+        // Parallel processing runs them on task-graph workers, so turn it on only for cameras
+        // whose processing touches no UObjects and keeps any shared state behind a lock.
+        void setParallelCameras(bool parallel, bool sharedTimestamp=true)
+        {
+            _parallelCameras = parallel;
+            _sharedCameraTimestamp = sharedTimestamp;
+        }
+
         void addCamera(Camera* camera)
         {
             // Add camera to spring arm
@@ -365,7 +744,7 @@ class Vehicle {
             // Make sure a map has been selected
             _mapSelected = false;
             if (_pawn->GetWorld()->GetMapName().Contains("Untitled")) {
-                error("NO MAP SELECTED");
+                MCS_ERROR("NO MAP SELECTED");
                 return;
             }
             _mapSelected = true;
@@ -386,6 +765,14 @@ class Vehicle {
 
             // AGL offset will be set to a positve value the first time agl() is called
             _aglOffset = 0;
+            agl();
+
+            bakeTerrain();
+
+            loadWind();
+
+            // Before init(), which adopts them
+            loadParameters();
 
             // Get vehicle ground-truth rotation to initialize flight manager
             FRotator startRotation = _pawn->GetActorRotation();
@@ -408,6 +795,14 @@ class Vehicle {
             }
 
             playerCameraSetChaseView();
+
+            startMetrics();
+
+            // -Trace traces from the start; T toggles it
+            Trace::get().setThreadName("Game");
+            if (FParse::Param(FCommandLine::Get(), TEXT("Trace")) && !Trace::get().isEnabled()) {
+                Trace::get().start();
+            }
         }
 
         void Tick(float DeltaSeconds)
@@ -418,16 +813,36 @@ class Vehicle {
             // Run the game if a map has been selected
             if (_mapSelected) {
 
+                Trace::Scope scope("Vehicle::Tick");
+
+                toggleTrace();
+
+                // Messages from the flight manager and other threads
+                showLog();
+
+                pollParameters(DeltaSeconds);
+
                 // Use 1/2 keys to switch player-camera view
                 setPlayerCameraView();
 
-                updateKinematics();
+                {
+                    Trace::Scope kinematicsScope("Vehicle::updateKinematics");
+                    updateKinematics();
+                }
 
-                grabImages();
+                {
+                    Trace::Scope camerasScope("Vehicle::grabImages");
+                    grabImages();
+                }
 
                 animatePropellers();
 
-                _dynamics->setAgl(agl());
+                // Off the baked terrain, AGL comes from a trace at the displayed location
+                if (!_dynamics->hasTerrainAt(_displayedPose.location[0], _displayedPose.location[1])) {
+                    _dynamics->setAgl(agl());
+                }
+
+                updateMetrics();
             }
         }
 
@@ -475,21 +890,32 @@ class Vehicle {
         // (other than the vehicle itself).
         float getImpactDistance(FVector startPoint, FVector endPoint)
         {
+            FVector impactPoint;
+            return traceImpact(startPoint, endPoint, impactPoint) ? (startPoint.Z - impactPoint.Z) / 100 : -1;
+        }
+
+        bool traceImpact(FVector startPoint, FVector endPoint, FVector & impactPoint)
+        {
+            static const FName traceTag(TEXT("Distance Trace"));
+
             // Currently, the only collisions we ignore are with the pawn itself
-            TArray<AActor*> actorsToIgnore;
-            actorsToIgnore.Add(_pawn);
-            FCollisionQueryParams traceParams(FName(TEXT("Distance Trace")), true, actorsToIgnore[0]);
-            traceParams.AddIgnoredActors(actorsToIgnore);
+            FCollisionQueryParams traceParams(traceTag, true, _pawn);
 
             FHitResult OutHit;
             if (_pawn->GetWorld()->LineTraceSingleByChannel(OutHit, startPoint, endPoint, ECC_Visibility, traceParams)) {
                 if (OutHit.bBlockingHit) {
-                    FVector impactPoint = OutHit.ImpactPoint;
-                    return (startPoint.Z - impactPoint.Z) / 100;
+                    impactPoint = OutHit.ImpactPoint;
+                    return true;
                 }
             }
 
-            return -1;
+            return false;
+        }
+
+        // Traces straight down from a point to the ground
+        bool traceGround(FVector startPoint, FVector & impactPoint)
+        {
+            return traceImpact(startPoint, FVector(startPoint.X, startPoint.Y, startPoint.Z - INF), impactPoint);
         }
 
         void drawHorizontal(FVector point)
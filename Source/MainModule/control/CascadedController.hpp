@@ -0,0 +1,289 @@
+/*
+ * Cascaded flight controller: position, altitude, attitude and rate loops
+ *
+ * Each loop's output is the target of the one inside it:
+ *
+ *   position (m) -> velocity (m/s) -> acceleration (m/s^2) -> roll and pitch angles
+ *   altitude (m) -> climb rate (m/s) -> vertical acceleration (m/s^2) -> throttle
+ *   angles (rad) -> angular rates (rad/s) -> roll, pitch and yaw demands -> mixer
+ *
+ * In MODE_ATTITUDE the setpoint gives the roll and pitch angles and the
+ * throttle; MODE_ALTITUDE adds altitude hold; MODE_POSITION holds location.
+ * Yaw is held at the setpoint in every mode.  Locations are NED, as in
+ * MultirotorDynamics.  Throttle comes from the hover throttle, scaled for
+ * thrust going as the square of motor speed and for tilt.
+ *
+ * ControllerBatch runs the same loops for many vehicles at once.
+ *
+ * Copyright (C) 2019 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include "Pid.hpp"
+#include "Mixer.hpp"
+#include "../dynamics/MultirotorDynamics.hpp"
+
+class CascadedController {
+
+    public:
+
+        typedef enum {
+
+            MODE_ATTITUDE,
+            MODE_ALTITUDE,
+            MODE_POSITION
+
+        } Mode_t;
+
+        typedef struct {
+
+            Pid::gains_t position;  // horizontal m -> m/s
+            Pid::gains_t velocity;  // horizontal m/s -> m/s^2
+            Pid::gains_t altitude;  // m -> m/s
+            Pid::gains_t climb;     // m/s -> m/s^2
+            Pid::gains_t angle;     // roll and pitch rad -> rad/s
+            Pid::gains_t rate;      // roll and pitch rad/s -> demand
+            Pid::gains_t heading;   // yaw rad -> rad/s
+            Pid::gains_t yawRate;   // yaw rad/s -> demand
+
+            // Motor value that holds the vehicle in a hover
+            double hoverThrottle;
+
+            // Largest roll or pitch the position loop asks for, in radians
+            double maxTilt;
+
+        } config_t;
+
+        typedef struct {
+
+            // NED meters; x and y in MODE_POSITION, z in MODE_ALTITUDE and MODE_POSITION
+            double location[3];
+
+            // Roll and pitch in MODE_ATTITUDE and MODE_ALTITUDE, yaw always; radians
+            double rotation[3];
+
+            // MODE_ATTITUDE only
+            double throttle;
+
+        } setpoint_t;
+
+        static constexpr double G = 9.80665;
+
+        static constexpr double PI = 3.14159265358979323846;
+
+        // Tilt beyond which we stop adding throttle to make up for it
+        static constexpr double MIN_TILT_COSINE = 0.5;
+
+    private:
+
+        config_t _config = {};
+        const Mixer * _mixer = NULL;
+
+        Mode_t _mode = MODE_POSITION;
+        setpoint_t _setpoint = {};
+
+        Pid _positionPid[2];
+        Pid _velocityPid[2];
+        Pid _altitudePid;
+        Pid _climbPid;
+        Pid _anglePid[2];
+        Pid _ratePid[2];
+        Pid _headingPid;
+        Pid _yawRatePid;
+
+    public:
+
+        /**
+         * @param config gains and limits
+         * @param mixer motor layout; has to outlive us, as Mixer::quadXAP() and the like do
+         */
+        CascadedController(const config_t & config, const Mixer & mixer)
+            : _mixer(&mixer)
+        {
+            setConfig(config);
+        }
+
+        void setConfig(const config_t & config)
+        {
+            _config = config;
+
+            for (uint8_t k=0; k<2; ++k) {
+                _positionPid[k].setGains(config.position);
+                _velocityPid[k].setGains(config.velocity);
+                _anglePid[k].setGains(config.angle);
+                _ratePid[k].setGains(config.rate);
+            }
+
+            _altitudePid.setGains(config.altitude);
+            _climbPid.setGains(config.climb);
+            _headingPid.setGains(config.heading);
+            _yawRatePid.setGains(config.yawRate);
+        }
+
+        const config_t & getConfig(void) const
+        {
+            return _config;
+        }
+
+        // Changing mode starts the loops afresh
+        void setMode(Mode_t mode)
+        {
+            if (mode != _mode) {
+                reset();
+            }
+
+            _mode = mode;
+        }
+
+        Mode_t getMode(void) const
+        {
+            return _mode;
+        }
+
+        void setSetpoint(const setpoint_t & setpoint)
+        {
+            _setpoint = setpoint;
+        }
+
+        const setpoint_t & getSetpoint(void) const
+        {
+            return _setpoint;
+        }
+
+        // Clears integrals and derivative history, e.g. when the vehicle is reset
+        void reset(void)
+        {
+            for (uint8_t k=0; k<2; ++k) {
+                _positionPid[k].reset();
+                _velocityPid[k].reset();
+                _anglePid[k].reset();
+                _ratePid[k].reset();
+            }
+
+            _altitudePid.reset();
+            _climbPid.reset();
+            _headingPid.reset();
+            _yawRatePid.reset();
+        }
+
+        /**
+         * Runs the loops once.
+         *
+         * @param state vehicle state
+         * @param dt seconds since the last update
+         * @param motorvals motor values out, one per motor of the mixer
+         */
+        void update(const MultirotorDynamics::state_t & state, double dt, double * motorvals)
+        {
+            const double * location = state.pose.location;
+            const double * rotation = state.pose.rotation;
+
+            const double cosYaw = cos(rotation[2]);
+            const double sinYaw = sin(rotation[2]);
+
+            double rollTarget = _setpoint.rotation[0];
+            double pitchTarget = _setpoint.rotation[1];
+
+            if (_mode == MODE_POSITION) {
+
+                double accel[2] = {};
+
+                for (uint8_t k=0; k<2; ++k) {
+                    const double velocityTarget = _positionPid[k].update(_setpoint.location[k], location[k], dt);
+                    accel[k] = _velocityPid[k].update(velocityTarget, state.inertialVel[k], dt);
+                }
+
+                tiltTargets(accel[0], accel[1], cosYaw, sinYaw, _config.maxTilt, rollTarget, pitchTarget);
+            }
+
+            double throttle = _setpoint.throttle;
+
+            if (_mode != MODE_ATTITUDE) {
+
+                // Up is positive here
+                const double climbTarget = _altitudePid.update(-_setpoint.location[2], -location[2], dt);
+                const double accelUp = _climbPid.update(climbTarget, -state.inertialVel[2], dt);
+
+                throttle = thrustThrottle(_config.hoverThrottle, sqrt(thrustRatio(accelUp)),
+                        tiltCompensation(rotation[0], rotation[1]));
+            }
+
+            Mixer::demands_t demands = {};
+            demands.throttle = throttle;
+
+            const double rollRateTarget = _anglePid[0].update(rollTarget, rotation[0], dt);
+            const double pitchRateTarget = _anglePid[1].update(pitchTarget, rotation[1], dt);
+
+            demands.roll = _ratePid[0].update(rollRateTarget, state.angularVel[0], dt);
+            demands.pitch = _ratePid[1].update(pitchRateTarget, state.angularVel[1], dt);
+
+            // Turn the short way round
+            const double yawTarget = rotation[2] + wrap(_setpoint.rotation[2] - rotation[2]);
+            const double yawRateTarget = _headingPid.update(yawTarget, rotation[2], dt);
+            demands.yaw = _yawRatePid.update(yawRateTarget, state.angularVel[2], dt);
+
+            _mixer->mix(demands, motorvals);
+        }
+
+        /**
+         * Motor value that balances gravity, for a vehicle whose dynamics turn motor values into
+         * speed linearly up to maxrpm
+         */
+        static double hoverThrottle(const MultirotorDynamics::Parameters & params, uint8_t motorCount)
+        {
+            const double maxOmega = params.maxrpm * 3.14159 / 30;
+
+            return sqrt(params.m * G / (motorCount * params.b)) / maxOmega;
+        }
+
+        // The rest is shared with ControllerBatch so the two agree
+
+        // Roll and pitch that point the thrust for a horizontal acceleration in NED
+        static void tiltTargets(double accelX, double accelY, double cosYaw, double sinYaw, double maxTilt,
+                double & roll, double & pitch)
+        {
+            // Into the vehicle's heading: forward and right
+            const double forward = cosYaw * accelX + sinYaw * accelY;
+            const double right = -sinYaw * accelX + cosYaw * accelY;
+
+            // Rolling right accelerates right; pitching up (positive theta) accelerates backward
+            roll = Pid::clamp(right / G, maxTilt);
+            pitch = Pid::clamp(-forward / G, maxTilt);
+        }
+
+        // Thrust needed for an upward acceleration, as a fraction of hover thrust
+        static double thrustRatio(double accelUp)
+        {
+            const double ratio = (G + accelUp) / G;
+            return ratio > 0 ? ratio : 0;
+        }
+
+        // Cosine of the tilt from vertical, held to where we stop making up for it
+        static double tiltCosine(double cosRoll, double cosPitch)
+        {
+            const double tilt = cosRoll * cosPitch;
+            return tilt > MIN_TILT_COSINE ? tilt : MIN_TILT_COSINE;
+        }
+
+        // Extra thrust for tilt, as a factor on motor values
+        static double tiltCompensation(double roll, double pitch)
+        {
+            return 1 / sqrt(tiltCosine(cos(roll), cos(pitch)));
+        }
+
+        // Motor value from the square root of the thrust ratio, since thrust goes as the square of motor speed
+        static double thrustThrottle(double hoverThrottle, double rootThrustRatio, double tiltCompensation)
+        {
+            return hoverThrottle * rootThrustRatio * tiltCompensation;
+        }
+
+        // An angle in [-pi, pi]
+        static double wrap(double angle)
+        {
+            return remainder(angle, 2 * PI);
+        }
+
+}; // class CascadedController
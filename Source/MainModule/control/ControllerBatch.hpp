@@ -0,0 +1,381 @@
+/*
+ * CascadedController for many vehicles at once, in structure-of-arrays form
+ *
+ * Every vehicle flies the same loops with the same gains and mixer, in the
+ * same mode; each has its own state, setpoint and PID memory.  Each field
+ * is an array over vehicles, so update() runs each PID as one loop over the
+ * vehicles that the compiler vectorizes.  The trigonometry and square roots
+ * are done in their own passes, through FastMath, so that at less than full
+ * accuracy they vectorize too.
+ *
+ * Given the same states and setpoints, the motor values agree with those of
+ * a CascadedController per vehicle, at full accuracy.
+ *
+ * Copyright (C) 2019 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include "CascadedController.hpp"
+
+class ControllerBatch {
+
+    private:
+
+        // Arrays over vehicles
+        typedef enum {
+
+            // State
+            ARRAY_X,
+            ARRAY_Y,
+            ARRAY_Z,
+            ARRAY_VX,
+            ARRAY_VY,
+            ARRAY_VZ,
+            ARRAY_ROLL,
+            ARRAY_PITCH,
+            ARRAY_YAW,
+            ARRAY_ROLL_RATE,
+            ARRAY_PITCH_RATE,
+            ARRAY_YAW_RATE,
+
+            // Setpoints
+            ARRAY_TARGET_X,
+            ARRAY_TARGET_Y,
+            ARRAY_TARGET_Z,
+            ARRAY_TARGET_ROLL,
+            ARRAY_TARGET_PITCH,
+            ARRAY_TARGET_YAW,
+            ARRAY_TARGET_THROTTLE,
+
+            // Between the loops
+            ARRAY_COS_YAW,
+            ARRAY_SIN_YAW,
+            ARRAY_TILT,
+            ARRAY_YAW_ERROR,
+            ARRAY_A,
+            ARRAY_B,
+            ARRAY_C,
+            ARRAY_D,
+            ARRAY_ROLL_GOAL,
+            ARRAY_PITCH_GOAL,
+            ARRAY_THROTTLE,
+            ARRAY_ROLL_DEMAND,
+            ARRAY_PITCH_DEMAND,
+            ARRAY_YAW_DEMAND,
+
+            ARRAY_COUNT
+
+        } Array_t;
+
+        // PIDs, each with an integral and a last measurement per vehicle
+        typedef enum {
+
+            PID_POSITION_X,
+            PID_POSITION_Y,
+            PID_VELOCITY_X,
+            PID_VELOCITY_Y,
+            PID_ALTITUDE,
+            PID_CLIMB,
+            PID_ANGLE_ROLL,
+            PID_ANGLE_PITCH,
+            PID_RATE_ROLL,
+            PID_RATE_PITCH,
+            PID_HEADING,
+            PID_YAW_RATE,
+
+            PID_COUNT
+
+        } Pid_t;
+
+        CascadedController::config_t _config = {};
+        const Mixer * _mixer = NULL;
+
+        CascadedController::Mode_t _mode = CascadedController::MODE_POSITION;
+
+        uint32_t _count = 0;
+
+        // One block holding the arrays, the PID memories and the motor values, each array a whole number of cache lines
+        double * _block = NULL;
+        uint32_t _stride = 0;
+
+        bool _started = false;
+
+        FastMath::Accuracy_t _accuracy = FastMath::ACCURACY_FULL;
+
+        double * array(uint32_t index)
+        {
+            return _block + index * _stride;
+        }
+
+        double * integral(Pid_t pid)
+        {
+            return array(ARRAY_COUNT + 2 * pid);
+        }
+
+        double * lastActual(Pid_t pid)
+        {
+            return array(ARRAY_COUNT + 2 * pid + 1);
+        }
+
+        double * motors(uint8_t motor)
+        {
+            return array(ARRAY_COUNT + 2 * PID_COUNT + motor);
+        }
+
+        // Pid::update() over all vehicles
+        void pid(Pid_t which, const Pid::gains_t & gains, const double * target, const double * actual, double * output,
+                double dt)
+        {
+            double * integral = this->integral(which);
+            double * last = lastActual(which);
+
+            // Locals, so the stores in the loop can't be taken for changes to them; and no branches, so it vectorizes
+            const uint32_t n = _count;
+            const bool derivative = _started && dt > 0;
+            const double kp = gains.kp;
+            const double ki = gains.ki;
+            const double kd = derivative ? gains.kd : 0;
+            const double divisor = derivative ? dt : 1;
+            const double windupMax = gains.windupMax;
+            const double outputMax = gains.outputMax;
+
+            for (uint32_t i=0; i<n; ++i) {
+
+                const double error = target[i] - actual[i];
+
+                const double proportional = kp * error + kd * ((last[i] - actual[i]) / divisor);
+
+                const double step = ki * error * dt;
+
+                const double unclamped = proportional + integral[i] + step;
+                const double integrated = Pid::clamp(integral[i] + step, windupMax);
+                const bool hold = (fabs(unclamped) >= outputMax) & (unclamped * step >= 0);
+                integral[i] = hold ? integral[i] : integrated;
+
+                last[i] = actual[i];
+
+                output[i] = Pid::clamp(proportional + integral[i], outputMax);
+            }
+        }
+
+        // Negates an array, for the loops that work with up rather than down
+        void negate(const double * in, double * out)
+        {
+            const uint32_t n = _count;
+
+            for (uint32_t i=0; i<n; ++i) {
+                out[i] = -in[i];
+            }
+        }
+
+    public:
+
+        /**
+         * @param config gains and limits for every vehicle
+         * @param mixer motor layout; has to outlive us
+         * @param count number of vehicles
+         */
+        ControllerBatch(const CascadedController::config_t & config, const Mixer & mixer, uint32_t count)
+            : _config(config), _mixer(&mixer), _count(count)
+        {
+            // Eight doubles to a cache line
+            _stride = (count + 7) & ~7u;
+
+            const uint32_t arrays = ARRAY_COUNT + 2 * PID_COUNT + mixer.motorCount();
+
+            _block = new double[arrays * _stride]();
+        }
+
+        ~ControllerBatch(void)
+        {
+            delete[] _block;
+        }
+
+        uint32_t count(void) const
+        {
+            return _count;
+        }
+
+        // Trades the accuracy of the sines, cosines and square roots for speed; the default is full
+        void setMathAccuracy(FastMath::Accuracy_t accuracy)
+        {
+            _accuracy = accuracy;
+        }
+
+        // Changing mode starts every vehicle's loops afresh
+        void setMode(CascadedController::Mode_t mode)
+        {
+            if (mode != _mode) {
+                reset();
+            }
+
+            _mode = mode;
+        }
+
+        void reset(void)
+        {
+            for (uint32_t k=0; k<2*PID_COUNT; ++k) {
+                memset(array(ARRAY_COUNT + k), 0, _count * sizeof(double));
+            }
+
+            _started = false;
+        }
+
+        void setState(uint32_t index, const MultirotorDynamics::state_t & state)
+        {
+            for (uint8_t k=0; k<3; ++k) {
+                array(ARRAY_X + k)[index] = state.pose.location[k];
+                array(ARRAY_VX + k)[index] = state.inertialVel[k];
+                array(ARRAY_ROLL + k)[index] = state.pose.rotation[k];
+                array(ARRAY_ROLL_RATE + k)[index] = state.angularVel[k];
+            }
+        }
+
+        void setSetpoint(uint32_t index, const CascadedController::setpoint_t & setpoint)
+        {
+            for (uint8_t k=0; k<3; ++k) {
+                array(ARRAY_TARGET_X + k)[index] = setpoint.location[k];
+                array(ARRAY_TARGET_ROLL + k)[index] = setpoint.rotation[k];
+            }
+
+            array(ARRAY_TARGET_THROTTLE)[index] = setpoint.throttle;
+        }
+
+        /**
+         * Runs every vehicle's loops once.
+         *
+         * @param dt seconds since the last update, the same for every vehicle
+         */
+        void update(double dt)
+        {
+            const uint32_t n = _count;
+
+            double * cosYaw = array(ARRAY_COS_YAW);
+            double * sinYaw = array(ARRAY_SIN_YAW);
+            double * tilt = array(ARRAY_TILT);
+            double * yawError = array(ARRAY_YAW_ERROR);
+
+            const double * roll = array(ARRAY_ROLL);
+            const double * pitch = array(ARRAY_PITCH);
+            const double * yaw = array(ARRAY_YAW);
+            const double * targetYaw = array(ARRAY_TARGET_YAW);
+
+            double * a = array(ARRAY_A);
+            double * b = array(ARRAY_B);
+            double * c = array(ARRAY_C);
+            double * d = array(ARRAY_D);
+
+            // Trigonometry pass, with CascadedController::tiltCompensation() taken apart around its calls
+            FastMath::sincos(yaw, sinYaw, cosYaw, n, _accuracy);
+            FastMath::sincos(roll, a, b, n, _accuracy);
+            FastMath::sincos(pitch, a, c, n, _accuracy);
+
+            for (uint32_t i=0; i<n; ++i) {
+                tilt[i] = CascadedController::tiltCosine(b[i], c[i]);
+            }
+
+            FastMath::sqrt(tilt, tilt, n, _accuracy);
+
+            // Math library pass
+            for (uint32_t i=0; i<n; ++i) {
+                tilt[i] = 1 / tilt[i];
+                yawError[i] = CascadedController::wrap(targetYaw[i] - yaw[i]);
+            }
+
+            double * rollGoal = array(ARRAY_ROLL_GOAL);
+            double * pitchGoal = array(ARRAY_PITCH_GOAL);
+            double * throttle = array(ARRAY_THROTTLE);
+
+            if (_mode == CascadedController::MODE_POSITION) {
+
+                pid(PID_POSITION_X, _config.position, array(ARRAY_TARGET_X), array(ARRAY_X), a, dt);
+                pid(PID_VELOCITY_X, _config.velocity, a, array(ARRAY_VX), b, dt);
+                pid(PID_POSITION_Y, _config.position, array(ARRAY_TARGET_Y), array(ARRAY_Y), a, dt);
+                pid(PID_VELOCITY_Y, _config.velocity, a, array(ARRAY_VY), c, dt);
+
+                const double maxTilt = _config.maxTilt;
+
+                for (uint32_t i=0; i<n; ++i) {
+                    CascadedController::tiltTargets(b[i], c[i], cosYaw[i], sinYaw[i], maxTilt, rollGoal[i], pitchGoal[i]);
+                }
+            }
+            else {
+                memcpy(rollGoal, array(ARRAY_TARGET_ROLL), n * sizeof(double));
+                memcpy(pitchGoal, array(ARRAY_TARGET_PITCH), n * sizeof(double));
+            }
+
+            if (_mode != CascadedController::MODE_ATTITUDE) {
+
+                negate(array(ARRAY_TARGET_Z), a);
+                negate(array(ARRAY_Z), b);
+                pid(PID_ALTITUDE, _config.altitude, a, b, c, dt);
+
+                negate(array(ARRAY_VZ), b);
+                pid(PID_CLIMB, _config.climb, c, b, d, dt);
+
+                for (uint32_t i=0; i<n; ++i) {
+                    d[i] = CascadedController::thrustRatio(d[i]);
+                }
+
+                // Square roots
+                FastMath::sqrt(d, d, n, _accuracy);
+
+                const double hover = _config.hoverThrottle;
+                for (uint32_t i=0; i<n; ++i) {
+                    throttle[i] = CascadedController::thrustThrottle(hover, d[i], tilt[i]);
+                }
+            }
+            else {
+                memcpy(throttle, array(ARRAY_TARGET_THROTTLE), n * sizeof(double));
+            }
+
+            double * rollDemand = array(ARRAY_ROLL_DEMAND);
+            double * pitchDemand = array(ARRAY_PITCH_DEMAND);
+            double * yawDemand = array(ARRAY_YAW_DEMAND);
+
+            pid(PID_ANGLE_ROLL, _config.angle, rollGoal, roll, a, dt);
+            pid(PID_RATE_ROLL, _config.rate, a, array(ARRAY_ROLL_RATE), rollDemand, dt);
+
+            pid(PID_ANGLE_PITCH, _config.angle, pitchGoal, pitch, a, dt);
+            pid(PID_RATE_PITCH, _config.rate, a, array(ARRAY_PITCH_RATE), pitchDemand, dt);
+
+            for (uint32_t i=0; i<n; ++i) {
+                b[i] = yaw[i] + yawError[i];
+            }
+            pid(PID_HEADING, _config.heading, b, yaw, a, dt);
+            pid(PID_YAW_RATE, _config.yawRate, a, array(ARRAY_YAW_RATE), yawDemand, dt);
+
+            // Mixer, one motor at a time
+            for (uint8_t k=0; k<_mixer->motorCount(); ++k) {
+
+                const Mixer::motor_t & m = _mixer->motor(k);
+
+                double * out = motors(k);
+
+                for (uint32_t i=0; i<n; ++i) {
+                    out[i] = Mixer::clip(throttle[i] * m.throttle + rollDemand[i] * m.roll +
+                            pitchDemand[i] * m.pitch + yawDemand[i] * m.yaw);
+                }
+            }
+
+            _started = true;
+        }
+
+        // Motor values for one vehicle
+        void getMotors(uint32_t index, double * motorvals)
+        {
+            for (uint8_t k=0; k<_mixer->motorCount(); ++k) {
+                motorvals[k] = motors(k)[index];
+            }
+        }
+
+        // Values of one motor for every vehicle
+        const double * getMotor(uint8_t motor)
+        {
+            return motors(motor);
+        }
+
+}; // class ControllerBatch
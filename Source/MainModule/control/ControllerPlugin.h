@@ -0,0 +1,73 @@
+/*
+ * Binary interface for flight controllers built as shared libraries
+ *
+ * A plugin is a .so, .dylib or .dll exporting controllerPlugin(), which
+ * returns a description of the controller.  This header is plain C, so a
+ * plugin needs nothing else from MulticopterSim to build.
+ *
+ * The host owns the controller's state: it allocates stateSize bytes,
+ * zeroes them and calls init() once, then passes them to every update().
+ * When the plugin is rebuilt and reloaded, the host keeps the state if the
+ * new build reports the same stateSize and stateVersion, so a controller in
+ * flight carries on where it was; otherwise it starts the new build with
+ * fresh state.  Bump stateVersion whenever the state's layout changes.
+ *
+ * Copyright (C) 2019 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#define CONTROLLER_PLUGIN_ABI_VERSION 1
+
+#ifdef _WIN32
+#define CONTROLLER_PLUGIN_EXPORT __declspec(dllexport)
+#else
+#define CONTROLLER_PLUGIN_EXPORT __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Laid out like MultirotorDynamics::state_t
+typedef struct {
+
+    double angularVel[3];
+    double bodyAccel[3];
+    double inertialVel[3];
+    double quaternion[4];
+    double location[3];
+    double rotation[3];
+
+} controller_plugin_state_t;
+
+typedef struct {
+
+    // CONTROLLER_PLUGIN_ABI_VERSION when the plugin was built
+    uint32_t abiVersion;
+
+    // Bytes of controller state the host keeps for the plugin, and the version of their layout
+    uint32_t stateSize;
+    uint32_t stateVersion;
+
+    // Sets up fresh, zeroed state
+    void (*init)(void * state, uint8_t motorCount);
+
+    // Computes motor values in [0,1] from the vehicle state; dt is the time since the last update
+    void (*update)(void * state, double time, double dt, const controller_plugin_state_t * vehicle,
+            double * motorvals, uint8_t motorCount);
+
+} controller_plugin_t;
+
+// Signature of the function every plugin exports
+typedef const controller_plugin_t * (*controller_plugin_function_t)(void);
+
+#define CONTROLLER_PLUGIN_FUNCTION "controllerPlugin"
+
+#ifdef __cplusplus
+}
+#endif
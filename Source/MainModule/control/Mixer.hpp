@@ -0,0 +1,128 @@
+/*
+ * Mixer turning throttle, roll, pitch and yaw demands into motor values
+ *
+ * Each motor has a coefficient per demand, taken from the sums its frame's
+ * dynamics computes in u2(), u3() and u4().  Roll, pitch and yaw demands are
+ * signed like the angles of the state they accelerate: positive roll and
+ * yaw increase phi and psi, as u2() and u4() do, and positive pitch increases
+ * theta, which u3() decreases.  Motor values are clipped to [0,1].
+ *
+ * Copyright (C) 2019 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+class Mixer {
+
+    public:
+
+        typedef struct {
+
+            double throttle;
+            double roll;
+            double pitch;
+            double yaw;
+
+        } demands_t;
+
+        typedef struct {
+
+            double throttle;
+            double roll;
+            double pitch;
+            double yaw;
+
+        } motor_t;
+
+        static const uint8_t MAX_MOTORS = 16;
+
+    private:
+
+        motor_t _motors[MAX_MOTORS] = {};
+        uint8_t _motorCount = 0;
+
+    public:
+
+        // To [0,1], in two steps so that loops over arrays of values vectorize
+        static double clip(double value)
+        {
+            value = value < 0 ? 0 : value;
+            return value > 1 ? 1 : value;
+        }
+
+        /**
+         * @param motors one row of coefficients per motor
+         * @param motorCount number of motors, at most MAX_MOTORS
+         */
+        Mixer(const motor_t * motors, uint8_t motorCount)
+        {
+            _motorCount = motorCount < MAX_MOTORS ? motorCount : MAX_MOTORS;
+
+            for (uint8_t k=0; k<_motorCount; ++k) {
+                _motors[k] = motors[k];
+            }
+        }
+
+        void mix(const demands_t & demands, double * motorvals) const
+        {
+            for (uint8_t k=0; k<_motorCount; ++k) {
+                const motor_t & m = _motors[k];
+                motorvals[k] = clip(demands.throttle * m.throttle + demands.roll * m.roll +
+                        demands.pitch * m.pitch + demands.yaw * m.yaw);
+            }
+        }
+
+        uint8_t motorCount(void) const
+        {
+            return _motorCount;
+        }
+
+        const motor_t & motor(uint8_t index) const
+        {
+            return _motors[index];
+        }
+
+        // Matches QuadXAPDynamics
+        static const Mixer & quadXAP(void)
+        {
+            static const motor_t MOTORS[4] = {
+                // throttle roll  pitch  yaw
+                { 1,       -1,    +1,    +1 },
+                { 1,       +1,    -1,    +1 },
+                { 1,       +1,    +1,    -1 },
+                { 1,       -1,    -1,    -1 }
+            };
+
+            static const Mixer mixer(MOTORS, 4);
+
+            return mixer;
+        }
+
+        // Matches OctoXAPDynamics
+        static const Mixer & octoXAP(void)
+        {
+            static const double C1 = 0.382680;
+            static const double C2 = 0.923879;
+
+            static const motor_t MOTORS[8] = {
+                // throttle roll  pitch  yaw
+                { 1,       -C1,   +C2,   -1 },
+                { 1,       +C1,   -C2,   -1 },
+                { 1,       -C2,   +C1,   +1 },
+                { 1,       -C1,   -C2,   +1 },
+                { 1,       +C1,   +C2,   +1 },
+                { 1,       +C2,   -C1,   +1 },
+                { 1,       +C2,   +C1,   -1 },
+                { 1,       -C2,   -C1,   -1 }
+            };
+
+            static const Mixer mixer(MOTORS, 8);
+
+            return mixer;
+        }
+
+}; // class Mixer
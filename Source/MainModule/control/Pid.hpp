@@ -0,0 +1,108 @@
+/*
+ * PID controller with anti-windup, for the native flight controllers
+ *
+ * The derivative is taken on the measurement rather than the error, so a
+ * step in the target doesn't kick the output.  The integral stops growing
+ * while the output is saturated in the direction it would grow, and is
+ * clamped besides, so it can't wind up while the vehicle sits on the
+ * ground or against a limit.
+ *
+ * Copyright (C) 2019 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include <math.h>
+
+class Pid {
+
+    public:
+
+        typedef struct {
+
+            double kp;
+            double ki;
+            double kd;
+
+            // Limit on the integral term, in output units
+            double windupMax;
+
+            // Limit on the output
+            double outputMax;
+
+        } gains_t;
+
+    private:
+
+        gains_t _gains = {};
+
+        double _integral = 0;
+        double _lastActual = 0;
+        bool _started = false;
+
+    public:
+
+        Pid(void)
+        {
+        }
+
+        Pid(const gains_t & gains)
+            : _gains(gains)
+        {
+        }
+
+        // In two steps so that loops over arrays of values vectorize
+        static double clamp(double value, double limit)
+        {
+            value = value < -limit ? -limit : value;
+            return value > limit ? limit : value;
+        }
+
+        /**
+         * @param target where we want the measurement to be
+         * @param actual the measurement
+         * @param dt seconds since the last update
+         * @return control output
+         */
+        double update(double target, double actual, double dt)
+        {
+            const double error = target - actual;
+
+            const double derivative = _started && dt > 0 ? (_lastActual - actual) / dt : 0;
+
+            const double proportional = _gains.kp * error + _gains.kd * derivative;
+
+            const double step = _gains.ki * error * dt;
+
+            // Conditional integration: hold the integral while the output is pinned in the direction it would move
+            const double unclamped = proportional + _integral + step;
+            if (fabs(unclamped) < _gains.outputMax || unclamped * step < 0) {
+                _integral = clamp(_integral + step, _gains.windupMax);
+            }
+
+            _lastActual = actual;
+            _started = true;
+
+            return clamp(proportional + _integral, _gains.outputMax);
+        }
+
+        void reset(void)
+        {
+            _integral = 0;
+            _lastActual = 0;
+            _started = false;
+        }
+
+        void setGains(const gains_t & gains)
+        {
+            _gains = gains;
+        }
+
+        const gains_t & getGains(void) const
+        {
+            return _gains;
+        }
+
+}; // class Pid
@@ -0,0 +1,355 @@
+/*
+ * Host for a flight controller loaded from a shared library (see ControllerPlugin.h)
+ *
+ * poll() watches the library file and reloads it once a new build has
+ * stopped changing, so a controller can be rebuilt while the simulator runs.
+ * Call it between updates, on the thread that calls update(); nothing else
+ * is calling into the plugin then.  A build that fails to load or doesn't
+ * match the interface leaves the one already loaded in place, and
+ * getMessage() says why.
+ *
+ * Each build is loaded from its own copy of the file, so the compiler can
+ * replace the file while a build is loaded from it, even on Windows.
+ *
+ * Copyright (C) 2019 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include "ControllerPlugin.h"
+#include "../dynamics/MultirotorDynamics.hpp"
+#include "../FileWatcher.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#ifdef _WIN32
+// Inside the engine, windows.h has to come between its guards, unless an includer already opened them
+#if defined(WITH_ENGINE) && !defined(WINDOWS_PLATFORM_TYPES_GUARD)
+#define PLUGINCONTROLLER_WINDOWS_TYPES
+#pragma push_macro("TEXT")
+#include "Windows/AllowWindowsPlatformTypes.h"
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#ifdef PLUGINCONTROLLER_WINDOWS_TYPES
+#include "Windows/HideWindowsPlatformTypes.h"
+#pragma pop_macro("TEXT")
+#undef PLUGINCONTROLLER_WINDOWS_TYPES
+#endif
+#else
+#include <dlfcn.h>
+#include <unistd.h>
+#endif
+
+class PluginController {
+
+    public:
+
+        // Largest controller state we keep for a plugin
+        static const uint32_t MAX_STATE_SIZE = 1 << 20;
+
+        static const uint8_t MAX_MOTORS = 16;
+
+    private:
+
+        static const uint32_t MAX_PATH_LENGTH = 1024;
+
+        // A build as loaded
+        typedef struct {
+
+#ifdef _WIN32
+            HMODULE handle;
+#else
+            void * handle;
+#endif
+            const controller_plugin_t * plugin;
+            char copy[MAX_PATH_LENGTH + 32];
+
+        } build_t;
+
+        char _path[MAX_PATH_LENGTH] = {};
+
+        uint8_t _motorCount = 0;
+
+        build_t _build = {};
+
+        uint8_t * _state = NULL;
+
+        FileWatcher _watcher;
+
+        uint32_t _copies = 0;
+        uint32_t _reloads = 0;
+
+        char _message[2 * MAX_PATH_LENGTH + 200] = {};
+
+        static bool copyFile(const char * from, const char * to)
+        {
+            FILE * in = fopen(from, "rb");
+
+            if (!in) {
+                return false;
+            }
+
+            FILE * out = fopen(to, "wb");
+
+            if (!out) {
+                fclose(in);
+                return false;
+            }
+
+            char buf[65536];
+            size_t count = 0;
+            bool ok = true;
+
+            while ((count = fread(buf, 1, sizeof(buf), in)) > 0) {
+                if (fwrite(buf, 1, count, out) != count) {
+                    ok = false;
+                    break;
+                }
+            }
+
+            ok = ok && !ferror(in);
+
+            fclose(in);
+
+            return fclose(out) == 0 && ok;
+        }
+
+        static uint32_t processId(void)
+        {
+#ifdef _WIN32
+            return (uint32_t)GetCurrentProcessId();
+#else
+            return (uint32_t)getpid();
+#endif
+        }
+
+        // Loads a copy of the file, checking that it is a plugin we can run
+        bool open(build_t & build)
+        {
+            // dlopen() searches the library path for a name without a slash
+            const char * here = strchr(_path, '/') || strchr(_path, '\\') ? "" : "./";
+
+            snprintf(build.copy, sizeof(build.copy), "%s%s.%u.%u", here, _path, processId(), ++_copies);
+
+            if (!copyFile(_path, build.copy)) {
+                snprintf(_message, sizeof(_message), "can't copy %s to %s", _path, build.copy);
+                return false;
+            }
+
+            controller_plugin_function_t function = NULL;
+
+#ifdef _WIN32
+            build.handle = LoadLibraryA(build.copy);
+
+            if (!build.handle) {
+                snprintf(_message, sizeof(_message), "can't load %s: error %lu", _path, GetLastError());
+                remove(build.copy);
+                return false;
+            }
+
+            function = (controller_plugin_function_t)GetProcAddress(build.handle, CONTROLLER_PLUGIN_FUNCTION);
+#else
+            build.handle = dlopen(build.copy, RTLD_NOW | RTLD_LOCAL);
+
+            // The library stays mapped, so the copy can go now
+            remove(build.copy);
+            build.copy[0] = 0;
+
+            if (!build.handle) {
+                snprintf(_message, sizeof(_message), "can't load %s: %s", _path, dlerror());
+                return false;
+            }
+
+            function = (controller_plugin_function_t)dlsym(build.handle, CONTROLLER_PLUGIN_FUNCTION);
+#endif
+
+            build.plugin = function ? function() : NULL;
+
+            if (!build.plugin) {
+                snprintf(_message, sizeof(_message), "%s has no %s()", _path, CONTROLLER_PLUGIN_FUNCTION);
+            }
+            else if (build.plugin->abiVersion != CONTROLLER_PLUGIN_ABI_VERSION) {
+                snprintf(_message, sizeof(_message), "%s was built for interface version %u, not %u", _path,
+                        build.plugin->abiVersion, CONTROLLER_PLUGIN_ABI_VERSION);
+            }
+            else if (!build.plugin->init || !build.plugin->update) {
+                snprintf(_message, sizeof(_message), "%s is missing init() or update()", _path);
+            }
+            else if (build.plugin->stateSize > MAX_STATE_SIZE) {
+                snprintf(_message, sizeof(_message), "%s wants %u bytes of state, more than %u", _path,
+                        build.plugin->stateSize, MAX_STATE_SIZE);
+            }
+            else {
+                return true;
+            }
+
+            close(build);
+
+            return false;
+        }
+
+        static void close(build_t & build)
+        {
+            if (build.handle) {
+#ifdef _WIN32
+                FreeLibrary(build.handle);
+#else
+                dlclose(build.handle);
+#endif
+            }
+
+            if (build.copy[0]) {
+                remove(build.copy);
+            }
+
+            memset(&build, 0, sizeof(build));
+        }
+
+        // Makes a newly opened build current, keeping the old one's state if the layout is the same
+        void install(build_t & build)
+        {
+            const controller_plugin_t * old = _build.plugin;
+            const controller_plugin_t * plugin = build.plugin;
+
+            const bool keep = old && _state && old->stateSize == plugin->stateSize &&
+                old->stateVersion == plugin->stateVersion;
+
+            if (!keep) {
+                delete[] _state;
+                _state = new uint8_t[plugin->stateSize > 0 ? plugin->stateSize : 1]();
+                plugin->init(_state, _motorCount);
+            }
+
+            close(_build);
+            _build = build;
+
+            snprintf(_message, sizeof(_message), "loaded %s%s", _path,
+                    old ? keep ? ", keeping its state" : " with fresh state" : "");
+        }
+
+    public:
+
+        PluginController(uint8_t motorCount)
+            : _motorCount(motorCount < MAX_MOTORS ? motorCount : MAX_MOTORS)
+        {
+        }
+
+        ~PluginController(void)
+        {
+            close(_build);
+            delete[] _state;
+        }
+
+        /**
+         * Loads the plugin and starts watching its file.
+         *
+         * @param path shared library
+         * @return false if it couldn't be loaded; poll() keeps trying as the file changes
+         */
+        bool load(const char * path)
+        {
+            snprintf(_path, sizeof(_path), "%s", path);
+
+            if (!_watcher.watch(_path)) {
+                snprintf(_message, sizeof(_message), "can't find %s", _path);
+                return false;
+            }
+
+            build_t build = {};
+
+            if (!open(build)) {
+                return false;
+            }
+
+            install(build);
+
+            return true;
+        }
+
+        /**
+         * Reloads the plugin if its file has changed and then stayed the same since the last call,
+         * so we don't load a build the linker is still writing.
+         *
+         * @return true if a new build was loaded
+         */
+        bool poll(void)
+        {
+            // Whether or not this build loads, we wait for the next one
+            if (!_path[0] || !_watcher.poll(_path)) {
+                return false;
+            }
+
+            build_t build = {};
+
+            if (!open(build)) {
+                return false;
+            }
+
+            install(build);
+
+            _reloads++;
+
+            return true;
+        }
+
+        /**
+         * Runs the controller once.
+         *
+         * @return false, leaving motorvals alone, if no plugin is loaded or it gave a value that isn't a number
+         */
+        bool update(double time, double dt, const MultirotorDynamics::state_t & state, double * motorvals)
+        {
+            if (!_build.plugin) {
+                return false;
+            }
+
+            controller_plugin_state_t vehicle = {};
+
+            memcpy(vehicle.angularVel, state.angularVel, sizeof(vehicle.angularVel));
+            memcpy(vehicle.bodyAccel, state.bodyAccel, sizeof(vehicle.bodyAccel));
+            memcpy(vehicle.inertialVel, state.inertialVel, sizeof(vehicle.inertialVel));
+            memcpy(vehicle.quaternion, state.quaternion, sizeof(vehicle.quaternion));
+            memcpy(vehicle.location, state.pose.location, sizeof(vehicle.location));
+            memcpy(vehicle.rotation, state.pose.rotation, sizeof(vehicle.rotation));
+
+            double values[MAX_MOTORS] = {};
+
+            _build.plugin->update(_state, time, dt, &vehicle, values, _motorCount);
+
+            for (uint8_t k=0; k<_motorCount; ++k) {
+                if (!isfinite(values[k])) {
+                    return false;
+                }
+            }
+
+            for (uint8_t k=0; k<_motorCount; ++k) {
+                motorvals[k] = values[k] < 0 ? 0 : values[k] > 1 ? 1 : values[k];
+            }
+
+            return true;
+        }
+
+        bool isLoaded(void) const
+        {
+            return _build.plugin != NULL;
+        }
+
+        // What happened at the last load or reload
+        const char * getMessage(void) const
+        {
+            return _message;
+        }
+
+        uint32_t getReloads(void) const
+        {
+            return _reloads;
+        }
+
+}; // class PluginController
@@ -0,0 +1,429 @@
+/*
+ * Dynamics class for any frame described by a MotorLayout
+ *
+ * The layout is compiled into a mixing matrix, stored a column of four per
+ * motor, so that thrust and the three torques come from one matrix-vector
+ * product over the squared motor speeds: each motor adds its column times
+ * its squared speed, four lanes at once, in place of a scalar sum per
+ * torque.  The matrix is compiled again whenever the parameters change.
+ *
+ * Motors can instead follow measured curves (see MotorCurve), which give
+ * each motor's speed, thrust and drag torque from a table, after a
+ * first-order lag on its motor value; the thrusts then go through the same
+ * matrix, compiled without the force constant.  With SSE2 the curves are
+ * evaluated two motors to a vector, from cells gathered into a vector per
+ * coefficient.  Each motor remembers its cell, since a lagged motor value
+ * seldom leaves it from one step to the next, so the lookup waits on no
+ * conversion from the value to an index.
+ *
+ * Copyright (C) 2019 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include "MultirotorDynamics.hpp"
+#include "MotorLayout.hpp"
+#include "MotorCurve.hpp"
+
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FRAMEDYNAMICS_SSE
+#include <emmintrin.h>
+#endif
+
+class FrameDynamics : public MultirotorDynamics {
+
+    private:
+
+        static const uint8_t ROWS = MotorLayout::ROWS;
+
+        MotorLayout _layout;
+
+        // Mixing matrix, one column per motor; a column fills a 256-bit vector
+        double _columns[MotorLayout::MAX_MOTORS][ROWS] = {};
+
+        // Unscaled drag coefficient of each motor, for the gyroscopic torque of the props
+        double _drag[MotorLayout::MAX_MOTORS] = {};
+
+        // The motors' curves, packed so that one loop looks up every motor in turn
+        typedef struct {
+
+            // CELLS cells for each motor in turn
+            MotorCurve::cell_t cells[MotorLayout::MAX_MOTORS * MotorCurve::CELLS];
+
+            // Reciprocal of each motor's time constant, zero for a motor without lag
+            double rate[MotorLayout::MAX_MOTORS];
+
+            // One for a motor without lag, which follows its motor value at once; zero for the others
+            double unlagged[MotorLayout::MAX_MOTORS];
+
+            // Largest rate, which decides whether a step is short enough for the series
+            double maxRate;
+
+            // Which motors have a measured curve; the others follow the parameters
+            bool measured[MotorLayout::MAX_MOTORS];
+
+        } curves_t;
+
+        // NULL until a curve is set
+        curves_t * _curves = NULL;
+
+        // Mixing matrix taking each motor's thrust in newtons, rather than its squared speed, to U1 through U4
+        double _geometry[MotorLayout::MAX_MOTORS][ROWS] = {};
+
+        // Motor values as the motors have followed them so far, through their lag
+        double _values[MotorLayout::MAX_MOTORS] = {};
+
+        // Below this step, as a fraction of the time constant, the lag comes from a series
+        static constexpr double SERIES_STEP = 0.1;
+
+        // Fraction of a change in motor value each motor follows in one step, for steps of _lagDt seconds
+        double _lag[MotorLayout::MAX_MOTORS] = {};
+        double _lagDt = -1;
+
+        // Each motor's cell, and the cell's first motor value times CELLS, as of the last step
+        int32_t _cell[MotorLayout::MAX_MOTORS] = {};
+        double _cellStart[MotorLayout::MAX_MOTORS] = {};
+
+        // On the wall clock dt changes every step, so the usual short steps avoid exp(): the series
+        // x - x^2/2 + x^3/6 differs from 1 - exp(-x) by under x^4/24, a relative error under x^3/24,
+        // which is a few parts in 10^5 below SERIES_STEP.  A motor without lag has a rate of zero,
+        // and takes a lag of one from unlagged[].
+        void computeLag(double dt)
+        {
+            const double * rate = _curves->rate;
+            const double * unlagged = _curves->unlagged;
+
+            if (dt * _curves->maxRate < SERIES_STEP) {
+
+#ifdef FRAMEDYNAMICS_SSE
+                // In pairs, as setMotorsFromCurves() loads them, so the loads take them straight from
+                // the stores; an odd count fills the spare slot after the last motor
+                const __m128d dts = _mm_set1_pd(dt);
+                for (uint8_t j=0; j<_motorCount; j+=2) {
+                    const __m128d x = _mm_mul_pd(dts, _mm_loadu_pd(rate + j));
+                    const __m128d series = _mm_mul_pd(x, _mm_sub_pd(_mm_set1_pd(1),
+                                _mm_mul_pd(x, _mm_sub_pd(_mm_set1_pd(0.5), _mm_mul_pd(x, _mm_set1_pd(1 / 6.))))));
+                    _mm_storeu_pd(_lag + j, _mm_max_pd(series, _mm_loadu_pd(unlagged + j)));
+                }
+#else
+                for (uint8_t j=0; j<_motorCount; ++j) {
+                    const double x = dt * rate[j];
+                    _lag[j] = std::max(x * (1 - x * (0.5 - x * (1 / 6.))), unlagged[j]);
+                }
+#endif
+            }
+
+            else {
+                for (uint8_t j=0; j<_motorCount; ++j) {
+                    _lag[j] = rate[j] > 0 ? 1 - exp(-dt * rate[j]) : 1;
+                }
+            }
+
+            _lagDt = dt;
+        }
+
+        void pack(uint8_t index, const MotorCurve & curve)
+        {
+            memcpy(&_curves->cells[index * MotorCurve::CELLS], curve.getCells(), MotorCurve::CELLS * sizeof(MotorCurve::cell_t));
+
+            const double tau = curve.getTimeConstant();
+            _curves->rate[index] = tau > 0 ? 1 / tau : 0;
+            _curves->unlagged[index] = tau > 0 ? 0 : 1;
+
+            _curves->maxRate = 0;
+            for (uint8_t j=0; j<_motorCount; ++j) {
+                _curves->maxRate = std::max(_curves->maxRate, _curves->rate[j]);
+            }
+
+            _lagDt = -1;
+        }
+
+        // Curves from the parameters for the motors without measured ones
+        void followParameters(void)
+        {
+            const MotorCurve curve = MotorCurve::quadratic(*_p);
+
+            for (uint8_t j=0; j<_motorCount; ++j) {
+                if (!_curves->measured[j]) {
+                    pack(j, curve);
+                }
+            }
+        }
+
+        // Equation 6 with speed, thrust and torque from each motor's curve
+        void setMotorsFromCurves(const double * motorvals, double dt)
+        {
+            if (dt != _lagDt) {
+                computeLag(dt);
+            }
+
+            const uint8_t count = _motorCount;
+            const MotorCurve::cell_t * cells = _curves->cells;
+
+            double Omega = 0;
+            double yaw = 0;
+            double u[ROWS] = {};
+
+            uint8_t j = 0;
+
+#ifdef FRAMEDYNAMICS_SSE
+            const __m128d zero = _mm_setzero_pd();
+            const __m128d one = _mm_set1_pd(1);
+            const __m128d scale = _mm_set1_pd(MotorCurve::CELLS);
+
+            __m128d Omegas = zero, yaws = zero, u01 = zero, u23 = zero;
+
+            for (; j+1<count; j+=2) {
+
+                const __m128d previous = _mm_loadu_pd(_values + j);
+                const __m128d value = _mm_add_pd(previous,
+                        _mm_mul_pd(_mm_loadu_pd(_lag + j), _mm_sub_pd(_mm_loadu_pd(motorvals + j), previous)));
+
+                __m128d f = _mm_sub_pd(_mm_mul_pd(value, scale), _mm_loadu_pd(_cellStart + j));
+
+                // Either motor out of its cell: find both cells again
+                if (_mm_movemask_pd(_mm_and_pd(_mm_cmpge_pd(f, zero), _mm_cmple_pd(f, one))) != 3) {
+                    double values[2], fractions[2];
+                    _mm_storeu_pd(values, value);
+                    for (uint8_t k=0; k<2; ++k) {
+                        MotorCurve::locate(values[k], _cell[j+k], fractions[k]);
+                        _cellStart[j+k] = _cell[j+k];
+                    }
+                    f = _mm_loadu_pd(fractions);
+                }
+
+                // Gather the two cells, each eight doubles, into a vector per coefficient
+                const double * a = (const double *)&cells[j * MotorCurve::CELLS + _cell[j]];
+                const double * b = (const double *)&cells[(j+1) * MotorCurve::CELLS + _cell[j+1]];
+
+                __m128d c[8];
+                for (uint8_t k=0; k<8; k+=2) {
+                    const __m128d ca = _mm_loadu_pd(a + k);
+                    const __m128d cb = _mm_loadu_pd(b + k);
+                    c[k] = _mm_unpacklo_pd(ca, cb);
+                    c[k+1] = _mm_unpackhi_pd(ca, cb);
+                }
+
+                // Speed, thrust and torque, as MotorCurve::speed(), thrust() and torque()
+                const __m128d omega = _mm_add_pd(c[0], _mm_mul_pd(c[1], f));
+                const __m128d thrust = _mm_add_pd(c[2], _mm_mul_pd(_mm_add_pd(c[3], _mm_mul_pd(c[4], f)), f));
+                const __m128d torque = _mm_add_pd(c[5], _mm_mul_pd(_mm_add_pd(c[6], _mm_mul_pd(c[7], f)), f));
+
+                _mm_storeu_pd(_values + j, value);
+                _mm_storeu_pd(_omegas + j, omega);
+                _mm_storeu_pd(_omegas2 + j, _mm_mul_pd(omega, omega));
+
+                const __m128d drag = _mm_loadu_pd(_drag + j);
+                Omegas = _mm_add_pd(Omegas, _mm_mul_pd(drag, omega));
+                yaws = _mm_add_pd(yaws, _mm_mul_pd(drag, torque));
+
+                // Each motor's column, two rows to a vector, times its thrust
+                const __m128d ta = _mm_unpacklo_pd(thrust, thrust);
+                const __m128d tb = _mm_unpackhi_pd(thrust, thrust);
+                u01 = _mm_add_pd(u01, _mm_add_pd(_mm_mul_pd(_mm_loadu_pd(&_geometry[j][0]), ta),
+                            _mm_mul_pd(_mm_loadu_pd(&_geometry[j+1][0]), tb)));
+                u23 = _mm_add_pd(u23, _mm_add_pd(_mm_mul_pd(_mm_loadu_pd(&_geometry[j][2]), ta),
+                            _mm_mul_pd(_mm_loadu_pd(&_geometry[j+1][2]), tb)));
+            }
+
+            double sums[2];
+            _mm_storeu_pd(sums, Omegas);
+            Omega = sums[0] + sums[1];
+            _mm_storeu_pd(sums, yaws);
+            yaw = sums[0] + sums[1];
+            _mm_storeu_pd(u, u01);
+            _mm_storeu_pd(u + 2, u23);
+#endif
+
+            // The motor left over, or every motor without SSE2
+            for (; j<count; ++j) {
+
+                const double value = _values[j] + _lag[j] * (motorvals[j] - _values[j]);
+
+                double f = value * MotorCurve::CELLS - _cellStart[j];
+
+                if (!(f >= 0 && f <= 1)) {
+                    MotorCurve::locate(value, _cell[j], f);
+                    _cellStart[j] = _cell[j];
+                }
+
+                const MotorCurve::cell_t & cell = cells[j * MotorCurve::CELLS + _cell[j]];
+
+                const double omega = MotorCurve::speed(cell, f);
+                const double thrust = MotorCurve::thrust(cell, f);
+
+                _values[j] = value;
+                _omegas[j] = omega;
+                _omegas2[j] = omega * omega;
+                Omega += _drag[j] * omega;
+                yaw += _drag[j] * MotorCurve::torque(cell, f);
+
+                for (uint8_t row=0; row<ROWS; ++row) {
+                    u[row] += _geometry[j][row] * thrust;
+                }
+            }
+
+            _U1 = u[MotorLayout::THRUST];
+            _U2 = u[MotorLayout::ROLL];
+            _U3 = u[MotorLayout::PITCH];
+            _U4 = u[MotorLayout::YAW] + yaw;
+            _Omega = Omega;
+        }
+
+        // One row of the matrix without its parameters, as u2(), u3() and u4() give it
+        double unscaled(uint8_t row, const double * o) const
+        {
+            const double scale = row == MotorLayout::YAW ? _p->d : _p->l * _p->b;
+
+            double sum = 0;
+
+            for (uint8_t j=0; j<_motorCount; ++j) {
+                sum += _columns[j][row] * o[j];
+            }
+
+            return sum / scale;
+        }
+
+    public:
+
+        FrameDynamics(Parameters * params, const MotorLayout & layout)
+            : MultirotorDynamics(params, layout.motorCount()), _layout(layout)
+        {
+            for (uint8_t j=0; j<_motorCount; ++j) {
+                _drag[j] = _layout.motor(j).direction * _layout.motor(j).axis[2];
+            }
+
+            _layout.compile(*_p, _columns);
+        }
+
+        virtual ~FrameDynamics(void)
+        {
+            delete _curves;
+        }
+
+        const MotorLayout & getLayout(void) const
+        {
+            return _layout;
+        }
+
+        /**
+         * Uses motor values to implement Equation 6, as one product of the mixing matrix
+         * with the squared motor speeds, or with the thrusts from the motor curves when set.
+         *
+         * @param motorvals in interval [0,1]
+         * @param dt time constant in seconds
+         */
+        virtual void setMotors(double * motorvals, double dt) override
+        {
+            if (_curves) {
+                setMotorsFromCurves(motorvals, dt);
+                return;
+            }
+
+            const uint8_t count = _motorCount;
+
+            // Convert the motor values to radians per second, and sum the props' gyroscopic torque
+            double Omega = 0;
+            for (uint8_t j=0; j<count; ++j) {
+                const double omega = computeMotorSpeed(motorvals[j]);
+                _omegas[j] = omega;
+                _omegas2[j] = omega * omega;
+                Omega += _drag[j] * omega;
+            }
+
+            const double * omegas2 = _omegas2;
+
+            double u[ROWS] = {};
+
+            for (uint8_t j=0; j<count; ++j) {
+                for (uint8_t row=0; row<ROWS; ++row) {
+                    u[row] += _columns[j][row] * omegas2[j];
+                }
+            }
+
+            _U1 = u[MotorLayout::THRUST];
+            _U2 = u[MotorLayout::ROLL];
+            _U3 = u[MotorLayout::PITCH];
+            _U4 = u[MotorLayout::YAW];
+            _Omega = Omega;
+        }
+
+        /**
+         * Has a motor follow a measured curve in place of the quadratic model of the parameters.
+         * Set curves before flight: this isn't safe while another thread calls setMotors().
+         *
+         * @param index motor
+         * @param curve speed, thrust and torque of the motor and its prop
+         */
+        void setMotorCurve(uint8_t index, const MotorCurve & curve)
+        {
+            if (index >= _motorCount) {
+                return;
+            }
+
+            if (!_curves) {
+                _curves = new curves_t();
+                _layout.compile(_p->l, 1, 0, _geometry);
+                followParameters();
+            }
+
+            pack(index, curve);
+            _curves->measured[index] = true;
+        }
+
+        // Has every motor follow the same measured curve
+        void setMotorCurves(const MotorCurve & curve)
+        {
+            for (uint8_t j=0; j<_motorCount; ++j) {
+                setMotorCurve(j, curve);
+            }
+        }
+
+        // motor direction for animation
+        virtual int8_t motorDirection(uint8_t i) override
+        {
+            return _layout.motor(i).direction;
+        }
+
+    protected:
+
+        // MultirotorDynamics method overrides, for code calling them directly; setMotors() doesn't
+
+        // roll right
+        virtual double u2(double * o) override
+        {
+            return unscaled(MotorLayout::ROLL, o);
+        }
+
+        // pitch forward
+        virtual double u3(double * o) override
+        {
+            return unscaled(MotorLayout::PITCH, o);
+        }
+
+        // yaw cw
+        virtual double u4(double * o) override
+        {
+            return unscaled(MotorLayout::YAW, o);
+        }
+
+        virtual void motorsStopped(void) override
+        {
+            memset(_values, 0, sizeof(_values));
+        }
+
+        virtual void parametersChanged(void) override
+        {
+            _layout.compile(*_p, _columns);
+
+            if (_curves) {
+                _layout.compile(_p->l, 1, 0, _geometry);
+                followParameters();
+            }
+        }
+
+}; // class FrameDynamics
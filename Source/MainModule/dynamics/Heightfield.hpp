@@ -0,0 +1,265 @@
+/*
+ * Tiled terrain heightfield for computing AGL inside the dynamics
+ *
+ * Heights are stored in square tiles that share a one-sample border with
+ * their neighbors, so a bilinear lookup always reads a single tile.  The file
+ * format is the header followed by the tiles exactly as they sit in memory,
+ * so a saved heightfield can be memory-mapped and used without copying, by
+ * the engine or by a headless program.
+ *
+ * Coordinates are the dynamics' NED x,y in meters relative to the vehicle's
+ * start location; heights are meters up from the ground under the start
+ * location.  Samples where nothing was found are NaN.
+ *
+ * Copyright (C) 2019 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+
+#include "../MappedFile.hpp"
+
+class Heightfield {
+
+    public:
+
+        static const uint32_t MAGIC   = 0x4648534d; // "MSHF"
+        static const uint32_t VERSION = 1;
+
+        // Samples per tile edge, not counting the shared border
+        static const uint16_t TILE_SIZE = 64;
+
+#pragma pack(push, 1)
+        typedef struct {
+
+            uint32_t magic;
+            uint32_t version;
+            uint16_t tileSize;
+            uint16_t tilesX;
+            uint16_t tilesY;
+            uint16_t reserved;
+            uint32_t samplesX;
+            uint32_t samplesY;
+            double   originX;   // location of sample (0,0)
+            double   originY;
+            double   spacing;   // meters between samples
+
+        } header_t;
+#pragma pack(pop)
+
+    private:
+
+        header_t _header = {};
+
+        // Owned when built in memory, mapped when loaded from a file
+        float * _owned = NULL;
+        MappedFile _file;
+        const float * _tiles = NULL;
+
+        size_t _tileStride = 0;
+
+        // Precomputed for lookups
+        double _invSpacing = 0;
+        double _maxX = 0;
+        double _maxY = 0;
+
+        void setup(void)
+        {
+            _tileStride = (size_t)(_header.tileSize + 1) * (_header.tileSize + 1);
+            _invSpacing = 1 / _header.spacing;
+
+            // Tiles past the last sample only repeat it, so lookups stop there
+            _maxX = _header.samplesX - 1;
+            _maxY = _header.samplesY - 1;
+        }
+
+        void release(void)
+        {
+            delete[] _owned;
+            _owned = NULL;
+            _file.close();
+            _tiles = NULL;
+        }
+
+    public:
+
+        ~Heightfield(void)
+        {
+            release();
+        }
+
+        /**
+         * Builds the heightfield from a row-major grid of samples.
+         *
+         * @param samples heights, samplesY rows of samplesX values; y increases with the row
+         * @param samplesX number of samples in x
+         * @param samplesY number of samples in y
+         * @param originX x of the first sample
+         * @param originY y of the first sample
+         * @param spacing meters between samples
+         */
+        void build(const float * samples, uint32_t samplesX, uint32_t samplesY, double originX, double originY, double spacing)
+        {
+            release();
+
+            const uint16_t T = TILE_SIZE;
+
+            _header.magic = MAGIC;
+            _header.version = VERSION;
+            _header.tileSize = T;
+            _header.tilesX = (uint16_t)((samplesX - 1 + T - 1) / T);
+            _header.tilesY = (uint16_t)((samplesY - 1 + T - 1) / T);
+            _header.samplesX = samplesX;
+            _header.samplesY = samplesY;
+            _header.originX = originX;
+            _header.originY = originY;
+            _header.spacing = spacing;
+
+            setup();
+
+            _owned = new float [(size_t)_tileStride * _header.tilesX * _header.tilesY];
+
+            for (uint16_t ty=0; ty<_header.tilesY; ++ty) {
+                for (uint16_t tx=0; tx<_header.tilesX; ++tx) {
+
+                    float * tile = _owned + ((size_t)ty * _header.tilesX + tx) * _tileStride;
+
+                    for (uint16_t ly=0; ly<=T; ++ly) {
+                        for (uint16_t lx=0; lx<=T; ++lx) {
+
+                            // Repeat the last row / column past the edge of the grid
+                            uint32_t gx = tx*T + lx;
+                            uint32_t gy = ty*T + ly;
+                            if (gx >= samplesX) gx = samplesX - 1;
+                            if (gy >= samplesY) gy = samplesY - 1;
+
+                            tile[ly*(T+1) + lx] = samples[(size_t)gy*samplesX + gx];
+                        }
+                    }
+                }
+            }
+
+            _tiles = _owned;
+        }
+
+        bool save(const char * path) const
+        {
+            if (!_tiles) return false;
+
+            FILE * fp = fopen(path, "wb");
+            if (!fp) return false;
+
+            size_t count = (size_t)_tileStride * _header.tilesX * _header.tilesY;
+            bool ok = fwrite(&_header, sizeof(header_t), 1, fp) == 1 &&
+                fwrite(_tiles, sizeof(float), count, fp) == count;
+
+            fclose(fp);
+
+            return ok;
+        }
+
+        // Maps a saved heightfield; the tiles are used in place
+        bool load(const char * path)
+        {
+            release();
+
+            if (!_file.open(path) || _file.size() < sizeof(header_t)) {
+                _file.close();
+                return false;
+            }
+
+            memcpy(&_header, _file.data(), sizeof(header_t));
+
+            // Only the tile size we write is read back, which also bounds the size computed below
+            if (_header.magic != MAGIC || _header.version != VERSION || _header.tileSize != TILE_SIZE ||
+                    !(_header.spacing > 0) || !isfinite(_header.spacing) ||
+                    !isfinite(_header.originX) || !isfinite(_header.originY) ||
+                    _header.samplesX < 2 || _header.samplesY < 2) {
+                _file.close();
+                return false;
+            }
+
+            // Lookups index tiles from the sample counts, so the tile counts have to cover them exactly
+            const uint64_t T = _header.tileSize;
+            if (_header.tilesX != (_header.samplesX - 1 + T - 1) / T || _header.tilesY != (_header.samplesY - 1 + T - 1) / T) {
+                _file.close();
+                return false;
+            }
+
+            setup();
+
+            // At most 65^2 floats times 2^32 tiles, well inside 64 bits even where size_t is 32
+            const uint64_t needed = sizeof(header_t) + sizeof(float) * (uint64_t)_tileStride * _header.tilesX * _header.tilesY;
+            if ((uint64_t)_file.size() < needed) {
+                _file.close();
+                return false;
+            }
+
+            _tiles = (const float *)(_file.data() + sizeof(header_t));
+
+            return true;
+        }
+
+        bool isValid(void) const
+        {
+            return _tiles != NULL;
+        }
+
+        bool contains(double x, double y) const
+        {
+            double gx = (x - _header.originX) * _invSpacing;
+            double gy = (y - _header.originY) * _invSpacing;
+
+            return _tiles && gx >= 0 && gy >= 0 && gx <= _maxX && gy <= _maxY;
+        }
+
+        /**
+         * Bilinearly interpolated height.  Safe to call from any thread once built or loaded.
+         *
+         * @return height in meters, or NaN outside the heightfield or where terrain is unknown
+         */
+        double height(double x, double y) const
+        {
+            if (!_tiles) return NAN;
+
+            double gx = (x - _header.originX) * _invSpacing;
+            double gy = (y - _header.originY) * _invSpacing;
+
+            if (!(gx >= 0 && gy >= 0 && gx <= _maxX && gy <= _maxY)) return NAN;
+
+            const uint16_t T = _header.tileSize;
+
+            // Cell containing the point; points on the far edge use the last cell
+            uint32_t ix = (uint32_t)gx;
+            uint32_t iy = (uint32_t)gy;
+            if (ix >= (uint32_t)_header.tilesX * T) ix--;
+            if (iy >= (uint32_t)_header.tilesY * T) iy--;
+
+            uint32_t tx = ix / T;
+            uint32_t ty = iy / T;
+            uint32_t lx = ix - tx*T;
+            uint32_t ly = iy - ty*T;
+
+            const float * p = _tiles + ((size_t)ty * _header.tilesX + tx) * _tileStride + ly*(T+1) + lx;
+
+            double fx = gx - ix;
+            double fy = gy - iy;
+
+            double h0 = p[0]   + fx * (p[1] - p[0]);
+            double h1 = p[T+1] + fx * (p[T+2] - p[T+1]);
+
+            return h0 + fy * (h1 - h0);
+        }
+
+        const header_t & getHeader(void) const
+        {
+            return _header;
+        }
+
+}; // class Heightfield
@@ -0,0 +1,373 @@
+/*
+ * Measured motor and propeller curves, as a lookup table on a uniform grid
+ *
+ * A curve gives a motor's speed, and its prop's thrust and drag torque, for
+ * a motor value, from samples taken on a thrust stand.  The samples are
+ * resampled onto a uniform grid over the motor value, each cell holding the
+ * speed as a line and the thrust and torque as quadratics across the cell,
+ * so a lookup is a multiply, a truncation and one cache line of multiply-adds,
+ * with no search and no branches.  Between samples the speed goes linearly with the motor value
+ * and the thrust and torque linearly with the squared speed, which makes them
+ * quadratic in the motor value, so the quadratic model b*w^2, d*w^2 is
+ * reproduced exactly.
+ *
+ * The motor follows a change in motor value through a first-order lag with
+ * the curve's time constant.
+ *
+ * A sample file holds one sample per line, as the motor value in [0,1],
+ * rpm, thrust in newtons and torque in newton-meters, separated by spaces
+ * or commas, in order of motor value, with anything after a # ignored.  A
+ * line "timeConstant 0.03" gives the lag in seconds.
+ *
+ * Copyright (C) 2019 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include "MultirotorDynamics.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+
+class MotorCurve {
+
+    public:
+
+        // Cells in the table
+        static const int32_t CELLS = 32;
+
+        // Most samples we read from a file
+        static const uint16_t MAX_SAMPLES = 1024;
+
+        // One cell: with f the fraction of the way across it, speed[0] + speed[1]*f rad/s,
+        // thrust[0] + thrust[1]*f + thrust[2]*f^2 newtons, and torque likewise in newton-meters
+        typedef struct {
+
+            double speed[2];
+            double thrust[3];
+            double torque[3];
+
+        } cell_t;
+
+    private:
+
+        static const uint32_t MAX_PATH_LENGTH = 1024;
+        static const uint32_t MAX_LINE_LENGTH = 256;
+
+        cell_t _cells[CELLS] = {};
+
+        double _timeConstant = 0;
+
+        char _message[MAX_PATH_LENGTH + MAX_LINE_LENGTH + 100] = {};
+
+        // Linear interpolation in samples xs increasing, holding the ends outside them
+        static double interpolate(const double * xs, const double * ys, uint16_t count, double x)
+        {
+            if (x <= xs[0]) {
+                return ys[0];
+            }
+
+            for (uint16_t k=1; k<count; ++k) {
+                if (x <= xs[k]) {
+                    const double dx = xs[k] - xs[k-1];
+                    return dx > 0 ? ys[k-1] + (ys[k] - ys[k-1]) * (x - xs[k-1]) / dx : ys[k];
+                }
+            }
+
+            return ys[count-1];
+        }
+
+        // The quadratic through y0, ym and y1 at the start, middle and end of a cell
+        static void fit(double y0, double ym, double y1, double coefficients[3])
+        {
+            coefficients[0] = y0;
+            coefficients[1] = 4*ym - 3*y0 - y1;
+            coefficients[2] = 2*y0 - 4*ym + 2*y1;
+        }
+
+    public:
+
+        /**
+         * Finds the cell and the fraction of the way across it for a motor value, holding the
+         * ends outside [0,1].  The index and the fraction are clamped as an integer and with
+         * min/max rather than by tests on the motor value, which the compiler would turn into
+         * branches, so that a loop over motors runs straight through.
+         *
+         * @param motorval where to look
+         * @param index output, cell
+         * @param fraction output, in [0,1]
+         */
+        static void locate(double motorval, int32_t & index, double & fraction)
+        {
+            const double s = motorval * CELLS;
+
+            index = std::min(std::max((int32_t)s, 0), CELLS-1);
+            fraction = std::min(std::max(s - index, 0.0), 1.0);
+        }
+
+        static double speed(const cell_t & cell, double f)
+        {
+            return cell.speed[0] + cell.speed[1] * f;
+        }
+
+        static double thrust(const cell_t & cell, double f)
+        {
+            return cell.thrust[0] + (cell.thrust[1] + cell.thrust[2] * f) * f;
+        }
+
+        static double torque(const cell_t & cell, double f)
+        {
+            return cell.torque[0] + (cell.torque[1] + cell.torque[2] * f) * f;
+        }
+
+        /**
+         * Builds the table from thrust-stand samples.
+         *
+         * @param commands motor values in [0,1], increasing
+         * @param rpms speed at each motor value, not decreasing
+         * @param thrusts newtons at each sample
+         * @param torques newton-meters at each sample
+         * @param count number of samples, at least two
+         * @param timeConstant seconds for the motor to cover 63% of a change in motor value; 0 for none
+         * @return false, with getMessage() saying why, if the samples won't do
+         */
+        bool build(const double * commands, const double * rpms, const double * thrusts, const double * torques,
+                uint16_t count, double timeConstant)
+        {
+            if (count < 2) {
+                snprintf(_message, sizeof(_message), "need at least two samples");
+                return false;
+            }
+
+            for (uint16_t k=0; k<count; ++k) {
+
+                const bool finite = isfinite(commands[k]) && isfinite(rpms[k]) && isfinite(thrusts[k]) &&
+                    isfinite(torques[k]);
+
+                if (!finite || commands[k] < 0 || commands[k] > 1 || rpms[k] < 0 || thrusts[k] < 0 || torques[k] < 0) {
+                    snprintf(_message, sizeof(_message), "sample %u is out of range", k+1);
+                    return false;
+                }
+
+                if (k > 0 && (commands[k] <= commands[k-1] || rpms[k] < rpms[k-1])) {
+                    snprintf(_message, sizeof(_message), "sample %u is out of order", k+1);
+                    return false;
+                }
+            }
+
+            if (!(rpms[count-1] > 0)) {
+                snprintf(_message, sizeof(_message), "motor never turns");
+                return false;
+            }
+
+            if (!isfinite(timeConstant) || timeConstant < 0) {
+                snprintf(_message, sizeof(_message), "bad time constant");
+                return false;
+            }
+
+            _timeConstant = timeConstant;
+
+            // Between samples, thrust and torque go linearly with the squared speed
+            double * rpms2 = new double[count];
+            for (uint16_t k=0; k<count; ++k) {
+                rpms2[k] = rpms[k] * rpms[k];
+            }
+
+            // Speed, thrust and torque at the edges and the middles of the cells
+            double rpm[2*CELLS+1] = {};
+            double thrust[2*CELLS+1] = {};
+            double torque[2*CELLS+1] = {};
+
+            for (int32_t k=0; k<=2*CELLS; ++k) {
+                rpm[k] = interpolate(commands, rpms, count, k / (2.0 * CELLS));
+                thrust[k] = interpolate(rpms2, thrusts, count, rpm[k] * rpm[k]);
+                torque[k] = interpolate(rpms2, torques, count, rpm[k] * rpm[k]);
+            }
+
+            delete[] rpms2;
+
+            for (int32_t k=0; k<CELLS; ++k) {
+
+                cell_t & cell = _cells[k];
+
+                cell.speed[0] = rpm[2*k] * 3.14159 / 30;
+                cell.speed[1] = (rpm[2*k+2] - rpm[2*k]) * 3.14159 / 30;
+
+                fit(thrust[2*k], thrust[2*k+1], thrust[2*k+2], cell.thrust);
+                fit(torque[2*k], torque[2*k+1], torque[2*k+2], cell.torque);
+            }
+
+            snprintf(_message, sizeof(_message), "%u samples up to %.0f rpm", count, rpms[count-1]);
+
+            return true;
+        }
+
+        /**
+         * Reads thrust-stand samples from a file (see above) and builds the table from them.
+         *
+         * @return false, with getMessage() saying why, if the file can't be read or its samples won't do
+         */
+        bool load(const char * path)
+        {
+            FILE * fp = fopen(path, "r");
+
+            if (!fp) {
+                snprintf(_message, sizeof(_message), "can't open %s", path);
+                return false;
+            }
+
+            double * samples = new double[4 * MAX_SAMPLES];
+            double timeConstant = 0;
+            uint16_t count = 0;
+            uint32_t lineNumber = 0;
+            bool ok = true;
+
+            char line[MAX_LINE_LENGTH];
+
+            while (ok && fgets(line, sizeof(line), fp)) {
+
+                lineNumber++;
+
+                if (!strchr(line, '\n') && !feof(fp)) {
+                    snprintf(_message, sizeof(_message), "%s:%u: line too long", path, lineNumber);
+                    ok = false;
+                    break;
+                }
+
+                char * comment = strchr(line, '#');
+                if (comment) {
+                    *comment = 0;
+                }
+
+                for (char * c = line; *c; ++c) {
+                    if (*c == ',') *c = ' ';
+                }
+
+                double values[4] = {};
+                char extra[2] = {};
+
+                if (sscanf(line, " timeConstant %lf %1s", &timeConstant, extra) == 1) {
+                    continue;
+                }
+
+                const int fields = sscanf(line, "%lf %lf %lf %lf %1s", &values[0], &values[1], &values[2], &values[3],
+                        extra);
+
+                if (fields == EOF) {
+                    continue;
+                }
+
+                if (fields != 4) {
+                    snprintf(_message, sizeof(_message), "%s:%u: expected motor value, rpm, thrust and torque", path,
+                            lineNumber);
+                    ok = false;
+                }
+                else if (count == MAX_SAMPLES) {
+                    snprintf(_message, sizeof(_message), "%s: more than %u samples", path, MAX_SAMPLES);
+                    ok = false;
+                }
+                else {
+                    memcpy(&samples[4*count], values, sizeof(values));
+                    count++;
+                }
+            }
+
+            fclose(fp);
+
+            if (ok) {
+
+                double * columns = new double[4 * count];
+
+                for (uint16_t k=0; k<count; ++k) {
+                    for (uint8_t c=0; c<4; ++c) {
+                        columns[c*count + k] = samples[4*k + c];
+                    }
+                }
+
+                ok = build(&columns[0], &columns[count], &columns[2*count], &columns[3*count], count, timeConstant);
+
+                if (!ok) {
+                    char reason[100];
+                    snprintf(reason, sizeof(reason), "%.99s", _message);
+                    snprintf(_message, sizeof(_message), "%s: %s", path, reason);
+                }
+
+                delete[] columns;
+            }
+
+            delete[] samples;
+
+            return ok;
+        }
+
+        /**
+         * The model of Equation 6 as a curve: speed proportional to motor value, up to maxrpm,
+         * with thrust b*w^2 and torque d*w^2.
+         */
+        static MotorCurve quadratic(const MultirotorDynamics::Parameters & params, double timeConstant=0)
+        {
+            const double commands[2] = { 0, 1 };
+            const double rpms[2] = { 0, (double)params.maxrpm };
+
+            const double maxSpeed = params.maxrpm * 3.14159 / 30;
+            const double thrusts[2] = { 0, params.b * maxSpeed * maxSpeed };
+            const double torques[2] = { 0, params.d * maxSpeed * maxSpeed };
+
+            MotorCurve curve;
+            curve.build(commands, rpms, thrusts, torques, 2, timeConstant);
+
+            return curve;
+        }
+
+        // Speed in rad/s for a motor value in [0,1]
+        double speed(double motorval) const
+        {
+            int32_t i = 0;
+            double f = 0;
+            locate(motorval, i, f);
+
+            return speed(_cells[i], f);
+        }
+
+        // Newtons for a motor value in [0,1]
+        double thrust(double motorval) const
+        {
+            int32_t i = 0;
+            double f = 0;
+            locate(motorval, i, f);
+
+            return thrust(_cells[i], f);
+        }
+
+        // Newton-meters for a motor value in [0,1]
+        double torque(double motorval) const
+        {
+            int32_t i = 0;
+            double f = 0;
+            locate(motorval, i, f);
+
+            return torque(_cells[i], f);
+        }
+
+        // The table, for packing several motors' curves together
+        const cell_t * getCells(void) const
+        {
+            return _cells;
+        }
+
+        double getTimeConstant(void) const
+        {
+            return _timeConstant;
+        }
+
+        const char * getMessage(void) const
+        {
+            return _message;
+        }
+
+}; // class MotorCurve
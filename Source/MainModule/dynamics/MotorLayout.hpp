@@ -0,0 +1,193 @@
+/*
+ * Motor geometry for a multirotor frame, compiled into a mixing matrix
+ *
+ * Each motor has a position, a spin direction and a thrust axis, in body
+ * coordinates (x forward, y right, z down).  compile() turns the table
+ * into the matrix taking the squared motor speeds to the total thrust and
+ * the roll, pitch and yaw torques of Equation 6, so a new frame is a new
+ * table rather than new code.
+ *
+ * Copyright (C) 2019 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include "MultirotorDynamics.hpp"
+
+#include <math.h>
+
+class MotorLayout {
+
+    public:
+
+        static const uint8_t MAX_MOTORS = 16;
+
+        // Rows of the mixing matrix
+        enum {
+            THRUST,
+            ROLL,
+            PITCH,
+            YAW,
+            ROWS
+        };
+
+        typedef struct {
+
+            // Where the rotor is, in arm lengths (Parameters::l) from the center of mass
+            double position[3];
+
+            // Unit vector along which the rotor pushes the vehicle; (0,0,-1) is straight up
+            double axis[3];
+
+            // +1 clockwise, -1 counter-clockwise, seen from above
+            int8_t direction;
+
+        } motor_t;
+
+    private:
+
+        motor_t _motors[MAX_MOTORS] = {};
+        uint8_t _count = 0;
+
+    public:
+
+        // Adds a motor pushing straight up, returning the layout so calls can be chained
+        MotorLayout & add(double x, double y, int8_t direction)
+        {
+            const double position[3] = { x, y, 0 };
+            const double up[3] = { 0, 0, -1 };
+
+            return add(position, up, direction);
+        }
+
+        MotorLayout & add(const double position[3], const double axis[3], int8_t direction)
+        {
+            if (_count < MAX_MOTORS) {
+
+                motor_t & motor = _motors[_count++];
+
+                const double norm = sqrt(axis[0]*axis[0] + axis[1]*axis[1] + axis[2]*axis[2]);
+
+                for (uint8_t k=0; k<3; ++k) {
+                    motor.position[k] = position[k];
+                    motor.axis[k] = axis[k] / norm;
+                }
+
+                motor.direction = direction < 0 ? -1 : +1;
+            }
+
+            return *this;
+        }
+
+        uint8_t motorCount(void) const
+        {
+            return _count;
+        }
+
+        const motor_t & motor(uint8_t index) const
+        {
+            return _motors[index];
+        }
+
+        /**
+         * Computes one column of the mixing matrix for each motor, so that summing
+         * column[j][row] * omega[j]^2 over the motors gives U1 (thrust) through U4 (yaw)
+         * of Equation 6.
+         *
+         * @param params b, d and l scale the rows
+         * @param columns output, ROWS values per motor
+         */
+        void compile(const MultirotorDynamics::Parameters & params, double columns[][ROWS]) const
+        {
+            compile(params.l, params.b, params.d, columns);
+        }
+
+        /**
+         * Computes the mixing matrix for a force constant b and a torque constant d; with b = 1
+         * and d = 0 the columns take each motor's thrust in newtons to U1 through U4.
+         *
+         * @param l arm length in meters
+         * @param b force constant, thrust = b * omega^2
+         * @param d torque constant, torque = d * omega^2
+         * @param columns output, ROWS values per motor
+         */
+        void compile(double l, double b, double d, double columns[][ROWS]) const
+        {
+            const double lb = l * b;
+
+            for (uint8_t j=0; j<_count; ++j) {
+
+                const double * r = _motors[j].position;
+                const double * t = _motors[j].axis;
+
+                // Torque of the thrust about the center of mass, r x t, with pitch forward as -y
+                const double roll = r[1]*t[2] - r[2]*t[1];
+                const double pitch = r[0]*t[2] - r[2]*t[0];
+                const double yaw = r[0]*t[1] - r[1]*t[0];
+
+                // The rotor's drag turns the body against its spin, about the rotor's axis
+                const double drag = _motors[j].direction * t[2];
+
+                columns[j][THRUST] = -b * t[2];
+                columns[j][ROLL] = lb * roll;
+                columns[j][PITCH] = lb * pitch;
+                columns[j][YAW] = lb * yaw + d * drag;
+            }
+        }
+
+        /**
+         * ArduPilot quad-X: 1 front right, 2 back left, 3 front left, 4 back right.
+         * As in the original model, the motors sit one arm length along each body axis.
+         */
+        static MotorLayout quadXAP(void)
+        {
+            MotorLayout layout;
+
+            return layout
+                .add(+1, +1, -1)
+                .add(-1, -1, -1)
+                .add(+1, -1, +1)
+                .add(-1, +1, +1);
+        }
+
+        // ArduPilot hexa-X: motors one arm length from the center at 90, -90, -30, 150, 30 and -150 degrees
+        static MotorLayout hexaXAP(void)
+        {
+            MotorLayout layout;
+
+            return layout
+                .add( 0,  +1,  +1)
+                .add( 0,  -1,  -1)
+                .add(+S3, -H,  +1)
+                .add(-S3, +H,  -1)
+                .add(+S3, +H,  -1)
+                .add(-S3, -H,  +1);
+        }
+
+        // ArduPilot octo-X: motors one arm length from the center at 22.5, -157.5, 67.5, 157.5, -22.5, -112.5, -67.5 and 112.5 degrees
+        static MotorLayout octoXAP(void)
+        {
+            MotorLayout layout;
+
+            return layout
+                .add(+C2, +C1, +1)
+                .add(-C2, -C1, +1)
+                .add(+C1, +C2, -1)
+                .add(-C2, +C1, -1)
+                .add(+C2, -C1, -1)
+                .add(-C1, -C2, -1)
+                .add(+C1, -C2, +1)
+                .add(-C1, +C2, +1);
+        }
+
+    private:
+
+        // sin and cos of 22.5 degrees, and cos and sin of 30 degrees
+        static constexpr double C1 = 0.382680;
+        static constexpr double C2 = 0.923879;
+        static constexpr double H  = 0.5;
+        static constexpr double S3 = 0.866025;
+
+}; // class MotorLayout
@@ -32,8 +32,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <atomic>
 
-#include "../Utils.hpp"
+#include "Heightfield.hpp"
+#include "WindField.hpp"
+#include "FastMath.hpp"
 
 class MultirotorDynamics {
 
@@ -139,18 +142,19 @@ private:
 	}
 
 	// bodyToInertial method optimized for body X=Y=0
-	static void bodyZToInertial(double bodyZ, const double rotation[3], double inertial[3])
+	static void bodyZToInertial(double bodyZ, const double rotation[3], double inertial[3],
+		FastMath::Accuracy_t accuracy = FastMath::ACCURACY_FULL)
 	{
-		double phi = rotation[0];
-		double theta = rotation[1];
-		double psi = rotation[2];
+		double s[3] = {};
+		double c[3] = {};
+		FastMath::sincos(rotation, s, c, 3, accuracy);
 
-		double cph = cos(phi);
-		double sph = sin(phi);
-		double cth = cos(theta);
-		double sth = sin(theta);
-		double cps = cos(psi);
-		double sps = sin(psi);
+		double cph = c[0];
+		double sph = s[0];
+		double cth = c[1];
+		double sth = s[1];
+		double cps = c[2];
+		double sps = s[2];
 
 		// This is the rightmost column of the body-to-inertial rotation matrix
 		double R[3] = { sph * sps + cph * cps * sth,
@@ -165,6 +169,52 @@ private:
 	// Height above ground, set by kinematics
 	double _agl = 0;
 
+	// Baked terrain; when present, AGL is computed here at every update
+	const Heightfield * _terrain = NULL;
+
+	// Wind field, where the vehicle started in it, and linear drag on the air-relative velocity
+	const WindField * _wind = NULL;
+	double _windOrigin[3] = {};
+	double _windDrag = 0;
+
+	// Seconds since init(), for the wind field
+	double _time = 0;
+
+	// Accuracy of the sines and cosines for the frame-of-reference conversions at each step
+	FastMath::Accuracy_t _accuracy = FastMath::ACCURACY_FULL;
+
+	/**
+	 * Adds the wind's drag to the NED acceleration, and returns the roll and pitch accelerations
+	 * from the difference in vertical wind across the rotors.
+	 */
+	void applyWind(double accelNED[3], double & netz, double & rollAccel, double & pitchAccel)
+	{
+		double position[3] = {};
+		for (uint8_t i = 0; i < 3; ++i) {
+			position[i] = _windOrigin[i] + _x[STATE_X + 2 * i];
+		}
+
+		float wind[3], dx[3], dy[3];
+		_wind->sample(position, _time, wind, dx, dy);
+
+		for (uint8_t i = 0; i < 3; ++i) {
+			accelNED[i] += _windDrag * (wind[i] - _x[STATE_X_DOT + 2 * i]);
+		}
+		netz = accelNED[2] + g;
+
+		// Vertical wind gradient in the body's horizontal axes
+		double cps = cos(_x[STATE_PSI]);
+		double sps = sin(_x[STATE_PSI]);
+		double dwdx = cps * dx[2] + sps * dy[2];
+		double dwdy = -sps * dx[2] + cps * dy[2];
+
+		// Each half of an arm sees the drag of its own air: downwind on the right rolls right,
+		// downwind at the front pitches nose down
+		double torque = 0.5 * _windDrag * _p->m * _p->l * _p->l;
+		rollAccel = torque * dwdy / _p->Ix;
+		pitchAccel = -torque * dwdx / _p->Iy;
+	}
+
 protected:
 
 	// universal constants
@@ -181,9 +231,30 @@ protected:
 	double _U4 = 0;     // yaw thrust clockwise
 	double _Omega = 0;  // torque clockwise
 
-	// parameter block
+	// parameter block: our own copy, so it can be replaced while we fly
+	Parameters _params;
 	Parameters* _p = NULL;
 
+	// Replacement handed over by setParameters(), adopted between steps
+	std::atomic<Parameters*> _pendingParams;
+
+	void adoptParameters(void)
+	{
+		Parameters* pending = _pendingParams.exchange(NULL, std::memory_order_acquire);
+
+		if (pending) {
+			_params = *pending;
+			delete pending;
+			parametersChanged();
+		}
+	}
+
+	// Lets a frame recompute whatever it derives from the parameters
+	virtual void parametersChanged(void) {}
+
+	// Lets a frame bring motor state of its own to rest when init() stops the motors
+	virtual void motorsStopped(void) {}
+
 	// roll right
 	virtual double u2(double* o) = 0;
 
@@ -206,8 +277,9 @@ protected:
 	 *  Constructor
 	 */
 	MultirotorDynamics(Parameters* params, const uint8_t motorCount)
+		: _params(*params), _pendingParams(NULL)
 	{
-		_p = params;
+		_p = &_params;
 		_motorCount = motorCount;
 
 		_omegas = new double[motorCount]();
@@ -268,6 +340,7 @@ public:
 	{
 		delete _omegas;
 		delete _omegas2;
+		delete _pendingParams.load();
 	}
 
 	/**
@@ -278,6 +351,10 @@ public:
 	 */
 	void init(double rotation[3], bool airborne = false)
 	{
+		adoptParameters();
+
+		_time = 0;
+
 		// Always start at location (0,0,0)
 		_x[STATE_X] = 0;
 		_x[STATE_Y] = 0;
@@ -296,8 +373,15 @@ public:
 		_x[STATE_THETA_DOT] = 0;
 		_x[STATE_PSI_DOT] = 0;
 
+		// Motors start at rest
+		for (unsigned int i = 0; i < _motorCount; ++i) {
+			_omegas[i] = 0;
+			_omegas2[i] = 0;
+		}
+		motorsStopped();
+
 		// Initialize inertial frame acceleration in NED coordinates
-		bodyZToInertial(-g, rotation, _inertialAccel);
+		bodyZToInertial(-g, rotation, _inertialAccel, _accuracy);
 
 		// We usuall start on ground, but can start in air for testing
 		_airborne = airborne;
@@ -310,11 +394,22 @@ public:
 	 */
 	void update(double dt)
 	{
+		_time += dt;
+
+		// Use the terrain under the vehicle when we have it, so ground contact sees the current AGL.
+		// Off the edge of the terrain, fall back on the last value from setAgl().
+		if (_terrain) {
+			double h = _terrain->height(_x[STATE_X], _x[STATE_Y]);
+			if (!isnan(h)) {
+				_agl = -_x[STATE_Z] - h;
+			}
+		}
+
 		// Use the current Euler angles to rotate the orthogonal thrust vector into the inertial frame.
 		// Negate to use NED.
 		double euler[3] = { _x[6], _x[8], _x[10] };
 		double accelNED[3] = {};
-		bodyZToInertial(-_U1 / _p->m, euler, accelNED);
+		bodyZToInertial(-_U1 / _p->m, euler, accelNED, _accuracy);
 
 		// We're airborne once net downward acceleration goes below zero
 		double netz = accelNED[2] + g;
@@ -350,9 +445,18 @@ public:
 		// Once airborne, we can update dynamics
 		if (_airborne) {
 
+			double rollAccel = 0;
+			double pitchAccel = 0;
+			if (_wind) {
+				applyWind(accelNED, netz, rollAccel, pitchAccel);
+			}
+
 			// Compute the state derivatives using Equation 12
 			computeStateDerivative(accelNED, netz);
 
+			_dxdt[STATE_PHI_DOT] += rollAccel;
+			_dxdt[STATE_THETA_DOT] += pitchAccel;
+
 			// Compute state as first temporal integral of first temporal derivative
 			for (uint8_t i = 0; i < 12; ++i) {
 				_x[i] += dt * _dxdt[i];
@@ -381,13 +485,28 @@ public:
 		}
 
 		// Convert inertial acceleration and velocity to body frame
-		inertialToBody(_inertialAccel, _state.pose.rotation, _state.bodyAccel);
+		inertialToBody(_inertialAccel, _state.pose.rotation, _state.bodyAccel, _accuracy);
 
 		// Convert Euler angles to quaternion
-		eulerToQuaternion(_state.pose.rotation, _state.quaternion);
+		eulerToQuaternion(_state.pose.rotation, _state.quaternion, _accuracy);
+
+		// New parameters take effect from the next step
+		adoptParameters();
 
 	} // update
 
+	/**
+	 * Replaces the parameters, e.g. after their file changes.  Safe to call from any thread
+	 * while another is stepping the dynamics: the whole block is swapped in at the end of
+	 * the current step, or at init(), and a later call before then supersedes an earlier one.
+	 *
+	 * @param params new parameters
+	 */
+	void setParameters(const Parameters & params)
+	{
+		delete _pendingParams.exchange(new Parameters(params), std::memory_order_release);
+	}
+
 	/**
 	 * Returns state structure.
 	 * @return state structure
@@ -462,6 +581,46 @@ public:
 		_agl = agl;
 	}
 
+	/**
+	 * Sets terrain for computing AGL on every update; NULL goes back to setAgl().
+	 * The heightfield must stay valid while the dynamics are running.
+	 */
+	void setTerrain(const Heightfield * terrain)
+	{
+		_terrain = terrain;
+	}
+
+	/**
+	 * Sets a wind field to fly through; NULL goes back to still air.  The field must stay valid
+	 * while the dynamics are running.
+	 *
+	 * @param wind field, sampled at the elapsed time since init()
+	 * @param origin NED location of the start location in the field's coordinates, meters
+	 * @param drag linear drag per unit mass on the velocity relative to the air, 1/s
+	 */
+	void setWind(const WindField * wind, const double origin[3], double drag = 0.3)
+	{
+		_wind = wind;
+		for (uint8_t i = 0; i < 3; ++i) {
+			_windOrigin[i] = origin[i];
+		}
+		_windDrag = drag;
+	}
+
+	/**
+	 * Trades the accuracy of the sines and cosines at each step for speed; the default,
+	 * FastMath::ACCURACY_FULL, gives the math library's.  Set it before flight.
+	 */
+	void setMathAccuracy(FastMath::Accuracy_t accuracy)
+	{
+		_accuracy = accuracy;
+	}
+
+	bool hasTerrainAt(double x, double y)
+	{
+		return _terrain && !isnan(_terrain->height(x, y));
+	}
+
 	// Motor direction for animation
 	virtual int8_t motorDirection(uint8_t i) { (void)i; return 0; }
 
@@ -469,20 +628,24 @@ public:
 	 *  Frame-of-reference conversion routines.
 	 *
 	 *  See Section 5 of http://www.chrobotics.com/library/understanding-euler-angles
+	 *
+	 *  Each takes the three sines and cosines it needs in one FastMath call, at full accuracy
+	 *  unless told otherwise.
 	 */
 
-	static void bodyToInertial(double body[3], const double rotation[3], double inertial[3])
+	static void bodyToInertial(double body[3], const double rotation[3], double inertial[3],
+		FastMath::Accuracy_t accuracy = FastMath::ACCURACY_FULL)
 	{
-		double phi = rotation[0];
-		double theta = rotation[1];
-		double psi = rotation[2];
+		double s[3] = {};
+		double c[3] = {};
+		FastMath::sincos(rotation, s, c, 3, accuracy);
 
-		double cph = cos(phi);
-		double sph = sin(phi);
-		double cth = cos(theta);
-		double sth = sin(theta);
-		double cps = cos(psi);
-		double sps = sin(psi);
+		double cph = c[0];
+		double sph = s[0];
+		double cth = c[1];
+		double sth = s[1];
+		double cps = c[2];
+		double sps = s[2];
 
 		double R[3][3] = { {cps * cth,  cps * sph * sth - cph * sps,  sph * sps + cph * cps * sth},
 			{cth * sps,  cph * cps + sph * sps * sth,  cph * sps * sth - cps * sph},
@@ -491,18 +654,19 @@ public:
 		dot(R, body, inertial);
 	}
 
-	static void inertialToBody(double inertial[3], const double rotation[3], double body[3])
+	static void inertialToBody(double inertial[3], const double rotation[3], double body[3],
+		FastMath::Accuracy_t accuracy = FastMath::ACCURACY_FULL)
 	{
-		double phi = rotation[0];
-		double theta = rotation[1];
-		double psi = rotation[2];
+		double s[3] = {};
+		double c[3] = {};
+		FastMath::sincos(rotation, s, c, 3, accuracy);
 
-		double cph = cos(phi);
-		double sph = sin(phi);
-		double cth = cos(theta);
-		double sth = sin(theta);
-		double cps = cos(psi);
-		double sps = sin(psi);
+		double cph = c[0];
+		double sph = s[0];
+		double cth = c[1];
+		double sth = s[1];
+		double cps = c[2];
+		double sps = s[2];
 
 		double R[3][3] = { {cps * cth,                cth * sps,                   -sth},
 			{cps * sph * sth - cph * sps,  cph * cps + sph * sps * sth,  cth * sph},
@@ -518,20 +682,23 @@ public:
 	 * @param quaternion output
 	 */
 
-	static void eulerToQuaternion(const double eulerAngles[3], double quaternion[4])
+	static void eulerToQuaternion(const double eulerAngles[3], double quaternion[4],
+		FastMath::Accuracy_t accuracy = FastMath::ACCURACY_FULL)
 	{
-		// Convenient renaming
-		double phi = eulerAngles[0] / 2;
-		double the = eulerAngles[1] / 2;
-		double psi = eulerAngles[2] / 2;
+		// Half angles
+		double halves[3] = { eulerAngles[0] / 2, eulerAngles[1] / 2, eulerAngles[2] / 2 };
 
 		// Pre-computation
-		double cph = cos(phi);
-		double cth = cos(the);
-		double cps = cos(psi);
-		double sph = sin(phi);
-		double sth = sin(the);
-		double sps = sin(psi);
+		double s[3] = {};
+		double c[3] = {};
+		FastMath::sincos(halves, s, c, 3, accuracy);
+
+		double cph = c[0];
+		double cth = c[1];
+		double cps = c[2];
+		double sph = s[0];
+		double sth = s[1];
+		double sps = s[2];
 
 		// Conversion
 		quaternion[0] = cph * cth * cps + sph * sth * sps;
@@ -549,4 +716,14 @@ public:
 		return _motorCount;
 	}
 
+	/**
+	 * Gets a motor's speed as of the last call to setMotors().
+	 * @param index motor
+	 * @return motor speed in rad/s
+	 */
+	double motorSpeed(uint8_t index)
+	{
+		return _omegas[index];
+	}
+
 }; // class MultirotorDynamics
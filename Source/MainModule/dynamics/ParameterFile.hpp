@@ -0,0 +1,263 @@
+/*
+ * Vehicle parameters read from a text file, checked, and watched for changes
+ *
+ * The file holds one parameter per line, as a name and a value, with
+ * anything after a # ignored:
+ *
+ *     # DJI Phantom
+ *     b      5.0E-06   # force constant [F=b*w^2]
+ *     d      2.0E-06   # torque constant [T=d*w^2]
+ *     m      1.380     # mass [kg]
+ *     l      0.350     # arm length [m]
+ *     Ix     2         # [kg*m^2]
+ *     Iy     2
+ *     Iz     3
+ *     Jr     38E-04    # prop inertia [kg*m^2]
+ *     maxrpm 15000
+ *
+ * Every parameter must appear exactly once.  A file with an unknown name,
+ * a value that isn't a number, a non-positive mass, length or constant, or
+ * moments of inertia no rigid body could have is rejected, and getMessage()
+ * says where.
+ *
+ * Copyright (C) 2019 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include "MultirotorDynamics.hpp"
+#include "../FileWatcher.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+class ParameterFile {
+
+    private:
+
+        static const uint32_t MAX_PATH_LENGTH = 1024;
+        static const uint32_t MAX_LINE_LENGTH = 256;
+
+        // Largest file we'll read; parameter files are a few hundred bytes
+        static const long MAX_FILE_SIZE = 65536;
+
+        enum {
+            B,
+            D,
+            M,
+            L,
+            IX,
+            IY,
+            IZ,
+            JR,
+            MAXRPM,
+            COUNT
+        };
+
+        static const char * name(uint8_t index)
+        {
+            static const char * names[COUNT] = { "b", "d", "m", "l", "Ix", "Iy", "Iz", "Jr", "maxrpm" };
+            return names[index];
+        }
+
+        char _path[MAX_PATH_LENGTH] = {};
+
+        MultirotorDynamics::Parameters _params = MultirotorDynamics::Parameters(0, 0, 0, 0, 0, 0, 0, 0, 0);
+
+        // Whether the last read passed the checks
+        bool _valid = false;
+
+        FileWatcher _watcher;
+
+        char _message[MAX_PATH_LENGTH + 2 * MAX_LINE_LENGTH + 100] = {};
+
+        // Reads and checks the file, leaving the parameters we have alone if it won't do
+        bool read(void)
+        {
+            _valid = false;
+
+            FILE * fp = fopen(_path, "r");
+
+            if (!fp) {
+                snprintf(_message, sizeof(_message), "can't open %s", _path);
+                return false;
+            }
+
+            double values[COUNT] = {};
+            bool found[COUNT] = {};
+
+            char line[MAX_LINE_LENGTH];
+            uint32_t lineNumber = 0;
+            long total = 0;
+            bool ok = true;
+
+            while (ok && fgets(line, sizeof(line), fp)) {
+
+                lineNumber++;
+                total += (long)strlen(line);
+
+                if (total > MAX_FILE_SIZE || (!strchr(line, '\n') && !feof(fp))) {
+                    snprintf(_message, sizeof(_message), "%s:%u: line too long", _path, lineNumber);
+                    ok = false;
+                    break;
+                }
+
+                char * comment = strchr(line, '#');
+                if (comment) {
+                    *comment = 0;
+                }
+
+                char key[MAX_LINE_LENGTH] = {};
+                char value[MAX_LINE_LENGTH] = {};
+                char extra[MAX_LINE_LENGTH] = {};
+
+                const int fields = sscanf(line, "%255s %255s %255s", key, value, extra);
+
+                if (fields <= 0) {
+                    continue;
+                }
+
+                if (fields != 2) {
+                    snprintf(_message, sizeof(_message), "%s:%u: expected a name and a value", _path, lineNumber);
+                    ok = false;
+                    break;
+                }
+
+                uint8_t index = 0;
+                while (index < COUNT && strcmp(key, name(index)) != 0) {
+                    index++;
+                }
+
+                char * end = NULL;
+                const double number = strtod(value, &end);
+
+                if (index == COUNT) {
+                    snprintf(_message, sizeof(_message), "%s:%u: unknown parameter %s", _path, lineNumber, key);
+                    ok = false;
+                }
+                else if (found[index]) {
+                    snprintf(_message, sizeof(_message), "%s:%u: %s given twice", _path, lineNumber, key);
+                    ok = false;
+                }
+                else if (*end || !isfinite(number)) {
+                    snprintf(_message, sizeof(_message), "%s:%u: %s is not a number", _path, lineNumber, value);
+                    ok = false;
+                }
+                else {
+                    values[index] = number;
+                    found[index] = true;
+                }
+            }
+
+            fclose(fp);
+
+            for (uint8_t k=0; ok && k<COUNT; ++k) {
+                if (!found[k]) {
+                    snprintf(_message, sizeof(_message), "%s: %s is missing", _path, name(k));
+                    ok = false;
+                }
+            }
+
+            if (!ok || !check(values)) {
+                return false;
+            }
+
+            _params = MultirotorDynamics::Parameters(values[B], values[D], values[M], values[L],
+                    values[IX], values[IY], values[IZ], values[JR], (uint16_t)values[MAXRPM]);
+
+            _valid = true;
+
+            snprintf(_message, sizeof(_message), "read %s", _path);
+
+            return true;
+        }
+
+        bool check(const double values[COUNT])
+        {
+            for (uint8_t k=0; k<COUNT; ++k) {
+
+                // The prop inertia only adds gyroscopic torque, and may be neglected
+                const bool positive = k == JR ? values[k] >= 0 : values[k] > 0;
+
+                if (!positive) {
+                    snprintf(_message, sizeof(_message), "%s: %s must be %s", _path, name(k),
+                            k == JR ? "zero or more" : "more than zero");
+                    return false;
+                }
+            }
+
+            if (values[MAXRPM] > 65535 || values[MAXRPM] != floor(values[MAXRPM])) {
+                snprintf(_message, sizeof(_message), "%s: maxrpm must be a whole number up to 65535", _path);
+                return false;
+            }
+
+            // Each principal moment of a rigid body is at most the sum of the other two
+            const double Ix = values[IX], Iy = values[IY], Iz = values[IZ];
+
+            if (Ix > Iy + Iz || Iy > Ix + Iz || Iz > Ix + Iy) {
+                snprintf(_message, sizeof(_message), "%s: no rigid body has moments of inertia %g, %g, %g", _path,
+                        Ix, Iy, Iz);
+                return false;
+            }
+
+            return true;
+        }
+
+    public:
+
+        /**
+         * Reads parameters and starts watching the file.
+         *
+         * @param path parameter file
+         * @return false if the file couldn't be read or was rejected; poll() keeps trying as it changes
+         */
+        bool load(const char * path)
+        {
+            snprintf(_path, sizeof(_path), "%s", path);
+
+            _watcher.watch(_path);
+
+            return read();
+        }
+
+        /**
+         * Reads the file again if it has changed and then stayed the same since the last call,
+         * so we don't read a file an editor is still writing.
+         *
+         * @return true if the file was read again; isValid() says whether it passed the checks
+         */
+        bool poll(void)
+        {
+            // Whether or not it passes, we wait for the next change
+            if (!_path[0] || !_watcher.poll(_path)) {
+                return false;
+            }
+
+            read();
+
+            return true;
+        }
+
+        // Whether the file passed the checks when last read
+        bool isValid(void) const
+        {
+            return _valid;
+        }
+
+        // The parameters from the last read that passed the checks
+        const MultirotorDynamics::Parameters & get(void) const
+        {
+            return _params;
+        }
+
+        // What happened at the last read
+        const char * getMessage(void) const
+        {
+            return _message;
+        }
+
+}; // class ParameterFile
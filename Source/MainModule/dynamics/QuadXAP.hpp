@@ -14,43 +14,14 @@
 
 #pragma once
 
-#include "MultirotorDynamics.hpp"
+#include "FrameDynamics.hpp"
 
-class QuadXAPDynamics : public MultirotorDynamics {
+class QuadXAPDynamics : public FrameDynamics {
 
     public:	
 
-		QuadXAPDynamics(Parameters * params) : MultirotorDynamics(params, 4)
+		QuadXAPDynamics(Parameters * params) : FrameDynamics(params, MotorLayout::quadXAP())
         {
         }
 
-    protected:
-
-        // MultirotorDynamics method overrides
-
-        // roll right
-        virtual double u2(double * o) override
-        {
-            return (o[1] + o[2]) - (o[0] + o[3]);
-        }
-
-        // pitch forward
-        virtual double u3(double * o) override
-        {
-            return (o[1] + o[3]) - (o[0] + o[2]);
-        }
-
-        // yaw cw
-        virtual double u4(double * o) override
-        {
-            return (o[0] + o[1]) - (o[2] + o[3]);
-        }
-
-        // motor direction for animation
-        virtual int8_t motorDirection(uint8_t i) override
-        {
-            const int8_t dir[4] = {-1, -1, +1, +1};
-            return dir[i];
-        }
-
 }; // class QuadXAP
@@ -0,0 +1,480 @@
+/*
+ * Memory-mapped, time-varying 3D wind field
+ *
+ * A sequence of frames, each a regular grid of wind vectors, sampled with
+ * trilinear interpolation in space and linear interpolation in time.  Each
+ * frame is stored as cubic bricks that share a one-node border with their
+ * neighbors, like the tiles of Heightfield, so a sample reads one brick per
+ * frame: a few pages that the OS brings in from the page cache as vehicles
+ * reach them.  Volumes larger than memory are fine.
+ *
+ * Coordinates are NED meters relative to the world origin; wind is NED m/s.
+ * Positions outside the grid use the nearest boundary value, and times
+ * past the last frame hold it or loop back to the first.
+ *
+ * Copyright (C) 2019 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+
+#include "../MappedFile.hpp"
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define WINDFIELD_SSE
+#include <xmmintrin.h>
+#endif
+
+class WindField {
+
+    public:
+
+        static const uint32_t MAGIC   = 0x46574d4d; // "MMWF"
+        static const uint32_t VERSION = 1;
+
+        // Nodes per brick edge, not counting the shared border
+        static const uint16_t BRICK_SIZE = 8;
+
+        static const uint16_t FLAG_LOOP = 1;
+
+#pragma pack(push, 1)
+        typedef struct {
+
+            uint32_t magic;
+            uint32_t version;
+            uint16_t brickSize;
+            uint16_t bricksX;
+            uint16_t bricksY;
+            uint16_t bricksZ;
+            uint32_t samplesX;
+            uint32_t samplesY;
+            uint32_t samplesZ;
+            uint32_t frames;
+            uint16_t flags;
+            uint16_t reserved;
+            double   origin[3];  // location of node (0,0,0)
+            double   spacing;    // meters between nodes
+            double   timeStep;   // seconds between frames
+
+        } header_t;
+#pragma pack(pop)
+
+    private:
+
+        header_t _header = {};
+
+        MappedFile _file;
+
+        // Three floats per node, plus one float of padding at the end so four-wide loads stay inside the file
+        float * _nodes = NULL;
+
+        size_t _brickStride = 0;   // floats
+        size_t _frameStride = 0;
+
+        double _invSpacing = 0;
+        double _invTimeStep = 0;
+        double _max[3] = {};
+
+        void setup(void)
+        {
+            uint32_t edge = _header.brickSize + 1;
+            _brickStride = 3 * (size_t)edge * edge * edge;
+            _frameStride = _brickStride * _header.bricksX * _header.bricksY * _header.bricksZ;
+
+            _invSpacing = 1 / _header.spacing;
+            _invTimeStep = _header.timeStep > 0 ? 1 / _header.timeStep : 0;
+
+            _max[0] = _header.samplesX - 1;
+            _max[1] = _header.samplesY - 1;
+            _max[2] = _header.samplesZ - 1;
+        }
+
+        size_t dataSize(void) const
+        {
+            return sizeof(header_t) + sizeof(float) * (_frameStride * _header.frames + 1);
+        }
+
+        // Whether the file holds every frame.  The brick and frame counts come from the file, and
+        // their product can overflow 64 bits, so the floats available are divided by each in turn.
+        bool holdsFrames(void) const
+        {
+            if (_file.size() < sizeof(header_t) + sizeof(float)) return false;
+
+            uint64_t available = (_file.size() - sizeof(header_t)) / sizeof(float) - 1;
+
+            const uint64_t counts[5] = { _brickStride, _header.bricksX, _header.bricksY, _header.bricksZ, _header.frames };
+
+            for (uint8_t k=0; k<5; ++k) {
+                if (counts[k] == 0 || counts[k] > available) return false;
+                available /= counts[k];
+            }
+
+            return true;
+        }
+
+        // Clamped grid coordinate, and the cell and offset within its brick
+        void locate(double position, uint8_t axis, uint32_t & brick, uint32_t & local, float & fraction) const
+        {
+            double g = (position - _header.origin[axis]) * _invSpacing;
+            g = g < 0 ? 0 : g > _max[axis] ? _max[axis] : g;
+
+            // Points on the far edge use the last cell
+            uint32_t i = (uint32_t)g;
+            if (i >= _max[axis]) i--;
+
+            brick = i / _header.brickSize;
+            local = i - brick * _header.brickSize;
+            fraction = (float)(g - i);
+        }
+
+        // Offset of a cell's first corner within a frame, and fractions within the cell
+        size_t cell(double x, double y, double z, float f[3]) const
+        {
+            uint32_t b[3], l[3];
+            locate(x, 0, b[0], l[0], f[0]);
+            locate(y, 1, b[1], l[1], f[1]);
+            locate(z, 2, b[2], l[2], f[2]);
+
+            uint32_t edge = _header.brickSize + 1;
+
+            return (((size_t)b[2] * _header.bricksY + b[1]) * _header.bricksX + b[0]) * _brickStride +
+                3 * (((size_t)l[2] * edge + l[1]) * edge + l[0]);
+        }
+
+        // The two frames around a time, and the weight of the second
+        void frames(double time, size_t & first, size_t & second, float & fraction) const
+        {
+            double t = time * _invTimeStep;
+            uint32_t n = _header.frames;
+
+            if (_header.flags & FLAG_LOOP) {
+                t = fmod(t, (double)n);
+                if (t < 0) t += n;
+            }
+            else {
+                t = t < 0 ? 0 : t > n - 1 ? n - 1 : t;
+            }
+
+            uint32_t i = (uint32_t)t;
+            if (i >= n) i = n - 1;
+
+            fraction = (float)(t - i);
+            first = i * _frameStride;
+            second = (i + 1 < n ? i + 1 : (_header.flags & FLAG_LOOP) ? 0 : i) * _frameStride;
+        }
+
+        void interpolate(size_t a, size_t b, float ft, const float f[3], float wind[3], float dx[3], float dy[3]) const
+        {
+            const size_t edge = _header.brickSize + 1;
+            const size_t sy = 3 * edge;
+            const size_t sz = 3 * edge * edge;
+
+            const float * pa = _nodes + a;
+            const float * pb = _nodes + b;
+
+#ifdef WINDFIELD_SSE
+            const __m128 t = _mm_set1_ps(ft);
+            const __m128 fx = _mm_set1_ps(f[0]);
+            const __m128 fy = _mm_set1_ps(f[1]);
+            const __m128 fz = _mm_set1_ps(f[2]);
+
+            __m128 e[2][2], g[2][2];
+
+            for (uint8_t k=0; k<2; ++k) {
+                for (uint8_t j=0; j<2; ++j) {
+                    size_t o = k*sz + j*sy;
+                    __m128 a0 = _mm_loadu_ps(pa + o);
+                    __m128 a1 = _mm_loadu_ps(pa + o + 3);
+                    __m128 c0 = _mm_add_ps(a0, _mm_mul_ps(t, _mm_sub_ps(_mm_loadu_ps(pb + o), a0)));
+                    __m128 c1 = _mm_add_ps(a1, _mm_mul_ps(t, _mm_sub_ps(_mm_loadu_ps(pb + o + 3), a1)));
+                    g[k][j] = _mm_sub_ps(c1, c0);
+                    e[k][j] = _mm_add_ps(c0, _mm_mul_ps(fx, g[k][j]));
+                }
+            }
+
+            __m128 w[2], gx[2], gy[2];
+            for (uint8_t k=0; k<2; ++k) {
+                gy[k] = _mm_sub_ps(e[k][1], e[k][0]);
+                w[k] = _mm_add_ps(e[k][0], _mm_mul_ps(fy, gy[k]));
+                gx[k] = _mm_add_ps(g[k][0], _mm_mul_ps(fy, _mm_sub_ps(g[k][1], g[k][0])));
+            }
+
+            float out[3][4];
+            _mm_storeu_ps(out[0], _mm_add_ps(w[0], _mm_mul_ps(fz, _mm_sub_ps(w[1], w[0]))));
+            _mm_storeu_ps(out[1], _mm_add_ps(gx[0], _mm_mul_ps(fz, _mm_sub_ps(gx[1], gx[0]))));
+            _mm_storeu_ps(out[2], _mm_add_ps(gy[0], _mm_mul_ps(fz, _mm_sub_ps(gy[1], gy[0]))));
+
+            for (uint8_t c=0; c<3; ++c) {
+                wind[c] = out[0][c];
+                if (dx) dx[c] = out[1][c] * (float)_invSpacing;
+                if (dy) dy[c] = out[2][c] * (float)_invSpacing;
+            }
+#else
+            for (uint8_t c=0; c<3; ++c) {
+
+                float e[2][2], g[2][2];
+
+                for (uint8_t k=0; k<2; ++k) {
+                    for (uint8_t j=0; j<2; ++j) {
+                        size_t o = k*sz + j*sy + c;
+                        float c0 = pa[o] + ft * (pb[o] - pa[o]);
+                        float c1 = pa[o+3] + ft * (pb[o+3] - pa[o+3]);
+                        g[k][j] = c1 - c0;
+                        e[k][j] = c0 + f[0] * g[k][j];
+                    }
+                }
+
+                float w[2], gx[2], gy[2];
+                for (uint8_t k=0; k<2; ++k) {
+                    gy[k] = e[k][1] - e[k][0];
+                    w[k] = e[k][0] + f[1] * gy[k];
+                    gx[k] = g[k][0] + f[1] * (g[k][1] - g[k][0]);
+                }
+
+                wind[c] = w[0] + f[2] * (w[1] - w[0]);
+                if (dx) dx[c] = (gx[0] + f[2] * (gx[1] - gx[0])) * (float)_invSpacing;
+                if (dy) dy[c] = (gy[0] + f[2] * (gy[1] - gy[0])) * (float)_invSpacing;
+            }
+#endif
+        }
+
+#ifdef WINDFIELD_SSE
+        // The four rows of a cell
+        void prefetch(size_t corner) const
+        {
+            const size_t edge = _header.brickSize + 1;
+
+            for (uint8_t k=0; k<2; ++k) {
+                for (uint8_t j=0; j<2; ++j) {
+                    _mm_prefetch((const char *)(_nodes + corner + 3 * (k*edge + j) * edge), _MM_HINT_T0);
+                }
+            }
+        }
+#endif
+
+    public:
+
+        ~WindField(void)
+        {
+            close();
+        }
+
+        /**
+         * Creates a field file and maps it for writing; fill it with setFrame().
+         *
+         * @param samples nodes along x, y, z; at least two each
+         * @param frames number of frames
+         * @param origin NED location of node (0,0,0) in meters
+         * @param spacing meters between nodes
+         * @param timeStep seconds between frames
+         * @param loop whether the last frame is followed by the first
+         */
+        bool create(const char * path, const uint32_t samples[3], uint32_t frames, const double origin[3], double spacing,
+                double timeStep, bool loop)
+        {
+            close();
+
+            if (samples[0] < 2 || samples[1] < 2 || samples[2] < 2 || frames < 1 || spacing <= 0) return false;
+
+            const uint16_t B = BRICK_SIZE;
+
+            _header.magic = MAGIC;
+            _header.version = VERSION;
+            _header.brickSize = B;
+            _header.bricksX = (uint16_t)((samples[0] - 1 + B - 1) / B);
+            _header.bricksY = (uint16_t)((samples[1] - 1 + B - 1) / B);
+            _header.bricksZ = (uint16_t)((samples[2] - 1 + B - 1) / B);
+            _header.samplesX = samples[0];
+            _header.samplesY = samples[1];
+            _header.samplesZ = samples[2];
+            _header.frames = frames;
+            _header.flags = loop ? FLAG_LOOP : 0;
+            _header.reserved = 0;
+            memcpy(_header.origin, origin, sizeof(_header.origin));
+            _header.spacing = spacing;
+            _header.timeStep = timeStep;
+
+            setup();
+
+            if (!_file.create(path, dataSize())) return false;
+
+            memcpy(_file.data(), &_header, sizeof(header_t));
+            _nodes = (float *)(_file.data() + sizeof(header_t));
+
+            return true;
+        }
+
+        /**
+         * Writes one frame into a field opened by create().
+         *
+         * @param frame frame index
+         * @param samples wind vectors, x fastest, then y, then z: samplesX * samplesY * samplesZ * 3 floats
+         */
+        void setFrame(uint32_t frame, const float * samples)
+        {
+            const uint16_t B = _header.brickSize;
+            const uint32_t nx = _header.samplesX, ny = _header.samplesY, nz = _header.samplesZ;
+
+            float * dst = _nodes + frame * _frameStride;
+
+            for (uint16_t bz=0; bz<_header.bricksZ; ++bz) {
+                for (uint16_t by=0; by<_header.bricksY; ++by) {
+                    for (uint16_t bx=0; bx<_header.bricksX; ++bx) {
+                        for (uint16_t lz=0; lz<=B; ++lz) {
+                            for (uint16_t ly=0; ly<=B; ++ly) {
+                                for (uint16_t lx=0; lx<=B; ++lx) {
+
+                                    // Repeat the last node past the edge of the grid
+                                    uint32_t gx = bx*B + lx, gy = by*B + ly, gz = bz*B + lz;
+                                    if (gx >= nx) gx = nx - 1;
+                                    if (gy >= ny) gy = ny - 1;
+                                    if (gz >= nz) gz = nz - 1;
+
+                                    memcpy(dst, &samples[3 * (((size_t)gz*ny + gy)*nx + gx)], 3 * sizeof(float));
+                                    dst += 3;
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        // Maps a saved field read-only
+        bool load(const char * path)
+        {
+            close();
+
+            if (!_file.open(path) || _file.size() < sizeof(header_t)) {
+                _file.close();
+                return false;
+            }
+
+            memcpy(&_header, _file.data(), sizeof(header_t));
+
+            // Only the brick size we write is read back, which bounds the brick stride
+            if (_header.magic != MAGIC || _header.version != VERSION || _header.brickSize != BRICK_SIZE ||
+                    !(_header.spacing > 0) || !isfinite(_header.spacing) ||
+                    !(_header.timeStep >= 0) || !isfinite(_header.timeStep) ||
+                    !isfinite(_header.origin[0]) || !isfinite(_header.origin[1]) || !isfinite(_header.origin[2]) ||
+                    _header.samplesX < 2 || _header.samplesY < 2 || _header.samplesZ < 2 || _header.frames < 1) {
+                _file.close();
+                return false;
+            }
+
+            // Lookups index bricks from the sample counts, so the brick counts have to cover them exactly
+            const uint64_t B = _header.brickSize;
+            if (_header.bricksX != (_header.samplesX - 1 + B - 1) / B ||
+                    _header.bricksY != (_header.samplesY - 1 + B - 1) / B ||
+                    _header.bricksZ != (_header.samplesZ - 1 + B - 1) / B) {
+                _file.close();
+                return false;
+            }
+
+            setup();
+
+            if (!holdsFrames()) {
+                _file.close();
+                return false;
+            }
+
+            // Vehicles read scattered bricks; don't read ahead
+            _file.adviseSequential(false);
+
+            _nodes = (float *)(_file.data() + sizeof(header_t));
+
+            return true;
+        }
+
+        void close(void)
+        {
+            _file.flush();
+            _file.close();
+            _nodes = NULL;
+        }
+
+        bool isValid(void) const
+        {
+            return _nodes != NULL;
+        }
+
+        /**
+         * Wind at a point and time.  Safe to call from any thread once loaded.
+         *
+         * @param position NED meters
+         * @param time seconds
+         * @param wind output, NED m/s
+         * @param dx if not NULL, output derivative of the wind along x, 1/s
+         * @param dy if not NULL, output derivative along y
+         */
+        void sample(const double position[3], double time, float wind[3], float dx[3]=NULL, float dy[3]=NULL) const
+        {
+            if (!_nodes) {
+                memset(wind, 0, 3 * sizeof(float));
+                if (dx) memset(dx, 0, 3 * sizeof(float));
+                if (dy) memset(dy, 0, 3 * sizeof(float));
+                return;
+            }
+
+            size_t a, b;
+            float ft;
+            frames(time, a, b, ft);
+
+            float f[3];
+            size_t o = cell(position[0], position[1], position[2], f);
+
+            interpolate(a + o, b + o, ft, f, wind, dx, dy);
+        }
+
+        /**
+         * Wind at many points at one time, fetching each point's bricks while the one before is interpolated.
+         *
+         * @param count number of points
+         * @param positions NED meters, three per point
+         * @param winds output, NED m/s, three per point
+         */
+        void sample(uint32_t count, const double * positions, double time, float * winds) const
+        {
+            if (!_nodes) {
+                memset(winds, 0, 3 * sizeof(float) * count);
+                return;
+            }
+
+            size_t a, b;
+            float ft;
+            frames(time, a, b, ft);
+
+            float f[2][3];
+            size_t o = count ? cell(positions[0], positions[1], positions[2], f[0]) : 0;
+
+            for (uint32_t k=0; k<count; ++k) {
+
+                size_t next = 0;
+
+                if (k + 1 < count) {
+                    const double * p = &positions[3*(k+1)];
+                    next = cell(p[0], p[1], p[2], f[(k+1)&1]);
+#ifdef WINDFIELD_SSE
+                    prefetch(a + next);
+                    prefetch(b + next);
+#endif
+                }
+
+                interpolate(a + o, b + o, ft, f[k&1], &winds[3*k], NULL, NULL);
+
+                o = next;
+            }
+        }
+
+        const header_t & getHeader(void) const
+        {
+            return _header;
+        }
+
+}; // class WindField
@@ -1,6 +1,14 @@
 /*
  * Joystick/gamepad support for flight simulators
  *
+ * On Linux, a thread per joystick waits for events from the device and
+ * publishes the axes as soon as they change, stamped with the monotonic time
+ * they were read; poll() just takes the latest values, without locking.  On
+ * Windows, poll() queries the device.
+ *
+ * What poll() returns can be recorded to a file and played back through
+ * JoystickPlayback.
+ *
  * Copyright (C) 2018 Simon D. Levy
  *
  * MIT License
@@ -11,6 +19,14 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#endif
 
 #ifndef MAINMODULE_API
 #define MAINMODULE_API
@@ -40,6 +56,17 @@ private:
 
 	bool _isGameController = false;
 
+    // Aux switches set by buttons
+    float _aux1 = 0;
+    float _aux2 = -1;
+    bool _down = false;
+
+    // Recording
+    FILE * _recording = NULL;
+    double _recordStart = 0;
+    float _recordedAxes[6] = {};
+    int32_t _recordedStatus = -1;
+
 public:
 
     typedef enum {
@@ -52,6 +79,28 @@ public:
 
 protected:
 
+    // Recording file layout: a header, then a record each time the axes or status change
+    static const uint32_t RECORD_MAGIC = 0x4352534a; // "JSRC"
+    static const uint32_t RECORD_VERSION = 1;
+
+    typedef struct {
+
+        uint32_t magic;
+        uint32_t version;
+        uint32_t recordSize;
+        uint32_t reserved;
+
+    } recordHeader_t;
+
+    typedef struct {
+
+        double time;      // seconds since recording started
+        float axes[6];
+        int32_t status;
+        int32_t reserved;
+
+    } record_t;
+
     enum {
 
         AX_THR,
@@ -65,11 +114,6 @@ protected:
 
     void buttonsToAxes(uint8_t buttons, uint8_t top, uint8_t rgt, uint8_t bot, uint8_t lft, float * axes)
     {
-        static float _aux1 = 0;
-        static float _aux2 = -1;
-
-        static bool _down;
-
         if (buttons) {
 
             if (!_down) {
@@ -96,18 +140,9 @@ protected:
         axes[AX_AU2] = _aux2;
     }
 
-    error_t pollProduct(float axes[6], uint8_t & buttons);
-
-public:
-
-    MAINMODULE_API Joystick(const char * devname = "/dev/input/js0"); // ignored by Windows
-
-    MAINMODULE_API error_t poll(float axes[6])
+    // Product-specific adjustments to the raw axes and buttons
+    void adjustAxes(float * axes, uint8_t buttons)
     {
-        uint8_t buttons = 0;
-
-        error_t status = pollProduct(axes, buttons);
-
         // Invert throttle, pitch axes on game controllers
         if (_isGameController) {
             axes[AX_THR] *= -1;
@@ -124,7 +159,140 @@ public:
 			case PRODUCT_XBOX360_CLONE2:
                 buttonsToAxes(buttons, 8, 2, 1, 4, axes);
         }
+    }
+
+#ifdef __linux__
+
+private:
+
+    char _productName[128] = {};
+
+    const uint8_t * _axisMap = NULL;
+
+    // Owned by the input thread
+    float _axes[6] = {};
+    uint8_t _buttons = 0;
+    float _adjusted[6] = {};
+
+    std::thread _thread;
+    int _epollFd = -1;
+    int _wakeFd = -1;
+
+    // Latest axes, guarded by a sequence counter that is odd while they are written
+    std::atomic<uint32_t> _sequence;
+    float _slotAxes[6] = {};
+    double _slotTime = -1;
+
+    std::atomic<int> _status;
+
+    // Sequence seen by the last poll(), for waitForInput()
+    std::atomic<uint32_t> _polled;
+
+    std::atomic<int> _waiters;
+    std::mutex _waitMutex;
+    std::condition_variable _waitCondition;
+
+    void run(void);
+
+    void handleEvent(uint8_t type, uint8_t number, int16_t value, bool init);
+
+    void publish(double time);
+
+#else
+
+    error_t pollProduct(float axes[6], uint8_t & buttons);
+
+#endif
+
+protected:
+
+    // Implemented by each platform, and by JoystickPlayback
+    virtual error_t pollDevice(float axes[6], double & eventTime);
+
+public:
+
+    /**
+     * @param devname device on Linux, ignored by Windows; NULL for no device
+     */
+    MAINMODULE_API Joystick(const char * devname = "/dev/input/js0");
+
+    MAINMODULE_API virtual ~Joystick(void);
+
+    MAINMODULE_API error_t poll(float axes[6])
+    {
+        double eventTime = 0;
+        return poll(axes, eventTime);
+    }
+
+    /**
+     * Gets the latest axes.
+     *
+     * @param axes throttle, roll, pitch, yaw, aux1, aux2 (output)
+     * @param eventTime time, on the now() clock, of the newest input the axes reflect; -1 before any input (output)
+     */
+    MAINMODULE_API error_t poll(float axes[6], double & eventTime)
+    {
+        error_t status = pollDevice(axes, eventTime);
+
+        if (_recording && (status != _recordedStatus || memcmp(axes, _recordedAxes, sizeof(_recordedAxes)))) {
+
+            record_t record = {};
+            record.time = now() - _recordStart;
+            memcpy(record.axes, axes, sizeof(record.axes));
+            record.status = status;
+
+            fwrite(&record, sizeof(record), 1, _recording);
+
+            memcpy(_recordedAxes, axes, sizeof(_recordedAxes));
+            _recordedStatus = status;
+        }
 
         return status;
     }
+
+    /**
+     * Blocks until there is input that poll() hasn't returned yet, or there is an error.  Windows can only
+     * query the device, so there this just sleeps for a millisecond.
+     *
+     * @return false on timeout
+     */
+    MAINMODULE_API virtual bool waitForInput(double timeoutSeconds);
+
+    /**
+     * Records what poll() returns from now on, replacing any earlier recording.
+     *
+     * @return false if the file can't be written
+     */
+    MAINMODULE_API bool startRecording(const char * path)
+    {
+        stopRecording();
+
+        _recording = fopen(path, "wb");
+
+        if (!_recording) {
+            return false;
+        }
+
+        recordHeader_t header = {};
+        header.magic = RECORD_MAGIC;
+        header.version = RECORD_VERSION;
+        header.recordSize = sizeof(record_t);
+        fwrite(&header, sizeof(header), 1, _recording);
+
+        _recordStart = now();
+        _recordedStatus = -1;
+
+        return true;
+    }
+
+    MAINMODULE_API void stopRecording(void)
+    {
+        if (_recording) {
+            fclose(_recording);
+            _recording = NULL;
+        }
+    }
+
+    // Monotonic time in seconds, for measuring input latency
+    MAINMODULE_API static double now(void);
 };
@@ -12,27 +12,30 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <fcntl.h>
 #include <linux/joystick.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
+#include <time.h>
 #include <stdio.h>
 
-#ifndef debug
-#define debug printf
-#endif
-
-static char _productName[128];
-
-Joystick::Joystick(const char * devname) 
+Joystick::Joystick(const char * devname)
+    : _sequence(0), _status(ERROR_MISSING), _polled(0), _waiters(0)
 {
-    _joystickId = open(devname, O_RDONLY);
+    // Initalize aux switches
+    _axes[AX_AU1] = -1;
+    _axes[AX_AU2] = -1;
+    memcpy(_slotAxes, _axes, sizeof(_axes));
 
-    if (_joystickId <= 0) return;
+    if (!devname) return;
 
-    fcntl(_joystickId, F_SETFL, O_NONBLOCK);
+    _joystickId = open(devname, O_RDONLY | O_NONBLOCK);
 
-    *_productName = 0;
+    if (_joystickId <= 0) return;
 
     if (ioctl(_joystickId, JSIOCGNAME(sizeof(_productName)), _productName) < 0) {
         return;
@@ -67,6 +70,77 @@ Joystick::Joystick(const char * devname)
         _productId = PRODUCT_XBOX360;
         _isGameController = true;
     }
+
+    // ------------------------------- 0       1       2       3       4       5       6       7 -----
+    static const uint8_t F310_MAP[8]      = {AX_YAW, AX_THR, AX_ROL, AX_PIT, AX_NIL, AX_NIL, AX_NIL, AX_NIL};
+    static const uint8_t SPEKTRUM_MAP[8]  = {AX_YAW, AX_THR, AX_ROL, AX_PIT, AX_AU2, AX_NIL, AX_AU1, AX_NIL};
+    static const uint8_t XBOX360_MAP[8]   = {AX_YAW, AX_THR, AX_NIL, AX_ROL, AX_PIT, AX_NIL, AX_NIL, AX_NIL};
+    static const uint8_t INTERLINK_MAP[8] = {AX_ROL, AX_PIT, AX_THR, AX_NIL, AX_YAW, AX_AU1, AX_NIL, AX_NIL};
+
+    switch (_productId) {
+
+        case PRODUCT_F310:
+            _axisMap = F310_MAP;
+            break;
+
+        case PRODUCT_SPEKTRUM:
+            _axisMap = SPEKTRUM_MAP;
+            break;
+
+        case PRODUCT_XBOX360:
+            _axisMap = XBOX360_MAP;
+            break;
+
+        case PRODUCT_INTERLINK:
+            _axisMap = INTERLINK_MAP;
+            break;
+
+        default:
+            printf("JOYSTICK '%s' NOT RECOGNIZED\n", _productName);
+            _status = ERROR_PRODUCT;
+            return;
+    }
+
+    // Wait on the device, and on an eventfd that tells the thread to stop
+    _epollFd = epoll_create1(EPOLL_CLOEXEC);
+    _wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = _joystickId;
+    epoll_ctl(_epollFd, EPOLL_CTL_ADD, _joystickId, &ev);
+    ev.data.fd = _wakeFd;
+    epoll_ctl(_epollFd, EPOLL_CTL_ADD, _wakeFd, &ev);
+
+    memcpy(_adjusted, _axes, sizeof(_axes));
+
+    _status = ERROR_NOERROR;
+
+    _thread = std::thread(&Joystick::run, this);
+}
+
+Joystick::~Joystick(void)
+{
+    stopRecording();
+
+    if (_thread.joinable()) {
+        uint64_t one = 1;
+        if (write(_wakeFd, &one, sizeof(one)) != sizeof(one)) {
+            printf("JOYSTICK THREAD NOT SIGNALLED\n");
+        }
+        _thread.join();
+    }
+
+    if (_epollFd >= 0) close(_epollFd);
+    if (_wakeFd >= 0) close(_wakeFd);
+    if (_joystickId > 0) close(_joystickId);
+}
+
+double Joystick::now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
 }
 
 // Convert InterLink aux switches to unique gamepad buttons
@@ -89,77 +163,152 @@ static void getAuxInterlink(float * axes, uint8_t number, uint8_t value, uint8_t
     }
 }
 
-Joystick::error_t Joystick::pollProduct(float axes[6], uint8_t & buttons)
+void Joystick::handleEvent(uint8_t type, uint8_t number, int16_t value, bool init)
 {
-    // ------------------------------- 0       1       2       3       4       5       6       7 -----
-    static uint8_t F310_MAP[8]      = {AX_YAW, AX_THR, AX_ROL, AX_PIT, AX_NIL, AX_NIL, AX_NIL, AX_NIL};
-    static uint8_t SPEKTRUM_MAP[8]  = {AX_YAW, AX_THR, AX_ROL, AX_PIT, AX_AU2, AX_NIL, AX_AU1, AX_NIL};
-    static uint8_t XBOX360_MAP[8]   = {AX_YAW, AX_THR, AX_NIL, AX_ROL, AX_PIT, AX_NIL, AX_NIL, AX_NIL};
-    static uint8_t INTERLINK_MAP[8] = {AX_ROL, AX_PIT, AX_THR, AX_NIL, AX_YAW, AX_AU1, AX_NIL, AX_NIL};
+    switch (type) {
 
-    if (_joystickId <= 0) return ERROR_PRODUCT;
+        case JS_EVENT_AXIS:
+            if (number < 8 && _axisMap[number] != AX_NIL) {
+                _axes[_axisMap[number]] = value / 32768.f;
+            }
+            break;
 
-    struct js_event js;
+        case JS_EVENT_BUTTON:
 
-    read(_joystickId, &js, sizeof(struct js_event));
+            // Initial button states shouldn't toggle the aux switches
+            if (init) {
+                return;
+            }
 
-    if (js.type & JS_EVENT_INIT) return ERROR_NOERROR;
+            if (_productId == PRODUCT_INTERLINK)  {
+                getAuxInterlink(_axes, number, (uint8_t)value, AX_AU1, AX_AU2, AUX1_MID);
+            }
+            else if (number < 8) {
+                _buttons = value ? (_buttons | (1 << number)) : (_buttons & ~(1 << number));
+            }
+            break;
 
-    uint8_t * axisMap = NULL;
+        default:
+            return;
+    }
 
-    switch (_productId) {
+    // Adjust after every event, so a press and release read together still toggles the switches
+    memcpy(_adjusted, _axes, sizeof(_axes));
+    adjustAxes(_adjusted, _buttons);
+}
 
-        case PRODUCT_F310:
-            axisMap = F310_MAP;
-            break;
+void Joystick::publish(double time)
+{
+    const uint32_t sequence = _sequence.load(std::memory_order_relaxed);
 
-        case PRODUCT_SPEKTRUM:
-            axisMap = SPEKTRUM_MAP;
-            break;
+    _sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
 
-        case PRODUCT_XBOX360:
-            axisMap = XBOX360_MAP;
-            break;
+    memcpy(_slotAxes, _adjusted, sizeof(_slotAxes));
+    _slotTime = time;
 
-        case PRODUCT_INTERLINK:
-            axisMap = INTERLINK_MAP;
-            break;
+    _sequence.store(sequence + 2, std::memory_order_seq_cst);
 
-        default:
-            debug("JOYSTICK '%s' NOT RECOGNIZED\n", _productName);
-            return ERROR_PRODUCT;
+    // Only take the lock when someone is waiting
+    if (_waiters.load(std::memory_order_seq_cst)) {
+        std::lock_guard<std::mutex> lock(_waitMutex);
+        _waitCondition.notify_all();
     }
+}
 
-    static float _axes[6];
+void Joystick::run(void)
+{
+    while (true) {
 
-    // Initalize aux switches
-    if (!_axes[AX_AU1]) {
-        _axes[AX_AU1] = -1;
-        _axes[AX_AU2] = -1;
-    }
+        struct epoll_event events[2];
 
-    switch (js.type) {
+        int n = epoll_wait(_epollFd, events, 2, -1);
 
-        case JS_EVENT_AXIS: 
-            _axes[axisMap[js.number]] = js.value / 32768.f;
+        if (n < 0) {
+            if (errno == EINTR) continue;
             break;
+        }
 
-        case JS_EVENT_BUTTON:
-            if (_productId == PRODUCT_INTERLINK)  {
-                getAuxInterlink(_axes, js.number, js.value, AX_AU1, AX_AU2, AUX1_MID);
+        for (int k=0; k<n; ++k) {
+
+            if (events[k].data.fd == _wakeFd) {
+                return;
             }
-            else {
-                buttons = js.value ? 1 << js.number : 0; // for Windows compatibility
+        }
+
+        // Read everything pending, timestamping each read
+        double time = -1;
+        struct js_event js[32];
+
+        while (true) {
+
+            ssize_t bytes = read(_joystickId, js, sizeof(js));
+
+            if (bytes < 0 && errno == EINTR) continue;
+
+            if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+
+            // Unplugged (ENODEV) or closed
+            if (bytes <= 0) {
+                _status = ERROR_MISSING;
+                publish(time >= 0 ? time : now());
+                return;
             }
-            break;
+
+            time = now();
+
+            for (size_t j=0; j<(size_t)bytes/sizeof(struct js_event); ++j) {
+                handleEvent(js[j].type & ~JS_EVENT_INIT, js[j].number, js[j].value, js[j].type & JS_EVENT_INIT);
+            }
+        }
+
+        if (time >= 0) {
+            publish(time);
+        }
     }
+}
+
+Joystick::error_t Joystick::pollDevice(float axes[6], double & eventTime)
+{
+    while (true) {
+
+        const uint32_t sequence = _sequence.load(std::memory_order_acquire);
 
-    for (uint8_t k=0; k<6; ++k) {
-        axes[k] = _axes[k];
+        if (sequence & 1) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        float copy[6];
+        memcpy(copy, _slotAxes, sizeof(copy));
+        double time = _slotTime;
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        if (_sequence.load(std::memory_order_relaxed) == sequence) {
+            memcpy(axes, copy, sizeof(copy));
+            eventTime = time;
+            _polled.store(sequence, std::memory_order_relaxed);
+            break;
+        }
     }
 
-    return ERROR_NOERROR;
-}  
+    return (error_t)_status.load();
+}
 
+bool Joystick::waitForInput(double timeoutSeconds)
+{
+    std::unique_lock<std::mutex> lock(_waitMutex);
+
+    _waiters.fetch_add(1, std::memory_order_seq_cst);
+
+    bool ready = _waitCondition.wait_for(lock, std::chrono::duration<double>(timeoutSeconds), [this] {
+            return _sequence.load(std::memory_order_seq_cst) != _polled.load(std::memory_order_relaxed) ||
+                   _status.load() != ERROR_NOERROR; });
+
+    _waiters.fetch_sub(1, std::memory_order_relaxed);
+
+    return ready;
+}
 
 #endif
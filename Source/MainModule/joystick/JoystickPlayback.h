@@ -0,0 +1,170 @@
+/*
+ * Plays back a joystick recording through the Joystick interface
+ *
+ * In real time, the recorded inputs appear at the times they were recorded,
+ * measured from construction or rewind().  Otherwise time stands still
+ * until advance() moves it on, or waitForInput() jumps straight to the next
+ * input, so a session can be replayed as fast as the simulation runs.
+ * poll() returns exactly the axes and status that were recorded.
+ *
+ * Copyright (C) 2019 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include "Joystick.h"
+
+#include <vector>
+#include <chrono>
+#include <thread>
+
+class JoystickPlayback : public Joystick {
+
+private:
+
+    std::vector<record_t> _records;
+
+    bool _realTime = true;
+
+    // Start of playback on the now() clock, in real time
+    double _start = 0;
+
+    // Playback time, when not in real time
+    double _time = 0;
+
+    // Records already played
+    size_t _played = 0;
+
+    double getTime(void)
+    {
+        return _realTime ? now() - _start : _time;
+    }
+
+    void catchUp(double time)
+    {
+        while (_played < _records.size() && _records[_played].time <= time) {
+            _played++;
+        }
+    }
+
+protected:
+
+    virtual error_t pollDevice(float axes[6], double & eventTime) override
+    {
+        catchUp(getTime());
+
+        // Nothing recorded yet: aux switches off, as from a device
+        if (_played == 0) {
+            memset(axes, 0, 6 * sizeof(float));
+            axes[AX_AU1] = -1;
+            axes[AX_AU2] = -1;
+            eventTime = -1;
+            return _records.empty() ? ERROR_MISSING : ERROR_NOERROR;
+        }
+
+        const record_t & record = _records[_played-1];
+
+        memcpy(axes, record.axes, sizeof(record.axes));
+
+        eventTime = _realTime ? _start + record.time : record.time;
+
+        return (error_t)record.status;
+    }
+
+public:
+
+    /**
+     * @param path file written by Joystick::startRecording()
+     * @param realTime false to advance only with advance() and waitForInput()
+     */
+    JoystickPlayback(const char * path, bool realTime = true)
+        : Joystick(NULL), _realTime(realTime)
+    {
+        FILE * fp = fopen(path, "rb");
+
+        if (!fp) {
+            return;
+        }
+
+        recordHeader_t header = {};
+
+        if (fread(&header, sizeof(header), 1, fp) == 1 && header.magic == RECORD_MAGIC &&
+                header.version == RECORD_VERSION && header.recordSize == sizeof(record_t)) {
+
+            record_t record = {};
+            while (fread(&record, sizeof(record), 1, fp) == 1) {
+                _records.push_back(record);
+            }
+        }
+
+        fclose(fp);
+
+        rewind();
+    }
+
+    // Returns to the start of the recording
+    void rewind(void)
+    {
+        _start = now();
+        _time = 0;
+        _played = 0;
+    }
+
+    // Moves playback time on, when not in real time
+    void advance(double seconds)
+    {
+        _time += seconds;
+    }
+
+    // Playback time in seconds from the start of the recording
+    double getPlaybackTime(void)
+    {
+        return getTime();
+    }
+
+    // Length of the recording in seconds
+    double getDuration(void)
+    {
+        return _records.empty() ? 0 : _records.back().time;
+    }
+
+    bool isFinished(void)
+    {
+        return _played == _records.size();
+    }
+
+    /**
+     * In real time, sleeps until the next recorded input; otherwise jumps to it.
+     *
+     * @return false on timeout, or when the recording has finished
+     */
+    virtual bool waitForInput(double timeoutSeconds) override
+    {
+        const double time = getTime();
+
+        catchUp(time);
+
+        if (isFinished()) {
+            return false;
+        }
+
+        const double next = _records[_played].time;
+
+        if (!_realTime) {
+            _time = next;
+            return true;
+        }
+
+        if (next - time > timeoutSeconds) {
+            std::this_thread::sleep_for(std::chrono::duration<double>(timeoutSeconds));
+            return false;
+        }
+
+        std::this_thread::sleep_for(std::chrono::duration<double>(next - time));
+
+        return true;
+    }
+
+}; // class JoystickPlayback
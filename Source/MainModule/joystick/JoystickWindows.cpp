@@ -16,6 +16,7 @@
 #undef TEXT
 #include <shlwapi.h>
 #include "joystickapi.h"
+#include <windows.h>
 
 static void getAxes4(float axes[6], DWORD axis0, DWORD axis1, DWORD axis2, DWORD axis3)
 {
@@ -50,6 +51,8 @@ Joystick::Joystick(const char * devname)
 
     _isGameController = false;
 
+    if (!devname) return;
+
     // Grab the first available joystick
     for (_joystickId=0; _joystickId<16; _joystickId++)
         if (joyGetDevCaps(_joystickId, &joycaps, sizeof(joycaps)) == JOYERR_NOERROR)
@@ -63,6 +66,19 @@ Joystick::Joystick(const char * devname)
     }
 }
 
+Joystick::~Joystick(void)
+{
+    stopRecording();
+}
+
+double Joystick::now(void)
+{
+    LARGE_INTEGER counter, frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return counter.QuadPart / (double)frequency.QuadPart;
+}
+
 // Convert InterLink aux switches to unique gamepad buttons
 static void getAuxInterlink(float * axes, uint8_t buttons, uint8_t aux1, uint8_t aux2, float auxMid)
 {
@@ -146,4 +162,28 @@ Joystick::error_t Joystick::pollProduct(float axes[6], uint8_t & buttons)
 	return Joystick::ERROR_NOERROR;
 }
 
+Joystick::error_t Joystick::pollDevice(float axes[6], double & eventTime)
+{
+    uint8_t buttons = 0;
+
+    error_t status = pollProduct(axes, buttons);
+
+    if (status != ERROR_NOERROR) {
+        return status;
+    }
+
+    adjustAxes(axes, buttons);
+
+    eventTime = now();
+
+    return ERROR_NOERROR;
+}
+
+bool Joystick::waitForInput(double timeoutSeconds)
+{
+    Sleep(timeoutSeconds < 0.001 ? 0 : 1);
+
+    return true;
+}
+
 #endif
@@ -0,0 +1,579 @@
+/*
+ * Bounding-volume hierarchy over a SceneMesh for fast ray casting
+ *
+ * Built top-down with the surface-area heuristic evaluated over a fixed
+ * number of bins per axis.  Nodes are 32 bytes in one flat array, and
+ * triangles are stored in leaf order as a vertex and two edges, ready for the
+ * Moller-Trumbore test.
+ *
+ * Rays can be traced one at a time or as packets of four.  A packet goes down
+ * the tree together, testing each box and triangle against all four rays at
+ * once with SSE (or a plain loop elsewhere), which pays off for coherent rays
+ * such as neighboring lidar beams.
+ *
+ * Copyright (C) 2019 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include "SceneMesh.hpp"
+
+#include <math.h>
+#include <float.h>
+
+#include <vector>
+#include <algorithm>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define BVH_SSE
+#include <xmmintrin.h>
+#endif
+
+class Bvh {
+
+    public:
+
+        typedef struct {
+
+            float lower[3];
+            uint32_t leftOrFirst;   // first child for inner nodes, first triangle for leaves
+            float upper[3];
+            uint16_t count;         // triangles in a leaf; zero for inner nodes
+            uint16_t axis;          // split axis of an inner node
+
+        } node_t;
+
+    private:
+
+        static const uint8_t  BINS      = 16;
+        static const uint16_t MAX_LEAF  = 8;
+        // Deepest a leaf can be, which bounds the traversal stacks; halving reaches leaves of MAX_LEAF
+        // from 2^32 triangles in 29 levels, so the build always keeps to it
+        static const uint8_t  MAX_DEPTH = 64;
+
+        typedef struct {
+
+            float v0[3];
+            float e1[3];
+            float e2[3];
+
+        } triangle_t;
+
+        typedef struct {
+
+            float lower[3];
+            float upper[3];
+
+        } box_t;
+
+        std::vector<node_t> _nodes;
+        std::vector<triangle_t> _triangles;
+        uint8_t _depth = 0;
+
+        // Four-wide floats
+#ifdef BVH_SSE
+        typedef __m128 f4;
+        static f4 f4set(float a) { return _mm_set1_ps(a); }
+        static f4 f4load(const float * p) { return _mm_loadu_ps(p); }
+        static void f4store(float * p, f4 a) { _mm_storeu_ps(p, a); }
+        static f4 f4add(f4 a, f4 b) { return _mm_add_ps(a, b); }
+        static f4 f4sub(f4 a, f4 b) { return _mm_sub_ps(a, b); }
+        static f4 f4mul(f4 a, f4 b) { return _mm_mul_ps(a, b); }
+        static f4 f4div(f4 a, f4 b) { return _mm_div_ps(a, b); }
+        static f4 f4min(f4 a, f4 b) { return _mm_min_ps(a, b); }
+        static f4 f4max(f4 a, f4 b) { return _mm_max_ps(a, b); }
+        static f4 f4and(f4 a, f4 b) { return _mm_and_ps(a, b); }
+        static f4 f4le(f4 a, f4 b) { return _mm_cmple_ps(a, b); }
+        static f4 f4lt(f4 a, f4 b) { return _mm_cmplt_ps(a, b); }
+        static f4 f4gt(f4 a, f4 b) { return _mm_cmpgt_ps(a, b); }
+        static f4 f4select(f4 mask, f4 a, f4 b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+        static int f4mask(f4 a) { return _mm_movemask_ps(a); }
+#else
+        typedef struct { float v[4]; } f4;
+        static f4 f4set(float a) { f4 r; for (int k=0; k<4; ++k) r.v[k] = a; return r; }
+        static f4 f4load(const float * p) { f4 r; for (int k=0; k<4; ++k) r.v[k] = p[k]; return r; }
+        static void f4store(float * p, f4 a) { for (int k=0; k<4; ++k) p[k] = a.v[k]; }
+        static f4 f4add(f4 a, f4 b) { for (int k=0; k<4; ++k) a.v[k] += b.v[k]; return a; }
+        static f4 f4sub(f4 a, f4 b) { for (int k=0; k<4; ++k) a.v[k] -= b.v[k]; return a; }
+        static f4 f4mul(f4 a, f4 b) { for (int k=0; k<4; ++k) a.v[k] *= b.v[k]; return a; }
+        static f4 f4div(f4 a, f4 b) { for (int k=0; k<4; ++k) a.v[k] /= b.v[k]; return a; }
+        static f4 f4min(f4 a, f4 b) { for (int k=0; k<4; ++k) a.v[k] = a.v[k] < b.v[k] ? a.v[k] : b.v[k]; return a; }
+        static f4 f4max(f4 a, f4 b) { for (int k=0; k<4; ++k) a.v[k] = a.v[k] > b.v[k] ? a.v[k] : b.v[k]; return a; }
+        static f4 f4and(f4 a, f4 b) { for (int k=0; k<4; ++k) a.v[k] = (a.v[k] != 0 && b.v[k] != 0) ? 1.f : 0.f; return a; }
+        static f4 f4le(f4 a, f4 b) { for (int k=0; k<4; ++k) a.v[k] = a.v[k] <= b.v[k] ? 1.f : 0.f; return a; }
+        static f4 f4lt(f4 a, f4 b) { for (int k=0; k<4; ++k) a.v[k] = a.v[k] < b.v[k] ? 1.f : 0.f; return a; }
+        static f4 f4gt(f4 a, f4 b) { for (int k=0; k<4; ++k) a.v[k] = a.v[k] > b.v[k] ? 1.f : 0.f; return a; }
+        static f4 f4select(f4 mask, f4 a, f4 b) { for (int k=0; k<4; ++k) a.v[k] = mask.v[k] != 0 ? a.v[k] : b.v[k]; return a; }
+        static int f4mask(f4 a) { int m = 0; for (int k=0; k<4; ++k) m |= (a.v[k] != 0) << k; return m; }
+#endif
+
+        // Plain comparisons: fminf/fmaxf handle NaNs and are far slower in the traversal loop
+        static float minf(float a, float b) { return a < b ? a : b; }
+        static float maxf(float a, float b) { return a > b ? a : b; }
+
+        // Reciprocal that stays finite, so axis-parallel rays don't produce NaNs in the slab test
+        static float safeInverse(float d)
+        {
+            return fabsf(d) > 1e-20f ? 1 / d : (d < 0 ? -1e20f : 1e20f);
+        }
+
+        static float area(const box_t & b)
+        {
+            float dx = b.upper[0] - b.lower[0];
+            float dy = b.upper[1] - b.lower[1];
+            float dz = b.upper[2] - b.lower[2];
+            return dx < 0 ? 0 : 2 * (dx*dy + dy*dz + dz*dx);
+        }
+
+        static void emptyBox(box_t & b)
+        {
+            for (uint8_t k=0; k<3; ++k) {
+                b.lower[k] = FLT_MAX;
+                b.upper[k] = -FLT_MAX;
+            }
+        }
+
+        static void growBox(box_t & b, const box_t & other)
+        {
+            for (uint8_t k=0; k<3; ++k) {
+                b.lower[k] = minf(b.lower[k], other.lower[k]);
+                b.upper[k] = maxf(b.upper[k], other.upper[k]);
+            }
+        }
+
+        // Finds the cheapest binned split, returning false if splitting doesn't beat a leaf
+        bool findSplit(const std::vector<box_t> & bounds, const std::vector<float> & centroids, const std::vector<uint32_t> & order,
+                uint32_t first, uint32_t count, float leafCost, uint8_t & bestAxis, float & bestPlane) const
+        {
+            float bestCost = FLT_MAX;
+
+            for (uint8_t axis=0; axis<3; ++axis) {
+
+                float lo = FLT_MAX;
+                float hi = -FLT_MAX;
+                for (uint32_t k=first; k<first+count; ++k) {
+                    float c = centroids[3*order[k] + axis];
+                    lo = minf(lo, c);
+                    hi = maxf(hi, c);
+                }
+
+                if (hi - lo < 1e-9f) continue;
+
+                box_t binBounds[BINS];
+                uint32_t binCounts[BINS] = {};
+                for (uint8_t b=0; b<BINS; ++b) {
+                    emptyBox(binBounds[b]);
+                }
+
+                float scale = BINS / (hi - lo);
+
+                for (uint32_t k=first; k<first+count; ++k) {
+                    uint32_t t = order[k];
+                    uint32_t b = (uint32_t)((centroids[3*t + axis] - lo) * scale);
+                    if (b >= BINS) b = BINS - 1;
+                    binCounts[b]++;
+                    growBox(binBounds[b], bounds[t]);
+                }
+
+                // Sweep from both ends to get the area and count on each side of each plane
+                float leftArea[BINS-1];
+                uint32_t leftCount[BINS-1];
+                box_t box;
+                emptyBox(box);
+                uint32_t sum = 0;
+                for (uint8_t b=0; b<BINS-1; ++b) {
+                    sum += binCounts[b];
+                    growBox(box, binBounds[b]);
+                    leftCount[b] = sum;
+                    leftArea[b] = area(box);
+                }
+
+                emptyBox(box);
+                sum = 0;
+                for (uint8_t b=BINS-1; b>0; --b) {
+                    sum += binCounts[b];
+                    growBox(box, binBounds[b]);
+                    float cost = leftCount[b-1] * leftArea[b-1] + sum * area(box);
+                    if (leftCount[b-1] > 0 && sum > 0 && cost < bestCost) {
+                        bestCost = cost;
+                        bestAxis = axis;
+                        bestPlane = lo + b / scale;
+                    }
+                }
+            }
+
+            return bestCost < leafCost;
+        }
+
+    public:
+
+        /**
+         * Builds the hierarchy.  The mesh is not needed afterward.
+         */
+        void build(const SceneMesh & mesh)
+        {
+            uint32_t n = mesh.triangleCount();
+
+            _nodes.clear();
+            _triangles.clear();
+            _depth = 0;
+
+            if (n == 0) return;
+
+            std::vector<box_t> bounds(n);
+            std::vector<float> centroids(3*n);
+            std::vector<uint32_t> order(n);
+
+            for (uint32_t t=0; t<n; ++t) {
+                emptyBox(bounds[t]);
+                for (uint8_t j=0; j<3; ++j) {
+                    const float * v = &mesh.vertices[3*mesh.indices[3*t+j]];
+                    for (uint8_t k=0; k<3; ++k) {
+                        bounds[t].lower[k] = minf(bounds[t].lower[k], v[k]);
+                        bounds[t].upper[k] = maxf(bounds[t].upper[k], v[k]);
+                    }
+                }
+                for (uint8_t k=0; k<3; ++k) {
+                    centroids[3*t+k] = (bounds[t].lower[k] + bounds[t].upper[k]) / 2;
+                }
+                order[t] = t;
+            }
+
+            _nodes.reserve(2*n);
+
+            node_t root = {};
+            root.leftOrFirst = 0;
+            root.count = 0;
+            _nodes.push_back(root);
+
+            // Nodes waiting to be split, with their triangle ranges
+            std::vector<uint32_t> pending;
+            std::vector<uint32_t> ranges;
+            std::vector<uint8_t> depths;
+            pending.push_back(0);
+            ranges.push_back(0);
+            ranges.push_back(n);
+            depths.push_back(0);
+
+            while (!pending.empty()) {
+
+                uint32_t index = pending.back();
+                pending.pop_back();
+                uint8_t depth = depths.back();
+                depths.pop_back();
+                uint32_t count = ranges.back();
+                ranges.pop_back();
+                uint32_t first = ranges.back();
+                ranges.pop_back();
+
+                box_t box;
+                emptyBox(box);
+                for (uint32_t k=first; k<first+count; ++k) {
+                    growBox(box, bounds[order[k]]);
+                }
+
+                node_t & node = _nodes[index];
+                for (uint8_t k=0; k<3; ++k) {
+                    node.lower[k] = box.lower[k];
+                    node.upper[k] = box.upper[k];
+                }
+
+                if (depth > _depth) _depth = depth;
+
+                // Uneven splits can go arbitrarily deep, so once only halving would reach leaves of
+                // MAX_LEAF by MAX_DEPTH, halve
+                uint8_t halvings = 0;
+                while (((count - 1) >> halvings) >= MAX_LEAF) halvings++;
+                bool deep = depth + halvings >= MAX_DEPTH;
+
+                uint8_t axis = 0;
+                float plane = 0;
+                bool split = !deep && count > 1 &&
+                    findSplit(bounds, centroids, order, first, count, count * area(box), axis, plane);
+
+                uint32_t middle = first;
+
+                if (split) {
+                    middle = (uint32_t)(std::partition(order.begin() + first, order.begin() + first + count,
+                                [&](uint32_t t) { return centroids[3*t + axis] < plane; }) - order.begin());
+                }
+
+                // Too many triangles to stop here, even if no plane helps or the plane leaves a side empty:
+                // split them down the middle
+                if ((middle == first || middle == first + count) && count > MAX_LEAF) {
+                    axis = 0;
+                    for (uint8_t k=1; k<3; ++k) {
+                        if (box.upper[k] - box.lower[k] > box.upper[axis] - box.lower[axis]) axis = k;
+                    }
+                    middle = first + count / 2;
+                    std::nth_element(order.begin() + first, order.begin() + middle, order.begin() + first + count,
+                            [&](uint32_t a, uint32_t b) { return centroids[3*a + axis] < centroids[3*b + axis]; });
+                }
+
+                if (middle == first || middle == first + count) {
+                    node.leftOrFirst = first;
+                    node.count = (uint16_t)count;
+                    continue;
+                }
+
+                uint32_t left = (uint32_t)_nodes.size();
+                node.leftOrFirst = left;
+                node.count = 0;
+                node.axis = axis;
+
+                node_t child = {};
+                _nodes.push_back(child);
+                _nodes.push_back(child);
+
+                pending.push_back(left);
+                ranges.push_back(first);
+                ranges.push_back(middle - first);
+                depths.push_back(depth + 1);
+
+                pending.push_back(left + 1);
+                ranges.push_back(middle);
+                ranges.push_back(first + count - middle);
+                depths.push_back(depth + 1);
+            }
+
+            // Store triangles in leaf order
+            _triangles.resize(n);
+            for (uint32_t k=0; k<n; ++k) {
+                const uint32_t * t = &mesh.indices[3*order[k]];
+                const float * a = &mesh.vertices[3*t[0]];
+                const float * b = &mesh.vertices[3*t[1]];
+                const float * c = &mesh.vertices[3*t[2]];
+                for (uint8_t j=0; j<3; ++j) {
+                    _triangles[k].v0[j] = a[j];
+                    _triangles[k].e1[j] = b[j] - a[j];
+                    _triangles[k].e2[j] = c[j] - a[j];
+                }
+            }
+        }
+
+        bool isEmpty(void) const
+        {
+            return _nodes.empty();
+        }
+
+        uint32_t nodeCount(void) const
+        {
+            return (uint32_t)_nodes.size();
+        }
+
+        // Levels below the root to the deepest leaf; never more than MAX_DEPTH
+        uint8_t depth(void) const
+        {
+            return _depth;
+        }
+
+        /**
+         * Traces one ray.
+         *
+         * @param origin start of the ray
+         * @param direction direction of the ray; distances are in units of its length
+         * @param tmin nearest distance that counts as a hit
+         * @param tmax farthest distance that counts as a hit
+         * @return distance to the nearest hit, or INFINITY if there is none
+         */
+        float intersect(const float origin[3], const float direction[3], float tmin, float tmax) const
+        {
+            if (_nodes.empty()) return INFINITY;
+
+            float inverse[3] = { safeInverse(direction[0]), safeInverse(direction[1]), safeInverse(direction[2]) };
+
+            float hit = tmax;
+            bool found = false;
+
+            // Each level above leaves at most one node waiting, and inner nodes are above MAX_DEPTH
+            uint32_t stack[MAX_DEPTH + 1];
+            uint8_t top = 0;
+            stack[top++] = 0;
+
+            while (top > 0) {
+
+                const node_t & node = _nodes[stack[--top]];
+
+                float t0 = tmin;
+                float t1 = hit;
+                for (uint8_t k=0; k<3; ++k) {
+                    float a = (node.lower[k] - origin[k]) * inverse[k];
+                    float b = (node.upper[k] - origin[k]) * inverse[k];
+                    t0 = maxf(t0, minf(a, b));
+                    t1 = minf(t1, maxf(a, b));
+                }
+                if (t0 > t1) continue;
+
+                if (node.count > 0) {
+
+                    for (uint32_t k=node.leftOrFirst; k<node.leftOrFirst+node.count; ++k) {
+
+                        const triangle_t & tri = _triangles[k];
+
+                        float p[3] = {
+                            direction[1]*tri.e2[2] - direction[2]*tri.e2[1],
+                            direction[2]*tri.e2[0] - direction[0]*tri.e2[2],
+                            direction[0]*tri.e2[1] - direction[1]*tri.e2[0] };
+
+                        float det = tri.e1[0]*p[0] + tri.e1[1]*p[1] + tri.e1[2]*p[2];
+                        if (fabsf(det) < 1e-12f) continue;
+                        float inv = 1 / det;
+
+                        float s[3] = { origin[0]-tri.v0[0], origin[1]-tri.v0[1], origin[2]-tri.v0[2] };
+                        float u = (s[0]*p[0] + s[1]*p[1] + s[2]*p[2]) * inv;
+                        if (u < 0 || u > 1) continue;
+
+                        float q[3] = {
+                            s[1]*tri.e1[2] - s[2]*tri.e1[1],
+                            s[2]*tri.e1[0] - s[0]*tri.e1[2],
+                            s[0]*tri.e1[1] - s[1]*tri.e1[0] };
+
+                        float v = (direction[0]*q[0] + direction[1]*q[1] + direction[2]*q[2]) * inv;
+                        if (v < 0 || u + v > 1) continue;
+
+                        float t = (tri.e2[0]*q[0] + tri.e2[1]*q[1] + tri.e2[2]*q[2]) * inv;
+                        if (t > tmin && t < hit) {
+                            hit = t;
+                            found = true;
+                        }
+                    }
+                }
+
+                else {
+
+                    // Visit the near child first
+                    uint32_t left = node.leftOrFirst;
+                    bool leftFirst = direction[node.axis] >= 0;
+                    stack[top++] = leftFirst ? left + 1 : left;
+                    stack[top++] = leftFirst ? left : left + 1;
+                }
+            }
+
+            return found ? hit : INFINITY;
+        }
+
+        /**
+         * Traces four rays together, given as separate x, y and z arrays.
+         *
+         * @param ox,oy,oz origins
+         * @param dx,dy,dz directions
+         * @param tmin nearest distance that counts as a hit
+         * @param t farthest distance for each ray on input; distance to the nearest hit, or INFINITY, on output
+         */
+        void intersect4(const float ox[4], const float oy[4], const float oz[4],
+                const float dx[4], const float dy[4], const float dz[4], float tmin, float t[4]) const
+        {
+            if (_nodes.empty()) {
+                for (uint8_t k=0; k<4; ++k) t[k] = INFINITY;
+                return;
+            }
+
+            float inverse[3][4];
+            for (uint8_t k=0; k<4; ++k) {
+                inverse[0][k] = safeInverse(dx[k]);
+                inverse[1][k] = safeInverse(dy[k]);
+                inverse[2][k] = safeInverse(dz[k]);
+            }
+
+            f4 o[3] = { f4load(ox), f4load(oy), f4load(oz) };
+            f4 d[3] = { f4load(dx), f4load(dy), f4load(dz) };
+            f4 inv[3] = { f4load(inverse[0]), f4load(inverse[1]), f4load(inverse[2]) };
+
+            f4 near = f4set(tmin);
+            f4 hit = f4load(t);
+            f4 tmax = hit;
+            f4 zero = f4set(0);
+            f4 one = f4set(1);
+            f4 eps = f4set(1e-12f);
+
+            // Each level above leaves at most one node waiting, and inner nodes are above MAX_DEPTH
+            uint32_t stack[MAX_DEPTH + 1];
+            uint8_t top = 0;
+            stack[top++] = 0;
+
+            while (top > 0) {
+
+                const node_t & node = _nodes[stack[--top]];
+
+                f4 t0 = near;
+                f4 t1 = hit;
+                for (uint8_t k=0; k<3; ++k) {
+                    f4 a = f4mul(f4sub(f4set(node.lower[k]), o[k]), inv[k]);
+                    f4 b = f4mul(f4sub(f4set(node.upper[k]), o[k]), inv[k]);
+                    t0 = f4max(t0, f4min(a, b));
+                    t1 = f4min(t1, f4max(a, b));
+                }
+
+                // Skip the node if it misses every ray
+                if (f4mask(f4le(t0, t1)) == 0) continue;
+
+                if (node.count > 0) {
+
+                    for (uint32_t k=node.leftOrFirst; k<node.leftOrFirst+node.count; ++k) {
+
+                        const triangle_t & tri = _triangles[k];
+
+                        f4 e1[3] = { f4set(tri.e1[0]), f4set(tri.e1[1]), f4set(tri.e1[2]) };
+                        f4 e2[3] = { f4set(tri.e2[0]), f4set(tri.e2[1]), f4set(tri.e2[2]) };
+
+                        f4 p[3] = {
+                            f4sub(f4mul(d[1], e2[2]), f4mul(d[2], e2[1])),
+                            f4sub(f4mul(d[2], e2[0]), f4mul(d[0], e2[2])),
+                            f4sub(f4mul(d[0], e2[1]), f4mul(d[1], e2[0])) };
+
+                        f4 det = f4add(f4add(f4mul(e1[0], p[0]), f4mul(e1[1], p[1])), f4mul(e1[2], p[2]));
+
+                        f4 absdet = f4max(det, f4sub(zero, det));
+                        f4 valid = f4gt(absdet, eps);
+                        if (f4mask(valid) == 0) continue;
+
+                        f4 invdet = f4div(one, f4select(valid, det, one));
+
+                        f4 s[3] = { f4sub(o[0], f4set(tri.v0[0])), f4sub(o[1], f4set(tri.v0[1])), f4sub(o[2], f4set(tri.v0[2])) };
+
+                        f4 u = f4mul(f4add(f4add(f4mul(s[0], p[0]), f4mul(s[1], p[1])), f4mul(s[2], p[2])), invdet);
+
+                        f4 q[3] = {
+                            f4sub(f4mul(s[1], e1[2]), f4mul(s[2], e1[1])),
+                            f4sub(f4mul(s[2], e1[0]), f4mul(s[0], e1[2])),
+                            f4sub(f4mul(s[0], e1[1]), f4mul(s[1], e1[0])) };
+
+                        f4 v = f4mul(f4add(f4add(f4mul(d[0], q[0]), f4mul(d[1], q[1])), f4mul(d[2], q[2])), invdet);
+
+                        f4 tt = f4mul(f4add(f4add(f4mul(e2[0], q[0]), f4mul(e2[1], q[1])), f4mul(e2[2], q[2])), invdet);
+
+                        valid = f4and(valid, f4le(zero, u));
+                        valid = f4and(valid, f4le(zero, v));
+                        valid = f4and(valid, f4le(f4add(u, v), one));
+                        valid = f4and(valid, f4gt(tt, near));
+                        valid = f4and(valid, f4lt(tt, hit));
+
+                        hit = f4select(valid, tt, hit);
+                    }
+                }
+
+                else {
+
+                    // Rays in a packet head the same way, so the first one picks the order
+                    float first = node.axis == 0 ? dx[0] : node.axis == 1 ? dy[0] : dz[0];
+                    uint32_t left = node.leftOrFirst;
+                    bool leftFirst = first >= 0;
+                    stack[top++] = leftFirst ? left + 1 : left;
+                    stack[top++] = leftFirst ? left : left + 1;
+                }
+            }
+
+            float result[4];
+            float limit[4];
+            f4store(result, hit);
+            f4store(limit, tmax);
+
+            // Rays that hit nothing come back with INFINITY
+            for (uint8_t k=0; k<4; ++k) {
+                t[k] = result[k] < limit[k] ? result[k] : INFINITY;
+            }
+        }
+
+}; // class Bvh
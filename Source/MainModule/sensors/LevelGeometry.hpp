@@ -0,0 +1,71 @@
+/*
+ * Exports the static meshes of a level to a SceneMesh
+ *
+ * Reads the highest-detail LOD of every static mesh actor, transforms it to
+ * world space, and converts it to NED meters relative to an origin (normally
+ * the vehicle's start location), so the level can be ray-cast headlessly or
+ * saved as OBJ.  Packaged builds need Allow CPU Access set on the meshes.
+ *
+ * Copyright (C) 2019 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include "SceneMesh.hpp"
+
+#include "Engine/StaticMeshActor.h"
+#include "Engine/StaticMesh.h"
+#include "EngineUtils.h"
+#include "StaticMeshResources.h"
+
+class LevelGeometry {
+
+    public:
+
+        /**
+         * @param world level to export
+         * @param origin world location in centimeters that becomes (0,0,0)
+         * @param mesh receives the triangles
+         * @return number of meshes exported
+         */
+        static uint32_t exportStaticMeshes(UWorld * world, const FVector & origin, SceneMesh & mesh)
+        {
+            uint32_t count = 0;
+
+            for (TActorIterator<AStaticMeshActor> it(world); it; ++it) {
+
+                UStaticMeshComponent * component = it->GetStaticMeshComponent();
+                if (!component || !component->GetStaticMesh()) continue;
+
+                FStaticMeshRenderData * renderData = component->GetStaticMesh()->RenderData.Get();
+                if (!renderData || renderData->LODResources.Num() == 0) continue;
+
+                const FStaticMeshLODResources & lod = renderData->LODResources[0];
+                const FPositionVertexBuffer & positions = lod.VertexBuffers.PositionVertexBuffer;
+                FIndexArrayView indices = lod.IndexBuffer.GetArrayView();
+
+                if (positions.GetNumVertices() == 0 || indices.Num() == 0) continue;
+
+                const FTransform transform = component->GetComponentTransform();
+
+                uint32_t base = mesh.vertexCount();
+
+                for (uint32_t k=0; k<positions.GetNumVertices(); ++k) {
+                    FVector v = transform.TransformPosition(positions.VertexPosition(k)) - origin;
+                    mesh.addVertex(v.X / 100, v.Y / 100, -v.Z / 100);  // UE cm forward, right, up => NED m
+                }
+
+                // Flipping Z mirrors the mesh, which reverses the winding; the BVH doesn't care
+                for (int32 k=0; k+2<indices.Num(); k+=3) {
+                    mesh.addTriangle(base + indices[k], base + indices[k+1], base + indices[k+2]);
+                }
+
+                count++;
+            }
+
+            return count;
+        }
+
+}; // class LevelGeometry
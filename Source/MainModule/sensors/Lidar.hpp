@@ -0,0 +1,300 @@
+/*
+ * Ray-cast rangefinder and lidar models over a Bvh
+ *
+ * A Lidar is a set of beams fixed to the vehicle body: one for a rangefinder,
+ * a fan for a 2D scanner, or several rings for a 3D scanner.  A scan rotates
+ * the beams by the vehicle pose and traces them in packets of four
+ * neighboring beams.  LidarScanner spreads the packets of a scan over a team
+ * of threads.
+ *
+ * Beams use body coordinates (x forward, y right, z down); ranges are in
+ * meters, or INFINITY where nothing was within range.
+ *
+ * Copyright (C) 2019 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include "Bvh.hpp"
+#include "../dynamics/MultirotorDynamics.hpp"
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+class Lidar {
+
+    private:
+
+        // Unit beam directions, body frame, padded to a multiple of four
+        std::vector<float> _dx, _dy, _dz;
+        uint32_t _beamCount = 0;
+
+        float _minRange = 0;
+        float _maxRange = 0;
+
+        float _mount[3] = {};
+
+        void addBeam(float azimuth, float elevation)
+        {
+            _dx.push_back(cosf(elevation) * cosf(azimuth));
+            _dy.push_back(cosf(elevation) * sinf(azimuth));
+            _dz.push_back(-sinf(elevation));
+            _beamCount++;
+        }
+
+        void pad(void)
+        {
+            while (_dx.size() % 4) {
+                _dx.push_back(_dx.back());
+                _dy.push_back(_dy.back());
+                _dz.push_back(_dz.back());
+            }
+        }
+
+        Lidar(float minRange, float maxRange)
+        {
+            _minRange = minRange;
+            _maxRange = maxRange;
+        }
+
+    public:
+
+        /**
+         * Single beam.
+         *
+         * @param azimuth radians clockwise from forward, seen from above
+         * @param elevation radians up from horizontal; -pi/2 looks straight down
+         */
+        static Lidar rangefinder(float azimuth, float elevation, float minRange, float maxRange)
+        {
+            Lidar lidar(minRange, maxRange);
+            lidar.addBeam(azimuth, elevation);
+            lidar.pad();
+            return lidar;
+        }
+
+        /**
+         * Rings of beams evenly spaced in azimuth; one ring makes a 2D scanner.
+         *
+         * @param beamsPerRing beams in each ring
+         * @param horizontalFov azimuth span in radians, centered on forward; 2*pi for a full circle
+         * @param rings number of rings
+         * @param lowerElevation elevation of the lowest ring, radians
+         * @param upperElevation elevation of the highest ring, radians
+         */
+        static Lidar scanner(uint32_t beamsPerRing, float horizontalFov, uint16_t rings, float lowerElevation, float upperElevation,
+                float minRange, float maxRange)
+        {
+            Lidar lidar(minRange, maxRange);
+
+            // A full circle shouldn't repeat its first beam
+            bool full = horizontalFov >= 6.2831853f;
+            float step = beamsPerRing > 1 ? horizontalFov / (full ? beamsPerRing : beamsPerRing - 1) : 0;
+            float start = beamsPerRing > 1 ? -horizontalFov / 2 : 0;
+
+            for (uint16_t r=0; r<rings; ++r) {
+                float elevation = rings > 1 ? lowerElevation + r * (upperElevation - lowerElevation) / (rings - 1) : lowerElevation;
+                for (uint32_t b=0; b<beamsPerRing; ++b) {
+                    lidar.addBeam(start + b * step, elevation);
+                }
+            }
+
+            lidar.pad();
+
+            return lidar;
+        }
+
+        // Location of the sensor in body coordinates, meters
+        void setMount(float x, float y, float z)
+        {
+            _mount[0] = x;
+            _mount[1] = y;
+            _mount[2] = z;
+        }
+
+        uint32_t beamCount(void) const
+        {
+            return _beamCount;
+        }
+
+        uint32_t packetCount(void) const
+        {
+            return (uint32_t)(_dx.size() / 4);
+        }
+
+        /**
+         * Traces a range of packets.  Safe to call from several threads on different packets.
+         *
+         * @param bvh scene
+         * @param pose vehicle pose in the scene's frame
+         * @param ranges output, at least 4 * packetCount() floats; entry k is beam k
+         * @param firstPacket first packet to trace
+         * @param count number of packets to trace
+         */
+        void scan(const Bvh & bvh, const MultirotorDynamics::pose_t & pose, float * ranges, uint32_t firstPacket, uint32_t count) const
+        {
+            // Body-to-NED rotation
+            double cph = cos(pose.rotation[0]), sph = sin(pose.rotation[0]);
+            double cth = cos(pose.rotation[1]), sth = sin(pose.rotation[1]);
+            double cps = cos(pose.rotation[2]), sps = sin(pose.rotation[2]);
+
+            float R[3][3] = {
+                { (float)(cth*cps), (float)(sph*sth*cps - cph*sps), (float)(cph*sth*cps + sph*sps) },
+                { (float)(cth*sps), (float)(sph*sth*sps + cph*cps), (float)(cph*sth*sps - sph*cps) },
+                { (float)(-sth),    (float)(sph*cth),               (float)(cph*cth) } };
+
+            float origin[3];
+            for (uint8_t k=0; k<3; ++k) {
+                origin[k] = (float)pose.location[k] + R[k][0]*_mount[0] + R[k][1]*_mount[1] + R[k][2]*_mount[2];
+            }
+
+            float ox[4], oy[4], oz[4];
+            for (uint8_t k=0; k<4; ++k) {
+                ox[k] = origin[0];
+                oy[k] = origin[1];
+                oz[k] = origin[2];
+            }
+
+            for (uint32_t p=firstPacket; p<firstPacket+count; ++p) {
+
+                const uint32_t b = 4 * p;
+
+                float dx[4], dy[4], dz[4];
+                for (uint8_t k=0; k<4; ++k) {
+                    dx[k] = R[0][0]*_dx[b+k] + R[0][1]*_dy[b+k] + R[0][2]*_dz[b+k];
+                    dy[k] = R[1][0]*_dx[b+k] + R[1][1]*_dy[b+k] + R[1][2]*_dz[b+k];
+                    dz[k] = R[2][0]*_dx[b+k] + R[2][1]*_dy[b+k] + R[2][2]*_dz[b+k];
+                }
+
+                float * t = ranges + b;
+                for (uint8_t k=0; k<4; ++k) {
+                    t[k] = _maxRange;
+                }
+
+                bvh.intersect4(ox, oy, oz, dx, dy, dz, _minRange, t);
+            }
+        }
+
+        // Traces every beam on the calling thread
+        void scan(const Bvh & bvh, const MultirotorDynamics::pose_t & pose, float * ranges) const
+        {
+            scan(bvh, pose, ranges, 0, packetCount());
+        }
+
+}; // class Lidar
+
+class LidarScanner {
+
+    private:
+
+        // Packets handed out at a time
+        static const uint32_t CHUNK = 16;
+
+        std::vector<std::thread> _threads;
+
+        std::mutex _mutex;
+        std::condition_variable _start;
+        std::condition_variable _done;
+
+        // Current job
+        const Bvh * _bvh = NULL;
+        const Lidar * _lidar = NULL;
+        MultirotorDynamics::pose_t _pose = {};
+        float * _ranges = NULL;
+        std::atomic<uint32_t> _nextPacket;
+
+        uint32_t _generation = 0;
+        uint32_t _busy = 0;
+        bool _quit = false;
+
+        // Takes chunks of packets until there are none left
+        void work(void)
+        {
+            uint32_t packets = _lidar->packetCount();
+
+            while (true) {
+                uint32_t first = _nextPacket.fetch_add(CHUNK);
+                if (first >= packets) break;
+                uint32_t count = packets - first < CHUNK ? packets - first : CHUNK;
+                _lidar->scan(*_bvh, _pose, _ranges, first, count);
+            }
+        }
+
+        void run(void)
+        {
+            uint32_t seen = 0;
+
+            while (true) {
+
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    _start.wait(lock, [&] { return _quit || _generation != seen; });
+                    if (_quit) return;
+                    seen = _generation;
+                }
+
+                work();
+
+                std::unique_lock<std::mutex> lock(_mutex);
+                if (--_busy == 0) {
+                    _done.notify_one();
+                }
+            }
+        }
+
+    public:
+
+        /**
+         * @param threads helper threads; the thread calling scan() works too
+         */
+        LidarScanner(uint8_t threads)
+            : _nextPacket(0)
+        {
+            for (uint8_t k=0; k<threads; ++k) {
+                _threads.push_back(std::thread(&LidarScanner::run, this));
+            }
+        }
+
+        ~LidarScanner(void)
+        {
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _quit = true;
+            }
+            _start.notify_all();
+
+            for (std::thread & thread : _threads) {
+                thread.join();
+            }
+        }
+
+        /**
+         * Traces every beam of a lidar, returning when the scan is complete.  One scan at a time.
+         *
+         * @param ranges output, at least 4 * lidar.packetCount() floats
+         */
+        void scan(const Bvh & bvh, const Lidar & lidar, const MultirotorDynamics::pose_t & pose, float * ranges)
+        {
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _bvh = &bvh;
+                _lidar = &lidar;
+                _pose = pose;
+                _ranges = ranges;
+                _nextPacket = 0;
+                _busy = (uint32_t)_threads.size();
+                _generation++;
+            }
+            _start.notify_all();
+
+            work();
+
+            std::unique_lock<std::mutex> lock(_mutex);
+            _done.wait(lock, [&] { return _busy == 0; });
+        }
+
+}; // class LidarScanner
@@ -0,0 +1,311 @@
+/*
+ * Counter-based random numbers (Philox4x32-10)
+ *
+ * Philox turns a 128-bit counter and a 64-bit key into four random words,
+ * with no state carried between calls.  Using (step, vehicle, channel) as
+ * the counter makes every noise sample a pure function of where it is used,
+ * so results don't depend on which thread ran which vehicle, or in what
+ * order.
+ *
+ * Blocks and normals are produced four lanes at a time with SSE2 (or a plain
+ * loop elsewhere).  Both paths do the same float operations in the same
+ * order, so they give the same numbers.
+ *
+ * Salmon et al., "Parallel Random Numbers: As Easy as 1, 2, 3", SC 2011
+ *
+ * Copyright (C) 2019 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PHILOX_SSE2
+#include <emmintrin.h>
+#endif
+
+class Philox {
+
+    private:
+
+        static const uint32_t M0 = 0xD2511F53;
+        static const uint32_t M1 = 0xCD9E8D57;
+        static const uint32_t W0 = 0x9E3779B9;
+        static const uint32_t W1 = 0xBB67AE85;
+
+        static const uint8_t ROUNDS = 10;
+
+        static constexpr float PI = 3.14159265f;
+        static constexpr float LN2 = 0.69314718f;
+        static constexpr float SQRT2 = 1.41421356f;
+        static constexpr float ULP = 1.f / 16777216;
+
+        // Uniform in (0,1], from the top 24 bits of a word
+        static float uniform(uint32_t word)
+        {
+            return (float)(int32_t)((word >> 8) + 1) * ULP;
+        }
+
+        // Natural log for x in (0,1], good to about 1e-7 relative
+        static float log(float x)
+        {
+            uint32_t bits;
+            memcpy(&bits, &x, 4);
+
+            // x = m * 2^e with m in [sqrt(1/2), sqrt(2))
+            int32_t e = (int32_t)(bits >> 23) - 127;
+            bits = (bits & 0x007FFFFF) | 0x3F800000;
+            float m;
+            memcpy(&m, &bits, 4);
+            bool high = m > SQRT2;
+            m = high ? m * 0.5f : m;
+            float fe = (float)(high ? e + 1 : e);
+
+            // ln(m) = 2 atanh(s), with |s| < 0.172
+            float s = (m - 1) / (m + 1);
+            float s2 = s * s;
+            float p = 1.f/7 + s2 * (1.f/9);
+            p = 1.f/5 + s2 * p;
+            p = 1.f/3 + s2 * p;
+            p = 1 + s2 * p;
+
+            return 2 * s * p + fe * LN2;
+        }
+
+        // Sine and cosine of 2*pi*u for u in [0,1), good to about 1e-6
+        static void sincos2pi(float u, float & s, float & c)
+        {
+            // Angle in [-pi,pi), folded into [-pi/2,pi/2]
+            float x = (u - 0.5f) * (2 * PI);
+            bool high = x > PI/2;
+            bool low = x < -PI/2;
+            x = high ? PI - x : x;
+            x = low ? -PI - x : x;
+
+            float x2 = x * x;
+
+            float ps = -1.f/5040 + x2 * (1.f/362880);
+            ps = 1.f/120 + x2 * ps;
+            ps = -1.f/6 + x2 * ps;
+            ps = 1 + x2 * ps;
+
+            float pc = 1.f/40320 + x2 * (-1.f/3628800);
+            pc = -1.f/720 + x2 * pc;
+            pc = 1.f/24 + x2 * pc;
+            pc = -1.f/2 + x2 * pc;
+            pc = 1 + x2 * pc;
+
+            // Folding flips the cosine, and the angle was shifted by pi
+            s = -(x * ps);
+            c = high || low ? pc : -pc;
+        }
+
+        static void generate1(const uint32_t counter[4], const uint32_t key[2], uint32_t out[4])
+        {
+            uint32_t c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+            uint32_t k0 = key[0], k1 = key[1];
+
+            for (uint8_t r=0; r<ROUNDS; ++r) {
+
+                uint64_t p0 = (uint64_t)M0 * c0;
+                uint64_t p1 = (uint64_t)M1 * c2;
+
+                c0 = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+                c1 = (uint32_t)p1;
+                c2 = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+                c3 = (uint32_t)p0;
+
+                k0 += W0;
+                k1 += W1;
+            }
+
+            out[0] = c0;
+            out[1] = c1;
+            out[2] = c2;
+            out[3] = c3;
+        }
+
+#ifdef PHILOX_SSE2
+
+        // High and low halves of four 32x32-bit products
+        static void mul4(__m128i a, __m128i b, __m128i & hi, __m128i & lo)
+        {
+            __m128i even = _mm_mul_epu32(a, b);
+            __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+
+            // Lanes 0,2 are in even, 1,3 in odd
+            __m128i l = _mm_unpacklo_epi32(even, odd);
+            __m128i h = _mm_unpackhi_epi32(even, odd);
+            lo = _mm_unpacklo_epi64(l, h);
+            hi = _mm_unpackhi_epi64(l, h);
+        }
+
+        static void transpose(__m128i & a, __m128i & b, __m128i & c, __m128i & d)
+        {
+            __m128i ab0 = _mm_unpacklo_epi32(a, b);
+            __m128i ab1 = _mm_unpackhi_epi32(a, b);
+            __m128i cd0 = _mm_unpacklo_epi32(c, d);
+            __m128i cd1 = _mm_unpackhi_epi32(c, d);
+            a = _mm_unpacklo_epi64(ab0, cd0);
+            b = _mm_unpackhi_epi64(ab0, cd0);
+            c = _mm_unpacklo_epi64(ab1, cd1);
+            d = _mm_unpackhi_epi64(ab1, cd1);
+        }
+
+        static void generate4(const uint32_t * counters, const uint32_t key[2], uint32_t * out)
+        {
+            __m128i c0 = _mm_loadu_si128((const __m128i *)counters);
+            __m128i c1 = _mm_loadu_si128((const __m128i *)(counters + 4));
+            __m128i c2 = _mm_loadu_si128((const __m128i *)(counters + 8));
+            __m128i c3 = _mm_loadu_si128((const __m128i *)(counters + 12));
+            transpose(c0, c1, c2, c3);
+
+            const __m128i m0 = _mm_set1_epi32((int32_t)M0);
+            const __m128i m1 = _mm_set1_epi32((int32_t)M1);
+
+            uint32_t k0 = key[0], k1 = key[1];
+
+            for (uint8_t r=0; r<ROUNDS; ++r) {
+
+                __m128i hi0, lo0, hi1, lo1;
+                mul4(c0, m0, hi0, lo0);
+                mul4(c2, m1, hi1, lo1);
+
+                c0 = _mm_xor_si128(_mm_xor_si128(hi1, c1), _mm_set1_epi32((int32_t)k0));
+                c1 = lo1;
+                c2 = _mm_xor_si128(_mm_xor_si128(hi0, c3), _mm_set1_epi32((int32_t)k1));
+                c3 = lo0;
+
+                k0 += W0;
+                k1 += W1;
+            }
+
+            transpose(c0, c1, c2, c3);
+            _mm_storeu_si128((__m128i *)out, c0);
+            _mm_storeu_si128((__m128i *)(out + 4), c1);
+            _mm_storeu_si128((__m128i *)(out + 8), c2);
+            _mm_storeu_si128((__m128i *)(out + 12), c3);
+        }
+
+        static __m128 select(__m128 mask, __m128 a, __m128 b)
+        {
+            return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+        }
+
+        static __m128 uniform4(__m128i words)
+        {
+            __m128i n = _mm_add_epi32(_mm_srli_epi32(words, 8), _mm_set1_epi32(1));
+            return _mm_mul_ps(_mm_cvtepi32_ps(n), _mm_set1_ps(ULP));
+        }
+
+        static __m128 log4(__m128 x)
+        {
+            __m128i bits = _mm_castps_si128(x);
+            __m128i e = _mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(127));
+            __m128 m = _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(bits, _mm_set1_epi32(0x007FFFFF)), _mm_set1_epi32(0x3F800000)));
+
+            __m128 high = _mm_cmpgt_ps(m, _mm_set1_ps(SQRT2));
+            m = select(high, _mm_mul_ps(m, _mm_set1_ps(0.5f)), m);
+            __m128 fe = _mm_cvtepi32_ps(_mm_sub_epi32(e, _mm_castps_si128(high)));  // mask is -1
+
+            const __m128 one = _mm_set1_ps(1);
+            __m128 s = _mm_div_ps(_mm_sub_ps(m, one), _mm_add_ps(m, one));
+            __m128 s2 = _mm_mul_ps(s, s);
+            __m128 p = _mm_add_ps(_mm_set1_ps(1.f/7), _mm_mul_ps(s2, _mm_set1_ps(1.f/9)));
+            p = _mm_add_ps(_mm_set1_ps(1.f/5), _mm_mul_ps(s2, p));
+            p = _mm_add_ps(_mm_set1_ps(1.f/3), _mm_mul_ps(s2, p));
+            p = _mm_add_ps(one, _mm_mul_ps(s2, p));
+
+            return _mm_add_ps(_mm_mul_ps(_mm_mul_ps(_mm_set1_ps(2), s), p), _mm_mul_ps(fe, _mm_set1_ps(LN2)));
+        }
+
+        static void sincos2pi4(__m128 u, __m128 & s, __m128 & c)
+        {
+            __m128 x = _mm_mul_ps(_mm_sub_ps(u, _mm_set1_ps(0.5f)), _mm_set1_ps(2 * PI));
+            __m128 high = _mm_cmpgt_ps(x, _mm_set1_ps(PI/2));
+            __m128 low = _mm_cmplt_ps(x, _mm_set1_ps(-PI/2));
+            x = select(high, _mm_sub_ps(_mm_set1_ps(PI), x), x);
+            x = select(low, _mm_sub_ps(_mm_set1_ps(-PI), x), x);
+
+            __m128 x2 = _mm_mul_ps(x, x);
+
+            __m128 ps = _mm_add_ps(_mm_set1_ps(-1.f/5040), _mm_mul_ps(x2, _mm_set1_ps(1.f/362880)));
+            ps = _mm_add_ps(_mm_set1_ps(1.f/120), _mm_mul_ps(x2, ps));
+            ps = _mm_add_ps(_mm_set1_ps(-1.f/6), _mm_mul_ps(x2, ps));
+            ps = _mm_add_ps(_mm_set1_ps(1), _mm_mul_ps(x2, ps));
+
+            __m128 pc = _mm_add_ps(_mm_set1_ps(1.f/40320), _mm_mul_ps(x2, _mm_set1_ps(-1.f/3628800)));
+            pc = _mm_add_ps(_mm_set1_ps(-1.f/720), _mm_mul_ps(x2, pc));
+            pc = _mm_add_ps(_mm_set1_ps(1.f/24), _mm_mul_ps(x2, pc));
+            pc = _mm_add_ps(_mm_set1_ps(-1.f/2), _mm_mul_ps(x2, pc));
+            pc = _mm_add_ps(_mm_set1_ps(1), _mm_mul_ps(x2, pc));
+
+            const __m128 sign = _mm_set1_ps(-0.f);
+            s = _mm_xor_ps(_mm_mul_ps(x, ps), sign);
+            c = select(_mm_or_ps(high, low), pc, _mm_xor_ps(pc, sign));
+        }
+
+#endif
+
+    public:
+
+        /**
+         * Random words for a run of blocks.
+         *
+         * @param counters four words per block
+         * @param key two words
+         * @param out four words per block
+         * @param blocks number of blocks
+         */
+        static void generate(const uint32_t * counters, const uint32_t key[2], uint32_t * out, uint32_t blocks=1)
+        {
+            uint32_t b = 0;
+
+#ifdef PHILOX_SSE2
+            for (; b+4<=blocks; b+=4) {
+                generate4(&counters[4*b], key, &out[4*b]);
+            }
+#endif
+
+            for (; b<blocks; ++b) {
+                generate1(&counters[4*b], key, &out[4*b]);
+            }
+        }
+
+        /**
+         * Standard normals by Box-Muller, in groups of eight: words 0-3 give radii and 4-7 give angles,
+         * producing the cosine terms in 0-3 and the sine terms in 4-7.
+         *
+         * @param words random words
+         * @param out normals
+         * @param count number of words and normals; a multiple of eight
+         */
+        static void normals(const uint32_t * words, float * out, uint32_t count)
+        {
+            for (uint32_t k=0; k<count; k+=8) {
+
+#ifdef PHILOX_SSE2
+                __m128 r = _mm_sqrt_ps(_mm_mul_ps(_mm_set1_ps(-2), log4(uniform4(_mm_loadu_si128((const __m128i *)&words[k])))));
+                __m128 u = _mm_sub_ps(uniform4(_mm_loadu_si128((const __m128i *)&words[k+4])), _mm_set1_ps(ULP));
+                __m128 s, c;
+                sincos2pi4(u, s, c);
+                _mm_storeu_ps(&out[k], _mm_mul_ps(r, c));
+                _mm_storeu_ps(&out[k+4], _mm_mul_ps(r, s));
+#else
+                for (uint8_t j=0; j<4; ++j) {
+                    float r = sqrtf(-2 * log(uniform(words[k+j])));
+                    float s, c;
+                    sincos2pi(uniform(words[k+4+j]) - ULP, s, c);
+                    out[k+j] = r * c;
+                    out[k+4+j] = r * s;
+                }
+#endif
+            }
+        }
+
+}; // class Philox
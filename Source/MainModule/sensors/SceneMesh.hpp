@@ -0,0 +1,156 @@
+/*
+ * Static scene geometry for ray-cast sensors
+ *
+ * A triangle soup in NED meters, loaded from Wavefront OBJ files (such as
+ * those in Extras/thingiverse) or exported from a level, with no engine
+ * dependencies.
+ *
+ * Copyright (C) 2019 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+class SceneMesh {
+
+    public:
+
+        // x,y,z for each vertex
+        std::vector<float> vertices;
+
+        // Three vertex indices per triangle
+        std::vector<uint32_t> indices;
+
+        uint32_t vertexCount(void) const
+        {
+            return (uint32_t)(vertices.size() / 3);
+        }
+
+        uint32_t triangleCount(void) const
+        {
+            return (uint32_t)(indices.size() / 3);
+        }
+
+        uint32_t addVertex(float x, float y, float z)
+        {
+            vertices.push_back(x);
+            vertices.push_back(y);
+            vertices.push_back(z);
+            return vertexCount() - 1;
+        }
+
+        void addTriangle(uint32_t a, uint32_t b, uint32_t c)
+        {
+            indices.push_back(a);
+            indices.push_back(b);
+            indices.push_back(c);
+        }
+
+        void clear(void)
+        {
+            vertices.clear();
+            indices.clear();
+        }
+
+        /**
+         * Appends the vertices and faces of an OBJ file; everything else in the file is ignored.
+         * Polygons are split into triangle fans.
+         *
+         * @param path file to load
+         * @param scale multiplies every coordinate, e.g. 0.001 for millimeters
+         * @param offset added to every coordinate after scaling, or NULL
+         * @return false if the file could not be read or has a bad face
+         */
+        bool loadObj(const char * path, float scale=1, const float * offset=NULL)
+        {
+            FILE * fp = fopen(path, "r");
+            if (!fp) return false;
+
+            uint32_t base = vertexCount();
+
+            char line[1024];
+            bool ok = true;
+
+            while (ok && fgets(line, sizeof(line), fp)) {
+
+                if (line[0] == 'v' && (line[1] == ' ' || line[1] == '\t')) {
+
+                    float v[3] = {};
+                    if (sscanf(line+2, "%f %f %f", &v[0], &v[1], &v[2]) != 3) {
+                        ok = false;
+                        break;
+                    }
+
+                    for (uint8_t k=0; k<3; ++k) {
+                        v[k] = v[k]*scale + (offset ? offset[k] : 0);
+                    }
+
+                    addVertex(v[0], v[1], v[2]);
+                }
+
+                else if (line[0] == 'f' && (line[1] == ' ' || line[1] == '\t')) {
+
+                    uint32_t first = 0;
+                    uint32_t previous = 0;
+                    uint32_t count = 0;
+
+                    char * p = line + 2;
+
+                    while (true) {
+
+                        char * end = NULL;
+                        long index = strtol(p, &end, 10);
+                        if (end == p) break;
+
+                        // Negative indices count back from the newest vertex
+                        long resolved = index > 0 ? (long)base + index - 1 : (long)vertexCount() + index;
+                        if (index == 0 || resolved < (long)base || resolved >= (long)vertexCount()) {
+                            ok = false;
+                            break;
+                        }
+
+                        uint32_t vertex = (uint32_t)resolved;
+
+                        if (count == 0) first = vertex;
+                        else if (count >= 2) addTriangle(first, previous, vertex);
+
+                        previous = vertex;
+                        count++;
+
+                        // Skip texture and normal indices
+                        p = end;
+                        while (*p && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n') p++;
+                    }
+                }
+            }
+
+            fclose(fp);
+
+            return ok;
+        }
+
+        bool saveObj(const char * path) const
+        {
+            FILE * fp = fopen(path, "w");
+            if (!fp) return false;
+
+            for (uint32_t k=0; k<vertexCount(); ++k) {
+                fprintf(fp, "v %.6g %.6g %.6g\n", vertices[3*k], vertices[3*k+1], vertices[3*k+2]);
+            }
+
+            for (uint32_t k=0; k<triangleCount(); ++k) {
+                fprintf(fp, "f %u %u %u\n", indices[3*k]+1, indices[3*k+1]+1, indices[3*k+2]+1);
+            }
+
+            return fclose(fp) == 0;
+        }
+
+}; // class SceneMesh
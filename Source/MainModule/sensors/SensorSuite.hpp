@@ -0,0 +1,373 @@
+/*
+ * IMU, barometer, and GPS models for a batch of vehicles
+ *
+ * Turns ground-truth states into what a flight controller would read:
+ *
+ *   IMU: gyro and accelerometer at every update, with white noise, a bias
+ *   that starts random and then wanders, and quantization
+ *
+ *   Barometer and GPS: sampled at their own rates and delivered after a
+ *   fixed latency, so the controller sees each reading late and holds it
+ *   until the next one arrives
+ *
+ * Noise comes from Philox, keyed by the seed and counted by (update, vehicle,
+ * channel), so a vehicle sees the same noise whichever thread updates it and
+ * however the vehicles are batched.  Everything is kept as arrays indexed by
+ * vehicle and allocated up front; update() does no allocation, and threads
+ * may update disjoint ranges of vehicles at the same time.
+ *
+ * Copyright (C) 2019 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include "Philox.hpp"
+#include "../dynamics/MultirotorDynamics.hpp"
+
+#include <vector>
+
+class SensorSuite {
+
+    public:
+
+        typedef struct {
+
+            // Noise densities (per root Hz) and bias random walks (per root second)
+            double gyroNoise;           // rad/s/sqrt(Hz)
+            double gyroBiasWalk;        // rad/s/sqrt(s)
+            double gyroBiasInit;        // rad/s, standard deviation at power-up
+            double gyroResolution;      // rad/s, or 0 for none
+
+            double accelNoise;          // m/s^2/sqrt(Hz)
+            double accelBiasWalk;       // m/s^2/sqrt(s)
+            double accelBiasInit;       // m/s^2
+            double accelResolution;     // m/s^2
+
+            double baroRate;            // Hz
+            double baroLatency;         // s
+            double baroNoise;           // m
+            double baroResolution;      // m
+
+            double gpsRate;             // Hz
+            double gpsLatency;          // s
+            double gpsHorizontalNoise;  // m
+            double gpsVerticalNoise;    // m
+            double gpsVelocityNoise;    // m/s
+
+        } params_t;
+
+        typedef struct {
+
+            double gyro[3];             // rad/s, like state_t::angularVel
+            double accel[3];            // m/s^2, like state_t::bodyAccel
+
+            double baroAltitude;        // m above the start location
+            double baroTime;            // when the reading was taken, or -1 before the first one arrives
+
+            double gpsLocation[3];      // NED m
+            double gpsVelocity[3];      // NED m/s
+            double gpsTime;
+
+        } reading_t;
+
+        // Roughly an MPU-6000, an MS5611, and a u-blox M8
+        static params_t defaultParams(void)
+        {
+            params_t params = {
+                0.0003, 0.00004, 0.005, 0.00106,
+                0.004, 0.0006, 0.05, 0.0048,
+                50, 0.02, 0.1, 0.01,
+                10, 0.1, 0.5, 1.0, 0.1 };
+
+            return params;
+        }
+
+    private:
+
+        // Philox channels within an update, two blocks of four words apiece
+        enum {
+            CHANNEL_IMU,
+            CHANNEL_WALK = 2,
+            CHANNEL_BARO = 4,
+            CHANNEL_GPS = 6,
+            CHANNEL_INIT = 8            // power-up biases
+        };
+
+        // Normals per channel
+        static const uint8_t NORMALS = 8;
+
+        // Updates between bias steps; a random walk sampled less often has the same statistics at those samples
+        static const uint8_t WALK_PERIOD = 8;
+
+        // Readings in flight between sampling and delivery, per vehicle
+        static const uint8_t DEPTH = 16;
+
+        typedef struct {
+
+            double taken;
+            double due;
+            float value[6];
+
+        } pending_t;
+
+        typedef struct {
+
+            pending_t ring[DEPTH];
+            uint8_t head;
+            uint8_t count;
+            double next;                // time of the next sample
+            pending_t delivered;
+
+        } delay_t;
+
+        params_t _params = {};
+
+        uint32_t _capacity = 0;
+
+        uint32_t _key[2] = {};
+
+        std::vector<uint64_t> _step;
+        std::vector<double> _lastTime;
+
+        std::vector<double> _walkTime;
+
+        std::vector<float> _gyroBias[3];
+        std::vector<float> _accelBias[3];
+
+        std::vector<delay_t> _baro;
+        std::vector<delay_t> _gps;
+
+        void normals(uint32_t vehicle, uint32_t channel, float out[NORMALS])
+        {
+            uint32_t counters[NORMALS];
+            uint32_t words[NORMALS];
+
+            for (uint8_t b=0; b<2; ++b) {
+                counters[4*b] = (uint32_t)_step[vehicle];
+                counters[4*b+1] = (uint32_t)(_step[vehicle] >> 32);
+                counters[4*b+2] = vehicle;
+                counters[4*b+3] = channel + b;
+            }
+
+            Philox::generate(counters, _key, words, 2);
+            Philox::normals(words, out, NORMALS);
+        }
+
+        static double quantize(double x, double resolution)
+        {
+            return resolution > 0 ? resolution * floor(x / resolution + 0.5) : x;
+        }
+
+        static void reset(delay_t & delay)
+        {
+            delay.head = 0;
+            delay.count = 0;
+            delay.next = -1;
+            delay.delivered.taken = -1;
+            delay.delivered.due = -1;
+            memset(delay.delivered.value, 0, sizeof(delay.delivered.value));
+        }
+
+        // Samples when due, then delivers everything whose latency has passed
+        template <typename Sampler>
+        static void advance(delay_t & delay, double time, double rate, double latency, Sampler sample)
+        {
+            if (rate <= 0) return;
+
+            double period = 1 / rate;
+
+            if (delay.next < 0) {
+                delay.next = time;
+            }
+
+            if (time >= delay.next) {
+
+                // Full means latency * rate > DEPTH; drop the oldest
+                if (delay.count == DEPTH) {
+                    delay.head = (delay.head + 1) % DEPTH;
+                    delay.count--;
+                }
+
+                pending_t & p = delay.ring[(delay.head + delay.count) % DEPTH];
+                p.taken = time;
+                p.due = time + latency;
+                sample(p.value);
+                delay.count++;
+
+                // Keep the sampling phase unless we've fallen a whole period behind
+                delay.next += period;
+                if (delay.next <= time) {
+                    delay.next = time + period;
+                }
+            }
+
+            while (delay.count > 0 && delay.ring[delay.head].due <= time) {
+                delay.delivered = delay.ring[delay.head];
+                delay.head = (delay.head + 1) % DEPTH;
+                delay.count--;
+            }
+        }
+
+    public:
+
+        /**
+         * @param capacity number of vehicles
+         * @param params sensor characteristics, shared by all vehicles
+         * @param seed selects the noise; the same seed gives the same noise
+         */
+        SensorSuite(uint32_t capacity, const params_t & params, uint64_t seed=0)
+        {
+            _capacity = capacity;
+            _params = params;
+
+            _key[0] = (uint32_t)seed;
+            _key[1] = (uint32_t)(seed >> 32);
+
+            _step.resize(capacity);
+            _lastTime.resize(capacity);
+            _walkTime.resize(capacity);
+
+            for (uint8_t k=0; k<3; ++k) {
+                _gyroBias[k].resize(capacity);
+                _accelBias[k].resize(capacity);
+            }
+
+            _baro.resize(capacity);
+            _gps.resize(capacity);
+
+            reset();
+        }
+
+        // Back to power-up: new biases, no readings in flight
+        void reset(void)
+        {
+            for (uint32_t v=0; v<_capacity; ++v) {
+                _step[v] = 0;
+                _lastTime[v] = -1;
+                _walkTime[v] = 0;
+                reset(_baro[v]);
+                reset(_gps[v]);
+            }
+        }
+
+        uint32_t capacity(void) const
+        {
+            return _capacity;
+        }
+
+        /**
+         * Advances a range of vehicles to the given time.  Updates for a vehicle must come in time order.
+         *
+         * @param first first vehicle
+         * @param count number of vehicles
+         * @param time current time in seconds
+         * @param truths ground truth for vehicles first .. first+count-1
+         * @param readings output for the same vehicles
+         */
+        void update(uint32_t first, uint32_t count, double time, const MultirotorDynamics::state_t * truths, reading_t * readings)
+        {
+            for (uint32_t v=first; v<first+count; ++v) {
+
+                const MultirotorDynamics::state_t & truth = truths[v - first];
+                reading_t & reading = readings[v - first];
+
+                if (_lastTime[v] < 0) {
+                    float b[NORMALS];
+                    normals(v, CHANNEL_INIT, b);
+                    for (uint8_t k=0; k<3; ++k) {
+                        _gyroBias[k][v] = (float)(_params.gyroBiasInit * b[k]);
+                        _accelBias[k][v] = (float)(_params.accelBiasInit * b[4+k]);
+                    }
+                }
+
+                float n[NORMALS];
+                normals(v, CHANNEL_IMU, n);
+
+                // No noise on the first update, which has no interval to scale it by
+                double dt = _lastTime[v] < 0 ? 0 : time - _lastTime[v];
+                double rootRate = dt > 0 ? 1 / sqrt(dt) : 0;
+
+                _walkTime[v] += dt;
+
+                if (_step[v] % WALK_PERIOD == WALK_PERIOD - 1) {
+
+                    float w[NORMALS];
+                    normals(v, CHANNEL_WALK, w);
+                    double rootDt = sqrt(_walkTime[v]);
+
+                    for (uint8_t k=0; k<3; ++k) {
+                        _gyroBias[k][v] += (float)(_params.gyroBiasWalk * rootDt * w[k]);
+                        _accelBias[k][v] += (float)(_params.accelBiasWalk * rootDt * w[4+k]);
+                    }
+
+                    _walkTime[v] = 0;
+                }
+
+                for (uint8_t k=0; k<3; ++k) {
+                    reading.gyro[k] = quantize(truth.angularVel[k] + _gyroBias[k][v] + _params.gyroNoise * rootRate * n[k],
+                            _params.gyroResolution);
+                    reading.accel[k] = quantize(truth.bodyAccel[k] + _accelBias[k][v] + _params.accelNoise * rootRate * n[4+k],
+                            _params.accelResolution);
+                }
+
+                advance(_baro[v], time, _params.baroRate, _params.baroLatency, [&](float * value) {
+                        float b[NORMALS];
+                        normals(v, CHANNEL_BARO, b);
+                        value[0] = (float)quantize(-truth.pose.location[2] + _params.baroNoise * b[0], _params.baroResolution);
+                        });
+
+                advance(_gps[v], time, _params.gpsRate, _params.gpsLatency, [&](float * value) {
+                        float g[NORMALS];
+                        normals(v, CHANNEL_GPS, g);
+                        value[0] = (float)(truth.pose.location[0] + _params.gpsHorizontalNoise * g[0]);
+                        value[1] = (float)(truth.pose.location[1] + _params.gpsHorizontalNoise * g[1]);
+                        value[2] = (float)(truth.pose.location[2] + _params.gpsVerticalNoise * g[2]);
+                        for (uint8_t k=0; k<3; ++k) {
+                            value[3+k] = (float)(truth.inertialVel[k] + _params.gpsVelocityNoise * g[3+k]);
+                        }
+                        });
+
+                reading.baroAltitude = _baro[v].delivered.value[0];
+                reading.baroTime = _baro[v].delivered.taken;
+
+                for (uint8_t k=0; k<3; ++k) {
+                    reading.gpsLocation[k] = _gps[v].delivered.value[k];
+                    reading.gpsVelocity[k] = _gps[v].delivered.value[3+k];
+                }
+                reading.gpsTime = _gps[v].delivered.taken;
+
+                _step[v]++;
+                _lastTime[v] = time;
+            }
+        }
+
+        /**
+         * Builds the state a controller sees: IMU rates and accelerations, GPS horizontal location and velocity,
+         * and barometric altitude, each held from its latest reading.  There is no attitude estimator, so
+         * rotation and quaternion stay true, as do values not yet measured.
+         */
+        static void toState(const MultirotorDynamics::state_t & truth, const reading_t & reading, MultirotorDynamics::state_t & measured)
+        {
+            measured = truth;
+
+            for (uint8_t k=0; k<3; ++k) {
+                measured.angularVel[k] = reading.gyro[k];
+                measured.bodyAccel[k] = reading.accel[k];
+            }
+
+            if (reading.gpsTime >= 0) {
+                measured.pose.location[0] = reading.gpsLocation[0];
+                measured.pose.location[1] = reading.gpsLocation[1];
+                for (uint8_t k=0; k<3; ++k) {
+                    measured.inertialVel[k] = reading.gpsVelocity[k];
+                }
+            }
+
+            if (reading.baroTime >= 0) {
+                measured.pose.location[2] = -reading.baroAltitude;
+            }
+        }
+
+}; // class SensorSuite
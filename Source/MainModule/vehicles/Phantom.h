@@ -23,6 +23,7 @@ class Phantom {
 
     private:
 
+        // Built-in parameters, for when Parameters/Phantom.txt can't be read
         MultirotorDynamics::Parameters params = MultirotorDynamics::Parameters(
 
                 // Estimated
@@ -43,7 +44,7 @@ class Phantom {
 
     public:
 
-        QuadXAPDynamics dynamics = QuadXAPDynamics(&params);
+        QuadXAPDynamics dynamics = { &params };
 
         Vehicle vehicle = Vehicle(&dynamics);
 
@@ -58,6 +59,8 @@ class Phantom {
         {
             vehicle.buildFull(pawn, FrameStatics.mesh.Get(), 1.5, 0.5);
 
+            vehicle.setParameterFile(FPaths::ProjectDir() + TEXT("Parameters/Phantom.txt"));
+
             // Add propellers
             addProp(+1, +1);
             addProp(-1, -1);
@@ -34,6 +34,7 @@ class TinyWhoop {
 
     private:
 
+        // Built-in parameters, for when Parameters/TinyWhoop.txt can't be read
         MultirotorDynamics::Parameters params = MultirotorDynamics::Parameters(
                 // Estimated
                 5.E-06, // b force constatnt [F=b*w^2]
@@ -54,7 +55,7 @@ class TinyWhoop {
 
     public:
 
-        QuadXAPDynamics dynamics = QuadXAPDynamics(&params);
+        QuadXAPDynamics dynamics = { &params };
 
         Vehicle vehicle = Vehicle(&dynamics);
 
@@ -78,6 +79,8 @@ class TinyWhoop {
             // Build the frame
             vehicle.buildFull(pawn, FrameStatics.mesh.Get(), 1.5, 0.50);
 
+            vehicle.setParameterFile(FPaths::ProjectDir() + TEXT("Parameters/TinyWhoop.txt"));
+
             // Add propellers
             float x13 = -.0470, x24 = +.0430, y14 = -.020, y23 = +.070;
             vehicle.addProp(PropCCWStatics.mesh.Get(), x13, y14);
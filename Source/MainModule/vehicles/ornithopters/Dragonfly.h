@@ -26,6 +26,7 @@ class Dragonfly {
 
     private:
 
+        // Built-in parameters, for when Parameters/Dragonfly.txt can't be read
         MultirotorDynamics::Parameters params = MultirotorDynamics::Parameters(
                 // Estimated
                 5.E-06, // b force constatnt [F=b*w^2]
@@ -53,7 +54,7 @@ class Dragonfly {
 
     public:
 
-        DragonflyDynamics dynamics = DragonflyDynamics(&params);
+        DragonflyDynamics dynamics = { &params };
 
         Ornithopter ornithopter = Ornithopter(&dynamics);
 
@@ -61,6 +62,8 @@ class Dragonfly {
         {
             ornithopter.buildFull(pawn, BodyStatics.mesh.Get(), 1.5, 0.5);
 
+            ornithopter.setParameterFile(FPaths::ProjectDir() + TEXT("Parameters/Dragonfly.txt"));
+
             addWing(+0.20, +0.05, -20,  -20);
             addWing(+0.15, -0.05, +160, -20);
             addWing(+0.25, -0.05, -160, +20);